@@ -12,6 +12,7 @@
 #include <limits.h>
 
 #include <PCA9685.h>
+#include <PCA9685client.h>
 #include "config.h"
 
 
@@ -21,6 +22,7 @@ int __addr;  // needed for cleanup()
 int debug = 0;
 int validate = 0;
 int ncmode = 0;
+volatile sig_atomic_t interrupted = 0; // signal caught, set by intHandler()
 
 
 void cleanup() {
@@ -34,9 +36,9 @@ void cleanup() {
 
 
 void intHandler(int dummy) {
-  cleanup();
-  fprintf(stdout, "Caught signal, exiting (%d)\n", dummy);
-  exit(0);
+  // the LEDs off at once, signal safe, the screen from the main loop
+  PCA9685_emergencyOff();
+  interrupted = dummy;
 } // intHandler 
 
 
@@ -44,6 +46,12 @@ int initHardware(int adpt, int addr, int freq) {
   int fd;
   int ret;
 
+  // the register reads and the emergency stop need the bus to ourselves
+  if (PCA9685_clientDaemonRunning()) {
+    fprintf(stderr, "initHardware(): pca9685d owns the I2C buses, stop it first\n");
+    return -1;
+  } // if
+
   // setup the I2C bus device 
   fd = PCA9685_openI2C(adpt, addr);
   if (fd < 0) {
@@ -442,8 +450,8 @@ int main(int argc, char **argv) {
     HSV.s = 1.0;
     HSV.v = 1.0;
 
-    // blink endlessly 
-    while (1) {
+    // blink until interrupted
+    while (!interrupted) {
 
       if (automatic) {
         // read a char (non-blocking)
@@ -638,8 +646,10 @@ int main(int argc, char **argv) {
         } // if ncmode
 
       } // if update screen
-    } // while forever
+    } // while not interrupted
   } // perf context 
 
+  cleanup();
+  fprintf(stdout, "Caught signal, exiting (%d)\n", (int) interrupted);
   return 0;
 } // main 
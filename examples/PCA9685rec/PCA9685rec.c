@@ -0,0 +1,340 @@
+// convert libPCA9685 recordings to text, register diffs or shows, or replay them
+// copyright 2018 Scott Edlin
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <linux/i2c.h>
+
+#include <PCA9685.h>
+#include <PCA9685rec.h>
+#include <PCA9685show.h>
+#include <PCA9685sim.h>
+#include "config.h"
+
+// register file of one device seen in the recording
+typedef struct board {
+  unsigned char adpt;           // adapter number, or the fd if unknown
+  unsigned char addr;           // I2C address
+  unsigned char ptr;            // register pointer, auto incremented
+  unsigned char regs[256];      // last written register values
+  int leds;                     // non-zero if LED registers were written
+} board;
+
+board* boards = NULL;
+int nboards = 0;
+
+
+void print_usage(char *name) {
+  printf("Usage:\n");
+  printf("  %s [options] recording\n", name);
+  printf("Options:\n");
+  printf("  -h\thelp, show this screen and quit\n");
+  printf("  -V\tVersion, print the program name and version and quit\n");
+  printf("  -d\tdebug, shows internal function calls and parameter values\n");
+  printf("  -D\tdiff, print only the registers each transaction changed\n");
+  printf("  -s show\tshow, convert the LED register writes into a delta show\n");
+  printf("  -g us\tgap, transactions closer than this form one show frame (default 1000)\n");
+  printf("  -r\treplay, reissue the transactions on the recorded adapters\n");
+  printf("  -S\tsimulate, reissue the transactions on simulated devices and print their LEDs\n");
+  printf("  -x speed\tspeed, replay this many times faster than recorded (default 1)\n");
+  printf("Without -D, -s, -r or -S every transaction is printed.\n");
+} // print_usage
+
+
+
+// find or add the register file of a device
+board* findBoard(const PCA9685_recReader* reader, int fd, unsigned char addr) {
+  unsigned char adpt = PCA9685_recAdapter(reader->hdr, fd);
+  if (adpt == _PCA9685_RECNOADPT) adpt = fd;
+  int b;
+  for (b = 0; b < nboards; b++) {
+    if (boards[b].adpt == adpt && boards[b].addr == addr) return &boards[b];
+  } // for boards
+  board* more = realloc(boards, (nboards + 1) * sizeof(board));
+  if (more == NULL) {
+    fprintf(stderr, "ERROR: realloc() failed\n");
+    exit(-1);
+  } // if
+  boards = more;
+  memset(&boards[nboards], 0, sizeof(board));
+  boards[nboards].adpt = adpt;
+  boards[nboards].addr = addr;
+  return &boards[nboards++];
+} // findBoard
+
+
+
+// write one register the way the chip does, ALL_LED writes every LED
+void writeReg(board* dev, unsigned char reg, unsigned char val) {
+  dev->regs[reg] = val;
+  if (reg >= _PCA9685_BASEPWMREG && reg < _PCA9685_BASEPWMREG + _PCA9685_CHANS*4) {
+    dev->leds = 1;
+  } else if (reg >= _PCA9685_ALLLEDREG && reg < _PCA9685_ALLLEDREG + 4) {
+    int i;
+    for (i = 0; i < _PCA9685_CHANS; i++) {
+      dev->regs[_PCA9685_BASEPWMREG + i*4 + reg - _PCA9685_ALLLEDREG] = val;
+    } // for LEDs
+    dev->leds = 1;
+  } // if LED
+} // writeReg
+
+
+
+// apply every write message of a record to the register files
+void applyRecord(const PCA9685_recReader* reader, const PCA9685_recRecord* record,
+                 double t, int diff) {
+  const PCA9685_recMsg* msg = PCA9685_recFirstMsg(record);
+  int m;
+  for (m = 0; m < record->nmsgs; m++, msg = PCA9685_recNextMsg(msg)) {
+    if ((msg->flags & I2C_M_RD) || msg->len == 0 || msg->addr == _PCA9685_GENCALLADDR) {
+      continue;
+    } // if read
+    const unsigned char* data = PCA9685_recMsgData(msg);
+    board* dev = findBoard(reader, record->fd, msg->addr);
+    unsigned char before[256];
+    memcpy(before, dev->regs, sizeof(before));
+    dev->ptr = data[0];
+    int i;
+    for (i = 1; i < msg->len; i++) {
+      writeReg(dev, dev->ptr++, data[i]);
+    } // for data
+
+    if (!diff) continue;
+    int reg;
+    for (reg = 0; reg < 256; reg++) {
+      if (dev->regs[reg] == before[reg]) continue;
+      int led = reg - _PCA9685_BASEPWMREG;
+      if (led >= 0 && led < _PCA9685_CHANS*4) {
+        // report the whole 16-bit ON or OFF value once
+        int lo = reg & ~1;
+        printf("%12.6f %3d/0x%02x LED%-2d %s 0x%04x -> 0x%04x\n", t, dev->adpt, dev->addr,
+               led / 4, (led & 2 ? "OFF" : "ON "),
+               before[lo] | before[lo + 1] << 8, dev->regs[lo] | dev->regs[lo + 1] << 8);
+        if (!(reg & 1)) reg++;
+      } else {
+        printf("%12.6f %3d/0x%02x reg 0x%02x 0x%02x -> 0x%02x\n", t, dev->adpt, dev->addr,
+               reg, before[reg], dev->regs[reg]);
+      } // if LED
+    } // for regs
+  } // for msgs
+} // applyRecord
+
+
+
+// print every message of a record
+void printRecord(const PCA9685_recReader* reader, const PCA9685_recRecord* record,
+                 double t) {
+  unsigned char adpt = PCA9685_recAdapter(reader->hdr, record->fd);
+  printf("%12.6f fd %d adapter %d ret %d msgs %d\n", t, record->fd,
+         (adpt == _PCA9685_RECNOADPT ? -1 : adpt), record->ret, record->nmsgs);
+  const PCA9685_recMsg* msg = PCA9685_recFirstMsg(record);
+  int m;
+  for (m = 0; m < record->nmsgs; m++, msg = PCA9685_recNextMsg(msg)) {
+    const unsigned char* data = PCA9685_recMsgData(msg);
+    printf("             0x%02x %s %3d:", msg->addr,
+           (msg->flags & I2C_M_RD ? "rd" : "wr"), msg->len);
+    int i;
+    for (i = 0; i < msg->len; i++) {
+      printf(" %02x", data[i]);
+    } // for data
+    printf("\n");
+  } // for msgs
+} // printRecord
+
+
+
+// append the LED registers of every board as one show frame
+int appendFrame(PCA9685_showWriter* writer, uint64_t timestampUs,
+                unsigned char* regs) {
+  int b, n = 0;
+  for (b = 0; b < nboards; b++) {
+    if (!boards[b].leds) continue;
+    memcpy(&regs[n++ * _PCA9685_CHANS*4], &boards[b].regs[_PCA9685_BASEPWMREG],
+           _PCA9685_CHANS*4);
+  } // for boards
+  return PCA9685_showAppendRegs(writer, timestampUs, regs);
+} // appendFrame
+
+
+
+// convert the recording into a delta show of the boards whose LEDs were written
+int writeShow(PCA9685_recReader* reader, const char* path, uint64_t gapUs) {
+  // first pass finds the boards
+  const PCA9685_recRecord* record;
+  while ((record = PCA9685_recNext(reader)) != NULL) {
+    applyRecord(reader, record, 0, 0);
+  } // while records
+  unsigned char adpts[256];
+  unsigned char addrs[256];
+  int b, n = 0;
+  for (b = 0; b < nboards && n < 256; b++) {
+    if (!boards[b].leds) continue;
+    adpts[n] = boards[b].adpt;
+    addrs[n++] = boards[b].addr;
+  } // for boards
+  if (n == 0) {
+    fprintf(stderr, "ERROR: no LED registers were written in the recording\n");
+    return -1;
+  } // if
+
+  PCA9685_showWriter* writer = PCA9685_showCreateDelta(path, n, adpts, addrs,
+                                                       _PCA9685_SHOWKEYINT);
+  unsigned char* regs = calloc(n, _PCA9685_CHANS*4);
+  if (writer == NULL || regs == NULL) {
+    fprintf(stderr, "ERROR: failed to create %s\n", path);
+    return -1;
+  } // if
+
+  // second pass replays the writes, one frame per burst of transactions
+  for (b = 0; b < nboards; b++) {
+    memset(boards[b].regs, 0, sizeof(boards[b].regs));
+  } // for boards
+  PCA9685_recRewind(reader);
+  uint64_t firstNs = 0;
+  uint64_t frameNs = 0;
+  int pending = 0;
+  while ((record = PCA9685_recNext(reader)) != NULL) {
+    if (firstNs == 0) firstNs = record->timestampNs;
+    if (pending && record->timestampNs - frameNs >= gapUs * 1000) {
+      if (appendFrame(writer, (frameNs - firstNs) / 1000, regs) != 0) return -1;
+      pending = 0;
+    } // if burst ended
+    if (!pending) frameNs = record->timestampNs;
+    applyRecord(reader, record, 0, 0);
+    pending = 1;
+  } // while records
+  if (pending && appendFrame(writer, (frameNs - firstNs) / 1000, regs) != 0) return -1;
+
+  free(regs);
+  return PCA9685_showFinish(writer, 0);
+} // writeShow
+
+
+
+// replay the recording in real time and report the timing
+int replay(PCA9685_recReader* reader, int simulate, double speed) {
+  int fds[_PCA9685_RECFDS];
+  PCA9685_sim* sim = NULL;
+  if (simulate) {
+    sim = PCA9685_simCreate();
+    if (sim == NULL) return -1;
+    PCA9685_simStart(sim);
+  } else if (PCA9685_recOpenI2C(reader, fds) != 0) {
+    fprintf(stderr, "ERROR: failed to open the recorded adapters\n");
+    return -1;
+  } // if simulate
+
+  PCA9685_recStats stats;
+  int ret = PCA9685_recReplay(reader, (simulate ? NULL : fds), speed, &stats);
+  printf("replayed %llu transactions at %gx, %llu failed\n",
+         (unsigned long long) stats.records, speed, (unsigned long long) stats.failed);
+  printf("late by %.1f us mean, %.1f us max, %.1f us drift at the end\n",
+         stats.meanLateNs / 1000.0, stats.maxLateNs / 1000.0, stats.driftNs / 1000.0);
+
+  if (simulate) {
+    PCA9685_simStop();
+    int d;
+    for (d = 0; d < sim->devices; d++) {
+      unsigned int onVals[_PCA9685_CHANS];
+      unsigned int offVals[_PCA9685_CHANS];
+      PCA9685_simGetPWMVals(&sim->dev[d], onVals, offVals);
+      unsigned char adpt = PCA9685_recAdapter(reader->hdr, sim->dev[d].fd);
+      printf("%3d/0x%02x MODE1 0x%02x PRE_SCALE 0x%02x OFF", (adpt == _PCA9685_RECNOADPT ? -1 : adpt),
+             sim->dev[d].addr, sim->dev[d].regs[_PCA9685_MODE1REG],
+             sim->dev[d].regs[_PCA9685_PRESCALEREG]);
+      int i;
+      for (i = 0; i < _PCA9685_CHANS; i++) {
+        printf(" %04x", offVals[i]);
+      } // for LEDs
+      printf("\n");
+    } // for devices
+    PCA9685_simDestroy(sim);
+  } // if simulate
+  return ret;
+} // replay
+
+
+
+// main driver
+int main(int argc, char **argv) {
+  int diff = 0;
+  const char* showPath = NULL;
+  uint64_t gapUs = 1000;
+  int play = 0;
+  int simulate = 0;
+  double speed = 1.0;
+  int c;
+  opterr = 0;
+  while ((c = getopt (argc, argv, "hVdDs:g:rSx:")) != -1)
+    switch (c)
+      {
+      case 'V':  // version
+        fprintf(stdout, "PCA9685rec %d.%d\n", libPCA9685_VERSION_MAJOR, libPCA9685_VERSION_MINOR);
+        exit(0);
+      case 'd':  // debug mode
+        _PCA9685_DEBUG = 1;
+        break;
+      case 'D':  // diff mode
+        diff = 1;
+        break;
+      case 's':  // show mode
+        showPath = optarg;
+        break;
+      case 'g':  // frame gap
+        gapUs = strtoull(optarg, NULL, 10);
+        break;
+      case 'r':  // replay mode
+        play = 1;
+        break;
+      case 'S':  // simulated replay mode
+        play = 1;
+        simulate = 1;
+        break;
+      case 'x':  // replay speed
+        speed = atof(optarg);
+        break;
+      case 'h':  // help mode
+        print_usage(argv[0]);
+        exit(0);
+      }
+
+  if ((argc - optind) != 1) {
+    print_usage(argv[0]);
+    exit(-1);
+  } // if argc
+
+  PCA9685_recReader* reader = PCA9685_recOpen(argv[optind]);
+  if (reader == NULL) {
+    fprintf(stderr, "ERROR: failed to open %s\n", argv[optind]);
+    exit(-1);
+  } // if
+
+  int ret = 0;
+  if (play) {
+    ret = replay(reader, simulate, speed);
+  } else if (showPath) {
+    ret = writeShow(reader, showPath, gapUs);
+  } else {
+    const PCA9685_recRecord* record;
+    uint64_t firstNs = 0;
+    while ((record = PCA9685_recNext(reader)) != NULL) {
+      if (firstNs == 0) firstNs = record->timestampNs;
+      double t = (record->timestampNs - firstNs) / 1e9;
+      if (diff) {
+        applyRecord(reader, record, t, 1);
+      } else {
+        printRecord(reader, record, t);
+      } // if diff
+    } // while records
+  } // if show
+
+  if (reader->hdr->dropped) {
+    fprintf(stderr, "WARNING: %llu transactions were too large to record\n",
+            (unsigned long long) reader->hdr->dropped);
+  } // if dropped
+  PCA9685_recCloseReader(reader);
+  free(boards);
+  return (ret ? -1 : 0);
+}
@@ -5,6 +5,8 @@
 
 #include <alsa/asoundlib.h>
 #include <PCA9685.h>
+#include <PCA9685client.h>
+#include <PCA9685engine.h>
 #include <signal.h>
 #include <fftw3.h>
 #include <math.h>
@@ -28,6 +30,11 @@ FILE* pbtsfh;
 FILE* spectrogramfh;
 FILE* phasogramfh;
 FILE* unwrapphasogramfh;
+// writes frames and backs off from a failing board instead of exiting
+PCA9685_engine* engine;
+int engineDev;
+// signal caught, set by intHandler()
+volatile sig_atomic_t interrupted = 0;
 
 
 void zero(char* buf, int len) {
@@ -46,9 +53,13 @@ unsigned Microseconds(void) {
 
 
 void intHandler(int dummy) {
-  // turn off all channels
-  PCA9685_setAllPWM(args.pwm_fd, args.pwm_addr, _PCA9685_MINVAL, _PCA9685_MINVAL);
+  // turn off all channels at once, signal safe, and hold the engine off
+  PCA9685_emergencyOff();
+  interrupted = dummy;
+}
+
 
+void cleanup(void) {
   // cleanup alsa
   snd_pcm_drain(rechandle);
   snd_pcm_close(rechandle);
@@ -58,15 +69,26 @@ void intHandler(int dummy) {
   //fftw_destroy_plan(p);
   //fftw_free(in);
   //fftw_free(out);
-
-  exit(dummy);
+  PCA9685_engineDestroy(engine);
 }
 
 void initPCA9685(void) {
   _PCA9685_DEBUG = args.pwm_debug;
+  // the engine writes the bus itself, pca9685d owns it while it runs
+  if (PCA9685_clientDaemonRunning()) {
+    fprintf(stderr, "FATAL: pca9685d owns the I2C buses, stop it first\n");
+    exit(-1);
+  } // if
   int pwm_fd = PCA9685_openI2C(args.pwm_bus, args.pwm_addr);
   args.pwm_fd = pwm_fd;
   PCA9685_initPWM(args.pwm_fd, args.pwm_addr, args.pwm_freq);
+  engine = PCA9685_engineCreate(args.pwm_freq);
+  if (engine == NULL) {
+    fprintf(stderr, "FATAL: PCA9685_engineCreate() failed, exiting\n");
+    exit(-1);
+  } // if
+  engineDev = PCA9685_engineAdd(engine, args.pwm_fd, args.pwm_addr);
+  if (args.pwm_deadband) PCA9685_engineSetDeadband(engine, args.pwm_deadband, 0);
 }
 
 
@@ -162,7 +184,7 @@ void process_args(int argc, char **argv) {
 Usage: vupeak [-m level|spectrum] [-d audio device] [-n audio fft period]\n\
               [-r audio rate] [-c audio channels] [-H audio hop period] [-B audio bytes] [-P audio playback device]\n\
               [-b pwm bus] [-a pwm address] [-f pwm frequency]\n\
-              [-D] [-s pwm smoothing] [-h] [-t] [-w] [-V] [-R] [-v verbosity] [-A]\n\
+              [-D] [-s pwm smoothing] [-e pwm deadband] [-h] [-t] [-w] [-V] [-R] [-v verbosity] [-A]\n\
 where\n\
   -m sets the mode of audio processing (spectrum)\n\
   -d sets the audio device (default)\n\
@@ -177,6 +199,7 @@ where\n\
   -f sets the pwm frequency (200)\n\
   -D sets debug to true (false)\n\
   -s sets the pwm smoothing (1)\n\
+  -e sets the pwm deadband in counts, smaller changes are not written (0)\n\
   -h sets the fft hanning to true (false)\n\
   -t sets the test period to true (false)\n\
   -w sets the ascii waterfall to true (false)\n\
@@ -201,6 +224,7 @@ where\n\
   args.pwm_freq = 200;
   args.pwm_debug = false;
   args.pwm_smoothing = 1;
+  args.pwm_deadband = 0;
   args.fft_hanning = false;
   args.test_period = false;
   args.save_fourier = false;
@@ -213,7 +237,7 @@ where\n\
 
   opterr = 0;
   int c;
-  while ((c = getopt(argc, argv, "m:d:P:n:r:c:p:H:B:b:a:f:Ds:htwVRFTv:A")) != -1) {
+  while ((c = getopt(argc, argv, "m:d:P:n:r:c:p:H:B:b:a:f:Ds:e:htwVRFTv:A")) != -1) {
     switch (c) {
       case 'm':
         args.mode = 0;
@@ -266,6 +290,9 @@ where\n\
       case 's':
         args.pwm_smoothing = atoi(optarg);
         break;
+      case 'e':
+        args.pwm_deadband = atoi(optarg);
+        break;
       case 'h':
         args.fft_hanning = true;
         break;
@@ -385,8 +412,13 @@ void level(char* buffer) {
   int display = ratio / 100.0 * _PCA9685_MAXVAL;
   if (args.verbosity & VPWM) fprintf(stdout, "%d %d\n", intensity_value, ratio);
 
-  // update the pwms
-  PCA9685_setAllPWM(args.pwm_fd, args.pwm_addr, 0, display);
+  // update the pwms through the engine, so an emergency stop holds them
+  // off as it does the spectrum's
+  unsigned int levelOff[_PCA9685_CHANS];
+  int i;
+  for (i = 0; i < _PCA9685_CHANS; i++) levelOff[i] = display;
+  PCA9685_engineSubmit(engine, engineDev, NULL, levelOff);
+  PCA9685_engineFlush(engine);
 } // level
 
 
@@ -969,17 +1001,10 @@ void spectrum(fftw_complex* fftout, int n) {
     //fprintf(stderr, "\n");
     j = 0;
   } // if j
-  if (PCA9685_setPWMVals(args.pwm_fd, args.pwm_addr, pwmon, pwmoff) == -1) {
-    for (int i = 0; i < 10; i++) {
-      fprintf(stderr, "ERROR: PCA9685_setPWMVals() returned -1, retrying\n");
-      if (PCA9685_setPWMVals(args.pwm_fd, args.pwm_addr, pwmon, pwmoff) != -1) {
-        break;
-      } else if (i == 9) {
-        fprintf(stderr, "FATAL: PCA9685_setPWMVals() failed, exiting\n");
-        intHandler(-1);
-      } // else
-    } // for i
-  } // if setPWMVals
+  // a failing board is retried with backoff on later frames, without
+  // stalling the audio loop, and rewritten in full once it answers
+  PCA9685_engineSubmit(engine, engineDev, pwmon, pwmoff);
+  PCA9685_engineFlush(engine);
 } // spectrum
 
 
@@ -1071,7 +1096,7 @@ int main(int argc, char **argv) {
 
   int audio_offset = args.audio_period;
   int fourier_offset = 0;
-  while (1) {
+  while (!interrupted) {
     current = Microseconds();
 
     // if fourier buffer full, transform then shift
@@ -1104,5 +1129,8 @@ int main(int argc, char **argv) {
     audio_offset++;
     fourier_offset++;
     if (args.test_period && loop >= args.audio_period / args.fft_hop_period) exit(0);
-  } // while
+  } // while not interrupted
+
+  cleanup();
+  return 0;
 } // main
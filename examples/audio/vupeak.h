@@ -15,6 +15,7 @@ typedef struct audiopwms {
   unsigned int pwm_addr;
   unsigned int pwm_freq;
   unsigned int pwm_smoothing;
+  unsigned int pwm_deadband;
   unsigned int fft_period;
   unsigned int fft_hop_period;
   bool fft_hanning;
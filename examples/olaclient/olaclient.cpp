@@ -1,21 +1,91 @@
-#include <ola/DmxBuffer.h>    // sudo apt-get install libola-dev
+#include <ola/Constants.h>    // sudo apt-get install libola-dev
+#include <ola/DmxBuffer.h>
 #include <ola/Logging.h>
 #include <ola/OlaClientWrapper.h>
-#include <string>
-#include <bitset>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <vector>
+#include <unistd.h>
 using namespace std;
 
 #include <PCA9685.h>
+#include <PCA9685client.h>
+#include <PCA9685engine.h>
 #include "config.h"
 
 #define PWM_FREQ 200
+
+// seconds between logging the frame counters
+#define STATS_SECS 60
+
+// default seconds between rewriting every board in full, so a board that
+// reset while its scene held still is caught; 0 for never
+#define KEEPALIVE_SECS 10
+
+// patch used without -p, one board on the first 32 slots of universe 1
 #define DMX_UNIVERSE 1
 #define I2C_ADPT 1
 #define I2C_ADDR 0x40
 
-// global var for i2c file descriptor
-int i2c_fd;
+// one board of the rig, every patched channel's latest 12-bit value
+struct Board {
+  unsigned char adpt;
+  unsigned char addr;
+  int dev;                      // engine device
+  unsigned int offVals[_PCA9685_CHANS];
+};
+
+// a run of DMX slots driving consecutive channels of one board
+struct Range {
+  unsigned int slot;            // first slot, from 0
+  unsigned int bits;            // 8 or 16, MSB first
+  unsigned int board;           // index in boards
+  unsigned int chan;            // first channel on the board
+  unsigned int count;           // channels
+};
+
+// the ranges one universe drives and the boards they touch
+struct Universe {
+  unsigned int id;
+  vector<Range> ranges;
+  vector<unsigned int> boards;  // indexes in boards, each once
+  unsigned int slotsFirst;      // first slot patched
+  unsigned int slotsUsed;       // slots up to the last one patched
+  bool seen;                    // a frame was committed, last holds it
+  uint8_t last[ola::DMX_UNIVERSE_SIZE]; // patched slots last committed
+};
+
+// the boards and adapters opened, every channel turned off and the
+// adapters closed on exit
+struct Rig {
+  vector<Board> boards;
+  int adptFd[256];
+  Rig() { memset(adptFd, -1, sizeof(adptFd)); }
+  ~Rig() {
+    for (const Board& b : boards) {
+      if (adptFd[b.adpt] < 0) continue;
+      PCA9685_setAllPWM(adptFd[b.adpt], b.addr, _PCA9685_MINVAL, _PCA9685_MINVAL);
+    } // for boards
+    for (int fd : adptFd) {
+      if (fd >= 0) PCA9685_closeI2C(fd);
+    } // for adapters
+  }
+};
+
+Rig rig;
+vector<Universe> universes;
+
+// frame engine writing the latest DMX frames once per PWM period, one
+// batched transaction per bus, from its own writer thread
+PCA9685_engine* engine;
+
+// DMX frames received for a patched universe, and those skipped as
+// unchanged
+uint64_t received;
+uint64_t unchanged;
 
 
 // Called when universe registration completes.
@@ -26,77 +96,250 @@ void RegisterComplete(const ola::client::Result& result) {
 }
 
 
+// Find a board of the rig by its bus and address, adding it if new.
+unsigned int FindBoard(unsigned char adpt, unsigned char addr) {
+  for (unsigned int b = 0; b < rig.boards.size(); b++) {
+    if (rig.boards[b].adpt == adpt && rig.boards[b].addr == addr) return b;
+  } // for boards
+  Board board = {};
+  board.adpt = adpt;
+  board.addr = addr;
+  board.dev = -1;
+  rig.boards.push_back(board);
+  return rig.boards.size() - 1;
+} // FindBoard
+
+
+// Find a universe of the patch, adding it if new.
+Universe& FindUniverse(unsigned int id) {
+  for (Universe& u : universes) {
+    if (u.id == id) return u;
+  } // for universes
+  Universe universe = {};
+  universe.id = id;
+  universe.slotsFirst = ola::DMX_UNIVERSE_SIZE;
+  universes.push_back(universe);
+  return universes.back();
+} // FindUniverse
+
+
+// Patch count channels of a board from a universe's slots, slot from 0.
+int AddRange(unsigned int id, unsigned int slot, unsigned int bits,
+             unsigned int adpt, unsigned int addr, unsigned int chan, unsigned int count) {
+  unsigned int end = slot + count * bits / 8;
+  if ((bits != 8 && bits != 16) || count == 0 || end > ola::DMX_UNIVERSE_SIZE ||
+      chan + count > _PCA9685_CHANS || adpt > 255 || addr > 0x7F) {
+    return -1;
+  } // if invalid
+  Range range;
+  range.slot = slot;
+  range.bits = bits;
+  range.board = FindBoard(adpt, addr);
+  range.chan = chan;
+  range.count = count;
+  Universe& universe = FindUniverse(id);
+  universe.ranges.push_back(range);
+  bool touched = false;
+  for (unsigned int b : universe.boards) touched |= (b == range.board);
+  if (!touched) universe.boards.push_back(range.board);
+  if (slot < universe.slotsFirst) universe.slotsFirst = slot;
+  if (end > universe.slotsUsed) universe.slotsUsed = end;
+  return 0;
+} // AddRange
+
+
+// Read the patch, a line per range of
+//   universe slot bits adapter address channel count
+// with slots from 1 as consoles number them and # comments.
+int LoadPatch(const char* path) {
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    cout << "LoadPatch(): can't open " << path << endl;
+    return -1;
+  } // if err
+  char line[256];
+  int lineNo = 0;
+  while (fgets(line, sizeof(line), file)) {
+    lineNo++;
+    char* hash = strchr(line, '#');
+    if (hash) *hash = '\0';
+    unsigned int id, slot, bits, adpt, chan, count;
+    int addr;
+    char extra;
+    int fields = sscanf(line, "%u %u %u %u %i %u %u %c",
+                        &id, &slot, &bits, &adpt, &addr, &chan, &count, &extra);
+    if (fields <= 0) continue;
+    if (fields != 7 || slot == 0 || AddRange(id, slot - 1, bits, adpt, addr, chan, count) != 0) {
+      cout << "LoadPatch(): " << path << ":" << lineNo << ": invalid range" << endl;
+      fclose(file);
+      return -1;
+    } // if err
+  } // while lines
+  fclose(file);
+  if (universes.empty()) {
+    cout << "LoadPatch(): " << path << " patches nothing" << endl;
+    return -1;
+  } // if err
+  return 0;
+} // LoadPatch
+
+
+// Convert n 16-bit big-endian slot pairs to 12-bit PWM values; a plain
+// loop without branches that the compiler vectorizes, with a size_t
+// index so the slot address can't wrap.
+static inline void Decode16(const uint8_t* __restrict slots, unsigned int* __restrict vals,
+                            unsigned int n) {
+  for (size_t i = 0; i < n; i++) {
+    vals[i] = ((slots[i * 2] << 8) | slots[i * 2 + 1]) >> 4;
+  } // for i
+} // Decode16
+
+
+// Convert n 8-bit slots to 12-bit PWM values, 255 to full scale.
+static inline void Decode8(const uint8_t* __restrict slots, unsigned int* __restrict vals,
+                           unsigned int n) {
+  for (size_t i = 0; i < n; i++) {
+    vals[i] = (slots[i] << 4) | (slots[i] >> 4);
+  } // for i
+} // Decode8
+
+
 // Called when new DMX data arrives.
 void NewDmx(const ola::client::DMXMetadata &metadata,
             const ola::DmxBuffer &data) {
-  static string inData="";
-  inData = data.Get();
-  unsigned int onVals[_PCA9685_CHANS];
-  static unsigned int offVals[_PCA9685_CHANS];
-  for (int i = 0; i < _PCA9685_CHANS; i++) {
-        onVals[i] = 0;
-  } // for
-
-  int dmxVals[_PCA9685_CHANS];
- 
-  // 16-bit ola values so two 8-bit dmx channels per 12-bit pwm value
-  for (unsigned int dmxChan = 0; dmxChan < inData.length(); dmxChan++) {
-
-    // disregard any data after pwm values
-    if (dmxChan >= _PCA9685_CHANS * 2) break;
- 
-    // get both bytes and increment dmxChan
-    int msb = inData.at(dmxChan);
-    dmxChan++;
-    int lsb = inData.at(dmxChan);
-    int pwmChan = dmxChan / 2;
-    dmxVals[pwmChan] = msb * 256 + lsb;
- 
-    // convert 16-bit to 12-bit
-    unsigned int pwmVal = dmxVals[pwmChan] >> 4;
- 
-    if (pwmVal != offVals[pwmChan]) {
-      //cout << showbase << std::internal << setfill('0');
-      //cout << dec << setw(2) << pwmChan << ": ";
-      //cout << hex << setw(5) << pwmVal << endl;
-    } // if
-
-    // store the 12-bit pwmVal
-    offVals[pwmChan] = pwmVal;
- 
-    // update all PWM values once at end of frame
-    if (dmxChan == _PCA9685_CHANS * 2 - 1) {
-
-      // update all channels from offVals
-      int ret;
-      ret = PCA9685_setPWMVals(i2c_fd, I2C_ADDR, onVals, offVals);
-      if (ret != 0) {
-        cout << "NewDMX(): PCA9685_setPWMVals() returned " << ret << endl;
-        return;
-      } // if err
-    } // if chan
-  } // for chan
+  Universe* universe = NULL;
+  for (Universe& u : universes) {
+    if (u.id == metadata.universe) universe = &u;
+  } // for universes
+  if (universe == NULL) return;
+  received++;
+
+  // read the slots in place; a short frame leaves the rest at 0 as
+  // olad would, in a stack copy
+  const uint8_t* slots = data.GetRaw();
+  uint8_t padded[ola::DMX_UNIVERSE_SIZE];
+  if (data.Size() < universe->slotsUsed) {
+    memset(padded, 0, sizeof(padded));
+    memcpy(padded, slots, data.Size());
+    slots = padded;
+  } // if short
+
+  // sources resend the whole universe dozens of times a second while a
+  // scene holds still; glibc's memcmp compares the patched slots a
+  // vector at a time, and an unchanged frame never reaches the engine
+  unsigned int first = universe->slotsFirst;
+  unsigned int size = universe->slotsUsed - first;
+  if (universe->seen && memcmp(&universe->last[first], &slots[first], size) == 0) {
+    unchanged++;
+    return;
+  } // if unchanged
+  memcpy(&universe->last[first], &slots[first], size);
+  universe->seen = true;
+
+  for (const Range& r : universe->ranges) {
+    unsigned int* vals = &rig.boards[r.board].offVals[r.chan];
+    if (r.bits == 16) {
+      Decode16(&slots[r.slot], vals, r.count);
+    } else {
+      Decode8(&slots[r.slot], vals, r.count);
+    } // if bits
+  } // for ranges
+
+  // post the universe's boards to their latest-value mailboxes, never
+  // blocking; the writer thread writes each bus's boards in one
+  // transaction at its next tick
+  for (unsigned int b : universe->boards) {
+    const Board& board = rig.boards[b];
+    if (board.dev < 0) continue;
+    int ret = PCA9685_engineSubmit(engine, board.dev, NULL, board.offVals);
+    if (ret != 0) {
+      cout << "NewDMX(): PCA9685_engineSubmit() returned " << ret << endl;
+    } // if err
+  } // for boards
 } // NewDMX
 
 
-int main() {
+// Log the frame counters; board frames submitted faster than the bus
+// takes them are coalesced in the mailboxes, not queued.
+bool Stats() {
+  cout << "received " << received << " DMX frames, " << unchanged << " unchanged, ";
+  cout << __atomic_load_n(&engine->submits, __ATOMIC_RELAXED) << " board frames, ";
+  cout << __atomic_load_n(&engine->coalesced, __ATOMIC_RELAXED) << " coalesced, ";
+  cout << __atomic_load_n(&engine->frames, __ATOMIC_RELAXED) << " written" << endl;
+  return true;
+} // Stats
+
+
+// Rewrite every board in full at the writer's next tick; the skipped
+// unchanged frames would otherwise leave a board that reset dark.
+bool Keepalive() {
+  for (const Board& board : rig.boards) {
+    if (board.dev >= 0) PCA9685_engineRefresh(engine, board.dev);
+  } // for boards
+  return true;
+} // Keepalive
+
+
+int main(int argc, char **argv) {
   cout << "olaclient " << libPCA9685_VERSION_MAJOR << "." << libPCA9685_VERSION_MINOR << endl;
-  // setup I2C device
-  i2c_fd = PCA9685_openI2C(I2C_ADPT, I2C_ADDR);
-  if (i2c_fd < 0) {
-    cout << "main(): PCA9685_openI2C() returned " << i2c_fd;
-    cout << " on I2C_ADPT " << I2C_ADPT << " at I2C_ADDR " << I2C_ADDR << endl;
-    return i2c_fd;
+  const char* patchPath = NULL;
+  bool realTime = false;
+  unsigned int keepalive = KEEPALIVE_SECS;
+  int c;
+  while ((c = getopt(argc, argv, "p:Rk:")) != -1) {
+    switch (c) {
+    case 'p':  // patch file
+      patchPath = optarg;
+      break;
+    case 'R':  // real-time writer thread
+      realTime = true;
+      break;
+    case 'k':  // keepalive seconds
+      keepalive = atoi(optarg);
+      break;
+    default:
+      cout << "Usage: " << argv[0] << " [-p patch file] [-R] [-k keepalive secs]" << endl;
+      return -1;
+    } // switch
+  } // while opts
+
+  // the patch, 16-bit values from slot 1 on one board by default
+  if (patchPath) {
+    if (LoadPatch(patchPath) != 0) return -1;
+  } else {
+    AddRange(DMX_UNIVERSE, 0, 16, I2C_ADPT, I2C_ADDR, 0, _PCA9685_CHANS);
+  } // if patch
+
+  // the engine writes the buses itself, pca9685d owns them while it runs
+  if (PCA9685_clientDaemonRunning()) {
+    cout << "main(): pca9685d owns the I2C buses, stop it first" << endl;
+    return -1;
+  } // if
+
+  // setup the frame engine
+  engine = PCA9685_engineCreate(PWM_FREQ);
+  if (engine == NULL) {
+    cout << "main(): PCA9685_engineCreate() returned NULL" << endl;
+    return -1;
   } // if err
 
-  // setup PCA9685 device
+  // setup I2C and the PCA9685 devices, one fd per bus so the engine
+  // batches each bus's boards; a board that does not answer yet is added
+  // anyway, the engine backs off and initializes it once it does
+  for (Board& board : rig.boards) {
+    int& fd = rig.adptFd[board.adpt];
+    if (fd < 0) fd = PCA9685_openI2C(board.adpt, board.addr);
+    if (fd < 0) {
+      cout << "main(): PCA9685_openI2C() failed on adapter " << (int) board.adpt << endl;
+      return -1;
+    } // if err
+    if (PCA9685_initPWM(fd, board.addr, PWM_FREQ) != 0) {
+      cout << "main(): PCA9685_initPWM() failed on adapter " << (int) board.adpt;
+      cout << " at addr " << (int) board.addr << endl;
+    } // if err
+    board.dev = PCA9685_engineAdd(engine, fd, board.addr);
+  } // for boards
   int ret;
-  ret = PCA9685_initPWM(i2c_fd, I2C_ADDR, PWM_FREQ);
-  if (ret != 0) {
-    cout << "main(): PCA9685_initPWM() returned " << ret;
-    cout << " I2C_ADDR " << I2C_ADDR << " PWM_FREQ " << PWM_FREQ << endl;
-    return ret;
-  } // if err
 
   // setup ola logging and wrapper
   ola::InitLogging(ola::OLA_LOG_INFO, ola::OLA_LOG_STDERR);
@@ -109,10 +352,32 @@ int main() {
 
   // connect ola to client
   ola::client::OlaClient *client = wrapper.GetClient();
-  // Set the callback and register our interest in this universe
+  // Set the callback and register our interest in every universe patched
   client->SetDMXCallback(ola::NewCallback(&NewDmx));
-  client->RegisterUniverse(
-      DMX_UNIVERSE, ola::client::REGISTER, ola::NewSingleCallback(&RegisterComplete));
+  for (const Universe& universe : universes) {
+    cout << "universe " << universe.id << ": " << universe.ranges.size() << " ranges on ";
+    cout << universe.boards.size() << " boards" << endl;
+    client->RegisterUniverse(
+        universe.id, ola::client::REGISTER, ola::NewSingleCallback(&RegisterComplete));
+  } // for universes
+
+  // write from the engine's own thread, so a slow or stalled bus never
+  // holds up olad's sockets and each side runs at its own rate
+  PCA9685_rtConfig rt;
+  PCA9685_rtDefaults(&rt);
+  ret = PCA9685_engineStart(engine, (realTime ? &rt : NULL));
+  if (ret != 0) {
+    cout << "main(): PCA9685_engineStart() returned " << ret << endl;
+    return -1;
+  } // if err
+  wrapper.GetSelectServer()->RegisterRepeatingTimeout(STATS_SECS * 1000,
+                                                      ola::NewCallback(&Stats));
+  if (keepalive) {
+    wrapper.GetSelectServer()->RegisterRepeatingTimeout(keepalive * 1000,
+                                                        ola::NewCallback(&Keepalive));
+  } // if keepalive
   wrapper.GetSelectServer()->Run();
+  PCA9685_engineStop(engine);
+  Stats();
+  PCA9685_engineDestroy(engine);
 }
-
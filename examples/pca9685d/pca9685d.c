@@ -0,0 +1,326 @@
+// pca9685d, owns the I2C buses and commits the frames clients publish in shared memory
+// copyright 2018 Scott Edlin
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <getopt.h>
+#include <grp.h>
+
+#include <PCA9685.h>
+#include <PCA9685engine.h>
+#include <PCA9685metrics.h>
+#include <PCA9685shm.h>
+#include <PCA9685sim.h>
+#include "config.h"
+
+// seconds between sweeps for clients that died holding a slot
+#define REAPSECS 1
+
+// percent of a tick each bus may take once full frames do not fit
+#define BUDGETPCT 90
+
+// group that may publish to the segment, the one owning /dev/i2c-* on the Pi
+#define SHMGROUP "i2c"
+
+// adapter allowed when none is given with -a
+#define DEFAULTADPT 1
+
+// addresses a client may name: not reserved, and not the power-on
+// ALLCALLADR or SUBADR1-3 every board answers on
+#define MINADDR 0x08
+#define MAXADDR 0x77
+#define ALLCALLADDR 0x70
+#define SUBADDR1 0x71
+#define SUBADDR2 0x72
+#define SUBADDR3 0x74
+
+volatile sig_atomic_t running = 1;
+
+PCA9685_shmFrame merged;        // every client's channels, in board order
+int engineDev[_PCA9685_SHMBOARDS]; // engine device of each merged board, -1 if unusable
+int nboards = 0;                // merged boards with an engine device
+int adptFd[256];                // fd of each adapter opened, -1 if not yet
+int calibrate = 0;              // measure each adapter's bus costs on its first board
+int adptAllowed[256];           // adapters clients may drive, from -a
+int addrAllowed[128];           // addresses clients may drive, from -b
+int addrsGiven = 0;             // any -b given, otherwise every valid address
+
+
+void print_usage(char *name) {
+  printf("Usage:\n");
+  printf("  %s [options]\n", name);
+  printf("Options:\n");
+  printf("  -h\thelp, show this screen and quit\n");
+  printf("  -V\tVersion, print the program name and version and quit\n");
+  printf("  -d\tdebug, shows internal function calls and parameter values\n");
+  printf("  -f freq\tfrequency, PWM frequency of the boards (default 200)\n");
+  printf("  -s fps\tspeed, frames committed per second (default 200)\n");
+  printf("  -n name\tname, shared memory segment (default %s)\n", _PCA9685_SHMNAME);
+  printf("  -m path\tmetrics, serve Prometheus metrics on a unix socket at path\n");
+  printf("  -g group\tgroup, may publish to the segment (default %s if it exists)\n", SHMGROUP);
+  printf("  -a adpt\tadapter, /dev/i2c-adpt clients may drive, repeatable (default %d)\n", DEFAULTADPT);
+  printf("  -b addr\tboard, address clients may drive, repeatable (default 0x%02x-0x%02x but\n"
+         "\t\t0x%02x, 0x%02x, 0x%02x and 0x%02x)\n", MINADDR, MAXADDR,
+         ALLCALLADDR, SUBADDR1, SUBADDR2, SUBADDR3);
+  printf("  -R\treal-time, run at SCHED_FIFO with locked memory\n");
+  printf("  -S\tsimulate, commit to simulated devices instead of /dev/i2c-*\n");
+  printf("  -C\tcalibrate, time each adapter's bus on its first board for the frame plan\n");
+} // print_usage
+
+
+
+void stopHandler(int sig) {
+  (void) sig;
+  running = 0;
+} // stopHandler
+
+
+
+// 1 if addr is a board address rather than a reserved or shared one
+int validAddr(int addr) {
+  return addr >= MINADDR && addr <= MAXADDR && addr != ALLCALLADDR &&
+         addr != SUBADDR1 && addr != SUBADDR2 && addr != SUBADDR3;
+} // validAddr
+
+
+
+// open and initialize a board the first time a client drives it
+int addBoard(PCA9685_engine* engine, const PCA9685_shmBoard* board, unsigned int freq) {
+  // any local client in the group names the board, the daemon is root
+  if (!adptAllowed[board->adpt] || !validAddr(board->addr) ||
+      (addrsGiven && !addrAllowed[board->addr])) {
+    fprintf(stderr, "WARNING: board %d/0x%02x is not allowed, see -a and -b\n",
+            board->adpt, board->addr);
+    return -1;
+  } // if
+  if (adptFd[board->adpt] < 0) {
+    adptFd[board->adpt] = PCA9685_openI2C(board->adpt, board->addr);
+    if (adptFd[board->adpt] < 0) {
+      fprintf(stderr, "ERROR: failed to open adapter %d\n", board->adpt);
+      return -1;
+    } // if
+    fprintf(stdout, "adapter %d opened, transfers through %s\n", board->adpt,
+            PCA9685_i2cPathName(PCA9685_getI2CPath(adptFd[board->adpt], NULL)));
+  } // if new adapter
+  int fd = adptFd[board->adpt];
+  // a board that does not answer yet is added anyway, the engine backs
+  // off and initializes it once it does
+  PCA9685_busCal cal;
+  if (PCA9685_initPWM(fd, board->addr, freq) != 0) {
+    fprintf(stderr, "WARNING: board %d/0x%02x is not answering\n", board->adpt, board->addr);
+  } else if (calibrate && PCA9685_getBusCal(fd, &cal) != 0) {
+    if (PCA9685_calibrate(fd, board->addr, &cal) == 0) {
+      fprintf(stdout, "adapter %d: %.0f Hz SCL, %.0f us per transaction\n",
+              board->adpt, cal.sclHz, cal.txNs / 1000);
+    } // if
+  } // if
+  int dev = PCA9685_engineAdd(engine, fd, board->addr);
+  if (dev >= 0) {
+    fprintf(stdout, "board %d/0x%02x added\n", board->adpt, board->addr);
+  } // if
+  return dev;
+} // addBoard
+
+
+
+// merge the client frames and post the boards to the engine
+void commitFrame(PCA9685_shm* shm, PCA9685_engine* engine, unsigned int freq) {
+  if (PCA9685_shmMerge(shm, &merged) == 0) return;
+  if (nboards < (int) merged.boards) {
+    while (nboards < (int) merged.boards) {
+      engineDev[nboards] = addBoard(engine, &merged.board[nboards], freq);
+      nboards++;
+    } // while new boards
+    // rather than fall behind, send the largest changes first and let
+    // the small ones wait a few ticks
+    unsigned int maxFps = PCA9685_engineMaxFps(engine);
+    if (maxFps < engine->fps) {
+      fprintf(stderr, "WARNING: the busiest bus carries %u full frames per second, not %u, "
+              "sending the largest changes first\n", maxFps, engine->fps);
+      PCA9685_engineSetBudget(engine, 1000000000LL / engine->fps * BUDGETPCT / 100);
+    } // if
+  } // if new boards
+
+  unsigned int onVals[_PCA9685_CHANS];
+  unsigned int offVals[_PCA9685_CHANS];
+  int b;
+  for (b = 0; b < nboards; b++) {
+    if (engineDev[b] < 0) continue;
+    const unsigned char* regs = merged.board[b].regs;
+    int i;
+    for (i = 0; i < _PCA9685_CHANS; i++) {
+      onVals[i] = regs[i*4] | (regs[i*4 + 1] << 8);
+      offVals[i] = regs[i*4 + 2] | (regs[i*4 + 3] << 8);
+    } // for chans
+    PCA9685_engineSubmit(engine, engineDev[b], onVals, offVals);
+  } // for boards
+} // commitFrame
+
+
+
+// main driver
+int main(int argc, char **argv) {
+  unsigned int freq = 200;
+  unsigned int fps = 200;
+  const char* name = _PCA9685_SHMNAME;
+  const char* metricsPath = NULL;
+  const char* group = NULL;
+  int adpts = 0;
+  int realTime = 0;
+  int simulate = 0;
+  int c;
+  opterr = 0;
+  while ((c = getopt (argc, argv, "hVdf:s:n:m:g:a:b:RSC")) != -1)
+    switch (c)
+      {
+      case 'V':  // version
+        fprintf(stdout, "pca9685d %d.%d\n", libPCA9685_VERSION_MAJOR, libPCA9685_VERSION_MINOR);
+        exit(0);
+      case 'd':  // debug mode
+        _PCA9685_DEBUG = 1;
+        break;
+      case 'f':  // PWM frequency
+        freq = atoi(optarg);
+        break;
+      case 's':  // frame rate
+        fps = atoi(optarg);
+        break;
+      case 'n':  // segment name
+        name = optarg;
+        break;
+      case 'm':  // metrics socket
+        metricsPath = optarg;
+        break;
+      case 'g':  // segment group
+        group = optarg;
+        break;
+      case 'a': {  // allowed adapter
+        int adpt = strtol(optarg, NULL, 0);
+        if (adpt < 0 || adpt > 255) {
+          fprintf(stderr, "ERROR: invalid adapter %s\n", optarg);
+          exit(-1);
+        } // if
+        adptAllowed[adpt] = 1;
+        adpts++;
+        break;
+      } // case
+      case 'b': {  // allowed address
+        int addr = strtol(optarg, NULL, 0);
+        if (!validAddr(addr)) {
+          fprintf(stderr, "ERROR: invalid board address %s\n", optarg);
+          exit(-1);
+        } // if
+        addrAllowed[addr] = 1;
+        addrsGiven = 1;
+        break;
+      } // case
+      case 'R':  // real-time mode
+        realTime = 1;
+        break;
+      case 'S':  // simulate mode
+        simulate = 1;
+        break;
+      case 'C':  // calibrate mode
+        calibrate = 1;
+        break;
+      case 'h':  // help mode
+        print_usage(argv[0]);
+        exit(0);
+      }
+
+  if (argc != optind || fps == 0) {
+    print_usage(argv[0]);
+    exit(-1);
+  } // if argc
+  fprintf(stdout, "pca9685d %d.%d\n", libPCA9685_VERSION_MAJOR, libPCA9685_VERSION_MINOR);
+  if (adpts == 0) adptAllowed[DEFAULTADPT] = 1;
+  int gid = -1;
+  struct group* gr = getgrnam(group ? group : SHMGROUP);
+  if (gr) {
+    gid = gr->gr_gid;
+  } else if (group) {
+    fprintf(stderr, "ERROR: no group %s\n", group);
+    exit(-1);
+  } else {
+    fprintf(stderr, "WARNING: no group %s, only the daemon's group may publish\n", SHMGROUP);
+  } // if group
+
+  PCA9685_sim* sim = NULL;
+  if (simulate) {
+    sim = PCA9685_simCreate();
+    if (sim == NULL) exit(-1);
+    PCA9685_simStart(sim);
+  } // if simulate
+  memset(adptFd, -1, sizeof(adptFd));
+
+  PCA9685_engine* engine = PCA9685_engineCreate(fps);
+  if (engine == NULL) {
+    fprintf(stderr, "ERROR: failed to create the engine\n");
+    exit(-1);
+  } // if
+  PCA9685_metrics* metrics = NULL;
+  if (metricsPath) {
+    metrics = PCA9685_metricsCreate(engine);
+    if (metrics == NULL || PCA9685_metricsListenUnix(metrics, metricsPath) != 0) {
+      fprintf(stderr, "ERROR: failed to serve metrics on %s\n", metricsPath);
+      exit(-1);
+    } // if
+  } // if metrics
+  if (realTime) {
+    PCA9685_rtConfig rt;
+    PCA9685_rtDefaults(&rt);
+    if (PCA9685_rtApply(&rt) != 0) {
+      fprintf(stderr, "WARNING: running without real-time scheduling\n");
+    } // if
+  } // if realTime
+
+  // the segment last, clients see the daemon only once it can commit
+  PCA9685_shm* shm = PCA9685_shmCreate(name, gid);
+  if (shm == NULL) {
+    fprintf(stderr, "ERROR: failed to create %s\n", name);
+    exit(-1);
+  } // if
+  shm->hdr->fps = fps;
+  shm->hdr->freq = freq;
+  signal(SIGINT, stopHandler);
+  signal(SIGTERM, stopHandler);
+  fprintf(stdout, "serving %s at %u fps\n", name, fps);
+
+  // the tick, then the metrics sockets, which never block a commit
+  struct pollfd fds[1 + _PCA9685_METRICSFDS];
+  fds[0].fd = PCA9685_engineTickFd(engine);
+  fds[0].events = POLLIN;
+  time_t reapAt = time(NULL) + REAPSECS;
+  while (running) {
+    int nfds = 1 + (metrics ? PCA9685_metricsPollFds(metrics, &fds[1]) : 0);
+    if (poll(fds, nfds, REAPSECS * 1000) < 0) continue;
+    if (fds[0].revents & POLLIN) {
+      commitFrame(shm, engine, freq);
+      // -1 is a serviced tick with a board backing off, still a heartbeat
+      if (PCA9685_engineService(engine) != 0) {
+        __atomic_store_n(&shm->hdr->commits, shm->hdr->commits + 1, __ATOMIC_RELAXED);
+      } // if serviced
+    } // if tick
+    // a scrape in progress also gets its request wait and timeout checked
+    int i;
+    for (i = 1; i < nfds && !fds[i].revents; i++);
+    if (i < nfds || nfds > 2) PCA9685_metricsService(metrics);
+    if (time(NULL) >= reapAt) {
+      int reaped = PCA9685_shmReap(shm);
+      if (reaped) fprintf(stdout, "freed %d slots of exited clients\n", reaped);
+      reapAt = time(NULL) + REAPSECS;
+    } // if reap
+  } // while running
+
+  fprintf(stdout, "stopping after %llu commits, %llu torn client frames\n",
+          (unsigned long long) shm->hdr->commits, (unsigned long long) shm->hdr->torn);
+  PCA9685_shmClose(shm);
+  PCA9685_metricsDestroy(metrics);
+  PCA9685_engineDestroy(engine);
+  if (sim) PCA9685_simDestroy(sim);
+  return 0;
+}
@@ -6,6 +6,7 @@
 #include <stdio.h>
 
 #include <PCA9685.h>
+#include <PCA9685client.h>
 #include "config.h"
 
 int fd;
@@ -13,18 +14,22 @@ int addr = 0x40;
 // Example for a second device. Set addr2 to device address (if set to 0x00 no second device will be used)
 int fd2;
 int addr2 = 0x00;
+// cleared by intHandler() to leave the loop
+volatile sig_atomic_t running = 1;
 
 
 void intHandler(int dummy) {
-  // turn off all channels
-  PCA9685_setAllPWM(fd, addr, _PCA9685_MINVAL, _PCA9685_MINVAL);
-  exit(dummy);
+  (void) dummy;
+  // turn off all channels of boards on this process's buses at once, it
+  // is signal safe where the other calls are not
+  PCA9685_emergencyOff();
+  running = 0;
 }
 
 
 int initHardware(int adpt, int addr, int freq) {
-  int afd = PCA9685_openI2C(adpt, addr);
-  PCA9685_initPWM(afd, addr, freq);
+  int afd = PCA9685_clientOpenI2C(adpt, addr);
+  PCA9685_clientInitPWM(afd, addr, freq);
   return afd;
 }
 
@@ -50,8 +55,8 @@ int main(void) {
       { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
   } // if addr2
 
-  // blink endlessly 
-  while (1) {
+  // blink until interrupted
+  while (running) {
     // setup random values array (seizure mode)
     int i;
     for (i=0; i<_PCA9685_CHANS; i++) {
@@ -60,7 +65,7 @@ int main(void) {
       setOffVals[i] = value;
     }
     // set the on and off vals on the PCA9685
-    PCA9685_setPWMVals(fd, addr, setOnVals, setOffVals);
+    PCA9685_clientSetPWMVals(fd, addr, setOnVals, setOffVals);
 
     // DEVICE #2
     if (addr2) {
@@ -71,8 +76,16 @@ int main(void) {
       }
     
       // set the on and off vals on the second PCA9685
-      PCA9685_setPWMVals(fd2, addr2, setOnVals, setOffVals);
+      PCA9685_clientSetPWMVals(fd2, addr2, setOnVals, setOffVals);
     } // if addr2
   }
+
+  // through pca9685d the boards are not on our buses, turn them off here
+  PCA9685_clientSetAllPWM(fd, addr, _PCA9685_MINVAL, _PCA9685_MINVAL);
+  PCA9685_clientClose(fd);
+  if (addr2) {
+    PCA9685_clientSetAllPWM(fd2, addr2, _PCA9685_MINVAL, _PCA9685_MINVAL);
+    PCA9685_clientClose(fd2);
+  } // if addr2
   return 0;
 }
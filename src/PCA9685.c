@@ -8,8 +8,12 @@
 #include <sys/ioctl.h>
 #include <sys/select.h>
 #include <stdint.h>
+#include <errno.h>
+#include <time.h>
 
 #include "PCA9685.h"
+#include "PCA9685rec.h"
+#include "PCA9685sim.h"
 
 // set the lib version from the Config header
 // sets libPCA9685_VERSION_MAJOR and libPCA9685_VERSION_MINOR
@@ -23,9 +27,63 @@ bool _PCA9685_TEST = 0;
 unsigned char _PCA9685_MODE1 = 0x00 | _PCA9685_ALLCALLBIT | _PCA9685_SLEEPBIT;
 // mode2 value hardware defaults (totem pole mode)
 unsigned char _PCA9685_MODE2 = 0x00 | _PCA9685_OUTDRVBIT;
+// set while an emergency stop latches the engines off
+int _PCA9685_EMERGENCY = 0;
+// emergency stops so far
+unsigned int _PCA9685_EMERGENCIES = 0;
+
+// I2C_TIMEOUT and I2C_RETRIES per adapter, defaults unless set
+static struct {
+  int set;
+  unsigned int timeoutMs;
+  unsigned int retries;
+} _PCA9685_i2cPolicy[256];
+
+// I2C_FUNCS and transfer path per adapter, probed by the first open
+static struct {
+  int probed;
+  int forced;
+  unsigned long funcs;
+  int path;
+} _PCA9685_i2cCaps[256];
+// bus costs per adapter, once PCA9685_calibrate() measured them
+static struct {
+  int set;
+  PCA9685_busCal cal;
+} _PCA9685_busCals[256];
+// adapter number + 1 of each fd PCA9685_openI2C() opened, 0 if none
+static unsigned char _PCA9685_fdAdpt[_PCA9685_I2CFDS];
+// I2C_SLAVE address + 1 last set on each fd, 0 if unknown
+static unsigned short _PCA9685_fdSlave[_PCA9685_I2CFDS];
+
+// emergency transaction of every initialized device, appended only so a
+// signal handler never sees an entry move; a closed fd's entries are
+// marked dead with fd -1 and reused
+static struct i2c_msg _PCA9685_emergMsgs[_PCA9685_EMERGDEVS];
+static int _PCA9685_emergFds[_PCA9685_EMERGDEVS];
+static int _PCA9685_emergDevs = 0;
+// ALL_LED_OFF_H alone with the full OFF bit, which overrides the ON
+// registers and needs no AUTOINC, so a board whose MODE1 was reset or
+// set up by another tool is still turned off
+static unsigned char _PCA9685_emergBuf[2] =
+  { _PCA9685_ALLLEDREG + 3, _PCA9685_FULLBIT };
 
 #define INT2VOIDP(i) (void*)(uintptr_t)(i)
 
+static int _PCA9685_transferPath(int fd, struct i2c_rdwr_ioctl_data* data, int raw);
+
+/////////////////////////////////////////////////////////////////////
+// the fastest transfer path an adapter's I2C_FUNCS allow
+static int _PCA9685_choosePath(unsigned long funcs) {
+  // plain I2C also carries combined transactions, unless the adapter's
+  // quirks refuse them, which the first such transaction finds out
+  if (funcs & I2C_FUNC_I2C) return PCA9685_I2CPATHRDWR;
+  if ((funcs & I2C_FUNC_SMBUS_I2C_BLOCK) == I2C_FUNC_SMBUS_I2C_BLOCK) return PCA9685_I2CPATHSMBUS;
+  return PCA9685_I2CPATHRDWR;
+} // _PCA9685_choosePath
+
+
+
 /////////////////////////////////////////////////////////////////////
 // open the I2C bus device and assign the default slave address 
 int PCA9685_openI2C(unsigned char adapterNum, unsigned char addr) {
@@ -54,12 +112,255 @@ int PCA9685_openI2C(unsigned char adapterNum, unsigned char addr) {
     fprintf(stderr, "PCA9685_openI2C(): _PCA9685_ioctl() returned %d for addr %d\n", ret, addr);
     return -1;
   } // if 
+  if (fd < _PCA9685_I2CFDS) _PCA9685_fdSlave[fd] = addr + 1;
+
+  // bound how long a board holding the bus stalls every other board on
+  // it, a failure leaves the adapter's own defaults
+  unsigned int timeoutMs = _PCA9685_I2CTIMEOUTMS;
+  unsigned int retries = _PCA9685_I2CRETRIES;
+  if (_PCA9685_i2cPolicy[adapterNum].set) {
+    timeoutMs = _PCA9685_i2cPolicy[adapterNum].timeoutMs;
+    retries = _PCA9685_i2cPolicy[adapterNum].retries;
+  } // if policy set
+  ret = _PCA9685_ioctl(fd, I2C_TIMEOUT, (char *) INT2VOIDP((timeoutMs + 9) / 10));
+  if (ret < 0) {
+    fprintf(stderr, "PCA9685_openI2C(): _PCA9685_ioctl() returned %d for I2C_TIMEOUT %u ms\n", ret, timeoutMs);
+  } // if 
+  ret = _PCA9685_ioctl(fd, I2C_RETRIES, (char *) INT2VOIDP(retries));
+  if (ret < 0) {
+    fprintf(stderr, "PCA9685_openI2C(): _PCA9685_ioctl() returned %d for I2C_RETRIES %u\n", ret, retries);
+  } // if 
+
+  // what the adapter can do decides how transactions reach it, asked
+  // once; a failure leaves I2C_RDWR, the path every adapter had before
+  if (!_PCA9685_i2cCaps[adapterNum].probed) {
+    unsigned long funcs = 0;
+    ret = _PCA9685_ioctl(fd, I2C_FUNCS, (char *) &funcs);
+    if (ret < 0) {
+      fprintf(stderr, "PCA9685_openI2C(): _PCA9685_ioctl() returned %d for I2C_FUNCS\n", ret);
+      funcs = 0;
+    } // if 
+    _PCA9685_i2cCaps[adapterNum].funcs = funcs;
+    _PCA9685_i2cCaps[adapterNum].probed = 1;
+    if (!_PCA9685_i2cCaps[adapterNum].forced) {
+      _PCA9685_i2cCaps[adapterNum].path = _PCA9685_choosePath(funcs);
+    } // if auto
+  } // if not probed
+  if (fd < _PCA9685_I2CFDS) _PCA9685_fdAdpt[fd] = adapterNum + 1;
+  if (_PCA9685_DEBUG) {
+    printf("PCA9685_openI2C(): funcs 0x%08lx, %s\n", _PCA9685_i2cCaps[adapterNum].funcs,
+           PCA9685_i2cPathName(_PCA9685_i2cCaps[adapterNum].path));
+  }
+
+  // recordings name the adapter rather than the fd
+  _PCA9685_recNoteAdapter(fd, adapterNum);
 
   return fd;
 } // PCA9685_openI2C 
 
 
 
+/////////////////////////////////////////////////////////////////////
+// close an I2C bus device PCA9685_openI2C() opened
+void PCA9685_closeI2C(int fd) {
+  if (fd < 0) return;
+  // the number may be reused by any file, which no emergency stop or
+  // adapter lookup may then reach
+  _PCA9685_emergencyRemove(fd);
+  if (fd < _PCA9685_I2CFDS) {
+    _PCA9685_fdAdpt[fd] = 0;
+    _PCA9685_fdSlave[fd] = 0;
+  } // if
+  if (!_PCA9685_TEST) close(fd);
+} // PCA9685_closeI2C
+
+
+
+/////////////////////////////////////////////////////////////////////
+// choose the I2C_TIMEOUT and I2C_RETRIES PCA9685_openI2C() sets
+int PCA9685_setI2CPolicy(unsigned char adpt, unsigned int timeoutMs, unsigned int retries) {
+  if (timeoutMs == 0) {
+    fprintf(stderr, "PCA9685_setI2CPolicy(): a zero timeout never lets a transaction finish\n");
+    return -1;
+  } // if
+  _PCA9685_i2cPolicy[adpt].timeoutMs = timeoutMs;
+  _PCA9685_i2cPolicy[adpt].retries = retries;
+  _PCA9685_i2cPolicy[adpt].set = 1;
+  return 0;
+} // PCA9685_setI2CPolicy
+
+
+
+/////////////////////////////////////////////////////////////////////
+// adapter number fd was opened on, -1 if unknown
+int _PCA9685_getAdapter(int fd) {
+  if (fd < 0 || fd >= _PCA9685_I2CFDS) return -1;
+  return _PCA9685_fdAdpt[fd] - 1;
+} // _PCA9685_getAdapter
+
+
+
+/////////////////////////////////////////////////////////////////////
+// the transfer path of the adapter fd was opened on, and its I2C_FUNCS
+int PCA9685_getI2CPath(int fd, unsigned long* funcs) {
+  if (fd < 0 || fd >= _PCA9685_I2CFDS || _PCA9685_fdAdpt[fd] == 0) {
+    if (funcs) *funcs = 0;
+    return PCA9685_I2CPATHRDWR;
+  } // if unknown
+  int adpt = _PCA9685_fdAdpt[fd] - 1;
+  if (funcs) *funcs = _PCA9685_i2cCaps[adpt].funcs;
+  return __atomic_load_n(&_PCA9685_i2cCaps[adpt].path, __ATOMIC_RELAXED);
+} // PCA9685_getI2CPath
+
+
+
+/////////////////////////////////////////////////////////////////////
+// force an adapter's transfer path, or choose it from I2C_FUNCS again
+int PCA9685_setI2CPath(unsigned char adpt, int path) {
+  if (path < PCA9685_I2CPATHAUTO || path > PCA9685_I2CPATHSMBUS) {
+    fprintf(stderr, "PCA9685_setI2CPath(): unknown path %d\n", path);
+    return -1;
+  } // if
+  _PCA9685_i2cCaps[adpt].forced = (path != PCA9685_I2CPATHAUTO);
+  if (path == PCA9685_I2CPATHAUTO) path = _PCA9685_choosePath(_PCA9685_i2cCaps[adpt].funcs);
+  __atomic_store_n(&_PCA9685_i2cCaps[adpt].path, path, __ATOMIC_RELAXED);
+  return 0;
+} // PCA9685_setI2CPath
+
+
+
+/////////////////////////////////////////////////////////////////////
+// name of a transfer path
+const char* PCA9685_i2cPathName(int path) {
+  switch (path) {
+  case PCA9685_I2CPATHRDWR: return "I2C_RDWR";
+  case PCA9685_I2CPATHSINGLE: return "I2C_RDWR single message";
+  case PCA9685_I2CPATHSMBUS: return "SMBus I2C block";
+  } // switch path
+  return "unknown";
+} // PCA9685_i2cPathName
+
+
+
+/////////////////////////////////////////////////////////////////////
+// ns of the fastest of _PCA9685_CALREPS transactions, write or read
+static double _PCA9685_calTime(int fd, unsigned char addr, int len, unsigned char* buf, int read) {
+  double best = -1;
+  int rep;
+  for (rep = 0; rep < _PCA9685_CALREPS; rep++) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int ret = (read ? _PCA9685_readI2CReg(fd, addr, buf[0], len, &buf[1])
+                    : _PCA9685_writeI2CRaw(fd, addr, 1 + len, buf));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (ret != 0) return -1;
+    double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    if (best < 0 || ns < best) best = ns;
+  } // for reps
+  return best;
+} // _PCA9685_calTime
+
+
+
+/////////////////////////////////////////////////////////////////////
+// fit the cost per transaction and per byte of a device's adapter
+int PCA9685_calibrate(int fd, unsigned char addr, PCA9685_busCal* cal) {
+  if (fd < 0 || fd >= _PCA9685_I2CFDS || _PCA9685_fdAdpt[fd] == 0) {
+    fprintf(stderr, "PCA9685_calibrate(): fd %d was not opened by PCA9685_openI2C()\n", fd);
+    return -1;
+  } // if
+  int adpt = _PCA9685_fdAdpt[fd] - 1;
+
+  // the writes put back what the LED registers hold, so nothing changes
+  unsigned char regs[1 + _PCA9685_CHANS*4];
+  regs[0] = _PCA9685_BASEPWMREG;
+  if (_PCA9685_readI2CReg(fd, addr, _PCA9685_BASEPWMREG, _PCA9685_CHANS*4, &regs[1]) != 0) {
+    fprintf(stderr, "PCA9685_calibrate(): failed to read the LED registers of %02x\n", addr);
+    return -1;
+  } // if
+
+  // a write is address, register and data; a read is address and
+  // register, then address and data
+  static const int lens[] = { 1, 2, 4, 8, 16, 32, 64 };
+  int n = sizeof(lens) / sizeof(lens[0]);
+  double bytes[2 * sizeof(lens) / sizeof(lens[0])];
+  double ns[2 * sizeof(lens) / sizeof(lens[0])];
+  int i;
+  for (i = 0; i < 2 * n; i++) {
+    int read = (i >= n);
+    int len = lens[i % n];
+    bytes[i] = (read ? 3 : 2) + len;
+    ns[i] = _PCA9685_calTime(fd, addr, len, regs, read);
+    if (ns[i] < 0) {
+      fprintf(stderr, "PCA9685_calibrate(): transaction of %d bytes to %02x failed\n", len, addr);
+      return -1;
+    } // if
+  } // for lengths
+
+  // least squares line through the fastest times
+  double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+  for (i = 0; i < 2 * n; i++) {
+    sumX += bytes[i];
+    sumY += ns[i];
+    sumXX += bytes[i] * bytes[i];
+    sumXY += bytes[i] * ns[i];
+  } // for samples
+  PCA9685_busCal fit;
+  fit.byteNs = (2 * n * sumXY - sumX * sumY) / (2 * n * sumXX - sumX * sumX);
+  fit.txNs = (sumY - fit.byteNs * sumX) / (2 * n);
+  if (!(fit.byteNs > 0)) {
+    fprintf(stderr, "PCA9685_calibrate(): no cost per byte measured on adapter %d\n", adpt);
+    return -1;
+  } // if
+  if (fit.txNs < 0) fit.txNs = 0;
+  fit.sclHz = 9e9 / fit.byteNs;
+  fit.maxErrNs = 0;
+  for (i = 0; i < 2 * n; i++) {
+    double err = ns[i] - (fit.txNs + fit.byteNs * bytes[i]);
+    if (err < 0) err = -err;
+    if (err > fit.maxErrNs) fit.maxErrNs = err;
+  } // for samples
+  fit.samples = 2 * n * _PCA9685_CALREPS;
+
+  if (_PCA9685_DEBUG) {
+    printf("PCA9685_calibrate(): adapter %d fitted from %d transactions\n", adpt, fit.samples);
+  }
+  _PCA9685_busCals[adpt].cal = fit;
+  _PCA9685_busCals[adpt].set = 1;
+  if (cal) *cal = fit;
+  return 0;
+} // PCA9685_calibrate
+
+
+
+/////////////////////////////////////////////////////////////////////
+// the costs measured on fd's adapter, or the nominal ones
+int PCA9685_getBusCal(int fd, PCA9685_busCal* cal) {
+  if (fd >= 0 && fd < _PCA9685_I2CFDS && _PCA9685_fdAdpt[fd] &&
+      _PCA9685_busCals[_PCA9685_fdAdpt[fd] - 1].set) {
+    *cal = _PCA9685_busCals[_PCA9685_fdAdpt[fd] - 1].cal;
+    return 0;
+  } // if calibrated
+  cal->txNs = _PCA9685_BUSTXNS;
+  cal->byteNs = 9e9 / _PCA9685_BUSHZ;
+  cal->sclHz = _PCA9685_BUSHZ;
+  cal->maxErrNs = 0;
+  cal->samples = 0;
+  return 1;
+} // PCA9685_getBusCal
+
+
+
+/////////////////////////////////////////////////////////////////////
+// ns transactions carrying bytes take on fd's bus
+int64_t PCA9685_busCostNs(int fd, int transactions, int bytes) {
+  PCA9685_busCal cal;
+  PCA9685_getBusCal(fd, &cal);
+  return (int64_t) (transactions * cal.txNs + bytes * cal.byteNs);
+} // PCA9685_busCostNs
+
+
+
 /////////////////////////////////////////////////////////////////////
 // initialize a PCA9685 device to defaults, turn off PWM's, and set the freq 
 int PCA9685_initPWM(int fd, unsigned char addr, unsigned int freq) {
@@ -128,6 +429,9 @@ int PCA9685_initPWM(int fd, unsigned char addr, unsigned int freq) {
     printf("PCA9685_initPWM(): mode2 set to 0x%02x on fd %d, addr 0x%02x\n", mode2val, fd, addr);
   } // if debug
 
+  // encode its emergency stop while nothing is urgent
+  _PCA9685_emergencyAdd(fd, addr);
+
   return 0;
 } // PCA9685_initPWM
 
@@ -331,34 +635,161 @@ int PCA9685_getPWMVal(int fd, unsigned char addr, unsigned char reg,
 /////////////////////////////////////////////////////////////////////
 // print out the values of all registers used in a PCA9685
 int PCA9685_dumpAllRegs(int fd, unsigned char addr) {
-  unsigned char loBuf[_PCA9685_LOREGS];
-  unsigned char hiBuf[_PCA9685_HIREGS];
+  unsigned char loBuf[1][_PCA9685_LOREGS];
+  unsigned char hiBuf[1][_PCA9685_HIREGS];
   int ret;
 
-  // read all the low PCA9685 registers 
-  ret = _PCA9685_readI2CReg(fd, addr, _PCA9685_FIRSTLOREG,
-                            _PCA9685_LOREGS, loBuf);
+  // read all the low and high PCA9685 registers in one transaction
+  ret = _PCA9685_readAllRegs(fd, 1, &addr, loBuf, hiBuf);
   if (ret != 0) {
-    fprintf(stderr, "PCA9685_dumpAllRegs(): _PCA9685_readI2CReg() returned %d\n", ret);
+    fprintf(stderr, "PCA9685_dumpAllRegs(): _PCA9685_readAllRegs() returned %d\n", ret);
     return -1;
   } // if 
 
   // display all of the low PCA9685 register values 
-  _PCA9685_dumpLoRegs(loBuf);
+  _PCA9685_dumpLoRegs(loBuf[0]);
+
+  // display all of the high PCA9685 register values 
+  _PCA9685_dumpHiRegs(hiBuf[0]);
+
+  return 0;
+} // PCA9685_dumpAllRegs 
+
 
-  // read all the high PCA9685 registers 
-  ret = _PCA9685_readI2CReg(fd, addr, _PCA9685_FIRSTHIREG,
-                            _PCA9685_HIREGS, hiBuf);
+
+/////////////////////////////////////////////////////////////////////
+// read every register used in a PCA9685 in one transaction
+int PCA9685_getSnapshot(int fd, unsigned char addr, PCA9685_snapshot* snap) {
+  int ret;
+  ret = PCA9685_getSnapshots(fd, 1, &addr, snap);
   if (ret != 0) {
-    fprintf(stderr, "PCA9685_dumpAllRegs(): _PCA9685_readI2CReg() returned %d\n", ret);
+    fprintf(stderr, "PCA9685_getSnapshot(): PCA9685_getSnapshots() returned %d\n", ret);
     return -1;
-  } // if 
+  } // if err
+  return 0;
+} // PCA9685_getSnapshot
 
-  // display all of the high PCA9685 register values 
-  _PCA9685_dumpHiRegs(hiBuf);
+
+
+/////////////////////////////////////////////////////////////////////
+// read every register used in count PCA9685s on one bus
+int PCA9685_getSnapshots(int fd, int count, const unsigned char* addrs,
+                         PCA9685_snapshot* snaps) {
+  unsigned char loBufs[_PCA9685_SNAPDEVS][_PCA9685_LOREGS];
+  unsigned char hiBufs[_PCA9685_SNAPDEVS][_PCA9685_HIREGS];
+  int ret;
+
+  int first;
+  for (first = 0; first < count; first += _PCA9685_SNAPDEVS) {
+    int n = (count - first > _PCA9685_SNAPDEVS ? _PCA9685_SNAPDEVS : count - first);
+    ret = _PCA9685_readAllRegs(fd, n, &addrs[first], loBufs, hiBufs);
+    if (ret != 0) {
+      fprintf(stderr, "PCA9685_getSnapshots(): _PCA9685_readAllRegs() returned %d\n", ret);
+      return -1;
+    } // if err
+
+    int d;
+    for (d = 0; d < n; d++) {
+      unsigned char* lo = loBufs[d];
+      unsigned char* hi = hiBufs[d];
+      PCA9685_snapshot* snap = &snaps[first + d];
+      snap->addr = addrs[first + d];
+      snap->mode1 = lo[_PCA9685_MODE1REG];
+      snap->mode2 = lo[_PCA9685_MODE2REG];
+      snap->subAddr[0] = lo[2];
+      snap->subAddr[1] = lo[3];
+      snap->subAddr[2] = lo[4];
+      snap->allCallAddr = lo[5];
+      int i;
+      for (i = 0; i < _PCA9685_CHANS; i++) {
+        unsigned char* led = &lo[_PCA9685_BASEPWMREG + i*4];
+        snap->onVals[i] = (led[1] << 8) + led[0];
+        snap->offVals[i] = (led[3] << 8) + led[2];
+      } // for channels
+      snap->allOn = (hi[1] << 8) + hi[0];
+      snap->allOff = (hi[3] << 8) + hi[2];
+      snap->prescale = hi[_PCA9685_PRESCALEREG - _PCA9685_FIRSTHIREG];
+    } // for devices
+  } // for batches
 
   return 0;
-} // PCA9685_dumpAllRegs 
+} // PCA9685_getSnapshots
+
+
+
+/////////////////////////////////////////////////////////////////////
+// one emergency transaction, straight to the kernel so no stdio is used
+static int _PCA9685_emergencyIoctl(int fd, struct i2c_msg* msgs, int n) {
+  struct i2c_rdwr_ioctl_data data = { msgs, n };
+  int raw = !(_PCA9685_TEST || __atomic_load_n(&_PCA9685_SIM, __ATOMIC_ACQUIRE));
+  return _PCA9685_transferPath(fd, &data, raw);
+} // _PCA9685_emergencyIoctl
+
+
+
+/////////////////////////////////////////////////////////////////////
+// write the emergency messages of devices on a bus
+static int _PCA9685_emergencyWrite(int fd, struct i2c_msg* msgs, int n) {
+  if (_PCA9685_emergencyIoctl(fd, msgs, n) >= 0) return 0;
+  if (n == 1) return -1;
+  // a device that NACKs ends the transaction, so the rest go alone
+  int ret = 0;
+  int i;
+  for (i = 0; i < n; i++) {
+    if (_PCA9685_emergencyIoctl(fd, &msgs[i], 1) < 0) ret = -1;
+  } // for devices
+  return ret;
+} // _PCA9685_emergencyWrite
+
+
+
+/////////////////////////////////////////////////////////////////////
+// write the full-off of every initialized device, async-signal-safe
+int _PCA9685_emergencyResend(void) {
+  int devs = __atomic_load_n(&_PCA9685_emergDevs, __ATOMIC_ACQUIRE);
+  struct i2c_msg msgs[_PCA9685_BATCHMSGS];
+  int ret = 0;
+  int i, j;
+  for (i = 0; i < devs; i++) {
+    int fd = __atomic_load_n(&_PCA9685_emergFds[i], __ATOMIC_ACQUIRE);
+    if (fd < 0) continue;
+    // each bus once, from its first device
+    for (j = 0; j < i && __atomic_load_n(&_PCA9685_emergFds[j], __ATOMIC_ACQUIRE) != fd; j++);
+    if (j < i) continue;
+    int n = 0;
+    for (j = i; j < devs; j++) {
+      if (__atomic_load_n(&_PCA9685_emergFds[j], __ATOMIC_ACQUIRE) != fd) continue;
+      msgs[n++] = _PCA9685_emergMsgs[j];
+      if (n == _PCA9685_BATCHMSGS) {
+        if (_PCA9685_emergencyWrite(fd, msgs, n) != 0) ret = -1;
+        n = 0;
+      } // if full
+    } // for devices on the bus
+    if (n && _PCA9685_emergencyWrite(fd, msgs, n) != 0) ret = -1;
+  } // for buses
+  return ret;
+} // _PCA9685_emergencyResend
+
+
+
+/////////////////////////////////////////////////////////////////////
+// turn every initialized device fully off, async-signal-safe
+int PCA9685_emergencyOff(void) {
+  int savedErrno = errno;
+  __atomic_store_n(&_PCA9685_EMERGENCY, 1, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&_PCA9685_EMERGENCIES, 1, __ATOMIC_ACQ_REL);
+  int ret = _PCA9685_emergencyResend();
+  errno = savedErrno;
+  return ret;
+} // PCA9685_emergencyOff
+
+
+
+/////////////////////////////////////////////////////////////////////
+// let the engines write again
+void PCA9685_emergencyClear(void) {
+  __atomic_store_n(&_PCA9685_EMERGENCY, 0, __ATOMIC_RELEASE);
+} // PCA9685_emergencyClear
 /////////////////////////////////////////////////////////////////////
 
 
@@ -396,14 +827,8 @@ int _PCA9685_setPWMFreq(int fd, unsigned char addr, unsigned int freq) {
     return -1;
   } // if 
 
-  // freq must be in range
-  freq = (freq > _PCA9685_MAXFREQ
-               ? _PCA9685_MAXFREQ
-               : (freq < _PCA9685_MINFREQ
-                       ? _PCA9685_MINFREQ
-                       : freq));
   // calculate and set prescale 
-  prescale = (unsigned char)(25000000.0f / (4096.0f * freq) - 0.5f);
+  prescale = _PCA9685_calcPrescale(freq);
 
   ret = _PCA9685_writeI2CReg(fd, addr, _PCA9685_PRESCALEREG, 1, &prescale);
   if (ret != 0) {
@@ -443,6 +868,76 @@ int _PCA9685_setPWMFreq(int fd, unsigned char addr, unsigned int freq) {
 
 
 
+/////////////////////////////////////////////////////////////////////
+// calculate the prescale register value for a PWM frequency
+unsigned char _PCA9685_calcPrescale(unsigned int freq) {
+  // freq must be in range
+  freq = (freq > _PCA9685_MAXFREQ
+               ? _PCA9685_MAXFREQ
+               : (freq < _PCA9685_MINFREQ
+                       ? _PCA9685_MINFREQ
+                       : freq));
+  return (unsigned char)(_PCA9685_OSCFREQ / (4096.0f * freq) - 0.5f);
+} // _PCA9685_calcPrescale
+
+
+
+/////////////////////////////////////////////////////////////////////
+// PWM period in microseconds produced by a prescale register value
+float _PCA9685_prescaleToPeriod(unsigned char prescale) {
+  // one period is 4096 ticks of the oscillator divided by (prescale + 1)
+  return (prescale + 1) * 4096.0f * 1000000.0f / _PCA9685_OSCFREQ;
+} // _PCA9685_prescaleToPeriod
+
+
+
+/////////////////////////////////////////////////////////////////////
+// encode the emergency stop transaction of a device
+void _PCA9685_emergencyAdd(int fd, unsigned char addr) {
+  int devs = _PCA9685_emergDevs;
+  int dead = -1;
+  int i;
+  if (fd < 0) return;
+  for (i = 0; i < devs; i++) {
+    if (_PCA9685_emergFds[i] == fd && _PCA9685_emergMsgs[i].addr == addr) return;
+    if (_PCA9685_emergFds[i] < 0 && dead < 0) dead = i;
+  } // for devices
+  if (dead >= 0) {
+    // a handler skips the entry until its fd is stored
+    _PCA9685_emergMsgs[dead].addr = addr;
+    __atomic_store_n(&_PCA9685_emergFds[dead], fd, __ATOMIC_RELEASE);
+    return;
+  } // if dead
+  if (devs == _PCA9685_EMERGDEVS) {
+    fprintf(stderr, "_PCA9685_emergencyAdd(): more than %d devices, addr %02x ", devs, addr);
+    fprintf(stderr, "is left out of PCA9685_emergencyOff()\n");
+    return;
+  } // if
+  _PCA9685_emergMsgs[devs].addr = addr;
+  _PCA9685_emergMsgs[devs].flags = 0;
+  _PCA9685_emergMsgs[devs].len = sizeof(_PCA9685_emergBuf);
+  _PCA9685_emergMsgs[devs].buf = _PCA9685_emergBuf;
+  _PCA9685_emergFds[devs] = fd;
+  // published last, a handler running now sees it whole or not at all
+  __atomic_store_n(&_PCA9685_emergDevs, devs + 1, __ATOMIC_RELEASE);
+} // _PCA9685_emergencyAdd
+
+
+
+/////////////////////////////////////////////////////////////////////
+// drop the emergency stop transactions of the devices on a closed fd
+void _PCA9685_emergencyRemove(int fd) {
+  int devs = _PCA9685_emergDevs;
+  int i;
+  for (i = 0; i < devs; i++) {
+    if (_PCA9685_emergFds[i] == fd) {
+      __atomic_store_n(&_PCA9685_emergFds[i], -1, __ATOMIC_RELEASE);
+    } // if
+  } // for devices
+} // _PCA9685_emergencyRemove
+
+
+
 /////////////////////////////////////////////////////////////////////
 // dump the contents of the first 70 registers (modes and PWMs) 
 int _PCA9685_dumpLoRegs(unsigned char* buf) {
@@ -472,6 +967,67 @@ int _PCA9685_dumpHiRegs(unsigned char* buf) {
 
 
 
+/////////////////////////////////////////////////////////////////////
+// read the LO and HI registers of count PCA9685s in one transaction
+int _PCA9685_readAllRegs(int fd, int count, const unsigned char* addrs,
+                         unsigned char (*loBufs)[_PCA9685_LOREGS],
+                         unsigned char (*hiBufs)[_PCA9685_HIREGS]) {
+  int ret;
+  // four messages per device, write/read the LO regs and write/read the HI regs
+  struct i2c_rdwr_ioctl_data data;
+  struct i2c_msg msgs[_PCA9685_SNAPDEVS * 4];
+  unsigned char loReg = _PCA9685_FIRSTLOREG;
+  unsigned char hiReg = _PCA9685_FIRSTHIREG;
+
+  if (count < 1 || count > _PCA9685_SNAPDEVS) {
+    fprintf(stderr, "_PCA9685_readAllRegs(): count %d not in 1 - %d\n",
+            count, _PCA9685_SNAPDEVS);
+    return -1;
+  } // if count
+
+  int d;
+  for (d = 0; d < count; d++) {
+    struct i2c_msg* m = &msgs[d*4];
+    memset(loBufs[d], 0, _PCA9685_LOREGS);
+    memset(hiBufs[d], 0, _PCA9685_HIREGS);
+
+    m[0].addr = addrs[d];
+    m[0].flags = 0x00;
+    m[0].len = 1;
+    m[0].buf = &loReg;
+
+    m[1].addr = addrs[d];
+    m[1].flags = I2C_M_RD;
+    m[1].len = _PCA9685_LOREGS;
+    m[1].buf = loBufs[d];
+
+    m[2].addr = addrs[d];
+    m[2].flags = 0x00;
+    m[2].len = 1;
+    m[2].buf = &hiReg;
+
+    m[3].addr = addrs[d];
+    m[3].flags = I2C_M_RD;
+    m[3].len = _PCA9685_HIREGS;
+    m[3].buf = hiBufs[d];
+  } // for devices
+
+  data.msgs = msgs;
+  data.nmsgs = count * 4;
+
+  // send the combined transaction 
+  ret = _PCA9685_transfer(fd, (char *) &data);
+  if (ret < 0) {
+    fprintf(stderr, "_PCA9685_readAllRegs(): _PCA9685_transfer() returned ");
+    fprintf(stderr, "%d on %d devices from addr %02x\n", ret, count, addrs[0]);
+    return -1;
+  } // if 
+
+  return 0;
+} // _PCA9685_readAllRegs
+
+
+
 /////////////////////////////////////////////////////////////////////
 // read characters from a register at an address 
 int _PCA9685_readI2CReg(int fd, unsigned char addr, unsigned char startReg,
@@ -501,9 +1057,9 @@ int _PCA9685_readI2CReg(int fd, unsigned char addr, unsigned char startReg,
   } // if debug
 
   // send the combined transaction 
-  ret = _PCA9685_ioctl(fd, I2C_RDWR, (char *) &data);
+  ret = _PCA9685_transfer(fd, (char *) &data);
   if (ret < 0) {
-    fprintf(stderr, "_PCA9685_readI2CReg(): _PCA9685_ioctl() returned ");
+    fprintf(stderr, "_PCA9685_readI2CReg(): _PCA9685_transfer() returned ");
     fprintf(stderr, "%d on addr %02x start %02x\n", ret, addr, startReg);
     return -1;
   } // if 
@@ -580,10 +1136,10 @@ int _PCA9685_writeI2CRaw(int fd, unsigned char addr, int len,
   data.nmsgs = 1;
 
   // send a combined transaction 
-  ret = _PCA9685_ioctl(fd, I2C_RDWR, (char *) &data);
+  ret = _PCA9685_transfer(fd, (char *) &data);
   if (ret < 0) {
     int i;
-    fprintf(stderr, "_PCA9685_writeI2CRaw(): _PCA9685_ioctl() returned ");
+    fprintf(stderr, "_PCA9685_writeI2CRaw(): _PCA9685_transfer() returned ");
     fprintf(stderr, "%d on addr %02x\n", ret, addr);
     fprintf(stderr, "_PCA9685_writeI2CRaw(): len = %d, buf = ", len);
     for (i=0; i<len; i++) {
@@ -598,6 +1154,191 @@ int _PCA9685_writeI2CRaw(int fd, unsigned char addr, int len,
 
 
 
+/////////////////////////////////////////////////////////////////////
+// write characters to count i2c addresses in batched transactions
+int _PCA9685_writeI2CBatch(int fd, int count, const unsigned char* addrs,
+                           const int* lens, unsigned char* const* bufs) {
+  return _PCA9685_transferI2CBatch(fd, count, addrs, NULL, lens, bufs);
+} // _PCA9685_writeI2CBatch
+
+
+
+/////////////////////////////////////////////////////////////////////
+// write or read characters at count i2c addresses in batched transactions
+int _PCA9685_transferI2CBatch(int fd, int count, const unsigned char* addrs,
+                              const unsigned short* flags, const int* lens,
+                              unsigned char* const* bufs) {
+  struct i2c_rdwr_ioctl_data data;
+  struct i2c_msg msgs[_PCA9685_BATCHMSGS];
+  int ret;
+
+  int first;
+  for (first = 0; first < count; first += _PCA9685_BATCHMSGS) {
+    int n = (count - first > _PCA9685_BATCHMSGS ? _PCA9685_BATCHMSGS : count - first);
+    int i;
+    // one msg per address, separated by repeated starts
+    for (i = 0; i < n; i++) {
+      msgs[i].addr = addrs[first + i];
+      msgs[i].flags = (flags ? flags[first + i] : 0x00);
+      msgs[i].len = lens[first + i];
+      msgs[i].buf = bufs[first + i];
+    } // for msgs
+
+    data.msgs = msgs;
+    data.nmsgs = n;
+
+    ret = _PCA9685_transfer(fd, (char *) &data);
+    if (ret < 0) {
+      int savedErrno = errno;
+      fprintf(stderr, "_PCA9685_transferI2CBatch(): _PCA9685_transfer() returned ");
+      fprintf(stderr, "%d on %d msgs from addr %02x\n", ret, n, addrs[first]);
+      errno = savedErrno;
+      return -1;
+    } // if 
+  } // for batches
+
+  return 0;
+} // _PCA9685_transferI2CBatch
+
+
+
+/////////////////////////////////////////////////////////////////////
+// one ioctl, raw ones go straight to the kernel for a signal handler
+static int _PCA9685_i2cCall(int fd, unsigned long int request, void* argp, int raw) {
+  if (raw) return ioctl(fd, request, argp);
+  return _PCA9685_ioctl(fd, request, (char *) argp);
+} // _PCA9685_i2cCall
+
+
+
+/////////////////////////////////////////////////////////////////////
+// address an fd's SMBus transfers to a slave, if not already
+static int _PCA9685_smbusSlave(int fd, unsigned char addr, int raw) {
+  int known = (fd >= 0 && fd < _PCA9685_I2CFDS);
+  if (known && _PCA9685_fdSlave[fd] == addr + 1) return 0;
+  if (_PCA9685_i2cCall(fd, I2C_SLAVE, INT2VOIDP(addr), raw) < 0) return -1;
+  if (known) _PCA9685_fdSlave[fd] = addr + 1;
+  return 0;
+} // _PCA9685_smbusSlave
+
+
+
+/////////////////////////////////////////////////////////////////////
+// one SMBus transfer to the fd's slave
+static int _PCA9685_smbus(int fd, char readWrite, unsigned char command, int size,
+                          union i2c_smbus_data* data, int raw) {
+  struct i2c_smbus_ioctl_data args = { readWrite, command, size, data };
+  return _PCA9685_i2cCall(fd, I2C_SMBUS, &args, raw);
+} // _PCA9685_smbus
+
+
+
+/////////////////////////////////////////////////////////////////////
+// carry out I2C messages as SMBus transfers of up to 32 bytes, relying
+// on auto-increment to carry the register from one block to the next
+static int _PCA9685_transferSmbus(int fd, struct i2c_msg* msgs, int n, int raw) {
+  union i2c_smbus_data data;
+  int m, off, len;
+  for (m = 0; m < n; m++) {
+    struct i2c_msg* msg = &msgs[m];
+    if (_PCA9685_smbusSlave(fd, msg->addr, raw) != 0) return -1;
+    if (!(msg->flags & I2C_M_RD) && msg->len == 1 && m + 1 < n &&
+        (msgs[m + 1].flags & I2C_M_RD) && msgs[m + 1].addr == msg->addr) {
+      // a register then a read of it, as block reads from the register
+      struct i2c_msg* rd = &msgs[++m];
+      for (off = 0; off < rd->len; off += I2C_SMBUS_BLOCK_MAX) {
+        len = (rd->len - off > I2C_SMBUS_BLOCK_MAX ? I2C_SMBUS_BLOCK_MAX : rd->len - off);
+        data.block[0] = len;
+        if (_PCA9685_smbus(fd, I2C_SMBUS_READ, msg->buf[0] + off,
+                           I2C_SMBUS_I2C_BLOCK_DATA, &data, raw) < 0) return -1;
+        memcpy(&rd->buf[off], &data.block[1], len);
+      } // for blocks
+    } else if (msg->flags & I2C_M_RD) {
+      // a read from wherever the register pointer is, a byte at a time
+      for (off = 0; off < msg->len; off++) {
+        if (_PCA9685_smbus(fd, I2C_SMBUS_READ, 0, I2C_SMBUS_BYTE, &data, raw) < 0) return -1;
+        msg->buf[off] = data.byte;
+      } // for bytes
+    } else if (msg->len == 0) {
+      if (_PCA9685_smbus(fd, I2C_SMBUS_WRITE, 0, I2C_SMBUS_QUICK, NULL, raw) < 0) return -1;
+    } else if (msg->len == 1) {
+      // a register alone, or a general call command such as SWRST
+      if (_PCA9685_smbus(fd, I2C_SMBUS_WRITE, msg->buf[0], I2C_SMBUS_BYTE, NULL, raw) < 0) return -1;
+    } else {
+      // a register then data, as block writes from the register
+      for (off = 1; off < msg->len; off += I2C_SMBUS_BLOCK_MAX) {
+        len = (msg->len - off > I2C_SMBUS_BLOCK_MAX ? I2C_SMBUS_BLOCK_MAX : msg->len - off);
+        data.block[0] = len;
+        memcpy(&data.block[1], &msg->buf[off], len);
+        if (_PCA9685_smbus(fd, I2C_SMBUS_WRITE, msg->buf[0] + off - 1,
+                           I2C_SMBUS_I2C_BLOCK_DATA, &data, raw) < 0) return -1;
+      } // for blocks
+    } // if kind of message
+  } // for msgs
+  return 0;
+} // _PCA9685_transferSmbus
+
+
+
+/////////////////////////////////////////////////////////////////////
+// carry out an I2C_RDWR transaction on the transfer path of fd's adapter
+static int _PCA9685_transferPath(int fd, struct i2c_rdwr_ioctl_data* data, int raw) {
+  int path = PCA9685_getI2CPath(fd, NULL);
+  int ret;
+  unsigned int m;
+
+  if (path == PCA9685_I2CPATHSMBUS) {
+    // a signal handler puts back the slave of the transfer it interrupted
+    unsigned short slave = (fd >= 0 && fd < _PCA9685_I2CFDS ? _PCA9685_fdSlave[fd] : 0);
+    ret = _PCA9685_transferSmbus(fd, data->msgs, data->nmsgs, raw);
+    if (raw && slave && _PCA9685_fdSlave[fd] != slave) {
+      int savedErrno = errno;
+      ioctl(fd, I2C_SLAVE, INT2VOIDP(slave - 1));
+      _PCA9685_fdSlave[fd] = slave;
+      errno = savedErrno;
+    } // if raw
+    if (ret < 0) return -1;
+    // recorded as the messages, which the blocks carried out
+    PCA9685_recorder* rec = __atomic_load_n(&_PCA9685_RECORDER, __ATOMIC_ACQUIRE);
+    if (rec && !raw) _PCA9685_recAppend(rec, fd, (char *) data, data->nmsgs);
+    return data->nmsgs;
+  } // if SMBus
+
+  if (path == PCA9685_I2CPATHRDWR || data->nmsgs == 1) {
+    ret = _PCA9685_i2cCall(fd, I2C_RDWR, data, raw);
+    if (ret >= 0 || path != PCA9685_I2CPATHRDWR || data->nmsgs == 1 || errno != EOPNOTSUPP) {
+      return ret;
+    } // if done
+
+    // the adapter's quirks refuse combined messages, so it gets one at a
+    // time from now on
+    int adpt = (fd >= 0 && fd < _PCA9685_I2CFDS ? _PCA9685_fdAdpt[fd] - 1 : -1);
+    if (adpt >= 0 && !_PCA9685_i2cCaps[adpt].forced) {
+      __atomic_store_n(&_PCA9685_i2cCaps[adpt].path, PCA9685_I2CPATHSINGLE, __ATOMIC_RELAXED);
+      if (!raw) {
+        fprintf(stderr, "_PCA9685_transfer(): adapter %d takes one message per I2C_RDWR\n", adpt);
+      } // if
+    } // if adapter known
+  } // if combined
+
+  // one message per transaction, the register pointer carries a read
+  for (m = 0; m < data->nmsgs; m++) {
+    struct i2c_rdwr_ioctl_data one = { &data->msgs[m], 1 };
+    if (_PCA9685_i2cCall(fd, I2C_RDWR, &one, raw) < 0) return -1;
+  } // for msgs
+  return data->nmsgs;
+} // _PCA9685_transferPath
+
+
+
+/////////////////////////////////////////////////////////////////////
+// carry out an I2C_RDWR transaction on the transfer path of fd's adapter
+int _PCA9685_transfer(int fd, char *argp) {
+  return _PCA9685_transferPath(fd, (struct i2c_rdwr_ioctl_data*) argp, 0);
+} // _PCA9685_transfer
+
+
+
 /////////////////////////////////////////////////////////////////////
 // wrapper for ioctl()
 int _PCA9685_ioctl(int fd, unsigned long int request, char *argp) {
@@ -625,17 +1366,48 @@ int _PCA9685_ioctl(int fd, unsigned long int request, char *argp) {
     else if (request == I2C_SLAVE) {
       printf("_PCA9685_ioctl(): fd = %d request = SLAVE argp = %p\n", fd, argp);
     } // if SLAVE
+    else if (request == I2C_TIMEOUT) {
+      printf("_PCA9685_ioctl(): fd = %d request = TIMEOUT argp = %p\n", fd, argp);
+    } // if TIMEOUT
+    else if (request == I2C_RETRIES) {
+      printf("_PCA9685_ioctl(): fd = %d request = RETRIES argp = %p\n", fd, argp);
+    } // if RETRIES
+    else if (request == I2C_FUNCS) {
+      printf("_PCA9685_ioctl(): fd = %d request = FUNCS\n", fd);
+    } // if FUNCS
+    else if (request == I2C_SMBUS) {
+      struct i2c_smbus_ioctl_data *args = (struct i2c_smbus_ioctl_data *) argp;
+      printf("_PCA9685_ioctl(): fd = %d request = SMBUS read_write = %d command = 0x%02x size = %u",
+             fd, args->read_write, args->command, args->size);
+      if (args->read_write == I2C_SMBUS_WRITE && args->size == I2C_SMBUS_I2C_BLOCK_DATA) {
+        int j;
+        printf(" *block = ");
+        for (j = 1; j <= args->data->block[0]; j++) printf("0x%02x ", args->data->block[j]);
+      } // if block write
+      printf("\n");
+    } // if SMBUS
   } // if debug or test
 
-  if (_PCA9685_TEST) {
-    return 0;
-  } // if test
+  int ret = 0;
+  PCA9685_sim* sim = __atomic_load_n(&_PCA9685_SIM, __ATOMIC_ACQUIRE);
+  if (sim) {
+    ret = _PCA9685_simIoctl(sim, fd, request, argp);
+  } else if (!_PCA9685_TEST) {
+    ret = ioctl(fd, request, argp);
+    if (ret < 0) {
+      // callers tell a NACK from a timeout by errno
+      int savedErrno = errno;
+      fprintf(stderr, "_PCA9685_ioctl(): ioctl() returned %d: %s\n", ret, strerror(savedErrno));
+      errno = savedErrno;
+    } // if ret
+  } // if sim
+
+  // record the transaction as sent, with any read data
+  if (request == I2C_RDWR) {
+    PCA9685_recorder* rec = __atomic_load_n(&_PCA9685_RECORDER, __ATOMIC_ACQUIRE);
+    if (rec) _PCA9685_recAppend(rec, fd, argp, ret);
+  } // if RDWR
 
-  int ret;
-  ret = ioctl(fd, request, argp);
-  if (ret < 0) {
-    fprintf(stderr, "_PCA9685_ioctl(): ioctl() returned %d\n", ret);
-  } // if ret
   return ret;
 } // _PCA9685_ioctl
 
@@ -652,6 +1424,11 @@ int _PCA9685_open(const char *pathname, int flags) {
     return 0;
   } // if test
 
+  // a simulated bus still needs a real fd to close
+  if (__atomic_load_n(&_PCA9685_SIM, __ATOMIC_ACQUIRE)) {
+    pathname = "/dev/null";
+  } // if sim
+
   int ret = open(pathname, flags);
   if (ret < 0) {
     fprintf(stderr, "_PCA9685_open: open() returned %d\n", ret);
@@ -3,6 +3,7 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stdint.h>
 
 // debug and test flags
 extern bool _PCA9685_DEBUG;
@@ -12,6 +13,10 @@ extern bool _PCA9685_TEST;
 extern unsigned char _PCA9685_MODE1;
 extern unsigned char _PCA9685_MODE2;
 
+// emergency stop latch and count, for the engines
+extern int _PCA9685_EMERGENCY;
+extern unsigned int _PCA9685_EMERGENCIES;
+
 #ifndef _PCA9685_H
 #define _PCA9685_H
 
@@ -48,11 +53,17 @@ extern unsigned char _PCA9685_MODE2;
 #define _PCA9685_OCHBIT 	0x08
 #define _PCA9685_INVRTBIT	0x10
 
+// full ON or full OFF bit in LEDn_ON_H and LEDn_OFF_H
+#define _PCA9685_FULLBIT	0x10
+
 // control register value to initiate device reset
 #define _PCA9685_RESETVAL	0x06
 // control register address for i2c all call
 #define _PCA9685_GENCALLADDR	0x00
 
+// internal oscillator frequency in Hz
+#define _PCA9685_OSCFREQ	25000000.0f
+
 // PWM frequency limits
 #define _PCA9685_MAXFREQ	1526
 #define _PCA9685_MINFREQ	24
@@ -62,9 +73,101 @@ extern unsigned char _PCA9685_MODE2;
 #define _PCA9685_MAXVAL		0xFFF
 
 
-// open the I2C bus device and assign the default slave address
+// max messages in one I2C_RDWR transaction (I2C_RDWR_IOCTL_MAX_MSGS)
+#define _PCA9685_BATCHMSGS	42
+
+// max devices in one snapshot transaction (4 msgs each, kernel max 42)
+#define _PCA9685_SNAPDEVS	10
+
+// max devices PCA9685_emergencyOff() turns off
+#define _PCA9685_EMERGDEVS	128
+
+// I2C_TIMEOUT and I2C_RETRIES PCA9685_openI2C() sets on an adapter,
+// unless PCA9685_setI2CPolicy() chose others; adapters default to as
+// much as a second, for which a board holding SCL low stalls the bus
+#define _PCA9685_I2CTIMEOUTMS	100
+#define _PCA9685_I2CRETRIES	1
+
+// fds whose adapter's transfer path is kept, others use I2C_RDWR
+#define _PCA9685_I2CFDS		256
+
+// how transactions reach an adapter, fastest first
+#define PCA9685_I2CPATHAUTO	-1      // chosen from the adapter's I2C_FUNCS
+#define PCA9685_I2CPATHRDWR	0       // I2C_RDWR, every message of a transaction in one ioctl
+#define PCA9685_I2CPATHSINGLE	1       // I2C_RDWR, one message per ioctl
+#define PCA9685_I2CPATHSMBUS	2       // SMBus I2C block transfers of 32 bytes
+
+// bus costs assumed until PCA9685_calibrate() measures them, the
+// kernel's default 100 kHz SCL and an ioctl with START and STOP
+#define _PCA9685_BUSHZ		100000
+#define _PCA9685_BUSTXNS	20000.0
+
+// times each transaction length is timed when calibrating, the fastest counts
+#define _PCA9685_CALREPS	5
+
+// typed copy of every register used in a pca
+typedef struct PCA9685_snapshot {
+  unsigned char addr;                   // I2C address
+  unsigned char mode1;                  // MODE1 register
+  unsigned char mode2;                  // MODE2 register
+  unsigned char subAddr[3];             // SUBADR1 - SUBADR3 registers
+  unsigned char allCallAddr;            // ALLCALLADR register
+  unsigned int onVals[_PCA9685_CHANS];  // LEDn_ON registers
+  unsigned int offVals[_PCA9685_CHANS]; // LEDn_OFF registers
+  unsigned int allOn;                   // ALL_LED_ON registers
+  unsigned int allOff;                  // ALL_LED_OFF registers
+  unsigned char prescale;               // PRE_SCALE register
+} PCA9685_snapshot;
+
+// cost of transactions on a bus, measured by PCA9685_calibrate()
+typedef struct PCA9685_busCal {
+  double txNs;                          // fixed cost of a transaction, ioctl to STOP
+  double byteNs;                        // cost of a byte on the bus, addresses included
+  double sclHz;                         // effective SCL rate, 9 clocks per byte
+  double maxErrNs;                      // largest distance of a length's time from the fit
+  int samples;                          // transactions timed
+} PCA9685_busCal;
+
+
+// open the I2C bus device and assign the default slave address,
+// setting the adapter's I2C_TIMEOUT and I2C_RETRIES
 int PCA9685_openI2C(unsigned char adpt, unsigned char addr);
 
+// close an I2C bus device PCA9685_openI2C() opened, dropping its devices
+// from PCA9685_emergencyOff() before the fd number can be reused
+void PCA9685_closeI2C(int fd);
+
+// choose the I2C_TIMEOUT (rounded up to 10 ms, the kernel's unit) and
+// the I2C_RETRIES after lost arbitration that PCA9685_openI2C() sets on
+// an adapter; the timeout covers a whole transaction, so it must exceed
+// the longest batched frame on the bus
+int PCA9685_setI2CPolicy(unsigned char adpt, unsigned int timeoutMs, unsigned int retries);
+
+// the transfer path of the adapter fd was opened on, and the I2C_FUNCS
+// PCA9685_openI2C() read from it when funcs is not NULL
+int PCA9685_getI2CPath(int fd, unsigned long* funcs);
+
+// force an adapter's transfer path, or PCA9685_I2CPATHAUTO to choose it
+// from I2C_FUNCS again
+int PCA9685_setI2CPath(unsigned char adpt, int path);
+
+// name of a transfer path, for logs
+const char* PCA9685_i2cPathName(int path);
+
+// time reads and writes of 1 to 64 LED registers of a device, writing
+// back the values they hold, and fit the cost per transaction and per
+// byte of its adapter on the adapter's transfer path; the result is
+// kept for the adapter and copied to cal unless NULL
+int PCA9685_calibrate(int fd, unsigned char addr, PCA9685_busCal* cal);
+
+// the costs PCA9685_calibrate() measured on fd's adapter, returning 0,
+// or the nominal _PCA9685_BUSHZ costs, returning 1, if none were
+int PCA9685_getBusCal(int fd, PCA9685_busCal* cal);
+
+// ns a number of transactions carrying a number of bytes, addresses
+// included, take on fd's bus
+int64_t PCA9685_busCostNs(int fd, int transactions, int bytes);
+
 // initialize a pca device to defaults, turn off PWM's, and set the freq
 int PCA9685_initPWM(int fd, unsigned char addr, unsigned int freq);
 
@@ -95,17 +198,58 @@ int PCA9685_getPWMVal(int fd, unsigned char addr, unsigned char reg,
 // print out the values of all registers used in a pca
 int PCA9685_dumpAllRegs(int fd, unsigned char addr);
 
+// read every register used in a pca in one transaction
+int PCA9685_getSnapshot(int fd, unsigned char addr, PCA9685_snapshot* snap);
+
+// read every register used in count pcas on one bus, one transaction
+// per _PCA9685_SNAPDEVS devices
+int PCA9685_getSnapshots(int fd, int count, const unsigned char* addrs,
+                         PCA9685_snapshot* snaps);
+
+// turn every device PCA9685_initPWM() initialized fully off with the
+// ALL_LED registers, from transactions encoded at init, one ioctl per
+// bus (per _PCA9685_BATCHMSGS devices); async-signal-safe, so it is
+// what a SIGINT handler calls, and latches every engine off until
+// PCA9685_emergencyClear(); a transaction already on a bus finishes first
+int PCA9685_emergencyOff(void);
+
+// let the engines write again, each rewrites every register
+void PCA9685_emergencyClear(void);
+
 
 
 // set the PWM frequency
 int _PCA9685_setPWMFreq(int fd, unsigned char addr, unsigned int freq);
 
+// calculate the prescale register value for a PWM frequency
+unsigned char _PCA9685_calcPrescale(unsigned int freq);
+
+// PWM period in microseconds produced by a prescale register value
+float _PCA9685_prescaleToPeriod(unsigned char prescale);
+
+// encode the emergency stop transaction of a device, PCA9685_initPWM()
+// calls it for every device
+void _PCA9685_emergencyAdd(int fd, unsigned char addr);
+
+// drop the emergency stop transactions of the devices on a closed fd,
+// PCA9685_closeI2C() calls it
+void _PCA9685_emergencyRemove(int fd);
+
+// write the emergency stop transactions again without touching the
+// latch, for an engine whose transaction may have landed after them
+int _PCA9685_emergencyResend(void);
+
 // dump the contents of the LO registers (modes and PWM)
 int _PCA9685_dumpLoRegs(unsigned char* buf);
 
 // dump the contents of the last six registers
 int _PCA9685_dumpHiRegs(unsigned char* buf);
 
+// read the LO and HI registers of count pcas in one transaction
+int _PCA9685_readAllRegs(int fd, int count, const unsigned char* addrs,
+                         unsigned char (*loBufs)[_PCA9685_LOREGS],
+                         unsigned char (*hiBufs)[_PCA9685_HIREGS]);
+
 // read I2C bytes from a register at an address
 int _PCA9685_readI2CReg(int fd, unsigned char addr, unsigned char startReg,
             int len, unsigned char* readBuf);
@@ -118,6 +262,23 @@ int _PCA9685_writeI2CReg(int fd, unsigned char addr, unsigned char startReg,
 int _PCA9685_writeI2CRaw(int fd, unsigned char addr, int len,
                          unsigned char* writeBuf);
 
+// write I2C bytes to count addresses, one transaction per
+// _PCA9685_BATCHMSGS messages
+int _PCA9685_writeI2CBatch(int fd, int count, const unsigned char* addrs,
+                           const int* lens, unsigned char* const* bufs);
+
+// as _PCA9685_writeI2CBatch() with I2C msg flags per message, so
+// I2C_M_RD messages read into their bufs; NULL flags writes them all
+int _PCA9685_transferI2CBatch(int fd, int count, const unsigned char* addrs,
+                              const unsigned short* flags, const int* lens,
+                              unsigned char* const* bufs);
+
+// adapter number PCA9685_openI2C() opened fd on, -1 if unknown
+int _PCA9685_getAdapter(int fd);
+
+// carry out an I2C_RDWR transaction on the transfer path of fd's adapter
+int _PCA9685_transfer(int fd, char *argp);
+
 // wrapper for ioctl()
 int _PCA9685_ioctl(int fd, unsigned long int request, char *argp);
 
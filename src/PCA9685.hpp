@@ -0,0 +1,178 @@
+// header-only C++17/20 wrapper for libPCA9685
+#ifndef _PCA9685_HPP
+#define _PCA9685_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+#include <cerrno>
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#endif
+
+#include "PCA9685.h"
+
+namespace pca9685 {
+
+// number of channels and bytes of LED registers per device
+inline constexpr std::size_t chans = _PCA9685_CHANS;
+inline constexpr std::size_t ledBytes = _PCA9685_CHANS * 4;
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+// one frame of 12-bit OFF values, one per channel
+using frame = std::span<const std::uint16_t, chans>;
+#else
+// fixed-extent view of one frame for C++17 (no std::span)
+class frame {
+ public:
+  constexpr frame(const std::uint16_t (&vals)[chans]) noexcept : p_(vals) {}
+  constexpr frame(const std::array<std::uint16_t, chans>& vals) noexcept
+      : p_(vals.data()) {}
+  constexpr const std::uint16_t* data() const noexcept { return p_; }
+  constexpr std::size_t size() const noexcept { return chans; }
+  constexpr std::uint16_t operator[](std::size_t i) const noexcept { return p_[i]; }
+ private:
+  const std::uint16_t* p_;
+};
+#endif
+
+
+// register address of LEDn_ON_L
+constexpr std::uint8_t ledReg(std::size_t chan) noexcept {
+  return static_cast<std::uint8_t>(_PCA9685_BASEPWMREG + 4 * chan);
+}
+
+// prescale register value for a PWM frequency, same as _PCA9685_calcPrescale()
+constexpr std::uint8_t prescale(unsigned int freq) noexcept {
+  freq = (freq > _PCA9685_MAXFREQ ? _PCA9685_MAXFREQ
+                                  : (freq < _PCA9685_MINFREQ ? _PCA9685_MINFREQ : freq));
+  return static_cast<std::uint8_t>(_PCA9685_OSCFREQ / (4096.0f * freq) - 0.5f);
+}
+
+// PWM period in microseconds for a prescale register value
+constexpr float periodUs(std::uint8_t pre) noexcept {
+  return (pre + 1) * 4096.0f * 1000000.0f / _PCA9685_OSCFREQ;
+}
+
+static_assert(prescale(200) == 0x1e, "prescale must match the C library");
+static_assert(ledReg(15) == 0x42, "LED15_ON_L is 0x42");
+
+
+// encode N channels of one constant ON val and 16-bit OFF vals into registers
+template <std::size_t N, std::uint16_t On = 0>
+constexpr void encode(const std::uint16_t* off, std::uint8_t* regs) noexcept {
+  for (std::size_t i = 0; i < N; i++) {
+    regs[i*4+0] = On & 0xFF;
+    regs[i*4+1] = On >> 8;
+    regs[i*4+2] = off[i] & 0xFF;
+    regs[i*4+3] = off[i] >> 8;
+  }
+}
+
+// encode N channels of separate ON and OFF vals into registers
+template <std::size_t N>
+constexpr void encode(const std::uint16_t* on, const std::uint16_t* off,
+                      std::uint8_t* regs) noexcept {
+  for (std::size_t i = 0; i < N; i++) {
+    regs[i*4+0] = on[i] & 0xFF;
+    regs[i*4+1] = on[i] >> 8;
+    regs[i*4+2] = off[i] & 0xFF;
+    regs[i*4+3] = off[i] >> 8;
+  }
+}
+
+
+// RAII handle for one PCA9685 on an I2C adapter
+class Pca9685 {
+ public:
+  // open the adapter and initialize the device, throws std::system_error
+  // with the errno of the call that failed
+  Pca9685(unsigned char adpt, unsigned char addr, unsigned int freq) : addr_(addr) {
+    errno = 0;
+    fd_ = PCA9685_openI2C(adpt, addr);
+    if (fd_ < 0) {
+      throw std::system_error(error(), std::generic_category(), "PCA9685_openI2C");
+    }
+    errno = 0;
+    if (PCA9685_initPWM(fd_, addr_, freq) != 0) {
+      int err = error();
+      close();
+      throw std::system_error(err, std::generic_category(), "PCA9685_initPWM");
+    }
+    buf_[0] = _PCA9685_BASEPWMREG;
+  }
+
+  // turn every channel off and close the adapter
+  ~Pca9685() { release(); }
+
+  Pca9685(const Pca9685&) = delete;
+  Pca9685& operator=(const Pca9685&) = delete;
+
+  Pca9685(Pca9685&& other) noexcept
+      : fd_(other.fd_), addr_(other.addr_), buf_(other.buf_) {
+    other.fd_ = -1;
+  }
+
+  Pca9685& operator=(Pca9685&& other) noexcept {
+    if (this != &other) {
+      release();
+      fd_ = other.fd_;
+      addr_ = other.addr_;
+      buf_ = other.buf_;
+      other.fd_ = -1;
+    }
+    return *this;
+  }
+
+  // set every channel's OFF val with ON at zero in one transaction
+  int set(frame off) noexcept {
+    encode<chans>(off.data(), &buf_[1]);
+    return write();
+  }
+
+  // set every channel's ON and OFF vals in one transaction
+  int set(frame on, frame off) noexcept {
+    encode<chans>(on.data(), off.data(), &buf_[1]);
+    return write();
+  }
+
+  // set every channel with the ALL_LED registers
+  int setAll(unsigned int on, unsigned int off) noexcept {
+    return PCA9685_setAllPWM(fd_, addr_, on, off);
+  }
+
+  int fd() const noexcept { return fd_; }
+  unsigned char addr() const noexcept { return addr_; }
+
+ private:
+  int write() noexcept {
+    return _PCA9685_writeI2CRaw(fd_, addr_, static_cast<int>(buf_.size()), buf_.data());
+  }
+
+  void close() noexcept {
+    PCA9685_closeI2C(fd_);
+    fd_ = -1;
+  }
+
+  // turn every channel off and close the adapter, if still open
+  void release() noexcept {
+    if (fd_ >= 0) {
+      PCA9685_setAllPWM(fd_, addr_, _PCA9685_MINVAL, _PCA9685_MINVAL);
+      close();
+    }
+  }
+
+  // errno of the call that just failed, EIO if it set none
+  static int error() noexcept { return errno ? errno : EIO; }
+
+  int fd_;
+  unsigned char addr_;
+  // LED0_ON_L register address followed by the LED registers
+  std::array<std::uint8_t, 1 + ledBytes> buf_{};
+};
+
+} // namespace pca9685
+
+#endif
@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "PCA9685client.h"
+
+
+// one connection per process, like the one bus per adapter it replaces
+static PCA9685_client _PCA9685_client = {
+  .mode = PCA9685_CLIENTAUTO, .request = PCA9685_CLIENTAUTO, .name = _PCA9685_SHMNAME };
+
+
+
+/////////////////////////////////////////////////////////////////////
+// choose the segment name and mode before the first open
+int PCA9685_clientSetup(const char* name, int mode) {
+  PCA9685_client* c = &_PCA9685_client;
+  if (c->handles) {
+    fprintf(stderr, "PCA9685_clientSetup(): %d handles are open\n", c->handles);
+    return -1;
+  } // if
+  if (mode < PCA9685_CLIENTAUTO || mode > PCA9685_CLIENTDIRECT) {
+    fprintf(stderr, "PCA9685_clientSetup(): unknown mode %d\n", mode);
+    return -1;
+  } // if
+  snprintf(c->name, sizeof(c->name), "%s", (name ? name : _PCA9685_SHMNAME));
+  c->request = mode;
+  c->mode = mode;
+  return 0;
+} // PCA9685_clientSetup
+
+
+
+/////////////////////////////////////////////////////////////////////
+// the mode the handles use
+int PCA9685_clientMode(void) {
+  return _PCA9685_client.mode;
+} // PCA9685_clientMode
+
+
+
+/////////////////////////////////////////////////////////////////////
+// 1 if pca9685d serves the segment
+int PCA9685_clientDaemonRunning(void) {
+  PCA9685_shm* shm = PCA9685_shmAttach(_PCA9685_client.name);
+  if (shm == NULL) return 0;
+  int alive = PCA9685_shmDaemonAlive(shm);
+  PCA9685_shmClose(shm);
+  return alive;
+} // PCA9685_clientDaemonRunning
+
+
+
+/////////////////////////////////////////////////////////////////////
+// attach to the daemon's segment and claim a slot
+static int _PCA9685_clientAttach(PCA9685_client* c) {
+  PCA9685_shm* shm = PCA9685_shmAttach(c->name);
+  if (shm == NULL) return -1;
+  if (!PCA9685_shmDaemonAlive(shm)) {
+    PCA9685_shmClose(shm);
+    return -1;
+  } // if
+  int slot = PCA9685_shmClaim(shm);
+  if (slot < 0) {
+    PCA9685_shmClose(shm);
+    return -1;
+  } // if
+
+  // a segment of a daemon that stopped is orphaned, move to the new one
+  if (c->shm) {
+    PCA9685_shmClose(c->shm);
+    c->reattaches++;
+  } // if reattaching
+  c->shm = shm;
+  c->slot = slot;
+  return 0;
+} // _PCA9685_clientAttach
+
+
+
+/////////////////////////////////////////////////////////////////////
+// milliseconds on the monotonic clock
+static int64_t _PCA9685_clientNowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+} // _PCA9685_clientNowMs
+
+
+
+/////////////////////////////////////////////////////////////////////
+// publish the process's frame to the daemon
+static int _PCA9685_clientPublish(PCA9685_client* c) {
+  // a stopped daemon zeroes its pid and unlinks the segment, a killed
+  // one leaves its pid behind, so that is checked once in a while; follow
+  // a restarted one to its new segment, until then the frames go nowhere
+  int64_t nowMs = _PCA9685_clientNowMs();
+  if (!c->lost && __atomic_load_n(&c->shm->hdr->daemonPid, __ATOMIC_ACQUIRE) == 0) {
+    c->lost = 1;
+    c->checkMs = nowMs;
+  } // if daemon stopped
+  if (nowMs >= c->checkMs) {
+    c->checkMs = nowMs + _PCA9685_CLIENTCHECKMS;
+    if (!c->lost && !PCA9685_shmDaemonAlive(c->shm)) c->lost = 1;
+    if (c->lost && _PCA9685_clientAttach(c) == 0) c->lost = 0;
+  } // if check due
+  if (c->lost) {
+    c->dropped++;
+    return -1;
+  } // if daemon gone
+  PCA9685_shmPublish(c->shm, c->slot, &c->frame);
+  c->publishes++;
+  return 0;
+} // _PCA9685_clientPublish
+
+
+
+/////////////////////////////////////////////////////////////////////
+// the board a daemon handle and address name in the process's frame
+static PCA9685_shmBoard* _PCA9685_clientBoard(PCA9685_client* c, int fd, unsigned char addr) {
+  PCA9685_shmBoard* board = PCA9685_shmBoardFind(&c->frame, fd - _PCA9685_CLIENTFD, addr);
+  if (board == NULL) {
+    fprintf(stderr, "_PCA9685_clientBoard(): more than %d boards\n", _PCA9685_SHMBOARDS);
+  } // if
+  return board;
+} // _PCA9685_clientBoard
+
+
+
+/////////////////////////////////////////////////////////////////////
+// set one channel's LED registers in a board of the frame
+static void _PCA9685_clientSetChan(PCA9685_shmBoard* board, int chan,
+                                   unsigned int on, unsigned int off) {
+  board->regs[chan*4] = on & 0xFF;
+  board->regs[chan*4 + 1] = on >> 8;
+  board->regs[chan*4 + 2] = off & 0xFF;
+  board->regs[chan*4 + 3] = off >> 8;
+  board->mask |= 1 << chan;
+} // _PCA9685_clientSetChan
+
+
+
+/////////////////////////////////////////////////////////////////////
+// open an adapter through the daemon if it runs, else directly
+int PCA9685_clientOpenI2C(unsigned char adpt, unsigned char addr) {
+  PCA9685_client* c = &_PCA9685_client;
+  if (c->shm == NULL && c->request != PCA9685_CLIENTDIRECT) {
+    if (_PCA9685_clientAttach(c) == 0) {
+      c->mode = PCA9685_CLIENTDAEMON;
+    } else if (c->request == PCA9685_CLIENTDAEMON) {
+      fprintf(stderr, "PCA9685_clientOpenI2C(): pca9685d is not serving %s\n", c->name);
+      return -1;
+    } else {
+      c->mode = PCA9685_CLIENTDIRECT;
+    } // if attached
+    if (_PCA9685_DEBUG) {
+      printf("PCA9685_clientOpenI2C(): %s\n",
+             (c->mode == PCA9685_CLIENTDAEMON ? "through pca9685d" : "direct"));
+    }
+  } // if not attached
+
+  if (c->mode == PCA9685_CLIENTDIRECT) return PCA9685_openI2C(adpt, addr);
+  c->handles++;
+  return _PCA9685_CLIENTFD + adpt;
+} // PCA9685_clientOpenI2C
+
+
+
+/////////////////////////////////////////////////////////////////////
+// initialize a board directly, or have the daemon open it
+int PCA9685_clientInitPWM(int fd, unsigned char addr, unsigned int freq) {
+  if (fd < _PCA9685_CLIENTFD) return PCA9685_initPWM(fd, addr, freq);
+  PCA9685_client* c = &_PCA9685_client;
+  uint32_t daemonFreq = c->shm->hdr->freq;
+  if (daemonFreq && daemonFreq != freq) {
+    fprintf(stderr, "PCA9685_clientInitPWM(): pca9685d runs the boards at %u Hz, not %u Hz\n",
+            daemonFreq, freq);
+  } // if
+  if (_PCA9685_clientBoard(c, fd, addr) == NULL) return -1;
+  // no channels driven yet, but the daemon opens the board now
+  return _PCA9685_clientPublish(c);
+} // PCA9685_clientInitPWM
+
+
+
+/////////////////////////////////////////////////////////////////////
+// set all PWM channels of a board
+int PCA9685_clientSetPWMVals(int fd, unsigned char addr,
+                             unsigned int* onVals, unsigned int* offVals) {
+  if (fd < _PCA9685_CLIENTFD) return PCA9685_setPWMVals(fd, addr, onVals, offVals);
+  PCA9685_client* c = &_PCA9685_client;
+  PCA9685_shmBoard* board = _PCA9685_clientBoard(c, fd, addr);
+  if (board == NULL) return -1;
+  int i;
+  for (i = 0; i < _PCA9685_CHANS; i++) {
+    _PCA9685_clientSetChan(board, i, onVals[i], offVals[i]);
+  } // for chans
+  return _PCA9685_clientPublish(c);
+} // PCA9685_clientSetPWMVals
+
+
+
+/////////////////////////////////////////////////////////////////////
+// set one PWM channel of a board by its LEDn_ON_L register
+int PCA9685_clientSetPWMVal(int fd, unsigned char addr, unsigned char reg,
+                            unsigned int on, unsigned int off) {
+  if (fd < _PCA9685_CLIENTFD) return PCA9685_setPWMVal(fd, addr, reg, on, off);
+  if (reg == _PCA9685_ALLLEDREG) return PCA9685_clientSetAllPWM(fd, addr, on, off);
+  int chan = (reg - _PCA9685_BASEPWMREG) / 4;
+  if (reg < _PCA9685_BASEPWMREG || chan >= _PCA9685_CHANS || (reg - _PCA9685_BASEPWMREG) % 4) {
+    fprintf(stderr, "PCA9685_clientSetPWMVal(): reg %02x is not an LEDn_ON_L register\n", reg);
+    return -1;
+  } // if
+  PCA9685_client* c = &_PCA9685_client;
+  PCA9685_shmBoard* board = _PCA9685_clientBoard(c, fd, addr);
+  if (board == NULL) return -1;
+  _PCA9685_clientSetChan(board, chan, on, off);
+  return _PCA9685_clientPublish(c);
+} // PCA9685_clientSetPWMVal
+
+
+
+/////////////////////////////////////////////////////////////////////
+// set all PWM channels of a board to one ON and one OFF val
+int PCA9685_clientSetAllPWM(int fd, unsigned char addr,
+                            unsigned int on, unsigned int off) {
+  if (fd < _PCA9685_CLIENTFD) return PCA9685_setAllPWM(fd, addr, on, off);
+  PCA9685_client* c = &_PCA9685_client;
+  PCA9685_shmBoard* board = _PCA9685_clientBoard(c, fd, addr);
+  if (board == NULL) return -1;
+  int i;
+  for (i = 0; i < _PCA9685_CHANS; i++) {
+    _PCA9685_clientSetChan(board, i, on, off);
+  } // for chans
+  return _PCA9685_clientPublish(c);
+} // PCA9685_clientSetAllPWM
+
+
+
+/////////////////////////////////////////////////////////////////////
+// close a handle, the last one through the daemon releases the slot
+void PCA9685_clientClose(int fd) {
+  if (fd < _PCA9685_CLIENTFD) {
+    PCA9685_closeI2C(fd);
+    return;
+  } // if direct
+  PCA9685_client* c = &_PCA9685_client;
+  if (c->handles == 0 || --c->handles > 0) return;
+  PCA9685_shmRelease(c->shm, c->slot);
+  PCA9685_shmClose(c->shm);
+  c->shm = NULL;
+  c->lost = 0;
+  c->mode = c->request;
+  memset(&c->frame, 0, sizeof(c->frame));
+} // PCA9685_clientClose
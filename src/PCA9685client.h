@@ -0,0 +1,85 @@
+#ifndef _PCA9685CLIENT_H
+#define _PCA9685CLIENT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "PCA9685.h"
+#include "PCA9685shm.h"
+
+// handles of boards reached through pca9685d, above any fd the kernel
+// hands out, with the adapter number in the low bits
+#define _PCA9685_CLIENTFD	0x40000000
+
+// how often a publish checks that the daemon's process is still alive
+#define _PCA9685_CLIENTCHECKMS	1000
+
+// how a client reaches its boards
+#define PCA9685_CLIENTAUTO	0       // through pca9685d if it runs, else directly
+#define PCA9685_CLIENTDAEMON	1       // through pca9685d's shared memory
+#define PCA9685_CLIENTDIRECT	2       // through /dev/i2c-N
+
+// the process's connection to pca9685d
+typedef struct PCA9685_client {
+  int mode;                     // mode the handles use, request until the first open
+  int request;                  // mode asked for in PCA9685_clientSetup()
+  char name[64];                // segment name
+  PCA9685_shm* shm;             // segment, NULL in direct mode
+  int slot;                     // slot claimed in the segment
+  int handles;                  // handles open through the daemon
+  uint64_t publishes;           // frames published
+  uint64_t reattaches;          // segments of a restarted daemon attached
+  int lost;                     // 1 from a dead daemon until a new one is attached
+  uint64_t dropped;             // frames no live daemon was there to take
+  int64_t checkMs;              // monotonic time of the next liveness check
+  PCA9685_shmFrame frame;       // every board this process drives
+} PCA9685_client;
+
+
+// choose the segment name (NULL for _PCA9685_SHMNAME) and mode before
+// the first open; fails while handles are open
+int PCA9685_clientSetup(const char* name, int mode);
+
+// 1 if pca9685d serves the segment, for apps that write the buses
+// themselves (an engine, register reads, the emergency stop) and must
+// not run alongside it
+int PCA9685_clientDaemonRunning(void);
+
+// PCA9685_CLIENTDAEMON or PCA9685_CLIENTDIRECT once a handle was
+// opened, the mode asked for before
+int PCA9685_clientMode(void);
+
+// PCA9685_openI2C(), or a handle to the adapter through pca9685d; in
+// PCA9685_CLIENTAUTO mode each open tries the daemon until one attaches
+int PCA9685_clientOpenI2C(unsigned char adpt, unsigned char addr);
+
+// PCA9685_initPWM(), through pca9685d it only makes the daemon open
+// the board, which the daemon initializes at its own frequency
+int PCA9685_clientInitPWM(int fd, unsigned char addr, unsigned int freq);
+
+// PCA9685_setPWMVals(), through pca9685d it publishes every channel of
+// the board; one thread publishes for the whole process; a daemon that
+// stopped or died is noticed within _PCA9685_CLIENTCHECKMS, the frames
+// fail with -1 until a restarted one is attached
+int PCA9685_clientSetPWMVals(int fd, unsigned char addr,
+                             unsigned int* onVals, unsigned int* offVals);
+
+// PCA9685_setPWMVal(), through pca9685d it publishes one channel
+int PCA9685_clientSetPWMVal(int fd, unsigned char addr, unsigned char reg,
+                            unsigned int on, unsigned int off);
+
+// PCA9685_setAllPWM(), through pca9685d it publishes every channel
+int PCA9685_clientSetAllPWM(int fd, unsigned char addr,
+                            unsigned int on, unsigned int off);
+
+// close a handle, the last one through pca9685d releases the slot
+void PCA9685_clientClose(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1180 @@
+// for CPU_SET() and pthread_attr_setaffinity_np()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <linux/i2c.h>
+
+#include "PCA9685engine.h"
+
+// add to a counter only the writer updates; readers such as the metrics
+// exporter load it without a lock and never see a torn value
+#define _PCA9685_ENGINEADD(counter, n) \
+  __atomic_store_n(&(counter), (counter) + (n), __ATOMIC_RELAXED)
+
+// raise a max only the writer updates
+#define _PCA9685_ENGINEMAX(max, val) \
+  do { \
+    if ((val) > (max)) __atomic_store_n(&(max), (val), __ATOMIC_RELAXED); \
+  } while (0)
+
+
+/////////////////////////////////////////////////////////////////////
+// CLOCK_MONOTONIC in ns
+static int64_t _PCA9685_engineNowNs(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+} // _PCA9685_engineNowNs
+
+
+
+/////////////////////////////////////////////////////////////////////
+// count ns in a log2 microsecond histogram
+static void _PCA9685_engineHistAdd(uint64_t* hist, int64_t ns) {
+  int64_t us = ns / 1000;
+  int b = 0;
+  while (us > 0 && b < _PCA9685_ENGINEHIST - 1) {
+    us >>= 1;
+    b++;
+  } // while
+  _PCA9685_ENGINEADD(hist[b], 1);
+} // _PCA9685_engineHistAdd
+
+
+/////////////////////////////////////////////////////////////////////
+// create an engine ticking fps times per second
+PCA9685_engine* PCA9685_engineCreate(unsigned int fps) {
+  PCA9685_engine* engine = calloc(1, sizeof(PCA9685_engine));
+  if (engine == NULL) {
+    fprintf(stderr, "PCA9685_engineCreate(): calloc() failed\n");
+    return NULL;
+  } // if
+
+  engine->tickFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  engine->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (engine->tickFd < 0 || engine->eventFd < 0) {
+    fprintf(stderr, "PCA9685_engineCreate(): failed to create the tick or event fd\n");
+    PCA9685_engineDestroy(engine);
+    return NULL;
+  } // if
+
+  if (PCA9685_engineSetFps(engine, fps) != 0) {
+    fprintf(stderr, "PCA9685_engineCreate(): PCA9685_engineSetFps() failed\n");
+    PCA9685_engineDestroy(engine);
+    return NULL;
+  } // if
+  engine->probeEvery = _PCA9685_ENGINEPROBEEVERY;
+  engine->emergencies = __atomic_load_n(&_PCA9685_EMERGENCIES, __ATOMIC_ACQUIRE);
+
+  return engine;
+} // PCA9685_engineCreate
+
+
+
+/////////////////////////////////////////////////////////////////////
+// free an engine, the devices' fds stay open
+void PCA9685_engineDestroy(PCA9685_engine* engine) {
+  if (engine == NULL) return;
+  if (engine->tickFd > 0) close(engine->tickFd);
+  if (engine->eventFd > 0) close(engine->eventFd);
+  free(engine->dev);
+  free(engine->order);
+  free(engine->msgFds);
+  free(engine->msgAddrs);
+  free(engine->msgFlags);
+  free(engine->msgLens);
+  free(engine->msgBufs);
+  free(engine->msgDevs);
+  free(engine->msgRanks);
+  free(engine->deadband);
+  free(engine);
+} // PCA9685_engineDestroy
+
+
+
+/////////////////////////////////////////////////////////////////////
+// add a device initialized with PCA9685_initPWM(), returns its index
+int PCA9685_engineAdd(PCA9685_engine* engine, int fd, unsigned char addr) {
+  // the writer thread holds pointers into the arrays
+  if (engine->running) {
+    fprintf(stderr, "PCA9685_engineAdd(): the writer thread is running\n");
+    return -1;
+  } // if
+  int n = engine->devs + 1;
+  int maxMsgs = n * (_PCA9685_ENGINESPANS + _PCA9685_ENGINEPROBEMSGS);
+  PCA9685_engineDev* dev = realloc(engine->dev, n * sizeof(PCA9685_engineDev));
+  if (dev) engine->dev = dev;
+  int* order = realloc(engine->order, n * sizeof(int));
+  if (order) engine->order = order;
+  int* msgFds = realloc(engine->msgFds, maxMsgs * sizeof(int));
+  if (msgFds) engine->msgFds = msgFds;
+  unsigned char* msgAddrs = realloc(engine->msgAddrs, maxMsgs);
+  if (msgAddrs) engine->msgAddrs = msgAddrs;
+  unsigned short* msgFlags = realloc(engine->msgFlags, maxMsgs * sizeof(unsigned short));
+  if (msgFlags) engine->msgFlags = msgFlags;
+  int* msgLens = realloc(engine->msgLens, maxMsgs * sizeof(int));
+  if (msgLens) engine->msgLens = msgLens;
+  unsigned char** msgBufs = realloc(engine->msgBufs, maxMsgs * sizeof(unsigned char*));
+  if (msgBufs) engine->msgBufs = msgBufs;
+  int* msgDevs = realloc(engine->msgDevs, maxMsgs * sizeof(int));
+  if (msgDevs) engine->msgDevs = msgDevs;
+  PCA9685_engineRank* msgRanks = realloc(engine->msgRanks, maxMsgs * sizeof(PCA9685_engineRank));
+  if (msgRanks) engine->msgRanks = msgRanks;
+  if (!dev || !order || !msgFds || !msgAddrs || !msgFlags || !msgLens || !msgBufs || !msgDevs ||
+      !msgRanks) {
+    fprintf(stderr, "PCA9685_engineAdd(): realloc() failed\n");
+    return -1;
+  } // if
+  engine->maxMsgs = maxMsgs;
+
+  PCA9685_engineDev* d = &engine->dev[engine->devs];
+  memset(d, 0, sizeof(PCA9685_engineDev));
+  d->fd = fd;
+  d->addr = addr;
+  d->probeReg = _PCA9685_MODE1REG;
+  // the device registers are unknown until the first full write
+  d->full = 1;
+
+  // keep the config PCA9685_initPWM() left for re-initializing
+  PCA9685_snapshot snap;
+  if (PCA9685_getSnapshot(fd, addr, &snap) == 0) {
+    d->mode1 = snap.mode1 & ~_PCA9685_SLEEPBIT & ~_PCA9685_RESTARTBIT;
+    d->mode2 = snap.mode2;
+    d->prescale = snap.prescale;
+  } else {
+    // not answering yet, initialize it at the first flush with defaults
+    fprintf(stderr, "PCA9685_engineAdd(): PCA9685_getSnapshot() failed on addr %02x\n", addr);
+    d->mode1 = (_PCA9685_MODE1 | _PCA9685_AUTOINCBIT) &
+               ~_PCA9685_SLEEPBIT & ~_PCA9685_EXTCLKBIT & ~_PCA9685_RESTARTBIT;
+    d->mode2 = _PCA9685_MODE2;
+    d->prescale = 0x1E;
+    d->health.state = PCA9685_DEVFAILING;
+  } // if snapshot
+
+  // keep the devices of each bus together, in the order added
+  int i = engine->devs;
+  while (i > 0 && engine->dev[engine->order[i - 1]].fd > fd) {
+    engine->order[i] = engine->order[i - 1];
+    i--;
+  } // while
+  engine->order[i] = engine->devs;
+
+  return engine->devs++;
+} // PCA9685_engineAdd
+
+
+
+/////////////////////////////////////////////////////////////////////
+// change the frame tick rate
+int PCA9685_engineSetFps(PCA9685_engine* engine, unsigned int fps) {
+  if (fps == 0 || fps > 1000000) {
+    fprintf(stderr, "PCA9685_engineSetFps(): invalid fps %u\n", fps);
+    return -1;
+  } // if
+  // the writer thread computes lateness from the period and start
+  if (engine->running) {
+    fprintf(stderr, "PCA9685_engineSetFps(): the writer thread is running\n");
+    return -1;
+  } // if
+
+  struct itimerspec its;
+  its.it_interval.tv_sec = 0;
+  its.it_interval.tv_nsec = 1000000000 / fps;
+  if (fps == 1) {
+    its.it_interval.tv_sec = 1;
+    its.it_interval.tv_nsec = 0;
+  } // if
+  its.it_value = its.it_interval;
+  engine->startNs = _PCA9685_engineNowNs();
+  if (timerfd_settime(engine->tickFd, 0, &its, NULL) != 0) {
+    fprintf(stderr, "PCA9685_engineSetFps(): timerfd_settime() failed\n");
+    return -1;
+  } // if
+  engine->fps = fps;
+  engine->periodNs = (int64_t) its.it_interval.tv_sec * 1000000000 + its.it_interval.tv_nsec;
+  engine->expirations = 0;
+  return 0;
+} // PCA9685_engineSetFps
+
+
+
+/////////////////////////////////////////////////////////////////////
+// post a device's next ON and OFF vals to its latest-value mailbox
+int PCA9685_engineSubmit(PCA9685_engine* engine, int dev,
+                         const unsigned int* onVals, const unsigned int* offVals) {
+  if (dev < 0 || dev >= engine->devs) {
+    fprintf(stderr, "PCA9685_engineSubmit(): invalid device %d\n", dev);
+    return -1;
+  } // if
+  PCA9685_engineDev* d = &engine->dev[dev];
+
+  // seqlock: odd while writing so the writer retries a torn read
+  unsigned int seq = __atomic_load_n(&d->seq, __ATOMIC_RELAXED);
+  __atomic_store_n(&d->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  int i;
+  for (i = 0; i < _PCA9685_CHANS; i++) {
+    unsigned int on = (onVals ? onVals[i] : 0);
+    d->mail[i*4+0] = on & 0xFF;
+    d->mail[i*4+1] = on >> 8;
+    d->mail[i*4+2] = offVals[i] & 0xFF;
+    d->mail[i*4+3] = offVals[i] >> 8;
+  } // for chans
+  __atomic_store_n(&d->seq, seq + 2, __ATOMIC_RELEASE);
+
+  __atomic_fetch_add(&engine->submits, 1, __ATOMIC_RELAXED);
+  return 0;
+} // PCA9685_engineSubmit
+
+
+
+/////////////////////////////////////////////////////////////////////
+// timerfd to poll for reading, readable when a frame tick is due
+int PCA9685_engineTickFd(PCA9685_engine* engine) {
+  return engine->tickFd;
+} // PCA9685_engineTickFd
+
+
+
+/////////////////////////////////////////////////////////////////////
+// eventfd to poll for reading, counts the ticks serviced
+int PCA9685_engineEventFd(PCA9685_engine* engine) {
+  return engine->eventFd;
+} // PCA9685_engineEventFd
+
+
+
+/////////////////////////////////////////////////////////////////////
+// end of the span from the changed reg i, extended while the next
+// change is within _PCA9685_ENGINEGAP
+static int _PCA9685_engineSpanEnd(const unsigned char* regs, const unsigned char* prev, int i) {
+  int end = i + 1;
+  while (end < _PCA9685_ENGINEREGS) {
+    int next = end;
+    while (next < _PCA9685_ENGINEREGS && regs[next] == prev[next]) next++;
+    if (next == _PCA9685_ENGINEREGS || next - end > _PCA9685_ENGINEGAP) break;
+    end = next + 1;
+  } // while extending
+  return end;
+} // _PCA9685_engineSpanEnd
+
+
+
+/////////////////////////////////////////////////////////////////////
+// message bytes the changed regs take as spans, and the spans in msgs
+static int _PCA9685_engineSpanBytes(const unsigned char* regs, const unsigned char* prev,
+                                    int* msgs) {
+  int bytes = 0;
+  int i = 0;
+  *msgs = 0;
+  while (i < _PCA9685_ENGINEREGS) {
+    if (regs[i] == prev[i]) {
+      i++;
+      continue;
+    } // if unchanged
+    int end = _PCA9685_engineSpanEnd(regs, prev, i);
+    bytes += 1 + end - i;
+    (*msgs)++;
+    i = end;
+  } // while regs
+  return bytes;
+} // _PCA9685_engineSpanBytes
+
+
+
+/////////////////////////////////////////////////////////////////////
+// keep the device's values in next for the channels whose change is
+// within the deadband, so they stay clean until the change grows
+static void _PCA9685_engineDeadband(PCA9685_engine* engine, PCA9685_engineDev* d) {
+  unsigned char submitted[_PCA9685_ENGINEREGS];
+  memcpy(submitted, d->next, sizeof(submitted));
+  int changed = 0;
+  int held = 0;
+  int i;
+  for (i = 0; i < _PCA9685_CHANS; i++) {
+    unsigned char* next = &d->next[i*4];
+    const unsigned char* prev = &d->shadow[i*4];
+    if (memcmp(next, prev, 4) == 0) continue;
+    changed++;
+    int on = next[0] | (next[1] << 8);
+    int off = next[2] | (next[3] << 8);
+    int prevOn = prev[0] | (prev[1] << 8);
+    int prevOff = prev[2] | (prev[3] << 8);
+    if (((on ^ prevOn) | (off ^ prevOff)) & ~_PCA9685_MAXVAL) continue;
+    if (off == 0) continue;
+    int least = engine->deadband[prevOff & _PCA9685_MAXVAL];
+    if (abs(on - prevOn) >= least || abs(off - prevOff) >= least) continue;
+    memcpy(next, prev, 4);
+    held++;
+  } // for chans
+  if (held == 0) return;
+  _PCA9685_ENGINEADD(engine->deadbanded, held);
+  if (held == changed) _PCA9685_ENGINEADD(engine->deadbandFrames, 1);
+
+  // the bus traffic saved, the spans of the frame as submitted against
+  // the spans that are left
+  int msgs, heldMsgs;
+  int bytes = _PCA9685_engineSpanBytes(submitted, d->shadow, &msgs);
+  bytes -= _PCA9685_engineSpanBytes(d->next, d->shadow, &heldMsgs);
+  _PCA9685_ENGINEADD(engine->deadbandBytes, bytes);
+  _PCA9685_ENGINEADD(engine->deadbandMsgs, msgs - heldMsgs);
+} // _PCA9685_engineDeadband
+
+
+
+/////////////////////////////////////////////////////////////////////
+// copy a device's mailbox into next if the app posted a new frame; the
+// writer never waits on the app, a mailbox caught mid-submit is left
+// for the next flush and the device goes out with its previous frame
+static void _PCA9685_engineTake(PCA9685_engine* engine, PCA9685_engineDev* d) {
+  unsigned int seq = __atomic_load_n(&d->seq, __ATOMIC_ACQUIRE);
+  if (seq == d->taken || (seq & 1)) return;
+
+  unsigned char regs[_PCA9685_ENGINEREGS];
+  memcpy(regs, d->mail, sizeof(regs));
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&d->seq, __ATOMIC_RELAXED) != seq) return;
+
+  // every submit bumps seq by two, all but the newest were replaced
+  _PCA9685_ENGINEADD(engine->coalesced, (seq - d->taken) / 2 - 1);
+  d->taken = seq;
+  memcpy(d->next, regs, sizeof(regs));
+  if (engine->deadband && !d->full) _PCA9685_engineDeadband(engine, d);
+} // _PCA9685_engineTake
+
+
+
+/////////////////////////////////////////////////////////////////////
+// count of a channel's ON and OFF change, full bits included
+static int _PCA9685_engineError(const unsigned char* regs, const unsigned char* prev, int chan) {
+  const unsigned char* r = &regs[chan*4];
+  const unsigned char* p = &prev[chan*4];
+  return abs((r[0] | (r[1] << 8)) - (p[0] | (p[1] << 8))) +
+         abs((r[2] | (r[3] << 8)) - (p[2] | (p[3] << 8)));
+} // _PCA9685_engineError
+
+
+
+/////////////////////////////////////////////////////////////////////
+// queue one device's changed LED regs as span messages, ranked by the
+// error and age of the changes they carry
+static void _PCA9685_engineSpans(PCA9685_engine* engine, int dev, int64_t nowNs) {
+  PCA9685_engineDev* d = &engine->dev[dev];
+  const unsigned char* regs = d->next;
+  const unsigned char* prev = d->shadow;
+  int c;
+  for (c = 0; c < _PCA9685_CHANS; c++) {
+    int pending = (memcmp(&regs[c*4], &prev[c*4], 4) != 0);
+    if (pending && d->pendingNs[c] == 0) {
+      __atomic_store_n(&d->pendingNs[c], nowNs, __ATOMIC_RELAXED);
+    } else if (!pending && d->pendingNs[c]) {
+      __atomic_store_n(&d->pendingNs[c], 0, __ATOMIC_RELAXED);
+    } // if
+  } // for chans
+
+  int spans = 0;
+  int i = 0;
+  while (i < _PCA9685_ENGINEREGS) {
+    if (!d->full && regs[i] == prev[i]) {
+      i++;
+      continue;
+    } // if unchanged
+
+    int start = i;
+    int end = (d->full ? _PCA9685_ENGINEREGS : _PCA9685_engineSpanEnd(regs, prev, i));
+
+    unsigned char* buf = d->tx[spans++];
+    buf[0] = _PCA9685_BASEPWMREG + start;
+    memcpy(&buf[1], &regs[start], end - start);
+    int m = engine->msgs++;
+    engine->msgFds[m] = d->fd;
+    engine->msgAddrs[m] = d->addr;
+    engine->msgFlags[m] = 0;
+    engine->msgLens[m] = 1 + end - start;
+    engine->msgBufs[m] = buf;
+    engine->msgDevs[m] = dev;
+    engine->msgRanks[m].msg = m;
+    engine->msgRanks[m].score = INT64_MAX;
+    if (!d->full) {
+      int64_t score = 0;
+      for (c = start / 4; c <= (end - 1) / 4; c++) {
+        if (d->pendingNs[c] == 0) continue;
+        score += _PCA9685_engineError(regs, prev, c) +
+                 (nowNs - d->pendingNs[c]) / engine->periodNs * _PCA9685_ENGINEAGECOUNTS;
+      } // for chans
+      engine->msgRanks[m].score = score;
+    } // if
+    i = end;
+  } // while regs
+} // _PCA9685_engineSpans
+
+
+
+/////////////////////////////////////////////////////////////////////
+// queue a combined read of one device's MODE1 after its spans
+static void _PCA9685_engineProbe(PCA9685_engine* engine, int dev) {
+  PCA9685_engineDev* d = &engine->dev[dev];
+  int m = engine->msgs;
+  engine->msgFds[m] = engine->msgFds[m + 1] = d->fd;
+  engine->msgAddrs[m] = engine->msgAddrs[m + 1] = d->addr;
+  engine->msgDevs[m] = engine->msgDevs[m + 1] = dev;
+  engine->msgFlags[m] = 0;
+  engine->msgLens[m] = 1;
+  engine->msgBufs[m] = &d->probeReg;
+  engine->msgFlags[m + 1] = I2C_M_RD;
+  engine->msgLens[m + 1] = 1;
+  engine->msgBufs[m + 1] = &d->probeVal;
+  engine->msgRanks[m].msg = m;
+  engine->msgRanks[m + 1].msg = m + 1;
+  engine->msgRanks[m].score = engine->msgRanks[m + 1].score = INT64_MAX;
+  engine->msgs += _PCA9685_ENGINEPROBEMSGS;
+} // _PCA9685_engineProbe
+
+
+
+/////////////////////////////////////////////////////////////////////
+// highest score first
+static int _PCA9685_engineRankCmp(const void* a, const void* b) {
+  int64_t sa = ((const PCA9685_engineRank*) a)->score;
+  int64_t sb = ((const PCA9685_engineRank*) b)->score;
+  return (sa < sb) - (sa > sb);
+} // _PCA9685_engineRankCmp
+
+
+
+/////////////////////////////////////////////////////////////////////
+// ns a message of len bytes adds to a transaction on its transfer path
+static int64_t _PCA9685_engineMsgNs(int fd, int path, int len) {
+  if (path == PCA9685_I2CPATHSINGLE) return PCA9685_busCostNs(fd, 1, 1 + len);
+  if (path == PCA9685_I2CPATHSMBUS) {
+    // blocks of at most 32, each with its own address and register
+    int blocks = (len + 30) / 32;
+    if (blocks < 1) blocks = 1;
+    return PCA9685_busCostNs(fd, blocks, len - 1 + 2 * blocks);
+  } // if
+  // the batch's transaction shared by _PCA9685_BATCHMSGS messages
+  return PCA9685_busCostNs(fd, 0, 1 + len) + PCA9685_busCostNs(fd, 1, 0) / _PCA9685_BATCHMSGS;
+} // _PCA9685_engineMsgNs
+
+
+
+/////////////////////////////////////////////////////////////////////
+// keep the messages of each bus that fit the budget, best ranked first,
+// and hold the others over to a later flush
+static void _PCA9685_engineSchedule(PCA9685_engine* engine, int64_t budgetNs) {
+  int kept = 0;
+  int first = 0;
+  while (first < engine->msgs) {
+    int fd = engine->msgFds[first];
+    int last = first + 1;
+    while (last < engine->msgs && engine->msgFds[last] == fd) last++;
+    int path = PCA9685_getI2CPath(fd, NULL);
+    int64_t totalNs = 0;
+    int m;
+    for (m = first; m < last; m++) {
+      totalNs += _PCA9685_engineMsgNs(fd, path, engine->msgLens[m]);
+    } // for msgs
+
+    if (totalNs > budgetNs) {
+      qsort(&engine->msgRanks[first], last - first, sizeof(PCA9685_engineRank),
+            _PCA9685_engineRankCmp);
+      int64_t usedNs = 0;
+      int r;
+      for (r = first; r < last; r++) {
+        int msg = engine->msgRanks[r].msg;
+        int64_t ns = _PCA9685_engineMsgNs(fd, path, engine->msgLens[msg]);
+        if (engine->msgRanks[r].score == INT64_MAX || r == first || usedNs + ns <= budgetNs) {
+          usedNs += ns;
+        } else {
+          // a zero length marks the message held over
+          engine->msgLens[msg] = 0;
+          _PCA9685_ENGINEADD(engine->deferred, 1);
+        } // if fits
+      } // for ranks
+    } // if over budget
+
+    // compact the kept messages, in their bus order
+    for (m = first; m < last; m++) {
+      if (engine->msgLens[m] == 0) continue;
+      engine->msgFds[kept] = engine->msgFds[m];
+      engine->msgAddrs[kept] = engine->msgAddrs[m];
+      engine->msgFlags[kept] = engine->msgFlags[m];
+      engine->msgLens[kept] = engine->msgLens[m];
+      engine->msgBufs[kept] = engine->msgBufs[m];
+      engine->msgDevs[kept] = engine->msgDevs[m];
+      kept++;
+    } // for msgs
+    first = last;
+  } // while buses
+  engine->msgs = kept;
+} // _PCA9685_engineSchedule
+
+
+
+/////////////////////////////////////////////////////////////////////
+// copy a written span into the shadow and note how long its channels'
+// changes waited
+static void _PCA9685_engineWritten(PCA9685_engine* engine, PCA9685_engineDev* d,
+                                   const unsigned char* buf, int len, int64_t nowNs) {
+  int start = buf[0] - _PCA9685_BASEPWMREG;
+  memcpy(&d->shadow[start], &buf[1], len - 1);
+  d->full = 0;
+  int c;
+  for (c = start / 4; c <= (start + len - 2) / 4; c++) {
+    if (d->pendingNs[c] == 0 || memcmp(&d->next[c*4], &d->shadow[c*4], 4) != 0) continue;
+    int64_t staleNs = nowNs - d->pendingNs[c];
+    _PCA9685_ENGINEMAX(d->health.maxStaleNs, staleNs);
+    _PCA9685_ENGINEMAX(engine->maxStaleNs, staleNs);
+    __atomic_store_n(&d->pendingNs[c], 0, __ATOMIC_RELAXED);
+  } // for chans
+} // _PCA9685_engineWritten
+
+
+
+/////////////////////////////////////////////////////////////////////
+// transfer messages first to last of one bus, updating the shadows if ok
+static int _PCA9685_engineWrite(PCA9685_engine* engine, int first, int last) {
+  int64_t startNs = _PCA9685_engineNowNs();
+  int ret = _PCA9685_transferI2CBatch(engine->msgFds[first], last - first,
+                                      &engine->msgAddrs[first], &engine->msgFlags[first],
+                                      &engine->msgLens[first], &engine->msgBufs[first]);
+  int64_t endNs = _PCA9685_engineNowNs();
+  int64_t txNs = endNs - startNs;
+  _PCA9685_ENGINEADD(engine->txs, 1);
+  _PCA9685_ENGINEADD(engine->txSumNs, txNs);
+  _PCA9685_ENGINEMAX(engine->txMaxNs, txNs);
+  _PCA9685_engineHistAdd(engine->txHist, txNs);
+  int i;
+  for (i = first; i < last; i++) {
+    _PCA9685_ENGINEMAX(engine->dev[engine->msgDevs[i]].health.maxTxNs, txNs);
+  } // for msgs
+  if (ret != 0) {
+    _PCA9685_ENGINEADD(engine->txErrors, 1);
+    if (errno == ETIMEDOUT) _PCA9685_ENGINEADD(engine->txTimeouts, 1);
+    return -1;
+  } // if
+  for (i = first; i < last; i++) {
+    PCA9685_engineDev* d = &engine->dev[engine->msgDevs[i]];
+    if (engine->msgFlags[i] & I2C_M_RD) {
+      d->probed = 1;
+    } else if (engine->msgBufs[i] != &d->probeReg) {
+      _PCA9685_engineWritten(engine, d, engine->msgBufs[i], engine->msgLens[i], endNs);
+    } // if
+    _PCA9685_ENGINEADD(engine->msgsSent, 1);
+    _PCA9685_ENGINEADD(engine->bytesSent, engine->msgLens[i]);
+  } // for msgs
+  return 0;
+} // _PCA9685_engineWrite
+
+
+
+/////////////////////////////////////////////////////////////////////
+// mark a device failing and back off its next retry exponentially, a
+// timed out device at least a second so it stalls its bus rarely
+static void _PCA9685_engineFail(PCA9685_engine* engine, int dev, int64_t nowNs) {
+  PCA9685_engineDev* d = &engine->dev[dev];
+  PCA9685_devHealth* h = &d->health;
+  int timedOut = (errno == ETIMEDOUT);
+  int64_t backoffNs = h->backoffNs * 2;
+  if (backoffNs < _PCA9685_ENGINEBACKOFFMIN) backoffNs = _PCA9685_ENGINEBACKOFFMIN;
+  if (timedOut && backoffNs < _PCA9685_ENGINEBACKOFFHUNG) backoffNs = _PCA9685_ENGINEBACKOFFHUNG;
+  if (backoffNs > _PCA9685_ENGINEBACKOFFMAX) backoffNs = _PCA9685_ENGINEBACKOFFMAX;
+  if (h->state == PCA9685_DEVOK) {
+    fprintf(stderr, "PCA9685_engineFlush(): device %d on fd %d addr %02x %s\n",
+            dev, d->fd, d->addr, (timedOut ? "timed out" : "failing"));
+  } // if newly failing
+
+  // part of a span may have landed, and a power cycle loses everything
+  d->full = 1;
+  __atomic_store_n(&h->fails, h->fails + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->errors, h->errors + 1, __ATOMIC_RELAXED);
+  if (timedOut) __atomic_store_n(&h->timeouts, h->timeouts + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->backoffNs, backoffNs, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->retryNs, nowNs + backoffNs, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->state, PCA9685_DEVFAILING, __ATOMIC_RELEASE);
+} // _PCA9685_engineFail
+
+
+
+/////////////////////////////////////////////////////////////////////
+// retry a failing device, restoring the config it had when added
+static int _PCA9685_engineReinit(PCA9685_engine* engine, int dev, int64_t nowNs) {
+  PCA9685_engineDev* d = &engine->dev[dev];
+
+  // PRE_SCALE is only writable while asleep, as in _PCA9685_setPWMFreq()
+  unsigned char sleep[2] = { _PCA9685_MODE1REG, d->mode1 | _PCA9685_SLEEPBIT };
+  unsigned char prescale[2] = { _PCA9685_PRESCALEREG, d->prescale };
+  unsigned char modes[3] = { _PCA9685_MODE1REG, d->mode1, d->mode2 };
+  unsigned char addrs[3] = { d->addr, d->addr, d->addr };
+  int lens[3] = { 2, 2, 3 };
+  unsigned char* bufs[3] = { sleep, prescale, modes };
+  if (_PCA9685_writeI2CBatch(d->fd, 3, addrs, lens, bufs) != 0) {
+    _PCA9685_engineFail(engine, dev, nowNs);
+    return -1;
+  } // if
+
+  // the LED regs follow in this frame, in full from the shadow
+  PCA9685_devHealth* h = &d->health;
+  if (h->fails) {
+    fprintf(stderr, "PCA9685_engineFlush(): device %d on fd %d addr %02x recovered\n",
+            dev, d->fd, d->addr);
+    __atomic_store_n(&h->recoveries, h->recoveries + 1, __ATOMIC_RELAXED);
+  } // if
+  d->full = 1;
+  __atomic_store_n(&h->fails, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->backoffNs, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->state, PCA9685_DEVOK, __ATOMIC_RELEASE);
+  return 0;
+} // _PCA9685_engineReinit
+
+
+
+/////////////////////////////////////////////////////////////////////
+// re-initialize a device found reset and rewrite its shadow registers
+static int _PCA9685_engineRestore(PCA9685_engine* engine, int dev, int64_t nowNs) {
+  PCA9685_engineDev* d = &engine->dev[dev];
+  PCA9685_devHealth* h = &d->health;
+  fprintf(stderr, "PCA9685_engineFlush(): device %d on fd %d addr %02x reset, MODE1 %02x\n",
+          dev, d->fd, d->addr, d->probeVal);
+  __atomic_store_n(&h->resets, h->resets + 1, __ATOMIC_RELAXED);
+  if (_PCA9685_engineReinit(engine, dev, nowNs) != 0) return -1;
+
+  unsigned char* buf = d->tx[0];
+  int len = 1 + _PCA9685_ENGINEREGS;
+  buf[0] = _PCA9685_BASEPWMREG;
+  memcpy(&buf[1], d->shadow, _PCA9685_ENGINEREGS);
+  if (_PCA9685_writeI2CBatch(d->fd, 1, &d->addr, &len, &buf) != 0) {
+    _PCA9685_engineFail(engine, dev, nowNs);
+    return -1;
+  } // if
+  d->full = 0;
+  _PCA9685_ENGINEADD(engine->msgsSent, 1);
+  _PCA9685_ENGINEADD(engine->bytesSent, len);
+  return 0;
+} // _PCA9685_engineRestore
+
+
+
+/////////////////////////////////////////////////////////////////////
+// 1 if PCA9685_emergencyOff() ran since the flush started; a
+// transaction of ours may have reached a bus after its full-off, so
+// the full-off goes out again behind it
+static int _PCA9685_engineStopped(PCA9685_engine* engine) {
+  if (__atomic_load_n(&_PCA9685_EMERGENCIES, __ATOMIC_ACQUIRE) == engine->emergencies) return 0;
+  if (__atomic_load_n(&_PCA9685_EMERGENCY, __ATOMIC_ACQUIRE)) _PCA9685_emergencyResend();
+  return 1;
+} // _PCA9685_engineStopped
+
+
+
+/////////////////////////////////////////////////////////////////////
+// write the changed registers of every device now, without a tick
+int PCA9685_engineFlush(PCA9685_engine* engine) {
+  int ret = 0;
+  int64_t nowNs = _PCA9685_engineNowNs();
+  int i;
+
+  // an emergency stop holds every frame back until it is cleared, and
+  // left the registers behind the shadows
+  unsigned int emergencies = __atomic_load_n(&_PCA9685_EMERGENCIES, __ATOMIC_ACQUIRE);
+  if (emergencies != engine->emergencies) {
+    for (i = 0; i < engine->devs; i++) engine->dev[i].full = 1;
+    engine->emergencies = emergencies;
+  } // if emergency stopped
+  if (__atomic_load_n(&_PCA9685_EMERGENCY, __ATOMIC_ACQUIRE)) return 0;
+  _PCA9685_ENGINEADD(engine->flushes, 1);
+
+  // devices in fd order so each bus gets contiguous messages
+  engine->msgs = 0;
+  for (i = 0; i < engine->devs; i++) {
+    int dev = engine->order[i];
+    PCA9685_engineDev* d = &engine->dev[dev];
+    _PCA9685_engineTake(engine, d);
+    if (__atomic_exchange_n(&d->refresh, 0, __ATOMIC_RELAXED)) d->full = 1;
+    // failing devices sit out their backoff, then get one retry
+    if (d->health.state == PCA9685_DEVFAILING) {
+      if (nowNs < d->health.retryNs) continue;
+      if (_PCA9685_engineStopped(engine)) return 0;
+      if (_PCA9685_engineReinit(engine, dev, nowNs) != 0) {
+        ret = -1;
+        continue;
+      } // if
+    } // if failing
+    _PCA9685_engineSpans(engine, dev, nowNs);
+    // devices take turns so the probes spread over the flushes
+    if (engine->probeEvery && (engine->flushes + dev) % engine->probeEvery == 0) {
+      _PCA9685_engineProbe(engine, dev);
+    } // if probe due
+  } // for devices
+  int64_t budgetNs = __atomic_load_n(&engine->budgetNs, __ATOMIC_RELAXED);
+  if (budgetNs > 0) _PCA9685_engineSchedule(engine, budgetNs);
+
+  // one batched transaction per bus, split where the adapter would
+  // split it anyway so the latch is checked between the parts
+  int first = 0;
+  while (first < engine->msgs) {
+    int last = first + 1;
+    while (last < engine->msgs && engine->msgFds[last] == engine->msgFds[first] &&
+           last - first < _PCA9685_BATCHMSGS) {
+      last++;
+    } // while same bus
+    // every transaction re-checks the latch, the next flush starts over
+    if (_PCA9685_engineStopped(engine)) return 0;
+    if (_PCA9685_engineWrite(engine, first, last) != 0) {
+      // the adapter stops at the first NACK, so find the failing
+      // devices one at a time and let the rest of the bus carry on
+      int m = first;
+      while (m < last) {
+        int end = m + 1;
+        while (end < last && engine->msgDevs[end] == engine->msgDevs[m]) end++;
+        if (_PCA9685_engineStopped(engine)) return 0;
+        if (_PCA9685_engineWrite(engine, m, end) != 0) {
+          _PCA9685_engineFail(engine, engine->msgDevs[m], nowNs);
+          ret = -1;
+        } // if
+        m = end;
+      } // while devices
+    } // if batch failed
+    first = last;
+  } // while buses
+
+  // a MODE1 that differs from the one restored means a reset
+  for (i = 0; i < engine->devs; i++) {
+    PCA9685_engineDev* d = &engine->dev[i];
+    if (!d->probed) continue;
+    d->probed = 0;
+    _PCA9685_ENGINEADD(engine->probes, 1);
+    if ((d->probeVal & ~_PCA9685_RESTARTBIT) != d->mode1) {
+      if (_PCA9685_engineStopped(engine)) return 0;
+      if (_PCA9685_engineRestore(engine, i, nowNs) != 0) ret = -1;
+    } // if reset
+  } // for devices
+
+  if (_PCA9685_engineStopped(engine)) return 0;
+  if (engine->msgs) _PCA9685_ENGINEADD(engine->frames, 1);
+  return ret;
+} // PCA9685_engineFlush
+
+
+
+/////////////////////////////////////////////////////////////////////
+// probe each device's MODE1 every so many flushes, 0 for never
+int PCA9685_engineSetProbe(PCA9685_engine* engine, unsigned int every) {
+  engine->probeEvery = every;
+  return 0;
+} // PCA9685_engineSetProbe
+
+
+
+/////////////////////////////////////////////////////////////////////
+// hold back channel changes smaller than counts or perceptual
+int PCA9685_engineSetDeadband(PCA9685_engine* engine, unsigned int counts, double perceptual) {
+  if (engine->running) {
+    fprintf(stderr, "PCA9685_engineSetDeadband(): the writer thread is running\n");
+    return -1;
+  } // if
+  if (counts > _PCA9685_MAXVAL || !(perceptual >= 0 && perceptual <= 1)) {
+    fprintf(stderr, "PCA9685_engineSetDeadband(): invalid counts %u or perceptual %g\n",
+            counts, perceptual);
+    return -1;
+  } // if
+  free(engine->deadband);
+  engine->deadband = NULL;
+  if (counts == 0 && perceptual == 0) return 0;
+
+  // the count step one perceptual step up from each OFF count, small
+  // near black where the eye is most sensitive
+  engine->deadband = malloc((_PCA9685_MAXVAL + 1) * sizeof(unsigned short));
+  if (engine->deadband == NULL) {
+    fprintf(stderr, "PCA9685_engineSetDeadband(): malloc() failed\n");
+    return -1;
+  } // if
+  int v;
+  for (v = 0; v <= _PCA9685_MAXVAL; v++) {
+    double level = pow((double) v / _PCA9685_MAXVAL, 1 / _PCA9685_DEADBANDGAMMA) + perceptual;
+    double step = _PCA9685_MAXVAL * pow(level < 1 ? level : 1, _PCA9685_DEADBANDGAMMA) - v;
+    unsigned int least = (unsigned int) ceil(step);
+    if (least < counts) least = counts;
+    if (least < 1) least = 1;
+    engine->deadband[v] = least;
+  } // for counts
+  return 0;
+} // PCA9685_engineSetDeadband
+
+
+
+/////////////////////////////////////////////////////////////////////
+// rewrite every LED register of a device at the next flush
+int PCA9685_engineRefresh(PCA9685_engine* engine, int dev) {
+  if (dev < 0 || dev >= engine->devs) {
+    fprintf(stderr, "PCA9685_engineRefresh(): invalid device %d\n", dev);
+    return -1;
+  } // if
+  __atomic_store_n(&engine->dev[dev].refresh, 1, __ATOMIC_RELAXED);
+  return 0;
+} // PCA9685_engineRefresh
+
+
+
+/////////////////////////////////////////////////////////////////////
+// limit the bus time of each bus per flush, 0 for no limit
+int PCA9685_engineSetBudget(PCA9685_engine* engine, int64_t budgetNs) {
+  if (budgetNs < 0) {
+    fprintf(stderr, "PCA9685_engineSetBudget(): invalid budget %lld ns\n", (long long) budgetNs);
+    return -1;
+  } // if
+  __atomic_store_n(&engine->budgetNs, budgetNs, __ATOMIC_RELAXED);
+  return 0;
+} // PCA9685_engineSetBudget
+
+
+
+/////////////////////////////////////////////////////////////////////
+// how long each channel's change has waited to be written
+int PCA9685_engineGetStaleness(PCA9685_engine* engine, int dev, int64_t* staleNs) {
+  if (dev < 0 || dev >= engine->devs) {
+    fprintf(stderr, "PCA9685_engineGetStaleness(): invalid device %d\n", dev);
+    return -1;
+  } // if
+  int64_t nowNs = _PCA9685_engineNowNs();
+  int c;
+  for (c = 0; c < _PCA9685_CHANS; c++) {
+    int64_t pendingNs = __atomic_load_n(&engine->dev[dev].pendingNs[c], __ATOMIC_RELAXED);
+    staleNs[c] = (pendingNs ? nowNs - pendingNs : 0);
+  } // for chans
+  return 0;
+} // PCA9685_engineGetStaleness
+
+
+
+/////////////////////////////////////////////////////////////////////
+// copy a device's health, safe while the writer thread runs
+int PCA9685_engineGetHealth(PCA9685_engine* engine, int dev, PCA9685_devHealth* health) {
+  if (dev < 0 || dev >= engine->devs) {
+    fprintf(stderr, "PCA9685_engineGetHealth(): invalid device %d\n", dev);
+    return -1;
+  } // if
+  PCA9685_devHealth* h = &engine->dev[dev].health;
+  health->state = __atomic_load_n(&h->state, __ATOMIC_ACQUIRE);
+  health->fails = __atomic_load_n(&h->fails, __ATOMIC_RELAXED);
+  health->errors = __atomic_load_n(&h->errors, __ATOMIC_RELAXED);
+  health->recoveries = __atomic_load_n(&h->recoveries, __ATOMIC_RELAXED);
+  health->resets = __atomic_load_n(&h->resets, __ATOMIC_RELAXED);
+  health->timeouts = __atomic_load_n(&h->timeouts, __ATOMIC_RELAXED);
+  health->maxTxNs = __atomic_load_n(&h->maxTxNs, __ATOMIC_RELAXED);
+  health->maxStaleNs = __atomic_load_n(&h->maxStaleNs, __ATOMIC_RELAXED);
+  health->backoffNs = __atomic_load_n(&h->backoffNs, __ATOMIC_RELAXED);
+  health->retryNs = __atomic_load_n(&h->retryNs, __ATOMIC_RELAXED);
+  return 0;
+} // PCA9685_engineGetHealth
+
+
+
+/////////////////////////////////////////////////////////////////////
+// if a tick is due write the changed registers of every device
+int PCA9685_engineService(PCA9685_engine* engine) {
+  uint64_t expirations;
+  if (read(engine->tickFd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+    if (errno == EAGAIN) return 0;
+    fprintf(stderr, "PCA9685_engineService(): read() failed on the tick fd\n");
+    return -1;
+  } // if no tick
+  int64_t nowNs = _PCA9685_engineNowNs();
+  _PCA9685_ENGINEADD(engine->ticks, 1);
+  _PCA9685_ENGINEADD(engine->missed, expirations - 1);
+
+  // lateness of the newest expiration, the timer period is exact
+  engine->expirations += expirations;
+  int64_t lateNs = nowNs - engine->startNs - (int64_t) engine->expirations * engine->periodNs;
+  if (lateNs < 0) lateNs = 0;
+  _PCA9685_ENGINEMAX(engine->maxLateNs, lateNs);
+  _PCA9685_ENGINEADD(engine->sumLateNs, lateNs);
+  _PCA9685_engineHistAdd(engine->lateHist, lateNs);
+
+  int ret = PCA9685_engineFlush(engine);
+
+  // completion is signalled even when nothing changed
+  uint64_t one = 1;
+  if (write(engine->eventFd, &one, sizeof(one)) != sizeof(one)) {
+    fprintf(stderr, "PCA9685_engineService(): write() failed on the event fd\n");
+    return -1;
+  } // if
+
+  if (ret != 0) {
+    fprintf(stderr, "PCA9685_engineService(): PCA9685_engineFlush() returned %d\n", ret);
+    return -1;
+  } // if
+  return 1;
+} // PCA9685_engineService
+
+
+
+/////////////////////////////////////////////////////////////////////
+// fill rt with SCHED_FIFO on the last CPU, locked memory and a stack
+void PCA9685_rtDefaults(PCA9685_rtConfig* rt) {
+  rt->policy = SCHED_FIFO;
+  rt->priority = _PCA9685_RTPRIORITY;
+  rt->cpu = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  rt->lockMemory = 1;
+  rt->prefaultStack = _PCA9685_RTSTACK;
+} // PCA9685_rtDefaults
+
+
+
+/////////////////////////////////////////////////////////////////////
+// touch bytes of stack below the caller so frames never fault it in
+static __attribute__((noinline)) void _PCA9685_rtPrefault(size_t bytes) {
+  unsigned char stack[bytes > 0 ? bytes : 1];
+  volatile unsigned char* p = stack;
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t i;
+  for (i = 0; i < bytes; i += page) {
+    p[i] = 0;
+  } // for pages
+} // _PCA9685_rtPrefault
+
+
+
+/////////////////////////////////////////////////////////////////////
+// apply rt to the calling thread
+int PCA9685_rtApply(const PCA9685_rtConfig* rt) {
+  if (rt->lockMemory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    fprintf(stderr, "PCA9685_rtApply(): mlockall() failed: %s\n", strerror(errno));
+    return -1;
+  } // if lock
+
+  int ret;
+  if (rt->cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(rt->cpu, &cpus);
+    ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (ret != 0) {
+      fprintf(stderr, "PCA9685_rtApply(): pthread_setaffinity_np() failed on CPU %d: %s\n",
+              rt->cpu, strerror(ret));
+      return -1;
+    } // if
+  } // if pin
+
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = (rt->policy == SCHED_OTHER ? 0 : rt->priority);
+  ret = pthread_setschedparam(pthread_self(), rt->policy, &param);
+  if (ret != 0) {
+    fprintf(stderr, "PCA9685_rtApply(): pthread_setschedparam() failed: %s\n", strerror(ret));
+    return -1;
+  } // if
+
+  _PCA9685_rtPrefault(rt->prefaultStack);
+  return 0;
+} // PCA9685_rtApply
+
+
+
+/////////////////////////////////////////////////////////////////////
+// writer thread, services every tick until stopped
+static void* _PCA9685_engineThread(void* arg) {
+  PCA9685_engine* engine = arg;
+  if (engine->useRt) _PCA9685_rtPrefault(engine->rt.prefaultStack);
+
+  // wake up now and then to notice PCA9685_engineStop()
+  struct pollfd pfd = { engine->tickFd, POLLIN, 0 };
+  while (__atomic_load_n(&engine->running, __ATOMIC_ACQUIRE)) {
+    if (poll(&pfd, 1, 100) == 1) PCA9685_engineService(engine);
+  } // while running
+  return NULL;
+} // _PCA9685_engineThread
+
+
+
+/////////////////////////////////////////////////////////////////////
+// service the engine from its own writer thread, with rt unless NULL
+int PCA9685_engineStart(PCA9685_engine* engine, const PCA9685_rtConfig* rt) {
+  if (engine->running) {
+    fprintf(stderr, "PCA9685_engineStart(): already started\n");
+    return -1;
+  } // if
+
+  // the devices were zeroed when added, touch the message arrays too
+  memset(engine->msgFds, 0, engine->maxMsgs * sizeof(int));
+  memset(engine->msgAddrs, 0, engine->maxMsgs);
+  memset(engine->msgFlags, 0, engine->maxMsgs * sizeof(unsigned short));
+  memset(engine->msgLens, 0, engine->maxMsgs * sizeof(int));
+  memset(engine->msgBufs, 0, engine->maxMsgs * sizeof(unsigned char*));
+  memset(engine->msgDevs, 0, engine->maxMsgs * sizeof(int));
+  memset(engine->msgRanks, 0, engine->maxMsgs * sizeof(PCA9685_engineRank));
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  engine->useRt = (rt != NULL);
+  if (rt) {
+    engine->rt = *rt;
+    if (rt->lockMemory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      fprintf(stderr, "PCA9685_engineStart(): mlockall() failed: %s\n", strerror(errno));
+      pthread_attr_destroy(&attr);
+      return -1;
+    } // if lock
+
+    // a small stack, since locked memory maps all of it
+    pthread_attr_setstacksize(&attr, rt->prefaultStack + _PCA9685_RTSTACK);
+
+    // set in the attributes so an unprivileged start fails here
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = (rt->policy == SCHED_OTHER ? 0 : rt->priority);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, rt->policy);
+    pthread_attr_setschedparam(&attr, &param);
+    if (rt->cpu >= 0) {
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(rt->cpu, &cpus);
+      pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    } // if pin
+  } // if rt
+
+  __atomic_store_n(&engine->running, 1, __ATOMIC_RELEASE);
+  int ret = pthread_create(&engine->thread, &attr, _PCA9685_engineThread, engine);
+  pthread_attr_destroy(&attr);
+  if (ret != 0) {
+    fprintf(stderr, "PCA9685_engineStart(): pthread_create() failed: %s\n", strerror(ret));
+    engine->running = 0;
+    return -1;
+  } // if
+  return 0;
+} // PCA9685_engineStart
+
+
+
+/////////////////////////////////////////////////////////////////////
+// stop and join the writer thread
+int PCA9685_engineStop(PCA9685_engine* engine) {
+  if (!engine->running) return 0;
+  __atomic_store_n(&engine->running, 0, __ATOMIC_RELEASE);
+  int ret = pthread_join(engine->thread, NULL);
+  if (ret != 0) {
+    fprintf(stderr, "PCA9685_engineStop(): pthread_join() failed: %s\n", strerror(ret));
+    return -1;
+  } // if
+  return 0;
+} // PCA9685_engineStop
+
+
+
+/////////////////////////////////////////////////////////////////////
+// reset the tick lateness and transaction time stats
+int PCA9685_engineResetStats(PCA9685_engine* engine) {
+  // the writer thread updates them
+  if (engine->running) {
+    fprintf(stderr, "PCA9685_engineResetStats(): the writer thread is running\n");
+    return -1;
+  } // if
+  engine->ticks = 0;
+  engine->missed = 0;
+  engine->maxLateNs = 0;
+  engine->sumLateNs = 0;
+  memset(engine->lateHist, 0, sizeof(engine->lateHist));
+  engine->txs = 0;
+  engine->txErrors = 0;
+  engine->txTimeouts = 0;
+  engine->txSumNs = 0;
+  engine->txMaxNs = 0;
+  memset(engine->txHist, 0, sizeof(engine->txHist));
+  return 0;
+} // PCA9685_engineResetStats
+
+
+
+/////////////////////////////////////////////////////////////////////
+// ns below which fraction of a log2 microsecond histogram falls
+static int64_t _PCA9685_engineHistPercentile(const uint64_t* hist, const int64_t* maxNs,
+                                             double fraction) {
+  int64_t max = __atomic_load_n(maxNs, __ATOMIC_RELAXED);
+  uint64_t counts[_PCA9685_ENGINEHIST];
+  uint64_t total = 0;
+  int b;
+  for (b = 0; b < _PCA9685_ENGINEHIST; b++) {
+    counts[b] = __atomic_load_n(&hist[b], __ATOMIC_RELAXED);
+    total += counts[b];
+  } // for buckets
+  uint64_t count = 0;
+  for (b = 0; b < _PCA9685_ENGINEHIST - 1; b++) {
+    count += counts[b];
+    // bucket b holds values below 2^b us
+    if (count >= fraction * total) {
+      int64_t upperNs = (int64_t) 1000 << b;
+      return (upperNs < max ? upperNs : max);
+    } // if
+  } // for buckets
+  return max;
+} // _PCA9685_engineHistPercentile
+
+
+
+/////////////////////////////////////////////////////////////////////
+// tick lateness below which fraction of the ticks fall, in ns
+int64_t PCA9685_engineLatePercentile(const PCA9685_engine* engine, double fraction) {
+  return _PCA9685_engineHistPercentile(engine->lateHist, &engine->maxLateNs, fraction);
+} // PCA9685_engineLatePercentile
+
+
+
+/////////////////////////////////////////////////////////////////////
+// frame transaction time below which fraction of them fall, in ns
+int64_t PCA9685_engineTxPercentile(const PCA9685_engine* engine, double fraction) {
+  return _PCA9685_engineHistPercentile(engine->txHist, &engine->txMaxNs, fraction);
+} // PCA9685_engineTxPercentile
+
+
+
+/////////////////////////////////////////////////////////////////////
+// ns the slowest bus takes to write every LED register of its devices
+int64_t PCA9685_engineFullFrameNs(const PCA9685_engine* engine) {
+  int64_t maxNs = 0;
+  int first = 0;
+  while (first < engine->devs) {
+    int fd = engine->dev[engine->order[first]].fd;
+    int last = first + 1;
+    while (last < engine->devs && engine->dev[engine->order[last]].fd == fd) last++;
+    int n = last - first;
+
+    // every device one message of the register and the LED registers,
+    // with the address byte
+    int transactions = (n + _PCA9685_BATCHMSGS - 1) / _PCA9685_BATCHMSGS;
+    int bytes = n * (2 + _PCA9685_ENGINEREGS);
+    int path = PCA9685_getI2CPath(fd, NULL);
+    if (path == PCA9685_I2CPATHSINGLE) {
+      transactions = n;
+    } else if (path == PCA9685_I2CPATHSMBUS) {
+      // a block of at most 32 each, with its own address and register
+      int blocks = (_PCA9685_ENGINEREGS + 31) / 32;
+      transactions = n * blocks;
+      bytes = n * (2 * blocks + _PCA9685_ENGINEREGS);
+    } // if path
+    int64_t ns = PCA9685_busCostNs(fd, transactions, bytes);
+    if (ns > maxNs) maxNs = ns;
+    first = last;
+  } // while buses
+  return maxNs;
+} // PCA9685_engineFullFrameNs
+
+
+
+/////////////////////////////////////////////////////////////////////
+// frame ticks per second in which every bus can carry a full frame
+unsigned int PCA9685_engineMaxFps(const PCA9685_engine* engine) {
+  int64_t ns = PCA9685_engineFullFrameNs(engine);
+  if (ns <= 0) return 0;
+  return (unsigned int) (1000000000LL / ns);
+} // PCA9685_engineMaxFps
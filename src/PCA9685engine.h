@@ -0,0 +1,285 @@
+#ifndef _PCA9685ENGINE_H
+#define _PCA9685ENGINE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "PCA9685.h"
+
+// bytes of LED registers per device
+#define _PCA9685_ENGINEREGS	(_PCA9685_CHANS*4)
+
+// unchanged bytes merged into a span rather than starting a new one,
+// a new I2C message costs a START, the address and the register
+#define _PCA9685_ENGINEGAP	3
+
+// max spans per device, at least one in every 1 + _PCA9685_ENGINEGAP + 1 bytes
+#define _PCA9685_ENGINESPANS	_PCA9685_CHANS
+
+// log2 microsecond buckets of tick lateness and transaction time, the
+// last catches the rest
+#define _PCA9685_ENGINEHIST	20
+
+// default real-time priority of a writer thread, above the kernel's
+// threaded irq handlers at 50; the writer sleeps in the I2C ioctl so
+// the bus irq still runs
+#define _PCA9685_RTPRIORITY	80
+
+// default stack touched before the first frame
+#define _PCA9685_RTSTACK	(64*1024)
+
+// first and longest wait before retrying a failing device, in ns
+#define _PCA9685_ENGINEBACKOFFMIN	10000000LL
+#define _PCA9685_ENGINEBACKOFFMAX	5000000000LL
+
+// shortest wait before retrying a device whose transaction timed out;
+// every retry stalls its whole bus for the adapter's I2C_TIMEOUT
+#define _PCA9685_ENGINEBACKOFFHUNG	1000000000LL
+
+// messages a MODE1 probe adds to a frame, a register write and a 1-byte read
+#define _PCA9685_ENGINEPROBEMSGS	2
+
+// default frames between MODE1 probes of a device
+#define _PCA9685_ENGINEPROBEEVERY	100
+
+// gamma of the perceived brightness a perceptual deadband is measured in
+#define _PCA9685_DEADBANDGAMMA	2.2
+
+// error counts a pending change gains per tick it waits under a bus
+// budget, so none waits more than about 16 ticks behind full scale changes
+#define _PCA9685_ENGINEAGECOUNTS	256
+
+// device health states
+#define PCA9685_DEVOK		0       // written every frame
+#define PCA9685_DEVFAILING	1       // skipped until its next retry
+
+// health of one device, kept by the fault manager
+typedef struct PCA9685_devHealth {
+  int state;                    // PCA9685_DEVOK or PCA9685_DEVFAILING
+  unsigned int fails;           // consecutive failed writes and retries
+  uint64_t errors;              // failed writes and retries in total
+  uint64_t recoveries;          // re-initializations after failing
+  uint64_t resets;              // brownouts or resets found by MODE1 probes
+  uint64_t timeouts;            // failed writes and retries the adapter timed out
+  int64_t maxTxNs;              // longest transaction the device was in
+  int64_t maxStaleNs;           // longest a channel change waited to be written
+  int64_t backoffNs;            // wait before the next retry
+  int64_t retryNs;              // CLOCK_MONOTONIC of the next retry
+} PCA9685_devHealth;
+
+// real-time settings for a writer thread
+typedef struct PCA9685_rtConfig {
+  int policy;                   // SCHED_FIFO, SCHED_RR or SCHED_OTHER
+  int priority;                 // 1 to 99 for SCHED_FIFO and SCHED_RR
+  int cpu;                      // CPU to pin to, -1 for any
+  int lockMemory;               // mlockall() current and future pages
+  size_t prefaultStack;         // stack bytes to touch before the first frame
+} PCA9685_rtConfig;
+
+// one device driven by an engine
+typedef struct PCA9685_engineDev {
+  int fd;                       // I2C bus fd
+  unsigned char addr;           // I2C address
+  unsigned int seq;             // mailbox seqlock, odd while being written
+  unsigned char mail[_PCA9685_ENGINEREGS];   // LED regs last submitted
+  unsigned int taken;           // mailbox seq last taken by the writer
+  unsigned char next[_PCA9685_ENGINEREGS];   // LED regs to write
+  unsigned char shadow[_PCA9685_ENGINEREGS]; // LED regs on the device
+  int full;                     // write every LED reg next
+  int refresh;                  // set by PCA9685_engineRefresh(), full at the next flush
+  unsigned char mode1;          // MODE1 to restore, without SLEEP and RESTART
+  unsigned char mode2;          // MODE2 to restore
+  unsigned char prescale;       // PRE_SCALE to restore
+  PCA9685_devHealth health;     // fault manager state
+  unsigned char probeReg;       // MODE1 register address of the probe
+  unsigned char probeVal;       // MODE1 read back by the probe
+  int probed;                   // probeVal was read in this flush
+  unsigned char tx[_PCA9685_ENGINESPANS][1 + _PCA9685_ENGINEREGS]; // span messages
+  int64_t pendingNs[_PCA9685_CHANS]; // CLOCK_MONOTONIC each channel has differed from the device since, 0 if not
+} PCA9685_engineDev;
+
+// a message of the frame ranked by the budget scheduler
+typedef struct PCA9685_engineRank {
+  int64_t score;                // pending error and age, INT64_MAX if it must go
+  int msg;                      // message index
+} PCA9685_engineRank;
+
+// frame writer for many devices, driven by a tick timerfd; the counters
+// have a single writer and may be read without a lock from any thread
+typedef struct PCA9685_engine {
+  int devs;                     // devices added
+  PCA9685_engineDev* dev;       // devices in the order added
+  int* order;                   // device indexes sorted by fd
+  unsigned int fps;             // frame ticks per second
+  int tickFd;                   // timerfd, readable once per frame tick
+  int eventFd;                  // eventfd, incremented per serviced tick
+  int msgs;                     // messages of the frame being written
+  int maxMsgs;                  // capacity of the message arrays
+  int* msgFds;                  // I2C bus fd per message, sorted
+  unsigned char* msgAddrs;      // I2C address per message
+  unsigned short* msgFlags;     // I2C msg flags per message
+  int* msgLens;                 // length per message
+  unsigned char** msgBufs;      // register then data per message
+  int* msgDevs;                 // device per message
+  PCA9685_engineRank* msgRanks; // rank per message, sorted per bus under a budget
+  int64_t budgetNs;             // bus time each bus may take per flush, 0 for any
+  uint64_t deferred;            // span messages held over to a later flush by the budget
+  int64_t maxStaleNs;           // longest a channel change waited to be written
+  uint64_t ticks;               // frame ticks serviced
+  uint64_t missed;              // frame ticks that expired unserviced
+  uint64_t frames;              // frames written with at least one message
+  uint64_t submits;             // frames submitted by the app
+  uint64_t coalesced;           // submitted frames replaced before writing
+  uint64_t msgsSent;            // I2C messages written
+  uint64_t bytesSent;           // I2C message bytes written, without addresses
+  unsigned int probeEvery;      // flushes between MODE1 probes of a device, 0 for never
+  uint64_t flushes;             // calls to PCA9685_engineFlush()
+  uint64_t probes;              // MODE1 probes read
+  unsigned short* deadband;     // least change written per OFF count on the device, NULL for all
+  uint64_t deadbanded;          // channel changes held back by the deadband
+  uint64_t deadbandFrames;      // submitted device frames the deadband held back whole
+  uint64_t deadbandBytes;       // message bytes the deadband kept off the buses
+  uint64_t deadbandMsgs;        // span messages the deadband kept off the buses
+  unsigned int emergencies;     // _PCA9685_EMERGENCIES at the last flush
+  int64_t startNs;              // CLOCK_MONOTONIC when the tick timer was armed
+  int64_t periodNs;             // tick period
+  uint64_t expirations;         // tick expirations since the timer was armed
+  int64_t maxLateNs;            // latest a tick was serviced after expiring
+  int64_t sumLateNs;            // sum of tick lateness, for the mean
+  uint64_t lateHist[_PCA9685_ENGINEHIST]; // ticks per log2 us of lateness
+  uint64_t txs;                 // frame transactions, one per bus per flush
+  uint64_t txErrors;            // frame transactions that failed
+  uint64_t txTimeouts;          // frame transactions the adapter timed out
+  int64_t txSumNs;              // time spent in frame transactions, the bus busy time
+  int64_t txMaxNs;              // longest frame transaction
+  uint64_t txHist[_PCA9685_ENGINEHIST];   // transactions per log2 us taken
+  pthread_t thread;             // writer thread while started
+  int running;                  // writer thread is running
+  PCA9685_rtConfig rt;          // writer thread settings
+  int useRt;                    // apply rt in the writer thread
+  int rtFailed;                 // the writer thread could not apply rt
+} PCA9685_engine;
+
+
+// create an engine ticking fps times per second
+PCA9685_engine* PCA9685_engineCreate(unsigned int fps);
+
+// free an engine, the devices' fds stay open
+void PCA9685_engineDestroy(PCA9685_engine* engine);
+
+// add a device initialized with PCA9685_initPWM(), returns its index;
+// its MODE1, MODE2 and PRE_SCALE are read back for re-initializing it;
+// add devices from the servicing thread, never while a writer thread runs
+int PCA9685_engineAdd(PCA9685_engine* engine, int fd, unsigned char addr);
+
+// change the frame tick rate, never while a writer thread runs
+int PCA9685_engineSetFps(PCA9685_engine* engine, unsigned int fps);
+
+// post a device's next ON and OFF vals (NULL onVals for zero) to its
+// latest-value mailbox, never blocks; one submitting thread per device
+int PCA9685_engineSubmit(PCA9685_engine* engine, int dev,
+                         const unsigned int* onVals, const unsigned int* offVals);
+
+// timerfd to poll for reading, readable when a frame tick is due
+int PCA9685_engineTickFd(PCA9685_engine* engine);
+
+// eventfd to poll for reading, counts the ticks serviced
+int PCA9685_engineEventFd(PCA9685_engine* engine);
+
+// if a tick is due write the changed registers of every device, never
+// waits for a tick; returns 1 if a tick was serviced, 0 if none was due
+int PCA9685_engineService(PCA9685_engine* engine);
+
+// write the changed registers of every device now, without a tick;
+// a device that fails is skipped while it backs off exponentially, then
+// re-initialized and rewritten in full from the shadow registers once it
+// answers again; nothing is written while PCA9685_emergencyOff() holds
+// the engines, and every register after; the latch is checked before
+// every transaction, and a stop that lands mid-flush ends it and sends
+// the full-off again; returns -1 if any device failed in this call
+int PCA9685_engineFlush(PCA9685_engine* engine);
+
+// probe each device's MODE1 every so many flushes, 0 for never; the
+// probe rides in the frame's transaction as a 1-byte combined read, at
+// most 2 bytes and 2 address bytes per device per every flushes, and a
+// MODE1 other than the one restored by re-initializing means the device
+// browned out or was reset, so it is re-initialized and its last frame
+// rewritten from the shadow registers at once
+int PCA9685_engineSetProbe(PCA9685_engine* engine, unsigned int every);
+
+// hold back a channel's change until its ON or OFF count moved at least
+// counts from the one on the device, or perceptual (0 to 1) of the
+// brightness perceived at _PCA9685_DEADBANDGAMMA, whichever is more;
+// small steps accumulate until they pass, while changes of the full bits
+// and to OFF 0 always go out; 0 and 0 turn it off, not while the writer
+// thread runs
+int PCA9685_engineSetDeadband(PCA9685_engine* engine, unsigned int counts, double perceptual);
+
+// rewrite every LED register of a device from its last frame at the
+// next flush, for a keepalive that catches boards reset unseen; safe
+// from any thread
+int PCA9685_engineRefresh(PCA9685_engine* engine, int dev);
+
+// limit the bus time of each bus per flush to budgetNs, at the costs
+// PCA9685_calibrate() measured or the nominal ones, 0 for no limit; when
+// the changed spans do not fit, those with the largest pending error,
+// raised by _PCA9685_ENGINEAGECOUNTS per tick waited, go first and the
+// rest wait for a later flush; probes and rewrites of recovered devices
+// always go, and so does the first span of each bus; safe while the
+// writer thread runs
+int PCA9685_engineSetBudget(PCA9685_engine* engine, int64_t budgetNs);
+
+// fill staleNs with how long each channel's change has waited to be
+// written, 0 for channels the device shows; safe while the writer
+// thread runs
+int PCA9685_engineGetStaleness(PCA9685_engine* engine, int dev, int64_t* staleNs);
+
+// copy a device's health, safe while the writer thread runs
+int PCA9685_engineGetHealth(PCA9685_engine* engine, int dev, PCA9685_devHealth* health);
+
+// fill rt with SCHED_FIFO at _PCA9685_RTPRIORITY on the last CPU,
+// locked memory and a _PCA9685_RTSTACK prefaulted stack
+void PCA9685_rtDefaults(PCA9685_rtConfig* rt);
+
+// apply rt to the calling thread, for writers the app runs itself
+int PCA9685_rtApply(const PCA9685_rtConfig* rt);
+
+// service the engine from its own writer thread instead of an event
+// loop, with rt applied first unless it is NULL; every buffer is
+// allocated and touched before the thread starts
+int PCA9685_engineStart(PCA9685_engine* engine, const PCA9685_rtConfig* rt);
+
+// stop and join the writer thread
+int PCA9685_engineStop(PCA9685_engine* engine);
+
+// reset the tick lateness and transaction time stats, never while a
+// writer thread runs
+int PCA9685_engineResetStats(PCA9685_engine* engine);
+
+// tick lateness below which fraction (0 to 1) of the ticks fall, in ns,
+// to the resolution of the log2 histogram
+int64_t PCA9685_engineLatePercentile(const PCA9685_engine* engine, double fraction);
+
+// frame transaction time below which fraction (0 to 1) of them fall, in
+// ns, to the resolution of the log2 histogram
+int64_t PCA9685_engineTxPercentile(const PCA9685_engine* engine, double fraction);
+
+// ns the slowest bus takes to write every LED register of its devices on
+// its transfer path, at the costs PCA9685_calibrate() measured or the
+// nominal ones
+int64_t PCA9685_engineFullFrameNs(const PCA9685_engine* engine);
+
+// frame ticks per second in which every bus can carry a full frame, 0
+// without devices
+unsigned int PCA9685_engineMaxFps(const PCA9685_engine* engine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
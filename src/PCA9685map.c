@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "PCA9685map.h"
+
+
+/////////////////////////////////////////////////////////////////////
+// create an empty map of chans logical channels
+PCA9685_map* PCA9685_mapCreate(int chans) {
+  if (chans <= 0 || chans > 0xFFFF) {
+    fprintf(stderr, "PCA9685_mapCreate(): invalid channel count %d\n", chans);
+    return NULL;
+  } // if chans
+
+  PCA9685_map* map = calloc(1, sizeof(PCA9685_map));
+  if (map == NULL) {
+    fprintf(stderr, "PCA9685_mapCreate(): calloc() failed\n");
+    return NULL;
+  } // if
+  map->chans = chans;
+  map->entries = calloc(chans, sizeof(PCA9685_mapEntry));
+  map->used = calloc(chans, 1);
+  if (map->entries == NULL || map->used == NULL) {
+    fprintf(stderr, "PCA9685_mapCreate(): calloc() failed\n");
+    PCA9685_mapDestroy(map);
+    return NULL;
+  } // if
+
+  int i;
+  for (i = 0; i < _PCA9685_MAPADPTS; i++) {
+    map->fds[i] = -1;
+  } // for adpts
+
+  return map;
+} // PCA9685_mapCreate
+
+
+
+/////////////////////////////////////////////////////////////////////
+// free a map and close its adapters
+void PCA9685_mapDestroy(PCA9685_map* map) {
+  if (map == NULL) return;
+  int i;
+  for (i = 0; i < _PCA9685_MAPADPTS; i++) {
+    if (map->fds[i] >= 0) {
+      PCA9685_closeI2C(map->fds[i]);
+    } // if open
+  } // for adpts
+  free(map->entries);
+  free(map->used);
+  free(map->board);
+  free(map);
+} // PCA9685_mapDestroy
+
+
+
+/////////////////////////////////////////////////////////////////////
+// map count logical channels from first onto LEDs from led at adpt/addr
+int PCA9685_mapAdd(PCA9685_map* map, int first, unsigned char adpt,
+                   unsigned char addr, unsigned char led, int count) {
+  if (first < 0 || count <= 0 || first + count > map->chans) {
+    fprintf(stderr, "PCA9685_mapAdd(): channels %d - %d outside 0 - %d\n",
+            first, first + count - 1, map->chans - 1);
+    return -1;
+  } // if first
+  if (led + count > _PCA9685_CHANS) {
+    fprintf(stderr, "PCA9685_mapAdd(): LEDs %d - %d outside 0 - %d\n",
+            led, led + count - 1, _PCA9685_CHANS - 1);
+    return -1;
+  } // if led
+  if (adpt >= _PCA9685_MAPADPTS) {
+    fprintf(stderr, "PCA9685_mapAdd(): adapter %d above %d\n",
+            adpt, _PCA9685_MAPADPTS - 1);
+    return -1;
+  } // if adpt
+
+  int i;
+  for (i = 0; i < count; i++) {
+    if (map->used[first + i]) {
+      fprintf(stderr, "PCA9685_mapAdd(): channel %d mapped twice\n", first + i);
+      return -1;
+    } // if used
+    map->entries[first + i].adpt = adpt;
+    map->entries[first + i].addr = addr;
+    map->entries[first + i].led = led + i;
+    map->used[first + i] = 1;
+  } // for count
+
+  return 0;
+} // PCA9685_mapAdd
+
+
+
+/////////////////////////////////////////////////////////////////////
+// parse a map config string, one "logical adpt addr led [count]" per line
+PCA9685_map* PCA9685_mapParse(const char* config) {
+  int pass;
+  int chans = 0;
+  PCA9685_map* map = NULL;
+
+  // first pass sizes the map, second pass fills it
+  for (pass = 0; pass < 2; pass++) {
+    const char* line = config;
+    int lineNum = 0;
+    while (*line) {
+      const char* next = strchr(line, '\n');
+      int len = (next ? next - line : (int) strlen(line));
+      char buf[128];
+      lineNum++;
+      if (len >= (int) sizeof(buf)) {
+        fprintf(stderr, "PCA9685_mapParse(): line %d too long\n", lineNum);
+        PCA9685_mapDestroy(map);
+        return NULL;
+      } // if len
+      memcpy(buf, line, len);
+      buf[len] = '\0';
+      char* comment = strchr(buf, '#');
+      if (comment) *comment = '\0';
+
+      int first, adpt, addr, led;
+      int count = 1;
+      int fields = sscanf(buf, "%i %i %i %i %i", &first, &adpt, &addr, &led, &count);
+      if (fields >= 4 && (adpt < 0 || adpt >= _PCA9685_MAPADPTS ||
+                          addr < 0 || addr > 0x7F || led < 0 || led >= _PCA9685_CHANS)) {
+        // checked before narrowing to PCA9685_mapAdd()'s unsigned chars
+        fprintf(stderr, "PCA9685_mapParse(): adapter %d, addr 0x%02x or LED %d out of range on line %d\n",
+                adpt, addr, led, lineNum);
+        PCA9685_mapDestroy(map);
+        return NULL;
+      } else if (fields >= 4) {
+        if (pass == 0) {
+          if (first + count > chans) chans = first + count;
+        } else if (PCA9685_mapAdd(map, first, adpt, addr, led, count) != 0) {
+          fprintf(stderr, "PCA9685_mapParse(): PCA9685_mapAdd() failed on line %d\n", lineNum);
+          PCA9685_mapDestroy(map);
+          return NULL;
+        } // if pass
+      } else if (fields > 0) {
+        fprintf(stderr, "PCA9685_mapParse(): expected logical adpt addr led [count] on line %d\n", lineNum);
+        PCA9685_mapDestroy(map);
+        return NULL;
+      } // if fields
+
+      line = (next ? next + 1 : line + len);
+    } // while lines
+
+    if (pass == 0) {
+      map = PCA9685_mapCreate(chans);
+      if (map == NULL) {
+        fprintf(stderr, "PCA9685_mapParse(): PCA9685_mapCreate() failed\n");
+        return NULL;
+      } // if map
+    } // if pass
+  } // for pass
+
+  if (PCA9685_mapCompile(map) != 0) {
+    fprintf(stderr, "PCA9685_mapParse(): PCA9685_mapCompile() failed\n");
+    PCA9685_mapDestroy(map);
+    return NULL;
+  } // if compile
+
+  return map;
+} // PCA9685_mapParse
+
+
+
+/////////////////////////////////////////////////////////////////////
+// read and parse a map config file
+PCA9685_map* PCA9685_mapLoad(const char* path) {
+  FILE* fp = fopen(path, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "PCA9685_mapLoad(): fopen() failed for %s\n", path);
+    return NULL;
+  } // if fp
+
+  long size = -1;
+  if (fseek(fp, 0, SEEK_END) == 0) size = ftell(fp);
+  if (size < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+    fprintf(stderr, "PCA9685_mapLoad(): failed to size %s\n", path);
+    fclose(fp);
+    return NULL;
+  } // if size
+  char* config = malloc(size + 1);
+  if (config == NULL || fread(config, 1, size, fp) != (size_t) size) {
+    fprintf(stderr, "PCA9685_mapLoad(): failed to read %s\n", path);
+    free(config);
+    fclose(fp);
+    return NULL;
+  } // if read
+  config[size] = '\0';
+  fclose(fp);
+
+  PCA9685_map* map = PCA9685_mapParse(config);
+  free(config);
+  return map;
+} // PCA9685_mapLoad
+
+
+
+/////////////////////////////////////////////////////////////////////
+// order boards by adapter then address
+static int _PCA9685_mapCmpBoard(const void* a, const void* b) {
+  const PCA9685_mapBoard* ba = a;
+  const PCA9685_mapBoard* bb = b;
+  if (ba->adpt != bb->adpt) return ba->adpt - bb->adpt;
+  return ba->addr - bb->addr;
+} // _PCA9685_mapCmpBoard
+
+
+
+/////////////////////////////////////////////////////////////////////
+// find a compiled board by adapter and address
+static int _PCA9685_mapFindBoard(PCA9685_map* map, unsigned char adpt,
+                                 unsigned char addr) {
+  int b;
+  for (b = 0; b < map->boards; b++) {
+    if (map->board[b].adpt == adpt && map->board[b].addr == addr) return b;
+  } // for boards
+  return -1;
+} // _PCA9685_mapFindBoard
+
+
+
+/////////////////////////////////////////////////////////////////////
+// build the per-board gather tables from the entries
+int PCA9685_mapCompile(PCA9685_map* map) {
+  free(map->board);
+  map->board = NULL;
+  map->boards = 0;
+
+  // collect the distinct boards
+  int i;
+  for (i = 0; i < map->chans; i++) {
+    if (!map->used[i]) continue;
+    if (_PCA9685_mapFindBoard(map, map->entries[i].adpt, map->entries[i].addr) >= 0) continue;
+    PCA9685_mapBoard* board = realloc(map->board, (map->boards + 1) * sizeof(PCA9685_mapBoard));
+    if (board == NULL) {
+      fprintf(stderr, "PCA9685_mapCompile(): realloc() failed\n");
+      return -1;
+    } // if
+    map->board = board;
+    memset(&board[map->boards], 0, sizeof(PCA9685_mapBoard));
+    board[map->boards].adpt = map->entries[i].adpt;
+    board[map->boards].addr = map->entries[i].addr;
+    board[map->boards].fd = -1;
+    board[map->boards].regBuf[0] = _PCA9685_BASEPWMREG;
+    map->boards++;
+  } // for chans
+  qsort(map->board, map->boards, sizeof(PCA9685_mapBoard), _PCA9685_mapCmpBoard);
+
+  // unused LEDs gather logical 0 through a zero mask
+  for (i = 0; i < map->chans; i++) {
+    if (!map->used[i]) continue;
+    int b = _PCA9685_mapFindBoard(map, map->entries[i].adpt, map->entries[i].addr);
+    PCA9685_mapBoard* board = &map->board[b];
+    unsigned char led = map->entries[i].led;
+    if (board->mask[led]) {
+      fprintf(stderr, "PCA9685_mapCompile(): LED %d at %d/0x%02x mapped twice\n",
+              led, board->adpt, board->addr);
+      return -1;
+    } // if mapped
+    board->gather[led] = i;
+    board->mask[led] = _PCA9685_MAXVAL;
+  } // for chans
+
+  if (_PCA9685_DEBUG) {
+    printf("PCA9685_mapCompile(): %d channels on %d boards\n", map->chans, map->boards);
+  } // if debug
+
+  return 0;
+} // PCA9685_mapCompile
+
+
+
+/////////////////////////////////////////////////////////////////////
+// open every adapter once and initialize every board at freq
+int PCA9685_mapOpen(PCA9685_map* map, unsigned int freq) {
+  int ret;
+  int b;
+  for (b = 0; b < map->boards; b++) {
+    PCA9685_mapBoard* board = &map->board[b];
+    if (map->fds[board->adpt] < 0) {
+      map->fds[board->adpt] = PCA9685_openI2C(board->adpt, board->addr);
+      if (map->fds[board->adpt] < 0) {
+        fprintf(stderr, "PCA9685_mapOpen(): PCA9685_openI2C() failed on adapter %d\n", board->adpt);
+        return -1;
+      } // if fd
+    } // if not open
+    board->fd = map->fds[board->adpt];
+
+    ret = PCA9685_initPWM(board->fd, board->addr, freq);
+    if (ret != 0) {
+      fprintf(stderr, "PCA9685_mapOpen(): PCA9685_initPWM() returned ");
+      fprintf(stderr, "%d on %d/0x%02x\n", ret, board->adpt, board->addr);
+      return -1;
+    } // if
+  } // for boards
+  return 0;
+} // PCA9685_mapOpen
+
+
+
+/////////////////////////////////////////////////////////////////////
+// gather a frame of 12-bit logical values into the board buffers
+void PCA9685_mapScatter(PCA9685_map* map, const unsigned short* frame) {
+  int b;
+  for (b = 0; b < map->boards; b++) {
+    PCA9685_mapBoard* board = &map->board[b];
+    unsigned char* regs = &board->regBuf[1];
+    int i;
+    // ON bytes stay zero, only the OFF bytes are gathered
+    for (i = 0; i < _PCA9685_CHANS; i++) {
+      unsigned int val = frame[board->gather[i]] & board->mask[i];
+      regs[i*4+2] = val & 0xFF;
+      regs[i*4+3] = val >> 8;
+    } // for LEDs
+  } // for boards
+} // PCA9685_mapScatter
+
+
+
+/////////////////////////////////////////////////////////////////////
+// write every board buffer in one transaction per board
+int PCA9685_mapWrite(PCA9685_map* map) {
+  int ret;
+  int b;
+  for (b = 0; b < map->boards; b++) {
+    PCA9685_mapBoard* board = &map->board[b];
+    ret = _PCA9685_writeI2CRaw(board->fd, board->addr,
+                               sizeof(board->regBuf), board->regBuf);
+    if (ret != 0) {
+      fprintf(stderr, "PCA9685_mapWrite(): _PCA9685_writeI2CRaw() returned ");
+      fprintf(stderr, "%d on %d/0x%02x\n", ret, board->adpt, board->addr);
+      return -1;
+    } // if
+  } // for boards
+  return 0;
+} // PCA9685_mapWrite
+
+
+
+/////////////////////////////////////////////////////////////////////
+// scatter and write a frame of 12-bit logical values
+int PCA9685_mapSetFrame(PCA9685_map* map, const unsigned short* frame) {
+  PCA9685_mapScatter(map, frame);
+  return PCA9685_mapWrite(map);
+} // PCA9685_mapSetFrame
@@ -0,0 +1,76 @@
+#ifndef _PCA9685MAP_H
+#define _PCA9685MAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "PCA9685.h"
+
+// maximum adapters that a map can open (/dev/i2c-0 to /dev/i2c-N)
+#define _PCA9685_MAPADPTS	32
+
+// one logical channel's location
+typedef struct PCA9685_mapEntry {
+  unsigned char adpt;           // adapter number
+  unsigned char addr;           // I2C address
+  unsigned char led;            // LED index 0 - 15
+} PCA9685_mapEntry;
+
+// one PCA9685 in a map with its compiled gather table
+typedef struct PCA9685_mapBoard {
+  unsigned char adpt;           // adapter number
+  unsigned char addr;           // I2C address
+  int fd;                       // I2C bus fd, shared by boards on one adapter
+  unsigned short gather[_PCA9685_CHANS]; // logical index per LED
+  unsigned short mask[_PCA9685_CHANS];   // 0xFFF if mapped, 0 if unused
+  unsigned char regBuf[1 + _PCA9685_CHANS*4]; // LED0_ON_L reg + LED regs
+} PCA9685_mapBoard;
+
+// map of a flat logical channel array onto boards on any adapters
+typedef struct PCA9685_map {
+  int chans;                    // logical channels
+  PCA9685_mapEntry* entries;    // location per logical channel
+  unsigned char* used;          // non-zero if logical channel is mapped
+  int boards;                   // boards after compiling
+  PCA9685_mapBoard* board;      // compiled boards, sorted by adapter, addr
+  int fds[_PCA9685_MAPADPTS];   // open fd per adapter or -1
+} PCA9685_map;
+
+
+// create an empty map of chans logical channels
+PCA9685_map* PCA9685_mapCreate(int chans);
+
+// free a map and close its adapters
+void PCA9685_mapDestroy(PCA9685_map* map);
+
+// map count logical channels from first onto LEDs from led at adpt/addr
+int PCA9685_mapAdd(PCA9685_map* map, int first, unsigned char adpt,
+                   unsigned char addr, unsigned char led, int count);
+
+// parse a map config string, one "logical adpt addr led [count]" per line
+PCA9685_map* PCA9685_mapParse(const char* config);
+
+// read and parse a map config file
+PCA9685_map* PCA9685_mapLoad(const char* path);
+
+// build the per-board gather tables from the entries
+int PCA9685_mapCompile(PCA9685_map* map);
+
+// open every adapter once and initialize every board at freq
+int PCA9685_mapOpen(PCA9685_map* map, unsigned int freq);
+
+// gather a frame of 12-bit logical values into the board buffers
+void PCA9685_mapScatter(PCA9685_map* map, const unsigned short* frame);
+
+// write every board buffer in one transaction per board
+int PCA9685_mapWrite(PCA9685_map* map);
+
+// scatter and write a frame of 12-bit logical values
+int PCA9685_mapSetFrame(PCA9685_map* map, const unsigned short* frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,489 @@
+// for accept4()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "PCA9685metrics.h"
+
+
+/////////////////////////////////////////////////////////////////////
+// create an exporter for an engine, its buffer grows with the devices
+PCA9685_metrics* PCA9685_metricsCreate(PCA9685_engine* engine) {
+  PCA9685_metrics* metrics = calloc(1, sizeof(PCA9685_metrics));
+  if (metrics == NULL) {
+    fprintf(stderr, "PCA9685_metricsCreate(): calloc() failed\n");
+    return NULL;
+  } // if
+  metrics->engine = engine;
+  metrics->listenFd = -1;
+  int i;
+  for (i = 0; i < _PCA9685_METRICSCONNS; i++) metrics->conns[i].fd = -1;
+  metrics->size = _PCA9685_METRICSBASE + engine->devs * _PCA9685_METRICSDEV;
+  metrics->text = malloc(metrics->size);
+  if (metrics->text == NULL) {
+    fprintf(stderr, "PCA9685_metricsCreate(): malloc() failed\n");
+    free(metrics);
+    return NULL;
+  } // if
+  return metrics;
+} // PCA9685_metricsCreate
+
+
+
+/////////////////////////////////////////////////////////////////////
+// close the socket and free the exporter, the engine is left alone
+void PCA9685_metricsDestroy(PCA9685_metrics* metrics) {
+  if (metrics == NULL) return;
+  if (metrics->listenFd >= 0) close(metrics->listenFd);
+  int i;
+  for (i = 0; i < _PCA9685_METRICSCONNS; i++) {
+    if (metrics->conns[i].fd >= 0) close(metrics->conns[i].fd);
+    free(metrics->conns[i].response);
+  } // for conns
+  if (metrics->path) {
+    unlink(metrics->path);
+    free(metrics->path);
+  } // if unix
+  free(metrics->text);
+  free(metrics);
+} // PCA9685_metricsDestroy
+
+
+
+/////////////////////////////////////////////////////////////////////
+// listen on a unix domain socket at path, replacing a stale one
+int PCA9685_metricsListenUnix(PCA9685_metrics* metrics, const char* path) {
+  struct sockaddr_un sun;
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(sun.sun_path)) {
+    fprintf(stderr, "PCA9685_metricsListenUnix(): path too long: %s\n", path);
+    return -1;
+  } // if
+  strcpy(sun.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    fprintf(stderr, "PCA9685_metricsListenUnix(): socket() failed: %s\n", strerror(errno));
+    return -1;
+  } // if
+
+  // only a socket nobody listens on any more is replaced
+  struct stat st;
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      fprintf(stderr, "PCA9685_metricsListenUnix(): %s is not a socket\n", path);
+      close(fd);
+      return -1;
+    } // if
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int live = (probe >= 0 && connect(probe, (struct sockaddr*) &sun, sizeof(sun)) == 0);
+    if (probe >= 0) close(probe);
+    if (live) {
+      fprintf(stderr, "PCA9685_metricsListenUnix(): %s is in use\n", path);
+      close(fd);
+      return -1;
+    } // if
+    unlink(path);
+  } // if left behind
+  if (bind(fd, (struct sockaddr*) &sun, sizeof(sun)) != 0 || listen(fd, 8) != 0) {
+    fprintf(stderr, "PCA9685_metricsListenUnix(): failed on %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  } // if
+
+  metrics->listenFd = fd;
+  metrics->path = strdup(path);
+  return 0;
+} // PCA9685_metricsListenUnix
+
+
+
+/////////////////////////////////////////////////////////////////////
+// listen on a TCP port on the loopback address only
+int PCA9685_metricsListenTcp(PCA9685_metrics* metrics, unsigned short port) {
+  struct sockaddr_in sin;
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(port);
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    fprintf(stderr, "PCA9685_metricsListenTcp(): socket() failed: %s\n", strerror(errno));
+    return -1;
+  } // if
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(fd, (struct sockaddr*) &sin, sizeof(sin)) != 0 || listen(fd, 8) != 0) {
+    fprintf(stderr, "PCA9685_metricsListenTcp(): failed on port %u: %s\n", port, strerror(errno));
+    close(fd);
+    return -1;
+  } // if
+
+  metrics->listenFd = fd;
+  return 0;
+} // PCA9685_metricsListenTcp
+
+
+
+/////////////////////////////////////////////////////////////////////
+// listening socket to poll for reading, -1 until listening
+int PCA9685_metricsFd(PCA9685_metrics* metrics) {
+  return metrics->listenFd;
+} // PCA9685_metricsFd
+
+
+
+/////////////////////////////////////////////////////////////////////
+// grow the text buffer for devices added after the exporter was created
+static int _PCA9685_metricsFit(PCA9685_metrics* metrics) {
+  size_t size = _PCA9685_METRICSBASE + metrics->engine->devs * _PCA9685_METRICSDEV;
+  if (size <= metrics->size) return 0;
+  char* text = realloc(metrics->text, size);
+  if (text == NULL) {
+    fprintf(stderr, "_PCA9685_metricsFit(): realloc() failed\n");
+    return -1;
+  } // if
+  metrics->text = text;
+  metrics->size = size;
+  return 0;
+} // _PCA9685_metricsFit
+
+
+
+/////////////////////////////////////////////////////////////////////
+// fill fds with the listening socket and the scrapes in progress
+int PCA9685_metricsPollFds(PCA9685_metrics* metrics, struct pollfd* fds) {
+  int n = 0;
+  int i;
+  // the listening socket only while a slot is free to accept into
+  for (i = 0; i < _PCA9685_METRICSCONNS && metrics->conns[i].fd >= 0; i++);
+  if (metrics->listenFd >= 0 && i < _PCA9685_METRICSCONNS) {
+    fds[n].fd = metrics->listenFd;
+    fds[n].events = POLLIN;
+    fds[n++].revents = 0;
+  } // if listening
+  for (i = 0; i < _PCA9685_METRICSCONNS; i++) {
+    PCA9685_metricsConn* conn = &metrics->conns[i];
+    if (conn->fd < 0) continue;
+    fds[n].fd = conn->fd;
+    fds[n].events = (conn->response ? POLLOUT : POLLIN);
+    fds[n++].revents = 0;
+  } // for conns
+  return n;
+} // PCA9685_metricsPollFds
+
+
+
+/////////////////////////////////////////////////////////////////////
+// milliseconds on the monotonic clock
+static int64_t _PCA9685_metricsNowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+} // _PCA9685_metricsNowMs
+
+
+
+/////////////////////////////////////////////////////////////////////
+// format the HTTP response of a scrape, the metrics as of now
+static int _PCA9685_metricsRespond(PCA9685_metrics* metrics, PCA9685_metricsConn* conn) {
+  _PCA9685_metricsFit(metrics);
+  int len = PCA9685_metricsFormat(metrics, metrics->text, metrics->size);
+  if (len < 0) len = 0;
+  char header[128];
+  int headerLen = snprintf(header, sizeof(header),
+                           "HTTP/1.0 200 OK\r\n"
+                           "Content-Type: text/plain; version=0.0.4\r\n"
+                           "Content-Length: %d\r\n\r\n", len);
+  conn->response = malloc(headerLen + len);
+  if (conn->response == NULL) {
+    fprintf(stderr, "_PCA9685_metricsRespond(): malloc() failed\n");
+    return -1;
+  } // if
+  memcpy(conn->response, header, headerLen);
+  memcpy(conn->response + headerLen, metrics->text, len);
+  conn->len = headerLen + len;
+  conn->sent = 0;
+  return 0;
+} // _PCA9685_metricsRespond
+
+
+
+/////////////////////////////////////////////////////////////////////
+// close a scrape and free its slot
+static void _PCA9685_metricsClose(PCA9685_metricsConn* conn) {
+  close(conn->fd);
+  conn->fd = -1;
+  free(conn->response);
+  conn->response = NULL;
+} // _PCA9685_metricsClose
+
+
+
+/////////////////////////////////////////////////////////////////////
+// accept pending scrapes and move each along without blocking
+int PCA9685_metricsService(PCA9685_metrics* metrics) {
+  int scrapes = 0;
+  int64_t nowMs = _PCA9685_metricsNowMs();
+  int ret = 0;
+  int i;
+
+  // new scrapes take the free slots, the rest wait in the backlog
+  for (i = 0; i < _PCA9685_METRICSCONNS && metrics->listenFd >= 0; i++) {
+    PCA9685_metricsConn* conn = &metrics->conns[i];
+    if (conn->fd >= 0) continue;
+    conn->fd = accept4(metrics->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (conn->fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        fprintf(stderr, "PCA9685_metricsService(): accept4() failed: %s\n", strerror(errno));
+        ret = -1;
+      } // if
+      break;
+    } // if
+    conn->acceptedMs = nowMs;
+  } // for free slots
+
+  for (i = 0; i < _PCA9685_METRICSCONNS; i++) {
+    PCA9685_metricsConn* conn = &metrics->conns[i];
+    if (conn->fd < 0) continue;
+
+    // read the request, whatever it asks for the answer is the metrics;
+    // closing with it unread would reset the connection instead
+    if (conn->response == NULL) {
+      char request[1024];
+      ssize_t n = read(conn->fd, request, sizeof(request));
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        if (nowMs - conn->acceptedMs < _PCA9685_METRICSWAITMS) continue;
+      } else if (n < 0) {
+        _PCA9685_metricsClose(conn);
+        continue;
+      } // if
+      if (_PCA9685_metricsRespond(metrics, conn) != 0) {
+        _PCA9685_metricsClose(conn);
+        continue;
+      } // if
+    } // if reading
+
+    // as much as the socket takes, the rest on a later call
+    int full = 0;
+    while (conn->sent < conn->len) {
+      ssize_t n = send(conn->fd, conn->response + conn->sent, conn->len - conn->sent,
+                       MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (n <= 0) {
+        full = (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+        break;
+      } // if
+      conn->sent += n;
+    } // while sending
+    if (conn->sent == conn->len) {
+      shutdown(conn->fd, SHUT_WR);
+      _PCA9685_metricsClose(conn);
+      metrics->scrapes++;
+      scrapes++;
+    } else if (!full) {
+      _PCA9685_metricsClose(conn);
+    } else if (nowMs - conn->acceptedMs >= _PCA9685_METRICSTIMEOUTMS) {
+      // a scraper that stopped reading loses its slot
+      _PCA9685_metricsClose(conn);
+    } // if
+  } // for conns
+  return (ret ? ret : scrapes);
+} // PCA9685_metricsService
+
+
+
+/////////////////////////////////////////////////////////////////////
+// append to the metrics text, len becomes -1 once it overflows
+static void _PCA9685_metricsAppend(char* text, size_t size, int* len, const char* format, ...) {
+  if (*len < 0) return;
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(text + *len, size - *len, format, args);
+  va_end(args);
+  if (n < 0 || (size_t) n >= size - *len) {
+    *len = -1;
+    return;
+  } // if overflow
+  *len += n;
+} // _PCA9685_metricsAppend
+
+
+
+/////////////////////////////////////////////////////////////////////
+// append one engine total with its help and type
+static void _PCA9685_metricsTotal(char* text, size_t size, int* len, const char* name,
+                                  const char* type, const char* help, double value) {
+  _PCA9685_metricsAppend(text, size, len, "# HELP pca9685_%s %s\n# TYPE pca9685_%s %s\n"
+                         "pca9685_%s %.17g\n", name, help, name, type, name, value);
+} // _PCA9685_metricsTotal
+
+
+
+/////////////////////////////////////////////////////////////////////
+// append a log2 microsecond histogram in seconds
+static void _PCA9685_metricsHist(char* text, size_t size, int* len, const char* name,
+                                 const char* help, const uint64_t* hist, const int64_t* sumNs) {
+  _PCA9685_metricsAppend(text, size, len, "# HELP pca9685_%s %s\n# TYPE pca9685_%s histogram\n",
+                         name, help, name);
+  uint64_t count = 0;
+  int b;
+  for (b = 0; b < _PCA9685_ENGINEHIST - 1; b++) {
+    count += __atomic_load_n(&hist[b], __ATOMIC_RELAXED);
+    _PCA9685_metricsAppend(text, size, len, "pca9685_%s_bucket{le=\"%g\"} %llu\n",
+                           name, (double) (1 << b) / 1e6, (unsigned long long) count);
+  } // for buckets
+  count += __atomic_load_n(&hist[b], __ATOMIC_RELAXED);
+  _PCA9685_metricsAppend(text, size, len, "pca9685_%s_bucket{le=\"+Inf\"} %llu\n"
+                         "pca9685_%s_sum %.9f\npca9685_%s_count %llu\n",
+                         name, (unsigned long long) count,
+                         name, __atomic_load_n(sumNs, __ATOMIC_RELAXED) / 1e9,
+                         name, (unsigned long long) count);
+} // _PCA9685_metricsHist
+
+
+
+/////////////////////////////////////////////////////////////////////
+// format the metrics in the Prometheus text format
+int PCA9685_metricsFormat(PCA9685_metrics* metrics, char* text, size_t size) {
+  PCA9685_engine* e = metrics->engine;
+  int len = 0;
+#define _PCA9685_LOAD(counter) (double) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+  _PCA9685_metricsTotal(text, size, &len, "fps", "gauge",
+                        "Frame ticks per second.", _PCA9685_LOAD(e->fps));
+  _PCA9685_metricsTotal(text, size, &len, "ticks_total", "counter",
+                        "Frame ticks serviced.", _PCA9685_LOAD(e->ticks));
+  _PCA9685_metricsTotal(text, size, &len, "ticks_missed_total", "counter",
+                        "Frame ticks that expired unserviced.", _PCA9685_LOAD(e->missed));
+  _PCA9685_metricsTotal(text, size, &len, "frames_total", "counter",
+                        "Frames written with at least one message.", _PCA9685_LOAD(e->frames));
+  _PCA9685_metricsTotal(text, size, &len, "submits_total", "counter",
+                        "Device frames submitted by the app.", _PCA9685_LOAD(e->submits));
+  _PCA9685_metricsTotal(text, size, &len, "coalesced_total", "counter",
+                        "Submitted device frames replaced before writing.",
+                        _PCA9685_LOAD(e->coalesced));
+  _PCA9685_metricsTotal(text, size, &len, "messages_total", "counter",
+                        "I2C messages transferred.", _PCA9685_LOAD(e->msgsSent));
+  _PCA9685_metricsTotal(text, size, &len, "bytes_total", "counter",
+                        "I2C message bytes transferred, without addresses.",
+                        _PCA9685_LOAD(e->bytesSent));
+  _PCA9685_metricsTotal(text, size, &len, "probes_total", "counter",
+                        "MODE1 probes read.", _PCA9685_LOAD(e->probes));
+  _PCA9685_metricsTotal(text, size, &len, "deadband_channels_total", "counter",
+                        "Channel changes held back by the deadband, 4 register bytes each.",
+                        _PCA9685_LOAD(e->deadbanded));
+  _PCA9685_metricsTotal(text, size, &len, "deadband_frames_total", "counter",
+                        "Submitted device frames the deadband held back whole.",
+                        _PCA9685_LOAD(e->deadbandFrames));
+  _PCA9685_metricsTotal(text, size, &len, "deadband_bytes_total", "counter",
+                        "I2C message bytes the deadband kept off the buses.",
+                        _PCA9685_LOAD(e->deadbandBytes));
+  _PCA9685_metricsTotal(text, size, &len, "deadband_messages_total", "counter",
+                        "I2C span messages the deadband kept off the buses.",
+                        _PCA9685_LOAD(e->deadbandMsgs));
+  _PCA9685_metricsTotal(text, size, &len, "transaction_errors_total", "counter",
+                        "Frame transactions that failed.", _PCA9685_LOAD(e->txErrors));
+  _PCA9685_metricsTotal(text, size, &len, "transaction_timeouts_total", "counter",
+                        "Frame transactions the adapter timed out.",
+                        _PCA9685_LOAD(e->txTimeouts));
+  _PCA9685_metricsTotal(text, size, &len, "bus_busy_seconds_total", "counter",
+                        "Time spent in frame transactions, rate() is the bus utilization.",
+                        _PCA9685_LOAD(e->txSumNs) / 1e9);
+  _PCA9685_metricsTotal(text, size, &len, "transaction_max_seconds", "gauge",
+                        "Longest frame transaction.", _PCA9685_LOAD(e->txMaxNs) / 1e9);
+  _PCA9685_metricsTotal(text, size, &len, "deferred_spans_total", "counter",
+                        "Span messages held over to a later frame by the bus budget.",
+                        _PCA9685_LOAD(e->deferred));
+  _PCA9685_metricsTotal(text, size, &len, "stale_max_seconds", "gauge",
+                        "Longest a channel change waited to be written.",
+                        _PCA9685_LOAD(e->maxStaleNs) / 1e9);
+  _PCA9685_metricsHist(text, size, &len, "transaction_seconds",
+                       "Frame transaction time.", e->txHist, &e->txSumNs);
+  _PCA9685_metricsHist(text, size, &len, "tick_late_seconds",
+                       "Frame tick lateness.", e->lateHist, &e->sumLateNs);
+#undef _PCA9685_LOAD
+
+  // per device health, one family at a time as the format requires
+  static const char* families[][3] = {
+    { "device_up", "gauge", "1 while the device is written every frame." },
+    { "device_errors_total", "counter", "Failed writes and retries." },
+    { "device_recoveries_total", "counter", "Re-initializations after failing." },
+    { "device_resets_total", "counter", "Brownouts or resets found by MODE1 probes." },
+    { "device_backoff_seconds", "gauge", "Wait before the next retry." },
+    { "device_timeouts_total", "counter", "Failed writes and retries the adapter timed out." },
+    { "device_transaction_max_seconds", "gauge", "Longest transaction the device was in." },
+    { "device_stale_max_seconds", "gauge", "Longest a channel change waited to be written." },
+  };
+  int f, dev;
+  for (f = 0; f < (int) (sizeof(families) / sizeof(families[0])); f++) {
+    _PCA9685_metricsAppend(text, size, &len, "# HELP pca9685_%s %s\n# TYPE pca9685_%s %s\n",
+                           families[f][0], families[f][2], families[f][0], families[f][1]);
+    for (dev = 0; dev < e->devs; dev++) {
+      PCA9685_devHealth health;
+      PCA9685_engineGetHealth(e, dev, &health);
+      double value = 0;
+      switch (f) {
+      case 0: value = (health.state == PCA9685_DEVOK); break;
+      case 1: value = health.errors; break;
+      case 2: value = health.recoveries; break;
+      case 3: value = health.resets; break;
+      case 4: value = (health.state == PCA9685_DEVOK ? 0 : health.backoffNs / 1e9); break;
+      case 5: value = health.timeouts; break;
+      case 6: value = health.maxTxNs / 1e9; break;
+      case 7: value = health.maxStaleNs / 1e9; break;
+      } // switch family
+      _PCA9685_metricsAppend(text, size, &len,
+                             "pca9685_%s{dev=\"%d\",fd=\"%d\",addr=\"0x%02x\"} %.17g\n",
+                             families[f][0], dev, e->dev[dev].fd, e->dev[dev].addr, value);
+    } // for devices
+  } // for families
+
+  if (len < 0) {
+    fprintf(stderr, "PCA9685_metricsFormat(): %zu bytes are too few\n", size);
+    return -1;
+  } // if
+  return len;
+} // PCA9685_metricsFormat
+
+
+
+/////////////////////////////////////////////////////////////////////
+// write the metrics to a file, through a rename
+int PCA9685_metricsDump(PCA9685_metrics* metrics, const char* path) {
+  if (_PCA9685_metricsFit(metrics) != 0) return -1;
+  int len = PCA9685_metricsFormat(metrics, metrics->text, metrics->size);
+  if (len < 0) return -1;
+
+  char tmp[4096];
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int) sizeof(tmp)) {
+    fprintf(stderr, "PCA9685_metricsDump(): path too long: %s\n", path);
+    return -1;
+  } // if
+  FILE* file = fopen(tmp, "w");
+  if (file == NULL) {
+    fprintf(stderr, "PCA9685_metricsDump(): fopen(%s) failed: %s\n", tmp, strerror(errno));
+    return -1;
+  } // if
+  int ok = (fwrite(metrics->text, 1, len, file) == (size_t) len);
+  ok = (fclose(file) == 0) && ok;
+  if (!ok || rename(tmp, path) != 0) {
+    fprintf(stderr, "PCA9685_metricsDump(): failed to write %s: %s\n", path, strerror(errno));
+    unlink(tmp);
+    return -1;
+  } // if
+  return 0;
+} // PCA9685_metricsDump
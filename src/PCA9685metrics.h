@@ -0,0 +1,90 @@
+#ifndef _PCA9685METRICS_H
+#define _PCA9685METRICS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <poll.h>
+
+#include "PCA9685engine.h"
+
+// metrics text bytes for the engine totals, plus per device
+#define _PCA9685_METRICSBASE	8192
+#define _PCA9685_METRICSDEV	1024
+
+// max wait for a scraper's request after accepting it, the metrics are
+// sent without one after that
+#define _PCA9685_METRICSWAITMS	100
+
+// scrapes served at once, and the time one has to finish before it is
+// dropped
+#define _PCA9685_METRICSCONNS	8
+#define _PCA9685_METRICSTIMEOUTMS	1000
+
+// pollfds PCA9685_metricsPollFds() fills at most
+#define _PCA9685_METRICSFDS	(1 + _PCA9685_METRICSCONNS)
+
+// a scrape in progress on a non-blocking socket
+typedef struct PCA9685_metricsConn {
+  int fd;                       // accepted socket, -1 for a free slot
+  int64_t acceptedMs;           // monotonic time it was accepted
+  char* response;               // HTTP response, NULL while reading
+  int len;                      // length of response
+  int sent;                     // bytes of response sent so far
+} PCA9685_metricsConn;
+
+// Prometheus text exporter for an engine
+typedef struct PCA9685_metrics {
+  PCA9685_engine* engine;       // engine whose counters are exported
+  int listenFd;                 // listening socket, -1 until listening
+  char* path;                   // unix socket path, unlinked when destroyed
+  char* text;                   // buffer the metrics are formatted into
+  size_t size;                  // size of text
+  unsigned long long scrapes;   // responses served
+  PCA9685_metricsConn conns[_PCA9685_METRICSCONNS]; // scrapes in progress
+} PCA9685_metrics;
+
+
+// create an exporter for an engine, the text buffer grows with devices
+// added later
+PCA9685_metrics* PCA9685_metricsCreate(PCA9685_engine* engine);
+
+// close the socket and free the exporter, the engine is left alone
+void PCA9685_metricsDestroy(PCA9685_metrics* metrics);
+
+// listen on a unix domain socket at path, replacing a stale one but
+// neither a socket something still listens on nor any other file
+int PCA9685_metricsListenUnix(PCA9685_metrics* metrics, const char* path);
+
+// listen on a TCP port on the loopback address only
+int PCA9685_metricsListenTcp(PCA9685_metrics* metrics, unsigned short port);
+
+// listening socket to poll for reading, -1 until listening
+int PCA9685_metricsFd(PCA9685_metrics* metrics);
+
+// fill fds with the listening socket and the scrapes in progress, at
+// most _PCA9685_METRICSFDS, for the app's poll(); returns the count
+int PCA9685_metricsPollFds(PCA9685_metrics* metrics, struct pollfd* fds);
+
+// accept pending scrapes and move every one in progress along as far as
+// its socket allows, each answered with an HTTP response of the metrics;
+// never blocks, so a slow scraper cannot hold up the caller's loop;
+// returns the number of scrapes finished
+int PCA9685_metricsService(PCA9685_metrics* metrics);
+
+// format the metrics in the Prometheus text format, returns the length
+// or -1 if the buffer is too small; reads the engine without a lock
+int PCA9685_metricsFormat(PCA9685_metrics* metrics, char* text, size_t size);
+
+// write the metrics to a file, through a rename so readers such as the
+// node_exporter textfile collector never see a partial file
+int PCA9685_metricsDump(PCA9685_metrics* metrics, const char* path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,467 @@
+// recordings may be larger than 2 GB on 32-bit platforms
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+
+#include "PCA9685rec.h"
+
+// recorder that _PCA9685_ioctl() appends to
+PCA9685_recorder* _PCA9685_RECORDER = NULL;
+
+
+/////////////////////////////////////////////////////////////////////
+// create a recording file of segments * segSize preallocated bytes
+PCA9685_recorder* PCA9685_recCreate(const char* path, unsigned int segments,
+                                    size_t segSize) {
+  if (segments < 2 || segSize < 256 || segSize % 8) {
+    fprintf(stderr, "PCA9685_recCreate(): need 2 or more segments of 256 or more bytes, ");
+    fprintf(stderr, "a multiple of 8, not %u of %zu\n", segments, segSize);
+    return NULL;
+  } // if
+
+  PCA9685_recorder* rec = calloc(1, sizeof(PCA9685_recorder));
+  if (rec == NULL) {
+    fprintf(stderr, "PCA9685_recCreate(): calloc() failed\n");
+    return NULL;
+  } // if
+  rec->ringSize = (uint64_t) segments * segSize;
+  rec->size = _PCA9685_RECDATA + rec->ringSize;
+
+  // allocate every block now so appending never extends the file
+  rec->file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (rec->file < 0 || posix_fallocate(rec->file, 0, rec->size) != 0) {
+    fprintf(stderr, "PCA9685_recCreate(): failed to create %zu bytes for %s\n",
+            rec->size, path);
+    if (rec->file >= 0) close(rec->file);
+    free(rec);
+    return NULL;
+  } // if
+
+  // populate the mapping so appending never faults a page in
+  void* map = mmap(NULL, rec->size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, rec->file, 0);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "PCA9685_recCreate(): mmap() failed for %s\n", path);
+    close(rec->file);
+    free(rec);
+    return NULL;
+  } // if
+  rec->hdr = map;
+  rec->data = (unsigned char*) map + _PCA9685_RECDATA;
+
+  PCA9685_recHeader* hdr = rec->hdr;
+  memcpy(hdr->magic, _PCA9685_RECMAGIC, sizeof(hdr->magic));
+  hdr->version = _PCA9685_RECVERSION;
+  hdr->segments = segments;
+  hdr->segSize = segSize;
+  int fd;
+  // the fds opened so far, 0xFF for unknown
+  for (fd = 0; fd < _PCA9685_RECFDS; fd++) {
+    hdr->fdAdpt[fd] = (uint8_t) _PCA9685_getAdapter(fd);
+  } // for fds
+
+  if (_PCA9685_DEBUG) {
+    printf("PCA9685_recCreate(): %s has %u segments of %zu bytes\n",
+           path, segments, segSize);
+  } // if debug
+
+  return rec;
+} // PCA9685_recCreate
+
+
+
+/////////////////////////////////////////////////////////////////////
+// start appending every I2C_RDWR transaction to rec
+void PCA9685_recStart(PCA9685_recorder* rec) {
+  __atomic_store_n(&_PCA9685_RECORDER, rec, __ATOMIC_RELEASE);
+} // PCA9685_recStart
+
+
+
+/////////////////////////////////////////////////////////////////////
+// stop appending transactions
+void PCA9685_recStop(void) {
+  __atomic_store_n(&_PCA9685_RECORDER, NULL, __ATOMIC_RELEASE);
+} // PCA9685_recStop
+
+
+
+/////////////////////////////////////////////////////////////////////
+// stop if recording, then sync, unmap and close a recording file
+void PCA9685_recClose(PCA9685_recorder* rec) {
+  if (rec == NULL) return;
+  PCA9685_recorder* expected = rec;
+  __atomic_compare_exchange_n(&_PCA9685_RECORDER, &expected, NULL, 0,
+                              __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+  if (_PCA9685_DEBUG) {
+    printf("PCA9685_recClose(): head at %llu, %llu dropped\n",
+           (unsigned long long) rec->hdr->head,
+           (unsigned long long) rec->hdr->dropped);
+  } // if debug
+  msync(rec->hdr, rec->size, MS_SYNC);
+  munmap(rec->hdr, rec->size);
+  close(rec->file);
+  free(rec);
+} // PCA9685_recClose
+
+
+
+/////////////////////////////////////////////////////////////////////
+// append one I2C_RDWR transaction without a system call or a lock
+int _PCA9685_recAppend(PCA9685_recorder* rec, int fd, const char* argp, int ret) {
+  const struct i2c_rdwr_ioctl_data* data = (const struct i2c_rdwr_ioctl_data*) argp;
+  PCA9685_recHeader* hdr = rec->hdr;
+  uint64_t segSize = hdr->segSize;
+
+  size_t len = sizeof(PCA9685_recRecord);
+  unsigned int i;
+  for (i = 0; i < data->nmsgs; i++) {
+    len += _PCA9685_RECMSGLEN(data->msgs[i].len);
+  } // for msgs
+  if (len > segSize) {
+    __atomic_fetch_add(&hdr->dropped, 1, __ATOMIC_RELAXED);
+    return -1;
+  } // if too large
+
+  // reserve len bytes, skipping to the next segment rather than splitting
+  uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_RELAXED);
+  uint64_t pos;
+  do {
+    pos = head;
+    if (pos % segSize + len > segSize) {
+      pos += segSize - pos % segSize;
+    } // if split
+  } while (!__atomic_compare_exchange_n(&hdr->head, &head, pos + len, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  // clock_gettime() is a vDSO call, not a system call
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  PCA9685_recRecord* record = (PCA9685_recRecord*) &rec->data[pos % rec->ringSize];
+  record->timestampNs = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+  record->len = len;
+  record->fd = fd;
+  record->ret = ret;
+  record->nmsgs = data->nmsgs;
+  record->reserved = 0;
+  PCA9685_recMsg* msg = (PCA9685_recMsg*) (record + 1);
+  for (i = 0; i < data->nmsgs; i++) {
+    msg->addr = data->msgs[i].addr;
+    msg->flags = data->msgs[i].flags;
+    msg->len = data->msgs[i].len;
+    msg->reserved = 0;
+    memcpy(msg + 1, data->msgs[i].buf, msg->len);
+    msg = (PCA9685_recMsg*) ((unsigned char*) msg + _PCA9685_RECMSGLEN(msg->len));
+  } // for msgs
+
+  // publish the record, readers ignore records whose seq is stale
+  __atomic_store_n(&record->seq, pos, __ATOMIC_RELEASE);
+  return 0;
+} // _PCA9685_recAppend
+
+
+
+/////////////////////////////////////////////////////////////////////
+// note the adapter number of an fd in a recording in progress, called
+// by PCA9685_openI2C()
+void _PCA9685_recNoteAdapter(int fd, unsigned char adpt) {
+  if (fd < 0 || fd >= _PCA9685_RECFDS) return;
+  PCA9685_recorder* rec = __atomic_load_n(&_PCA9685_RECORDER, __ATOMIC_ACQUIRE);
+  if (rec) rec->hdr->fdAdpt[fd] = adpt;
+} // _PCA9685_recNoteAdapter
+
+
+
+/////////////////////////////////////////////////////////////////////
+// adapter number of an fd, _PCA9685_RECNOADPT if unknown
+unsigned char PCA9685_recAdapter(const PCA9685_recHeader* hdr, int fd) {
+  if (fd < 0 || fd >= _PCA9685_RECFDS) return _PCA9685_RECNOADPT;
+  return hdr->fdAdpt[fd];
+} // PCA9685_recAdapter
+
+
+
+/////////////////////////////////////////////////////////////////////
+// open a recording file for reading from its oldest intact record
+PCA9685_recReader* PCA9685_recOpen(const char* path) {
+  PCA9685_recReader* reader = calloc(1, sizeof(PCA9685_recReader));
+  if (reader == NULL) {
+    fprintf(stderr, "PCA9685_recOpen(): calloc() failed\n");
+    return NULL;
+  } // if
+
+  reader->file = open(path, O_RDONLY);
+  struct stat st;
+  if (reader->file < 0 || fstat(reader->file, &st) != 0 ||
+      st.st_size < _PCA9685_RECDATA) {
+    fprintf(stderr, "PCA9685_recOpen(): failed to open %s\n", path);
+    if (reader->file >= 0) close(reader->file);
+    free(reader);
+    return NULL;
+  } // if
+  reader->size = st.st_size;
+
+  void* map = mmap(NULL, reader->size, PROT_READ, MAP_SHARED, reader->file, 0);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "PCA9685_recOpen(): mmap() failed for %s\n", path);
+    close(reader->file);
+    free(reader);
+    return NULL;
+  } // if
+  reader->hdr = map;
+  reader->data = (const unsigned char*) map + _PCA9685_RECDATA;
+
+  const PCA9685_recHeader* hdr = reader->hdr;
+  reader->ringSize = (uint64_t) hdr->segments * hdr->segSize;
+  if (memcmp(hdr->magic, _PCA9685_RECMAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != _PCA9685_RECVERSION || hdr->segments < 2 ||
+      hdr->segSize == 0 || hdr->segSize % 8 ||
+      _PCA9685_RECDATA + reader->ringSize > reader->size) {
+    fprintf(stderr, "PCA9685_recOpen(): %s is not a valid version %d recording\n",
+            path, _PCA9685_RECVERSION);
+    PCA9685_recCloseReader(reader);
+    return NULL;
+  } // if invalid
+
+  // the segment at the head is being overwritten, the rest are intact
+  reader->end = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+  uint64_t headSeg = reader->end - reader->end % hdr->segSize;
+  uint64_t keep = (uint64_t) (hdr->segments - 1) * hdr->segSize;
+  reader->start = (headSeg > keep ? headSeg - keep : 0);
+  reader->pos = reader->start;
+
+  if (_PCA9685_DEBUG) {
+    printf("PCA9685_recOpen(): %s has %llu bytes from %llu, %llu dropped\n",
+           path, (unsigned long long) (reader->end - reader->start),
+           (unsigned long long) reader->start, (unsigned long long) hdr->dropped);
+  } // if debug
+
+  return reader;
+} // PCA9685_recOpen
+
+
+
+/////////////////////////////////////////////////////////////////////
+// unmap and close a recording file
+void PCA9685_recCloseReader(PCA9685_recReader* reader) {
+  if (reader == NULL) return;
+  munmap((void*) reader->hdr, reader->size);
+  close(reader->file);
+  free(reader);
+} // PCA9685_recCloseReader
+
+
+
+/////////////////////////////////////////////////////////////////////
+// get the next record, NULL at the end of the recording
+const PCA9685_recRecord* PCA9685_recNext(PCA9685_recReader* reader) {
+  uint64_t segSize = reader->hdr->segSize;
+  while (reader->pos < reader->end) {
+    uint64_t pos = reader->pos;
+    uint64_t segLeft = segSize - pos % segSize;
+    if (segLeft >= sizeof(PCA9685_recRecord)) {
+      const PCA9685_recRecord* record =
+        (const PCA9685_recRecord*) &reader->data[pos % reader->ringSize];
+      // a stale seq marks the skipped tail of a segment or a torn append
+      if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) == pos &&
+          record->len >= sizeof(PCA9685_recRecord) && record->len <= segLeft) {
+        reader->pos = pos + record->len;
+        return record;
+      } // if valid
+    } // if room
+    reader->pos = pos + segLeft;
+  } // while
+  return NULL;
+} // PCA9685_recNext
+
+
+
+/////////////////////////////////////////////////////////////////////
+// rewind to the oldest intact record
+void PCA9685_recRewind(PCA9685_recReader* reader) {
+  reader->pos = reader->start;
+} // PCA9685_recRewind
+
+
+
+/////////////////////////////////////////////////////////////////////
+// get the first message of a record
+const PCA9685_recMsg* PCA9685_recFirstMsg(const PCA9685_recRecord* record) {
+  return (const PCA9685_recMsg*) (record + 1);
+} // PCA9685_recFirstMsg
+
+
+
+/////////////////////////////////////////////////////////////////////
+// get the message after msg in a record
+const PCA9685_recMsg* PCA9685_recNextMsg(const PCA9685_recMsg* msg) {
+  return (const PCA9685_recMsg*) ((const unsigned char*) msg + _PCA9685_RECMSGLEN(msg->len));
+} // PCA9685_recNextMsg
+
+
+
+/////////////////////////////////////////////////////////////////////
+// get the data bytes of a message
+const unsigned char* PCA9685_recMsgData(const PCA9685_recMsg* msg) {
+  return (const unsigned char*) (msg + 1);
+} // PCA9685_recMsgData
+
+
+
+/////////////////////////////////////////////////////////////////////
+// open the recorded adapters, fds maps each recorded fd to its new fd
+int PCA9685_recOpenI2C(PCA9685_recReader* reader, int* fds) {
+  int fd;
+  for (fd = 0; fd < _PCA9685_RECFDS; fd++) {
+    fds[fd] = -1;
+  } // for fds
+
+  // each adapter is opened once, at the first address sent to it
+  int adptFds[_PCA9685_RECFDS];
+  for (fd = 0; fd < _PCA9685_RECFDS; fd++) {
+    adptFds[fd] = -1;
+  } // for adapters
+  const PCA9685_recRecord* record;
+  uint64_t pos = reader->pos;
+  while ((record = PCA9685_recNext(reader)) != NULL) {
+    if (record->fd < 0 || record->fd >= _PCA9685_RECFDS || fds[record->fd] >= 0 ||
+        record->nmsgs == 0) {
+      continue;
+    } // if seen
+    unsigned char adpt = PCA9685_recAdapter(reader->hdr, record->fd);
+    if (adpt == _PCA9685_RECNOADPT) {
+      fprintf(stderr, "PCA9685_recOpenI2C(): no adapter recorded for fd %d\n", record->fd);
+      reader->pos = pos;
+      return -1;
+    } // if unknown
+    if (adptFds[adpt] < 0) {
+      adptFds[adpt] = PCA9685_openI2C(adpt, PCA9685_recFirstMsg(record)->addr);
+      if (adptFds[adpt] < 0) {
+        fprintf(stderr, "PCA9685_recOpenI2C(): PCA9685_openI2C() failed on adapter %d\n", adpt);
+        reader->pos = pos;
+        return -1;
+      } // if fd
+    } // if not open
+    fds[record->fd] = adptFds[adpt];
+  } // while records
+  reader->pos = pos;
+  return 0;
+} // PCA9685_recOpenI2C
+
+
+
+/////////////////////////////////////////////////////////////////////
+// reissue every record with the recorded timing divided by speed
+int PCA9685_recReplay(PCA9685_recReader* reader, const int* fds, double speed,
+                      PCA9685_recStats* stats) {
+  memset(stats, 0, sizeof(PCA9685_recStats));
+  if (!(speed > 0)) {
+    fprintf(stderr, "PCA9685_recReplay(): invalid speed %f\n", speed);
+    return -1;
+  } // if speed
+
+  // the mapping is read-only and reads need somewhere to land
+  unsigned char* buf = malloc(reader->hdr->segSize);
+  if (buf == NULL) {
+    fprintf(stderr, "PCA9685_recReplay(): malloc() failed\n");
+    return -1;
+  } // if
+  struct i2c_msg msgs[_PCA9685_BATCHMSGS];
+  struct i2c_rdwr_ioctl_data data;
+  data.msgs = msgs;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t startNs = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+  uint64_t firstNs = 0;
+  uint64_t lastNs = 0;
+  uint64_t deadlineNs = startNs;
+  uint64_t firstIssueNs = 0;
+  uint64_t lastIssueNs = 0;
+  int64_t sumLateNs = 0;
+  int ret = 0;
+
+  const PCA9685_recRecord* record;
+  while ((record = PCA9685_recNext(reader)) != NULL) {
+    if (stats->records == 0) firstNs = record->timestampNs;
+    if (record->nmsgs > _PCA9685_BATCHMSGS) {
+      fprintf(stderr, "PCA9685_recReplay(): record of %d msgs skipped\n", record->nmsgs);
+      continue;
+    } // if too many
+
+    // absolute deadlines, so lateness never accumulates; sleep short of
+    // the deadline by the timer slack and spin the rest
+    deadlineNs = startNs + (uint64_t) ((record->timestampNs - firstNs) / speed);
+    uint64_t nowNs;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    nowNs = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    if (deadlineNs > nowNs + _PCA9685_RECSPINNS) {
+      uint64_t wakeNs = deadlineNs - _PCA9685_RECSPINNS;
+      struct timespec wake = { wakeNs / 1000000000, wakeNs % 1000000000 };
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR);
+    } // if far
+    do {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      nowNs = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    } while (nowNs < deadlineNs);
+
+    const PCA9685_recMsg* msg = PCA9685_recFirstMsg(record);
+    unsigned char* p = buf;
+    int m;
+    for (m = 0; m < record->nmsgs; m++, msg = PCA9685_recNextMsg(msg)) {
+      msgs[m].addr = msg->addr;
+      msgs[m].flags = msg->flags;
+      msgs[m].len = msg->len;
+      msgs[m].buf = p;
+      memcpy(p, PCA9685_recMsgData(msg), msg->len);
+      p += msg->len;
+    } // for msgs
+    data.nmsgs = record->nmsgs;
+
+    int fd = record->fd;
+    if (fds) fd = (fd >= 0 && fd < _PCA9685_RECFDS ? fds[fd] : -1);
+
+    int64_t lateNs = (int64_t) (nowNs - deadlineNs);
+    if (lateNs > stats->maxLateNs) stats->maxLateNs = lateNs;
+    sumLateNs += lateNs;
+    if (stats->records == 0) firstIssueNs = nowNs;
+    lastIssueNs = nowNs;
+    lastNs = record->timestampNs;
+    stats->records++;
+
+    // the adapter's transfer path, so an SMBus-only or single message
+    // adapter replays what it was recorded carrying out
+    if (fd < 0 || _PCA9685_transfer(fd, (char *) &data) < 0) {
+      stats->failed++;
+      ret = -1;
+    } // if failed
+  } // while records
+
+  // from the first record issued to the last, against the recording
+  // between them at speed, so neither the first wait nor the last
+  // transaction counts
+  if (stats->records) {
+    stats->meanLateNs = sumLateNs / (int64_t) stats->records;
+    stats->driftNs = (int64_t) (lastIssueNs - firstIssueNs) -
+                     (int64_t) ((lastNs - firstNs) / speed);
+  } // if records
+  free(buf);
+
+  if (_PCA9685_DEBUG) {
+    printf("PCA9685_recReplay(): %llu records at %gx, %llu failed\n",
+           (unsigned long long) stats->records, speed, (unsigned long long) stats->failed);
+  } // if debug
+
+  return ret;
+} // PCA9685_recReplay
@@ -0,0 +1,164 @@
+#ifndef _PCA9685REC_H
+#define _PCA9685REC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "PCA9685.h"
+
+// recording file identification
+#define _PCA9685_RECMAGIC	"PCA9685R"
+#define _PCA9685_RECVERSION	1
+
+// file offset of the first segment, one page for the header
+#define _PCA9685_RECDATA	4096
+
+// default ring geometry, 16 segments of 1 MB
+#define _PCA9685_RECSEGS	16
+#define _PCA9685_RECSEGSIZE	(1 << 20)
+
+// replay spins rather than sleeps this close to a deadline, the
+// default timer slack of a non-realtime thread
+#define _PCA9685_RECSPINNS	50000
+
+// fds whose adapter number is noted in the header
+#define _PCA9685_RECFDS		256
+// adapter number of an fd that was not opened by PCA9685_openI2C()
+#define _PCA9685_RECNOADPT	0xFF
+
+// recording file header, all fields little-endian (host order on the Pi)
+typedef struct PCA9685_recHeader {
+  char magic[8];                // _PCA9685_RECMAGIC
+  uint16_t version;             // _PCA9685_RECVERSION
+  uint16_t reserved;            // zero
+  uint32_t segments;            // segments in the ring
+  uint64_t segSize;             // bytes per segment, a multiple of 8
+  uint64_t head;                // ring offset of the next record, never wraps
+  uint64_t dropped;             // transactions larger than a segment
+  uint8_t fdAdpt[_PCA9685_RECFDS]; // adapter number per fd
+} PCA9685_recHeader;
+
+// one recorded I2C_RDWR transaction, followed by its messages
+typedef struct PCA9685_recRecord {
+  uint64_t seq;                 // ring offset of the record, stored last
+  uint64_t timestampNs;         // CLOCK_MONOTONIC when the ioctl returned
+  uint32_t len;                 // bytes of the record and its messages
+  int32_t fd;                   // I2C bus fd
+  int16_t ret;                  // ioctl() return value
+  uint16_t nmsgs;               // messages in the transaction
+  uint32_t reserved;            // zero
+} PCA9685_recRecord;
+
+// one message of a record, followed by len data bytes padded to 8
+typedef struct PCA9685_recMsg {
+  uint16_t addr;                // I2C address
+  uint16_t flags;               // I2C_M_RD for reads
+  uint16_t len;                 // data bytes
+  uint16_t reserved;            // zero
+} PCA9685_recMsg;
+
+// bytes of a message and its padded data
+#define _PCA9685_RECMSGLEN(len)	(sizeof(PCA9685_recMsg) + (((len) + 7) & ~7))
+
+// recording file mapped for appending
+typedef struct PCA9685_recorder {
+  int file;                     // recording file descriptor
+  size_t size;                  // bytes mapped
+  PCA9685_recHeader* hdr;       // mapped header
+  unsigned char* data;          // mapped first segment
+  uint64_t ringSize;            // segments * segSize
+} PCA9685_recorder;
+
+// recording file mapped for reading
+typedef struct PCA9685_recReader {
+  int file;                     // recording file descriptor
+  size_t size;                  // bytes mapped
+  const PCA9685_recHeader* hdr; // mapped header
+  const unsigned char* data;    // mapped first segment
+  uint64_t ringSize;            // segments * segSize
+  uint64_t start;               // ring offset of the oldest intact segment
+  uint64_t end;                 // ring offset of the head when opened
+  uint64_t pos;                 // ring offset of the next record
+} PCA9685_recReader;
+
+// timing of a replay, lateness is issue time minus the scaled deadline
+typedef struct PCA9685_recStats {
+  uint64_t records;             // transactions replayed
+  uint64_t failed;              // transactions whose ioctl() failed
+  int64_t maxLateNs;            // worst lateness
+  int64_t meanLateNs;           // mean lateness
+  int64_t driftNs;              // first to last record issued, minus their recorded
+                                // span divided by speed
+} PCA9685_recStats;
+
+// recorder that _PCA9685_ioctl() appends to, NULL when not recording
+extern PCA9685_recorder* _PCA9685_RECORDER;
+
+
+// create a recording file of segments * segSize preallocated bytes
+PCA9685_recorder* PCA9685_recCreate(const char* path, unsigned int segments,
+                                    size_t segSize);
+
+// start appending every I2C_RDWR transaction to rec
+void PCA9685_recStart(PCA9685_recorder* rec);
+
+// stop appending transactions
+void PCA9685_recStop(void);
+
+// stop if recording, then sync, unmap and close a recording file
+void PCA9685_recClose(PCA9685_recorder* rec);
+
+// open a recording file for reading from its oldest intact record
+PCA9685_recReader* PCA9685_recOpen(const char* path);
+
+// unmap and close a recording file
+void PCA9685_recCloseReader(PCA9685_recReader* reader);
+
+// get the next record, NULL at the end of the recording
+const PCA9685_recRecord* PCA9685_recNext(PCA9685_recReader* reader);
+
+// rewind to the oldest intact record
+void PCA9685_recRewind(PCA9685_recReader* reader);
+
+// get the first message of a record
+const PCA9685_recMsg* PCA9685_recFirstMsg(const PCA9685_recRecord* record);
+
+// get the message after msg in a record
+const PCA9685_recMsg* PCA9685_recNextMsg(const PCA9685_recMsg* msg);
+
+// get the data bytes of a message
+const unsigned char* PCA9685_recMsgData(const PCA9685_recMsg* msg);
+
+// open the recorded adapters, fds maps each recorded fd to its new fd
+int PCA9685_recOpenI2C(PCA9685_recReader* reader, int* fds);
+
+// reissue every record from the reader's position with the recorded
+// timing divided by speed, on fds[recorded fd] or the recorded fd if
+// fds is NULL, through the adapter's transfer path like any other
+// transaction, and report the timing in stats
+int PCA9685_recReplay(PCA9685_recReader* reader, const int* fds, double speed,
+                      PCA9685_recStats* stats);
+
+// adapter number of an fd, _PCA9685_RECNOADPT if unknown
+unsigned char PCA9685_recAdapter(const PCA9685_recHeader* hdr, int fd);
+
+
+
+// append one I2C_RDWR transaction, called by _PCA9685_ioctl()
+int _PCA9685_recAppend(PCA9685_recorder* rec, int fd, const char* argp, int ret);
+
+// note the adapter number of an fd in a recording in progress, called
+// by PCA9685_openI2C(); recordings created later read the fds opened
+// so far with _PCA9685_getAdapter()
+void _PCA9685_recNoteAdapter(int fd, unsigned char adpt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "PCA9685servo.h"
+
+
+/////////////////////////////////////////////////////////////////////
+// fill one channel's angle table from its calibration and the period
+static void _PCA9685_servoBuildTable(PCA9685_servoRig* rig, int chan) {
+  PCA9685_servoCal* cal = &rig->cals[chan];
+  unsigned short* table = &rig->table[chan * (_PCA9685_SERVOSTEPS + 1)];
+  float span = cal->maxDeg - cal->minDeg;
+  float midDeg = cal->minDeg + span / 2.0f;
+
+  rig->stepsPerDeg[chan] = (span > 0.0f ? _PCA9685_SERVOSTEPS / span : 0.0f);
+
+  int i;
+  for (i = 0; i <= _PCA9685_SERVOSTEPS; i++) {
+    float deg = cal->minDeg + span * i / _PCA9685_SERVOSTEPS;
+    float us;
+    // piecewise linear through the center pulse
+    if (deg <= midDeg) {
+      float frac = (span > 0.0f ? (deg - cal->minDeg) / (midDeg - cal->minDeg) : 0.0f);
+      us = cal->minUs + frac * (cal->centerUs - cal->minUs);
+    } else {
+      float frac = (deg - midDeg) / (cal->maxDeg - midDeg);
+      us = cal->centerUs + frac * (cal->maxUs - cal->centerUs);
+    } // if deg
+    table[i] = PCA9685_servoUsToCount(rig, us);
+  } // for steps
+} // _PCA9685_servoBuildTable
+
+
+
+/////////////////////////////////////////////////////////////////////
+// recompute the period for freq and rebuild every angle table
+static void _PCA9685_servoSetPeriod(PCA9685_servoRig* rig, unsigned int freq) {
+  rig->freq = freq;
+  rig->prescale = _PCA9685_calcPrescale(freq);
+  rig->periodUs = _PCA9685_prescaleToPeriod(rig->prescale);
+  rig->countsPerUs = 4096.0f / rig->periodUs;
+
+  int chan;
+  for (chan = 0; chan < rig->boards * _PCA9685_CHANS; chan++) {
+    _PCA9685_servoBuildTable(rig, chan);
+  } // for chan
+} // _PCA9685_servoSetPeriod
+
+
+
+/////////////////////////////////////////////////////////////////////
+// write the offVals of every board in one transaction per board
+static int _PCA9685_servoWrite(PCA9685_servoRig* rig) {
+  int ret;
+  int board;
+  for (board = 0; board < rig->boards; board++) {
+    ret = PCA9685_setPWMVals(rig->fds[board], rig->addrs[board],
+                             &rig->onVals[board * _PCA9685_CHANS],
+                             &rig->offVals[board * _PCA9685_CHANS]);
+    if (ret != 0) {
+      fprintf(stderr, "_PCA9685_servoWrite(): PCA9685_setPWMVals() returned ");
+      fprintf(stderr, "%d on addr %02x\n", ret, rig->addrs[board]);
+      return -1;
+    } // if
+  } // for board
+  return 0;
+} // _PCA9685_servoWrite
+
+
+
+/////////////////////////////////////////////////////////////////////
+// create a servo rig for boards already initialized at freq
+PCA9685_servoRig* PCA9685_servoCreate(int boards, const int* fds,
+                                      const unsigned char* addrs,
+                                      unsigned int freq) {
+  if (boards <= 0) {
+    fprintf(stderr, "PCA9685_servoCreate(): invalid board count %d\n", boards);
+    return NULL;
+  } // if boards
+
+  int chans = boards * _PCA9685_CHANS;
+  PCA9685_servoRig* rig = calloc(1, sizeof(PCA9685_servoRig));
+  if (rig == NULL) {
+    fprintf(stderr, "PCA9685_servoCreate(): calloc() failed\n");
+    return NULL;
+  } // if
+  rig->boards = boards;
+  rig->fds = malloc(boards * sizeof(int));
+  rig->addrs = malloc(boards);
+  rig->cals = malloc(chans * sizeof(PCA9685_servoCal));
+  rig->stepsPerDeg = malloc(chans * sizeof(float));
+  rig->table = malloc(chans * (_PCA9685_SERVOSTEPS + 1) * sizeof(unsigned short));
+  rig->onVals = calloc(chans, sizeof(unsigned int));
+  rig->offVals = calloc(chans, sizeof(unsigned int));
+  if (!rig->fds || !rig->addrs || !rig->cals || !rig->stepsPerDeg ||
+      !rig->table || !rig->onVals || !rig->offVals) {
+    fprintf(stderr, "PCA9685_servoCreate(): malloc() failed\n");
+    PCA9685_servoDestroy(rig);
+    return NULL;
+  } // if
+
+  memcpy(rig->fds, fds, boards * sizeof(int));
+  memcpy(rig->addrs, addrs, boards);
+
+  int chan;
+  for (chan = 0; chan < chans; chan++) {
+    rig->cals[chan].minUs = _PCA9685_SERVOMINUS;
+    rig->cals[chan].centerUs = _PCA9685_SERVOCENTERUS;
+    rig->cals[chan].maxUs = _PCA9685_SERVOMAXUS;
+    rig->cals[chan].minDeg = _PCA9685_SERVOMINDEG;
+    rig->cals[chan].maxDeg = _PCA9685_SERVOMAXDEG;
+  } // for chan
+
+  _PCA9685_servoSetPeriod(rig, freq);
+
+  if (_PCA9685_DEBUG) {
+    printf("PCA9685_servoCreate(): %d boards, freq %d, prescale 0x%02x, period %.1fus\n",
+           boards, freq, rig->prescale, rig->periodUs);
+  } // if debug
+
+  return rig;
+} // PCA9685_servoCreate
+
+
+
+/////////////////////////////////////////////////////////////////////
+// free a servo rig
+void PCA9685_servoDestroy(PCA9685_servoRig* rig) {
+  if (rig == NULL) return;
+  free(rig->fds);
+  free(rig->addrs);
+  free(rig->cals);
+  free(rig->stepsPerDeg);
+  free(rig->table);
+  free(rig->onVals);
+  free(rig->offVals);
+  free(rig);
+} // PCA9685_servoDestroy
+
+
+
+/////////////////////////////////////////////////////////////////////
+// set the calibration of one channel and rebuild its angle table
+int PCA9685_servoSetCal(PCA9685_servoRig* rig, int chan,
+                        const PCA9685_servoCal* cal) {
+  if (chan < 0 || chan >= rig->boards * _PCA9685_CHANS) {
+    fprintf(stderr, "PCA9685_servoSetCal(): invalid channel %d\n", chan);
+    return -1;
+  } // if chan
+  if (cal->maxDeg < cal->minDeg) {
+    fprintf(stderr, "PCA9685_servoSetCal(): maxDeg %.1f below minDeg %.1f\n",
+            cal->maxDeg, cal->minDeg);
+    return -1;
+  } // if deg
+  // the tables would be clamped into moving backwards or at an end stop
+  if (cal->minUs <= 0.0f || cal->centerUs < cal->minUs || cal->maxUs < cal->centerUs) {
+    fprintf(stderr, "PCA9685_servoSetCal(): pulses %.1f, %.1f, %.1fus not positive and rising\n",
+            cal->minUs, cal->centerUs, cal->maxUs);
+    return -1;
+  } // if us
+  if (cal->maxUs >= rig->periodUs) {
+    fprintf(stderr, "PCA9685_servoSetCal(): maxUs %.1f not below the %.1fus period\n",
+            cal->maxUs, rig->periodUs);
+    return -1;
+  } // if period
+
+  rig->cals[chan] = *cal;
+  _PCA9685_servoBuildTable(rig, chan);
+  return 0;
+} // PCA9685_servoSetCal
+
+
+
+/////////////////////////////////////////////////////////////////////
+// change the PWM frequency of every board and rebuild the angle tables
+int PCA9685_servoSetFreq(PCA9685_servoRig* rig, unsigned int freq) {
+  int ret;
+  int board;
+  for (board = 0; board < rig->boards; board++) {
+    ret = _PCA9685_setPWMFreq(rig->fds[board], rig->addrs[board], freq);
+    if (ret != 0) {
+      fprintf(stderr, "PCA9685_servoSetFreq(): _PCA9685_setPWMFreq() returned ");
+      fprintf(stderr, "%d on addr %02x\n", ret, rig->addrs[board]);
+      // the angle tables are shared by every board, so put the boards
+      // already changed back at the old frequency the tables match
+      int undo;
+      for (undo = 0; undo < board; undo++) {
+        if (_PCA9685_setPWMFreq(rig->fds[undo], rig->addrs[undo], rig->freq) != 0) {
+          fprintf(stderr, "PCA9685_servoSetFreq(): could not restore %d on addr %02x\n",
+                  rig->freq, rig->addrs[undo]);
+        } // if
+      } // for undo
+      return -1;
+    } // if
+  } // for board
+
+  _PCA9685_servoSetPeriod(rig, freq);
+  return 0;
+} // PCA9685_servoSetFreq
+
+
+
+/////////////////////////////////////////////////////////////////////
+// convert a pulse width in microseconds to a 12-bit count
+unsigned int PCA9685_servoUsToCount(PCA9685_servoRig* rig, float us) {
+  float count = us * rig->countsPerUs + 0.5f;
+  if (count <= _PCA9685_MINVAL) return _PCA9685_MINVAL;
+  if (count >= _PCA9685_MAXVAL) return _PCA9685_MAXVAL;
+  return (unsigned int) count;
+} // PCA9685_servoUsToCount
+
+
+
+/////////////////////////////////////////////////////////////////////
+// convert an angle on a channel to a 12-bit count using its table
+unsigned int PCA9685_servoDegToCount(PCA9685_servoRig* rig, int chan,
+                                     float deg) {
+  float step = (deg - rig->cals[chan].minDeg) * rig->stepsPerDeg[chan] + 0.5f;
+  int i = (step <= 0.0f ? 0
+                        : (step >= _PCA9685_SERVOSTEPS ? _PCA9685_SERVOSTEPS
+                                                      : (int) step));
+  return rig->table[chan * (_PCA9685_SERVOSTEPS + 1) + i];
+} // PCA9685_servoDegToCount
+
+
+
+/////////////////////////////////////////////////////////////////////
+// set every channel of the rig from an array of angles (NAN for limp)
+int PCA9685_servoSetAngles(PCA9685_servoRig* rig, const float* angles) {
+  int chan;
+  for (chan = 0; chan < rig->boards * _PCA9685_CHANS; chan++) {
+    rig->offVals[chan] = (isnan(angles[chan])
+                          ? _PCA9685_MINVAL
+                          : PCA9685_servoDegToCount(rig, chan, angles[chan]));
+  } // for chan
+
+  if (_PCA9685_DEBUG) {
+    printf("PCA9685_servoSetAngles(): %d channels\n", rig->boards * _PCA9685_CHANS);
+  } // if debug
+
+  return _PCA9685_servoWrite(rig);
+} // PCA9685_servoSetAngles
+
+
+
+/////////////////////////////////////////////////////////////////////
+// set every channel of the rig from an array of pulse widths in us
+int PCA9685_servoSetPulses(PCA9685_servoRig* rig, const float* pulses) {
+  int chan;
+  for (chan = 0; chan < rig->boards * _PCA9685_CHANS; chan++) {
+    rig->offVals[chan] = (isnan(pulses[chan])
+                          ? _PCA9685_MINVAL
+                          : PCA9685_servoUsToCount(rig, pulses[chan]));
+  } // for chan
+
+  if (_PCA9685_DEBUG) {
+    printf("PCA9685_servoSetPulses(): %d channels\n", rig->boards * _PCA9685_CHANS);
+  } // if debug
+
+  return _PCA9685_servoWrite(rig);
+} // PCA9685_servoSetPulses
@@ -0,0 +1,80 @@
+#ifndef _PCA9685SERVO_H
+#define _PCA9685SERVO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "PCA9685.h"
+
+// entries per channel in the precomputed angle to count table
+#define _PCA9685_SERVOSTEPS	1024
+
+// default calibration for a hobby servo
+#define _PCA9685_SERVOMINUS	1000.0f
+#define _PCA9685_SERVOCENTERUS	1500.0f
+#define _PCA9685_SERVOMAXUS	2000.0f
+#define _PCA9685_SERVOMINDEG	0.0f
+#define _PCA9685_SERVOMAXDEG	180.0f
+
+// per-channel servo calibration, pulse widths in microseconds
+typedef struct PCA9685_servoCal {
+  float minUs;          // pulse width at minDeg
+  float centerUs;       // pulse width halfway between minDeg and maxDeg
+  float maxUs;          // pulse width at maxDeg
+  float minDeg;         // lowest angle accepted
+  float maxDeg;         // highest angle accepted
+} PCA9685_servoCal;
+
+// a rig of servo boards, channel n is board n / 16, LED n % 16
+typedef struct PCA9685_servoRig {
+  int boards;                   // number of PCA9685 devices
+  int* fds;                     // I2C bus fd per board
+  unsigned char* addrs;         // I2C address per board
+  unsigned int freq;            // requested PWM frequency
+  unsigned char prescale;       // prescale register value for freq
+  float periodUs;               // actual PWM period from the prescale
+  float countsPerUs;            // 12-bit counts per microsecond
+  PCA9685_servoCal* cals;       // calibration per channel
+  float* stepsPerDeg;           // table steps per degree per channel
+  unsigned short* table;        // angle to count table per channel
+  unsigned int* onVals;         // ON vals per channel, always zero
+  unsigned int* offVals;        // OFF vals per channel, last written
+} PCA9685_servoRig;
+
+
+// create a servo rig for boards already initialized at freq
+PCA9685_servoRig* PCA9685_servoCreate(int boards, const int* fds,
+                                      const unsigned char* addrs,
+                                      unsigned int freq);
+
+// free a servo rig
+void PCA9685_servoDestroy(PCA9685_servoRig* rig);
+
+// set the calibration of one channel and rebuild its angle table; the
+// pulse widths must be positive, rising and below the PWM period
+int PCA9685_servoSetCal(PCA9685_servoRig* rig, int chan,
+                        const PCA9685_servoCal* cal);
+
+// change the PWM frequency of every board and rebuild the angle tables,
+// on a failure the boards already changed are set back to the old one
+int PCA9685_servoSetFreq(PCA9685_servoRig* rig, unsigned int freq);
+
+// convert a pulse width in microseconds to a 12-bit count
+unsigned int PCA9685_servoUsToCount(PCA9685_servoRig* rig, float us);
+
+// convert an angle on a channel to a 12-bit count using its table
+unsigned int PCA9685_servoDegToCount(PCA9685_servoRig* rig, int chan,
+                                     float deg);
+
+// set every channel of the rig from an array of angles (NAN for limp)
+int PCA9685_servoSetAngles(PCA9685_servoRig* rig, const float* angles);
+
+// set every channel of the rig from an array of pulse widths in us
+int PCA9685_servoSetPulses(PCA9685_servoRig* rig, const float* pulses);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "PCA9685shm.h"
+
+
+/////////////////////////////////////////////////////////////////////
+// map an open segment
+static PCA9685_shm* _PCA9685_shmMap(const char* name, int fd, int owner) {
+  PCA9685_shm* shm = calloc(1, sizeof(PCA9685_shm));
+  if (shm == NULL) {
+    fprintf(stderr, "_PCA9685_shmMap(): calloc() failed\n");
+    close(fd);
+    return NULL;
+  } // if
+  shm->hdr = mmap(NULL, sizeof(PCA9685_shmHeader), PROT_READ | PROT_WRITE,
+                  MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm->hdr == MAP_FAILED) {
+    fprintf(stderr, "_PCA9685_shmMap(): mmap() failed on %s\n", name);
+    free(shm);
+    return NULL;
+  } // if
+  snprintf(shm->name, sizeof(shm->name), "%s", name);
+  shm->owner = owner;
+  return shm;
+} // _PCA9685_shmMap
+
+
+
+/////////////////////////////////////////////////////////////////////
+// 1 if a process is alive, whoever owns it
+static int _PCA9685_shmAlive(uint32_t pid) {
+  return pid != 0 && (kill(pid, 0) == 0 || errno == EPERM);
+} // _PCA9685_shmAlive
+
+
+
+/////////////////////////////////////////////////////////////////////
+// create the segment as the daemon, replacing one whose daemon is gone
+PCA9685_shm* PCA9685_shmCreate(const char* name, int gid) {
+  PCA9685_shm* old = PCA9685_shmAttach(name);
+  if (old) {
+    uint32_t pid = __atomic_load_n(&old->hdr->daemonPid, __ATOMIC_ACQUIRE);
+    PCA9685_shmClose(old);
+    if (_PCA9685_shmAlive(pid)) {
+      fprintf(stderr, "PCA9685_shmCreate(): %s is served by pid %u\n", name, pid);
+      return NULL;
+    } // if
+  } // if attached
+  // stale, or of another layout; a missing one is left for O_EXCL so a
+  // daemon starting at the same time is not unlinked
+  int oldFd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+  if (oldFd >= 0) {
+    close(oldFd);
+    shm_unlink(name);
+  } // if left behind
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    fprintf(stderr, "PCA9685_shmCreate(): shm_open(%s) failed: %s\n", name, strerror(errno));
+    return NULL;
+  } // if
+
+  // a client picks the boards a root daemon writes, so only the group
+  // may publish, whatever the daemon's umask
+  if ((gid >= 0 && fchown(fd, -1, gid) != 0) || fchmod(fd, 0660) != 0) {
+    fprintf(stderr, "PCA9685_shmCreate(): failed to give %s to group %d: %s\n",
+            name, gid, strerror(errno));
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  } // if
+  if (ftruncate(fd, sizeof(PCA9685_shmHeader)) != 0) {
+    fprintf(stderr, "PCA9685_shmCreate(): ftruncate() failed on %s\n", name);
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  } // if
+  PCA9685_shm* shm = _PCA9685_shmMap(name, fd, 1);
+  if (shm == NULL) {
+    shm_unlink(name);
+    return NULL;
+  } // if
+
+  PCA9685_shmHeader* hdr = shm->hdr;
+  hdr->version = _PCA9685_SHMVERSION;
+  hdr->slots = _PCA9685_SHMSLOTS;
+  hdr->boards = _PCA9685_SHMBOARDS;
+  hdr->daemonPid = getpid();
+  // the magic last, a client attaching early sees no segment yet
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(hdr->magic, _PCA9685_SHMMAGIC, sizeof(hdr->magic));
+  return shm;
+} // PCA9685_shmCreate
+
+
+
+/////////////////////////////////////////////////////////////////////
+// attach to an existing segment as a client, NULL if there is none
+PCA9685_shm* PCA9685_shmAttach(const char* name) {
+  int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+  if (fd < 0) return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size != sizeof(PCA9685_shmHeader)) {
+    fprintf(stderr, "PCA9685_shmAttach(): %s is not a pca9685d segment\n", name);
+    close(fd);
+    return NULL;
+  } // if
+  PCA9685_shm* shm = _PCA9685_shmMap(name, fd, 0);
+  if (shm == NULL) return NULL;
+
+  PCA9685_shmHeader* hdr = shm->hdr;
+  if (memcmp(hdr->magic, _PCA9685_SHMMAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != _PCA9685_SHMVERSION || hdr->slots != _PCA9685_SHMSLOTS ||
+      hdr->boards != _PCA9685_SHMBOARDS) {
+    fprintf(stderr, "PCA9685_shmAttach(): %s has another layout\n", name);
+    PCA9685_shmClose(shm);
+    return NULL;
+  } // if
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return shm;
+} // PCA9685_shmAttach
+
+
+
+/////////////////////////////////////////////////////////////////////
+// unmap the segment, unlinking it if this process created it
+void PCA9685_shmClose(PCA9685_shm* shm) {
+  if (shm == NULL) return;
+  if (shm->owner) {
+    __atomic_store_n(&shm->hdr->daemonPid, 0, __ATOMIC_RELEASE);
+    shm_unlink(shm->name);
+  } // if owner
+  munmap(shm->hdr, sizeof(PCA9685_shmHeader));
+  free(shm);
+} // PCA9685_shmClose
+
+
+
+/////////////////////////////////////////////////////////////////////
+// 1 if the daemon serving the segment is alive
+int PCA9685_shmDaemonAlive(PCA9685_shm* shm) {
+  return _PCA9685_shmAlive(__atomic_load_n(&shm->hdr->daemonPid, __ATOMIC_ACQUIRE));
+} // PCA9685_shmDaemonAlive
+
+
+
+/////////////////////////////////////////////////////////////////////
+// claim a free client slot for this process, returns its index
+int PCA9685_shmClaim(PCA9685_shm* shm) {
+  uint32_t pid = getpid();
+  int s;
+  for (s = 0; s < _PCA9685_SHMSLOTS; s++) {
+    uint32_t expected = 0;
+    if (__atomic_compare_exchange_n(&shm->hdr->slot[s].pid, &expected, pid, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      return s;
+    } // if claimed
+  } // for slots
+  fprintf(stderr, "PCA9685_shmClaim(): all %d slots are taken\n", _PCA9685_SHMSLOTS);
+  return -1;
+} // PCA9685_shmClaim
+
+
+
+/////////////////////////////////////////////////////////////////////
+// give a slot back, its boards stay at their last values
+void PCA9685_shmRelease(PCA9685_shm* shm, int slot) {
+  __atomic_store_n(&shm->hdr->slot[slot].pid, 0, __ATOMIC_RELEASE);
+} // PCA9685_shmRelease
+
+
+
+/////////////////////////////////////////////////////////////////////
+// publish a client frame, a memcpy and no syscalls
+void PCA9685_shmPublish(PCA9685_shm* shm, int slot, const PCA9685_shmFrame* frame) {
+  PCA9685_shmSlot* s = &shm->hdr->slot[slot];
+  uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED);
+  uint32_t back = s->front ^ 1;
+  uint32_t boards = (frame->boards < _PCA9685_SHMBOARDS ? frame->boards : _PCA9685_SHMBOARDS);
+
+  // odd while the back buffer is written
+  __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(&s->buf[back], frame, offsetof(PCA9685_shmFrame, board) + boards * sizeof(PCA9685_shmBoard));
+  s->buf[back].boards = boards;
+  __atomic_store_n(&s->front, back, __ATOMIC_RELEASE);
+  __atomic_store_n(&s->seq, seq + 2, __ATOMIC_RELEASE);
+  __atomic_store_n(&s->publishes, s->publishes + 1, __ATOMIC_RELAXED);
+} // PCA9685_shmPublish
+
+
+
+/////////////////////////////////////////////////////////////////////
+// find a board in a frame, adding it with no channels driven if new
+PCA9685_shmBoard* PCA9685_shmBoardFind(PCA9685_shmFrame* frame,
+                                       unsigned char adpt, unsigned char addr) {
+  uint32_t b;
+  for (b = 0; b < frame->boards; b++) {
+    if (frame->board[b].adpt == adpt && frame->board[b].addr == addr) return &frame->board[b];
+  } // for boards
+  if (frame->boards == _PCA9685_SHMBOARDS) return NULL;
+  PCA9685_shmBoard* board = &frame->board[frame->boards++];
+  memset(board, 0, sizeof(PCA9685_shmBoard));
+  board->adpt = adpt;
+  board->addr = addr;
+  return board;
+} // PCA9685_shmBoardFind
+
+
+
+/////////////////////////////////////////////////////////////////////
+// merge every client frame published since the last merge into merged
+int PCA9685_shmMerge(PCA9685_shm* shm, PCA9685_shmFrame* merged) {
+  PCA9685_shmFrame* frame = &shm->scratch;
+  int frames = 0;
+  int s;
+  for (s = 0; s < _PCA9685_SHMSLOTS; s++) {
+    PCA9685_shmSlot* slot = &shm->hdr->slot[s];
+    uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if ((seq & ~1u) == shm->seen[s]) continue;
+
+    // front is never written until a second publish starts, which moves
+    // seq at least 3 past the last even value
+    int ok = 0;
+    int tries;
+    for (tries = 0; tries < _PCA9685_SHMRETRIES && !ok; tries++) {
+      uint32_t front = __atomic_load_n(&slot->front, __ATOMIC_ACQUIRE);
+      uint32_t boards = slot->buf[front & 1].boards;
+      if (boards > _PCA9685_SHMBOARDS) boards = _PCA9685_SHMBOARDS;
+      memcpy(frame, &slot->buf[front & 1],
+             offsetof(PCA9685_shmFrame, board) + boards * sizeof(PCA9685_shmBoard));
+      frame->boards = boards;
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      uint32_t check = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+      ok = (check - (seq & ~1u) <= 2);
+      if (!ok) seq = check;
+    } // for tries
+    if (!ok) {
+      // the client publishes faster than this reads, next time
+      __atomic_store_n(&shm->hdr->torn, shm->hdr->torn + 1, __ATOMIC_RELAXED);
+      continue;
+    } // if torn
+    shm->seen[s] = seq & ~1u;
+
+    uint32_t b;
+    for (b = 0; b < frame->boards; b++) {
+      PCA9685_shmBoard* from = &frame->board[b];
+      PCA9685_shmBoard* to = PCA9685_shmBoardFind(merged, from->adpt, from->addr);
+      if (to == NULL) break;
+      int i;
+      for (i = 0; i < _PCA9685_CHANS; i++) {
+        if (from->mask & (1 << i)) memcpy(&to->regs[i*4], &from->regs[i*4], 4);
+      } // for chans
+      to->mask |= from->mask;
+    } // for boards
+    frames++;
+  } // for slots
+  return frames;
+} // PCA9685_shmMerge
+
+
+
+/////////////////////////////////////////////////////////////////////
+// free the slots of clients that exited without releasing them
+int PCA9685_shmReap(PCA9685_shm* shm) {
+  int reaped = 0;
+  int s;
+  for (s = 0; s < _PCA9685_SHMSLOTS; s++) {
+    uint32_t pid = __atomic_load_n(&shm->hdr->slot[s].pid, __ATOMIC_ACQUIRE);
+    if (pid == 0 || _PCA9685_shmAlive(pid)) continue;
+    if (__atomic_compare_exchange_n(&shm->hdr->slot[s].pid, &pid, 0, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      reaped++;
+    } // if freed
+  } // for slots
+  return reaped;
+} // PCA9685_shmReap
@@ -0,0 +1,116 @@
+#ifndef _PCA9685SHM_H
+#define _PCA9685SHM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "PCA9685.h"
+
+// shared memory segment pca9685d creates, under /dev/shm
+#define _PCA9685_SHMNAME	"/pca9685d"
+#define _PCA9685_SHMMAGIC	"PCA9685D"
+#define _PCA9685_SHMVERSION	1
+
+// client slots, and boards per client frame and in the merged frame
+#define _PCA9685_SHMSLOTS	16
+#define _PCA9685_SHMBOARDS	128
+
+// times the daemon retries a frame a client overwrote while it was read
+#define _PCA9685_SHMRETRIES	4
+
+// one board in a frame, the channels a client drives and their LED regs;
+// fixed width fields so 32 and 64-bit processes share the layout
+typedef struct PCA9685_shmBoard {
+  uint8_t adpt;                 // I2C adapter number
+  uint8_t addr;                 // I2C address
+  uint16_t mask;                // channels driven, bit n for LEDn
+  uint8_t regs[_PCA9685_CHANS*4]; // LEDn_ON_L, _ON_H, _OFF_L, _OFF_H
+} PCA9685_shmBoard;
+
+// a client's whole frame, or the daemon's merged frame
+typedef struct PCA9685_shmFrame {
+  uint32_t boards;              // boards in use
+  uint32_t reserved;
+  PCA9685_shmBoard board[_PCA9685_SHMBOARDS];
+} PCA9685_shmFrame;
+
+// one client's seqlocked double buffer; the client writes the back
+// buffer while seq is odd, then flips front and makes seq even again,
+// so the daemon reads front undisturbed unless two publishes overtake it
+typedef struct PCA9685_shmSlot {
+  uint32_t pid;                 // owning client, 0 when free
+  uint32_t seq;                 // odd while a publish is in progress
+  uint32_t front;               // buffer last published
+  uint32_t reserved;
+  uint64_t publishes;           // frames published
+  PCA9685_shmFrame buf[2];
+} PCA9685_shmSlot;
+
+// start of the segment
+typedef struct PCA9685_shmHeader {
+  char magic[8];                // _PCA9685_SHMMAGIC
+  uint32_t version;             // _PCA9685_SHMVERSION
+  uint32_t slots;               // _PCA9685_SHMSLOTS
+  uint32_t boards;              // _PCA9685_SHMBOARDS
+  uint32_t daemonPid;           // daemon serving the segment, 0 once stopped
+  uint32_t fps;                 // frames the daemon commits per second
+  uint32_t freq;                // PWM frequency the daemon initializes boards at
+  uint64_t commits;             // frame ticks serviced, a heartbeat
+  uint64_t torn;                // client frames skipped after retries
+  PCA9685_shmSlot slot[_PCA9685_SHMSLOTS];
+} PCA9685_shmHeader;
+
+// a mapping of the segment
+typedef struct PCA9685_shm {
+  char name[64];                // shm_open() name
+  int owner;                    // created by this process, unlinked when closed
+  PCA9685_shmHeader* hdr;       // the segment
+  uint32_t seen[_PCA9685_SHMSLOTS]; // daemon side, seq last merged per slot
+  PCA9685_shmFrame scratch;     // daemon side, client frame being merged
+} PCA9685_shm;
+
+
+// create the segment as the daemon, replacing a stale one; NULL if the
+// daemon that created the existing one is still alive.  It is mode 0660
+// and owned by group gid, or the daemon's group when gid is negative
+PCA9685_shm* PCA9685_shmCreate(const char* name, int gid);
+
+// attach to an existing segment as a client, NULL if there is none
+PCA9685_shm* PCA9685_shmAttach(const char* name);
+
+// unmap the segment, unlinking it if this process created it
+void PCA9685_shmClose(PCA9685_shm* shm);
+
+// 1 if the daemon serving the segment is alive
+int PCA9685_shmDaemonAlive(PCA9685_shm* shm);
+
+// claim a free client slot for this process, returns its index
+int PCA9685_shmClaim(PCA9685_shm* shm);
+
+// give a slot back, its boards stay at their last values
+void PCA9685_shmRelease(PCA9685_shm* shm, int slot);
+
+// publish a client frame, a memcpy and no syscalls; one thread per slot
+void PCA9685_shmPublish(PCA9685_shm* shm, int slot, const PCA9685_shmFrame* frame);
+
+// merge every client frame published since the last merge into merged,
+// board by board in slot order, adding boards not seen before; returns
+// the number of client frames merged
+int PCA9685_shmMerge(PCA9685_shm* shm, PCA9685_shmFrame* merged);
+
+// free the slots of clients that exited without releasing them
+int PCA9685_shmReap(PCA9685_shm* shm);
+
+// find a board in a frame, adding it with no channels driven if new;
+// NULL when the frame is full
+PCA9685_shmBoard* PCA9685_shmBoardFind(PCA9685_shmFrame* frame,
+                                       unsigned char adpt, unsigned char addr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
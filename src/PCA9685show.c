@@ -0,0 +1,882 @@
+// shows may be larger than 2 GB on 32-bit platforms
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "PCA9685show.h"
+
+
+/////////////////////////////////////////////////////////////////////
+// free a show writer and close its file
+static void _PCA9685_showFreeWriter(PCA9685_showWriter* writer) {
+  if (writer->fp) fclose(writer->fp);
+  free(writer->frame);
+  free(writer->regs);
+  free(writer->prev);
+  free(writer->index);
+  free(writer);
+} // _PCA9685_showFreeWriter
+
+
+
+/////////////////////////////////////////////////////////////////////
+// create a show file for boards at adpts/addrs
+PCA9685_showWriter* PCA9685_showCreate(const char* path, int boards,
+                                       const unsigned char* adpts,
+                                       const unsigned char* addrs) {
+  if (boards <= 0 || boards > 0xFFFF) {
+    fprintf(stderr, "PCA9685_showCreate(): invalid board count %d\n", boards);
+    return NULL;
+  } // if boards
+
+  PCA9685_showWriter* writer = calloc(1, sizeof(PCA9685_showWriter));
+  if (writer == NULL) {
+    fprintf(stderr, "PCA9685_showCreate(): calloc() failed\n");
+    return NULL;
+  } // if
+
+  PCA9685_showHeader* hdr = &writer->hdr;
+  memcpy(hdr->magic, _PCA9685_SHOWMAGIC, sizeof(hdr->magic));
+  hdr->version = _PCA9685_SHOWVERSION;
+  hdr->boards = boards;
+  hdr->stride = (sizeof(uint64_t) + boards * _PCA9685_SHOWBOARDLEN + 7) & ~7ULL;
+  hdr->mapOffset = sizeof(PCA9685_showHeader);
+  hdr->frameOffset = (hdr->mapOffset + boards * sizeof(PCA9685_showBoard) + 7) & ~7ULL;
+  writer->offset = hdr->frameOffset;
+
+  // big enough for a raw frame or the worst case delta frame
+  size_t frameLen = sizeof(uint64_t) + sizeof(uint32_t) +
+                    boards * (1 + _PCA9685_CHANS*4 + 2 * (_PCA9685_CHANS*2 + 1));
+  if (frameLen < hdr->stride) frameLen = hdr->stride;
+  writer->frame = calloc(1, frameLen);
+  writer->regs = calloc(boards, _PCA9685_CHANS*4);
+  writer->prev = calloc(boards, _PCA9685_CHANS*4);
+  writer->fp = fopen(path, "wb");
+  if (writer->frame == NULL || writer->regs == NULL || writer->prev == NULL ||
+      writer->fp == NULL) {
+    fprintf(stderr, "PCA9685_showCreate(): failed to create %s\n", path);
+    _PCA9685_showFreeWriter(writer);
+    return NULL;
+  } // if
+
+  // header is rewritten by PCA9685_showFinish()
+  int ok = (fwrite(hdr, sizeof(PCA9685_showHeader), 1, writer->fp) == 1);
+  int b;
+  for (b = 0; b < boards && ok; b++) {
+    PCA9685_showBoard board = { adpts[b], addrs[b], 0 };
+    ok = (fwrite(&board, sizeof(board), 1, writer->fp) == 1);
+  } // for boards
+  static const unsigned char pad[8];
+  size_t padLen = hdr->frameOffset - hdr->mapOffset - boards * sizeof(PCA9685_showBoard);
+  if (ok && padLen) {
+    ok = (fwrite(pad, padLen, 1, writer->fp) == 1);
+  } // if pad
+  if (!ok) {
+    fprintf(stderr, "PCA9685_showCreate(): fwrite() failed on %s\n", path);
+    _PCA9685_showFreeWriter(writer);
+    return NULL;
+  } // if
+
+  return writer;
+} // PCA9685_showCreate
+
+
+
+/////////////////////////////////////////////////////////////////////
+// create a delta encoded show file with a keyframe every keyInterval
+PCA9685_showWriter* PCA9685_showCreateDelta(const char* path, int boards,
+                                            const unsigned char* adpts,
+                                            const unsigned char* addrs,
+                                            unsigned int keyInterval) {
+  PCA9685_showWriter* writer = PCA9685_showCreate(path, boards, adpts, addrs);
+  if (writer == NULL) {
+    fprintf(stderr, "PCA9685_showCreateDelta(): PCA9685_showCreate() failed\n");
+    return NULL;
+  } // if
+  writer->hdr.flags |= _PCA9685_SHOWDELTA;
+  writer->hdr.stride = 0;
+  writer->hdr.keyInterval = (keyInterval ? keyInterval : _PCA9685_SHOWKEYINT);
+  return writer;
+} // PCA9685_showCreateDelta
+
+
+
+/////////////////////////////////////////////////////////////////////
+// encode one board's changed LED regs as spans, returns bytes used
+static int _PCA9685_showEncodeBoard(unsigned char* out, const unsigned char* regs,
+                                    const unsigned char* prev, int key) {
+  unsigned char* p = out + 1;
+  int spans = 0;
+  int i = 0;
+  while (i < _PCA9685_CHANS*4) {
+    if (!key && regs[i] == prev[i]) {
+      i++;
+      continue;
+    } // if unchanged
+
+    // extend the span while the next change is within _PCA9685_SHOWGAP
+    int start = i;
+    int end = i + 1;
+    if (key) {
+      end = _PCA9685_CHANS*4;
+    } // if key
+    while (end < _PCA9685_CHANS*4) {
+      int next = end;
+      while (next < _PCA9685_CHANS*4 && regs[next] == prev[next]) next++;
+      if (next == _PCA9685_CHANS*4 || next - end > _PCA9685_SHOWGAP) break;
+      end = next + 1;
+    } // while extending
+
+    p[0] = end - start;
+    p[1] = _PCA9685_BASEPWMREG + start;
+    memcpy(&p[2], &regs[start], end - start);
+    p += 2 + end - start;
+    spans++;
+    i = end;
+  } // while regs
+
+  out[0] = spans;
+  return p - out;
+} // _PCA9685_showEncodeBoard
+
+
+
+/////////////////////////////////////////////////////////////////////
+// write one frame of LED regs per board in the show's format
+static int _PCA9685_showPut(PCA9685_showWriter* writer, uint64_t timestampUs,
+                            const unsigned char* regs) {
+  PCA9685_showHeader* hdr = &writer->hdr;
+  size_t len;
+  int b;
+
+  if (hdr->flags & _PCA9685_SHOWDELTA) {
+    int key = (hdr->frames % hdr->keyInterval == 0);
+    if (key) {
+      PCA9685_showIndex* index = realloc(writer->index, (hdr->keyframes + 1) * sizeof(PCA9685_showIndex));
+      if (index == NULL) {
+        fprintf(stderr, "_PCA9685_showPut(): realloc() failed\n");
+        return -1;
+      } // if
+      writer->index = index;
+      index[hdr->keyframes].timestampUs = timestampUs;
+      index[hdr->keyframes].offset = writer->offset;
+      hdr->keyframes++;
+    } // if key
+
+    unsigned char* p = writer->frame + sizeof(uint64_t) + sizeof(uint32_t);
+    for (b = 0; b < hdr->boards; b++) {
+      p += _PCA9685_showEncodeBoard(p, &regs[b * _PCA9685_CHANS*4],
+                                    &writer->prev[b * _PCA9685_CHANS*4], key);
+    } // for boards
+    len = p - writer->frame;
+    uint32_t boardLen = len - sizeof(uint64_t) - sizeof(uint32_t);
+    memcpy(writer->frame + sizeof(uint64_t), &boardLen, sizeof(uint32_t));
+    memcpy(writer->prev, regs, hdr->boards * _PCA9685_CHANS*4);
+  } else {
+    // the register address leads every board record
+    for (b = 0; b < hdr->boards; b++) {
+      unsigned char* rec = &writer->frame[sizeof(uint64_t) + b * _PCA9685_SHOWBOARDLEN];
+      rec[0] = _PCA9685_BASEPWMREG;
+      memcpy(&rec[1], &regs[b * _PCA9685_CHANS*4], _PCA9685_CHANS*4);
+    } // for boards
+    len = hdr->stride;
+  } // if delta
+
+  memcpy(writer->frame, &timestampUs, sizeof(uint64_t));
+  if (fwrite(writer->frame, len, 1, writer->fp) != 1) {
+    fprintf(stderr, "_PCA9685_showPut(): fwrite() failed on frame %llu\n",
+            (unsigned long long) hdr->frames);
+    return -1;
+  } // if
+  writer->offset += len;
+  writer->rawBytes += (sizeof(uint64_t) + hdr->boards * _PCA9685_SHOWBOARDLEN + 7) & ~7ULL;
+  writer->lastUs = timestampUs;
+  hdr->frames++;
+  return 0;
+} // _PCA9685_showPut
+
+
+
+/////////////////////////////////////////////////////////////////////
+// append a frame of 16 OFF vals per board with ON at zero
+int PCA9685_showAppend(PCA9685_showWriter* writer, uint64_t timestampUs,
+                       const unsigned int* offVals) {
+  int boards = writer->hdr.boards;
+  unsigned char* regs = writer->regs;
+  int i;
+  for (i = 0; i < boards * _PCA9685_CHANS; i++) {
+    regs[i*4+0] = 0;
+    regs[i*4+1] = 0;
+    regs[i*4+2] = offVals[i] & 0xFF;
+    regs[i*4+3] = offVals[i] >> 8;
+  } // for channels
+
+  if (_PCA9685_showPut(writer, timestampUs, regs) != 0) {
+    fprintf(stderr, "PCA9685_showAppend(): _PCA9685_showPut() failed\n");
+    return -1;
+  } // if
+  return 0;
+} // PCA9685_showAppend
+
+
+
+/////////////////////////////////////////////////////////////////////
+// append a frame of 64 LED register bytes per board
+int PCA9685_showAppendRegs(PCA9685_showWriter* writer, uint64_t timestampUs,
+                           const unsigned char* regs) {
+  if (_PCA9685_showPut(writer, timestampUs, regs) != 0) {
+    fprintf(stderr, "PCA9685_showAppendRegs(): _PCA9685_showPut() failed\n");
+    return -1;
+  } // if
+  return 0;
+} // PCA9685_showAppendRegs
+
+
+
+/////////////////////////////////////////////////////////////////////
+// write the final header and close the file, zero durationUs for auto
+int PCA9685_showFinish(PCA9685_showWriter* writer, uint64_t durationUs) {
+  int ret = 0;
+  PCA9685_showHeader* hdr = &writer->hdr;
+  uint64_t last = writer->lastUs;
+
+  // by default a loop lasts until one frame interval after the last frame
+  if (durationUs == 0 && hdr->frames > 0) {
+    durationUs = last + (hdr->frames > 1 ? last / (hdr->frames - 1) : 1);
+  } // if auto
+  hdr->durationUs = durationUs;
+
+  // the keyframe index follows the last frame
+  if (hdr->flags & _PCA9685_SHOWDELTA) {
+    hdr->indexOffset = writer->offset;
+    if (hdr->keyframes &&
+        fwrite(writer->index, sizeof(PCA9685_showIndex), hdr->keyframes, writer->fp) != hdr->keyframes) {
+      fprintf(stderr, "PCA9685_showFinish(): failed to write the index\n");
+      ret = -1;
+    } // if
+    if (_PCA9685_DEBUG) {
+      printf("PCA9685_showFinish(): %llu frames in %llu bytes, %llu raw\n",
+             (unsigned long long) hdr->frames,
+             (unsigned long long) (writer->offset - hdr->frameOffset),
+             (unsigned long long) writer->rawBytes);
+    } // if debug
+  } // if delta
+
+  if (fflush(writer->fp) != 0 || fseek(writer->fp, 0, SEEK_SET) != 0 ||
+      fwrite(hdr, sizeof(PCA9685_showHeader), 1, writer->fp) != 1) {
+    fprintf(stderr, "PCA9685_showFinish(): failed to rewrite the header\n");
+    ret = -1;
+  } // if
+  if (fclose(writer->fp) != 0) {
+    fprintf(stderr, "PCA9685_showFinish(): fclose() failed\n");
+    ret = -1;
+  } // if
+  writer->fp = NULL;
+  _PCA9685_showFreeWriter(writer);
+  return ret;
+} // PCA9685_showFinish
+
+
+
+/////////////////////////////////////////////////////////////////////
+// order boards by fd so each bus gets one batched transaction
+static void _PCA9685_showSortBoards(PCA9685_show* show) {
+  int n = show->hdr.boards;
+  int i, j;
+  for (i = 0; i < n; i++) {
+    show->order[i] = i;
+  } // for boards
+  // insertion sort, stable so boards keep their file order on a bus
+  for (i = 1; i < n; i++) {
+    int b = show->order[i];
+    for (j = i; j > 0 && show->fds[show->order[j-1]] > show->fds[b]; j--) {
+      show->order[j] = show->order[j-1];
+    } // for
+    show->order[j] = b;
+  } // for boards
+  for (i = 0; i < n; i++) {
+    show->busFds[i] = show->fds[show->order[i]];
+    show->addrs[i] = show->map[show->order[i]].addr;
+    show->lens[i] = _PCA9685_SHOWBOARDLEN;
+  } // for boards
+} // _PCA9685_showSortBoards
+
+
+
+/////////////////////////////////////////////////////////////////////
+// map len bytes of the file at offset, sliding the window if needed
+static const unsigned char* _PCA9685_showMap(PCA9685_show* show, uint64_t offset,
+                                             size_t len) {
+  if (offset + len > show->size) {
+    fprintf(stderr, "_PCA9685_showMap(): %zu bytes at %llu beyond the file\n",
+            len, (unsigned long long) offset);
+    return NULL;
+  } // if
+
+  if (show->win == MAP_FAILED || offset < show->winOff ||
+      offset + len > show->winOff + show->winLen) {
+    // slide the window so it starts at the page holding offset
+    if (show->win != MAP_FAILED) {
+      munmap(show->win, show->winLen);
+    } // if mapped
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    show->winOff = offset & ~(page - 1);
+    show->winLen = _PCA9685_SHOWWINDOW;
+    if (show->winLen < offset - show->winOff + len) {
+      show->winLen = offset - show->winOff + len;
+    } // if small
+    if (show->winOff + show->winLen > show->size) {
+      show->winLen = show->size - show->winOff;
+    } // if end
+    show->win = mmap(NULL, show->winLen, PROT_READ, MAP_SHARED, show->file,
+                     (off_t) show->winOff);
+    if (show->win == MAP_FAILED) {
+      fprintf(stderr, "_PCA9685_showMap(): mmap() failed at offset %llu\n",
+              (unsigned long long) show->winOff);
+      return NULL;
+    } // if
+    madvise(show->win, show->winLen, MADV_SEQUENTIAL);
+  } // if outside window
+
+  return show->win + (offset - show->winOff);
+} // _PCA9685_showMap
+
+
+
+/////////////////////////////////////////////////////////////////////
+// open and validate a show file for playing
+PCA9685_show* PCA9685_showOpen(const char* path) {
+  PCA9685_show* show = calloc(1, sizeof(PCA9685_show));
+  if (show == NULL) {
+    fprintf(stderr, "PCA9685_showOpen(): calloc() failed\n");
+    return NULL;
+  } // if
+  show->win = MAP_FAILED;
+
+  show->file = open(path, O_RDONLY);
+  if (show->file < 0) {
+    fprintf(stderr, "PCA9685_showOpen(): open() failed for %s\n", path);
+    free(show);
+    return NULL;
+  } // if
+
+  struct stat st;
+  if (fstat(show->file, &st) != 0 || st.st_size < (off_t) sizeof(PCA9685_showHeader) ||
+      pread(show->file, &show->hdr, sizeof(PCA9685_showHeader), 0) != sizeof(PCA9685_showHeader)) {
+    fprintf(stderr, "PCA9685_showOpen(): failed to read the header of %s\n", path);
+    PCA9685_showClose(show);
+    return NULL;
+  } // if
+  show->size = st.st_size;
+
+  PCA9685_showHeader* hdr = &show->hdr;
+  int delta = (hdr->flags & _PCA9685_SHOWDELTA);
+  int valid = (memcmp(hdr->magic, _PCA9685_SHOWMAGIC, sizeof(hdr->magic)) == 0 &&
+               hdr->version == _PCA9685_SHOWVERSION && hdr->boards != 0);
+  if (valid && delta) {
+    valid = (hdr->keyInterval != 0 && (hdr->frames == 0 || hdr->keyframes != 0) &&
+             hdr->indexOffset + hdr->keyframes * sizeof(PCA9685_showIndex) <= show->size);
+  } else if (valid) {
+    valid = (hdr->stride >= sizeof(uint64_t) + hdr->boards * _PCA9685_SHOWBOARDLEN &&
+             hdr->frameOffset + hdr->frames * hdr->stride <= show->size);
+  } // if delta
+  if (!valid) {
+    fprintf(stderr, "PCA9685_showOpen(): %s is not a valid version %d show\n",
+            path, _PCA9685_SHOWVERSION);
+    PCA9685_showClose(show);
+    return NULL;
+  } // if invalid
+
+  int n = hdr->boards;
+  show->map = malloc(n * sizeof(PCA9685_showBoard));
+  show->fds = malloc(n * sizeof(int));
+  show->order = malloc(n * sizeof(int));
+  show->busFds = malloc(n * sizeof(int));
+  show->addrs = malloc(n);
+  show->lens = malloc(n * sizeof(int));
+  show->bufs = malloc(n * sizeof(unsigned char*));
+  if (!show->map || !show->fds || !show->order || !show->busFds || !show->addrs ||
+      !show->lens || !show->bufs) {
+    fprintf(stderr, "PCA9685_showOpen(): malloc() failed\n");
+    PCA9685_showClose(show);
+    return NULL;
+  } // if
+  if (pread(show->file, show->map, n * sizeof(PCA9685_showBoard), hdr->mapOffset)
+      != (ssize_t) (n * sizeof(PCA9685_showBoard))) {
+    fprintf(stderr, "PCA9685_showOpen(): failed to read the map of %s\n", path);
+    PCA9685_showClose(show);
+    return NULL;
+  } // if
+
+  if (delta) {
+    // a board has at most one span per 1 + _PCA9685_SHOWGAP + 1 bytes
+    show->maxSpans = n * _PCA9685_CHANS;
+    size_t indexLen = hdr->keyframes * sizeof(PCA9685_showIndex);
+    show->index = malloc(indexLen ? indexLen : 1);
+    show->shadow = calloc(n, _PCA9685_SHOWBOARDLEN);
+    show->spanFds = malloc(show->maxSpans * sizeof(int));
+    show->spanAddrs = malloc(show->maxSpans);
+    show->spanLens = malloc(show->maxSpans * sizeof(int));
+    show->spanBufs = malloc(show->maxSpans * sizeof(unsigned char*));
+    if (!show->index || !show->shadow || !show->spanFds || !show->spanAddrs ||
+        !show->spanLens || !show->spanBufs ||
+        pread(show->file, show->index, indexLen, hdr->indexOffset) != (ssize_t) indexLen) {
+      fprintf(stderr, "PCA9685_showOpen(): failed to read the index of %s\n", path);
+      PCA9685_showClose(show);
+      return NULL;
+    } // if
+    int b;
+    for (b = 0; b < n; b++) {
+      show->shadow[b * _PCA9685_SHOWBOARDLEN] = _PCA9685_BASEPWMREG;
+    } // for boards
+    show->posOff = hdr->frameOffset;
+    show->full = 1;
+  } // if delta
+
+  int b;
+  for (b = 0; b < n; b++) {
+    show->fds[b] = -1;
+  } // for boards
+  _PCA9685_showSortBoards(show);
+
+  if (_PCA9685_DEBUG) {
+    printf("PCA9685_showOpen(): %s has %d boards, %llu %s frames\n",
+           path, n, (unsigned long long) hdr->frames, (delta ? "delta" : "raw"));
+  } // if debug
+
+  return show;
+} // PCA9685_showOpen
+
+
+
+/////////////////////////////////////////////////////////////////////
+// unmap and close a show file
+void PCA9685_showClose(PCA9685_show* show) {
+  if (show == NULL) return;
+  if (show->win != MAP_FAILED) {
+    munmap(show->win, show->winLen);
+  } // if mapped
+  if (show->file >= 0) {
+    close(show->file);
+  } // if open
+  free(show->map);
+  free(show->fds);
+  free(show->order);
+  free(show->busFds);
+  free(show->addrs);
+  free(show->lens);
+  free(show->bufs);
+  free(show->index);
+  free(show->shadow);
+  free(show->spanFds);
+  free(show->spanAddrs);
+  free(show->spanLens);
+  free(show->spanBufs);
+  free(show);
+} // PCA9685_showClose
+
+
+
+/////////////////////////////////////////////////////////////////////
+// open the adapters of the channel map and initialize every board
+int PCA9685_showOpenI2C(PCA9685_show* show, unsigned int freq) {
+  int ret;
+  int b;
+  for (b = 0; b < show->hdr.boards; b++) {
+    // share the fd of an earlier board on the same adapter
+    int prev;
+    for (prev = 0; prev < b; prev++) {
+      if (show->map[prev].adpt == show->map[b].adpt) break;
+    } // for prev
+    if (prev < b) {
+      show->fds[b] = show->fds[prev];
+    } else {
+      show->fds[b] = PCA9685_openI2C(show->map[b].adpt, show->map[b].addr);
+      if (show->fds[b] < 0) {
+        fprintf(stderr, "PCA9685_showOpenI2C(): PCA9685_openI2C() failed on adapter %d\n",
+                show->map[b].adpt);
+        return -1;
+      } // if fd
+    } // if prev
+
+    ret = PCA9685_initPWM(show->fds[b], show->map[b].addr, freq);
+    if (ret != 0) {
+      fprintf(stderr, "PCA9685_showOpenI2C(): PCA9685_initPWM() returned ");
+      fprintf(stderr, "%d on %d/0x%02x\n", ret, show->map[b].adpt, show->map[b].addr);
+      return -1;
+    } // if
+  } // for boards
+
+  _PCA9685_showSortBoards(show);
+  return 0;
+} // PCA9685_showOpenI2C
+
+
+
+/////////////////////////////////////////////////////////////////////
+// set the I2C bus fd of one board
+int PCA9685_showSetFd(PCA9685_show* show, int board, int fd) {
+  if (board < 0 || board >= show->hdr.boards) {
+    fprintf(stderr, "PCA9685_showSetFd(): invalid board %d\n", board);
+    return -1;
+  } // if board
+  show->fds[board] = fd;
+  _PCA9685_showSortBoards(show);
+  return 0;
+} // PCA9685_showSetFd
+
+
+
+/////////////////////////////////////////////////////////////////////
+// get a pointer to a raw frame (timestamp followed by board records)
+const unsigned char* PCA9685_showFrame(PCA9685_show* show, uint64_t frame) {
+  if (frame >= show->hdr.frames || (show->hdr.flags & _PCA9685_SHOWDELTA)) {
+    fprintf(stderr, "PCA9685_showFrame(): no raw frame %llu of %llu\n",
+            (unsigned long long) frame, (unsigned long long) show->hdr.frames);
+    return NULL;
+  } // if frame
+
+  return _PCA9685_showMap(show, show->hdr.frameOffset + frame * show->hdr.stride,
+                          show->hdr.stride);
+} // PCA9685_showFrame
+
+
+
+/////////////////////////////////////////////////////////////////////
+// timestamp of a raw frame in microseconds
+uint64_t PCA9685_showTime(PCA9685_show* show, uint64_t frame) {
+  uint64_t ts = 0;
+  const unsigned char* p = PCA9685_showFrame(show, frame);
+  if (p != NULL) {
+    memcpy(&ts, p, sizeof(uint64_t));
+  } // if frame
+  return ts;
+} // PCA9685_showTime
+
+
+
+/////////////////////////////////////////////////////////////////////
+// timestamp of the frame at pos in either format
+static uint64_t _PCA9685_showPosTime(PCA9685_show* show) {
+  if (!(show->hdr.flags & _PCA9685_SHOWDELTA)) {
+    return PCA9685_showTime(show, show->pos);
+  } // if raw
+  uint64_t ts = 0;
+  const unsigned char* p = _PCA9685_showMap(show, show->posOff, sizeof(uint64_t));
+  if (p != NULL) {
+    memcpy(&ts, p, sizeof(uint64_t));
+  } // if frame
+  return ts;
+} // _PCA9685_showPosTime
+
+
+
+/////////////////////////////////////////////////////////////////////
+// decode the delta frame at pos into the dirty spans and advance
+int PCA9685_showDecode(PCA9685_show* show) {
+  PCA9685_showHeader* hdr = &show->hdr;
+  if (!(hdr->flags & _PCA9685_SHOWDELTA) || hdr->frames == 0) {
+    fprintf(stderr, "PCA9685_showDecode(): not a delta show with frames\n");
+    return -1;
+  } // if
+
+  const unsigned char* p = _PCA9685_showMap(show, show->posOff, sizeof(uint64_t) + sizeof(uint32_t));
+  if (p == NULL) {
+    fprintf(stderr, "PCA9685_showDecode(): _PCA9685_showMap() failed on frame %llu\n",
+            (unsigned long long) show->pos);
+    return -1;
+  } // if
+  uint32_t len;
+  memcpy(&show->posUs, p, sizeof(uint64_t));
+  memcpy(&len, p + sizeof(uint64_t), sizeof(uint32_t));
+  p = _PCA9685_showMap(show, show->posOff, sizeof(uint64_t) + sizeof(uint32_t) + len);
+  if (p == NULL) {
+    fprintf(stderr, "PCA9685_showDecode(): _PCA9685_showMap() failed on frame %llu\n",
+            (unsigned long long) show->pos);
+    return -1;
+  } // if
+  const unsigned char* q = p + sizeof(uint64_t) + sizeof(uint32_t);
+  const unsigned char* end = q + len;
+
+  // the span lists are in file order, the bus batches in fd order,
+  // so first locate each board's spans and then walk the sorted boards
+  int b;
+  for (b = 0; b < hdr->boards; b++) {
+    show->bufs[b] = (unsigned char*) q;
+    // the count, then every span's length, register and data in the frame
+    int n = (q < end ? *q++ : -1);
+    while (n > 0 && end - q >= 2 && end - q >= 2 + q[0]) {
+      q += 2 + q[0];
+      n--;
+    } // while spans
+    if (n != 0) {
+      fprintf(stderr, "PCA9685_showDecode(): frame %llu is corrupt\n",
+              (unsigned long long) show->pos);
+      return -1;
+    } // if
+  } // for boards
+
+  show->spans = 0;
+  int i;
+  for (i = 0; i < hdr->boards; i++) {
+    b = show->order[i];
+    unsigned char* regs = &show->shadow[b * _PCA9685_SHOWBOARDLEN + 1];
+    const unsigned char* s = show->bufs[b];
+    int n = *s++;
+    while (n-- > 0) {
+      int dataLen = s[0];
+      int off = s[1] - _PCA9685_BASEPWMREG;
+      if (off < 0 || off + dataLen > _PCA9685_CHANS*4 || show->spans >= show->maxSpans) {
+        fprintf(stderr, "PCA9685_showDecode(): bad span in frame %llu\n",
+                (unsigned long long) show->pos);
+        return -1;
+      } // if
+      memcpy(&regs[off], &s[2], dataLen);
+      if (!show->full) {
+        // the span is already an I2C message: register then data
+        show->spanFds[show->spans] = show->fds[b];
+        show->spanAddrs[show->spans] = show->map[b].addr;
+        show->spanLens[show->spans] = 1 + dataLen;
+        show->spanBufs[show->spans] = (unsigned char*) &s[1];
+        show->spans++;
+      } // if dirty
+      s += 2 + dataLen;
+    } // while spans
+  } // for boards
+
+  // after a seek every board is written whole from the shadow
+  if (show->full) {
+    for (i = 0; i < hdr->boards; i++) {
+      b = show->order[i];
+      show->spanFds[i] = show->fds[b];
+      show->spanAddrs[i] = show->map[b].addr;
+      show->spanLens[i] = _PCA9685_SHOWBOARDLEN;
+      show->spanBufs[i] = &show->shadow[b * _PCA9685_SHOWBOARDLEN];
+    } // for boards
+    show->spans = hdr->boards;
+    show->full = 0;
+  } // if full
+
+  show->pos++;
+  show->posOff += sizeof(uint64_t) + sizeof(uint32_t) + len;
+  if (show->pos >= hdr->frames) {
+    show->pos = 0;
+    show->posOff = hdr->frameOffset;
+  } // if wrapped
+  return 0;
+} // PCA9685_showDecode
+
+
+
+/////////////////////////////////////////////////////////////////////
+// position a delta show at a keyframe and decode up to frame
+static int _PCA9685_showSeekDelta(PCA9685_show* show, uint32_t key,
+                                  uint64_t frame, uint64_t timeUs) {
+  show->pos = (uint64_t) key * show->hdr.keyInterval;
+  show->posOff = show->index[key].offset;
+  show->full = 1;
+  // decode forward by frame count or by time, rebuilding the shadow
+  while (show->pos < frame) {
+    uint64_t next = show->pos + 1;
+    if (next < show->hdr.frames && frame == UINT64_MAX) {
+      // peek at the time of the frame after pos
+      const unsigned char* p = _PCA9685_showMap(show, show->posOff + sizeof(uint64_t), sizeof(uint32_t));
+      uint32_t len;
+      if (p == NULL) return -1;
+      memcpy(&len, p, sizeof(uint32_t));
+      p = _PCA9685_showMap(show, show->posOff + sizeof(uint64_t) + sizeof(uint32_t) + len, sizeof(uint64_t));
+      uint64_t ts;
+      if (p == NULL) return -1;
+      memcpy(&ts, p, sizeof(uint64_t));
+      if (ts > timeUs) break;
+    } else if (next >= show->hdr.frames) {
+      break;
+    } // if
+    if (PCA9685_showDecode(show) != 0) return -1;
+    show->full = 1;
+  } // while
+  return 0;
+} // _PCA9685_showSeekDelta
+
+
+
+/////////////////////////////////////////////////////////////////////
+// seek to a frame
+int PCA9685_showSeek(PCA9685_show* show, uint64_t frame) {
+  if (frame >= show->hdr.frames) {
+    fprintf(stderr, "PCA9685_showSeek(): frame %llu beyond %llu\n",
+            (unsigned long long) frame, (unsigned long long) show->hdr.frames);
+    return -1;
+  } // if frame
+
+  if (show->hdr.flags & _PCA9685_SHOWDELTA) {
+    if (_PCA9685_showSeekDelta(show, frame / show->hdr.keyInterval, frame, 0) != 0) {
+      fprintf(stderr, "PCA9685_showSeek(): failed to decode up to frame %llu\n",
+              (unsigned long long) frame);
+      return -1;
+    } // if
+    return 0;
+  } // if delta
+
+  show->pos = frame;
+  return 0;
+} // PCA9685_showSeek
+
+
+
+/////////////////////////////////////////////////////////////////////
+// seek to the last frame at or before a time in microseconds
+int PCA9685_showSeekTime(PCA9685_show* show, uint64_t timeUs) {
+  if (show->hdr.frames == 0) {
+    fprintf(stderr, "PCA9685_showSeekTime(): show has no frames\n");
+    return -1;
+  } // if empty
+
+  if (show->hdr.flags & _PCA9685_SHOWDELTA) {
+    // binary search the keyframe index, then decode forward
+    uint32_t lo = 0;
+    uint32_t hi = show->hdr.keyframes - 1;
+    while (lo < hi) {
+      uint32_t mid = lo + (hi - lo + 1) / 2;
+      if (show->index[mid].timestampUs <= timeUs) {
+        lo = mid;
+      } else {
+        hi = mid - 1;
+      } // if
+    } // while
+    if (_PCA9685_showSeekDelta(show, lo, UINT64_MAX, timeUs) != 0) {
+      fprintf(stderr, "PCA9685_showSeekTime(): failed to decode up to %lluus\n",
+              (unsigned long long) timeUs);
+      return -1;
+    } // if
+    return 0;
+  } // if delta
+
+  // binary search the timestamps, only touching log2(frames) pages
+  uint64_t lo = 0;
+  uint64_t hi = show->hdr.frames - 1;
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo + 1) / 2;
+    if (PCA9685_showTime(show, mid) <= timeUs) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    } // if
+  } // while
+  show->pos = lo;
+  return 0;
+} // PCA9685_showSeekTime
+
+
+
+/////////////////////////////////////////////////////////////////////
+// write count messages grouped by fd, one batched transaction per bus
+static int _PCA9685_showWriteBuses(const int* fds, int count, const unsigned char* addrs,
+                                   const int* lens, unsigned char* const* bufs) {
+  int ret;
+  int first = 0;
+  while (first < count) {
+    int last = first + 1;
+    while (last < count && fds[last] == fds[first]) last++;
+    ret = _PCA9685_writeI2CBatch(fds[first], last - first, &addrs[first],
+                                 &lens[first], &bufs[first]);
+    if (ret != 0) {
+      fprintf(stderr, "_PCA9685_showWriteBuses(): _PCA9685_writeI2CBatch() returned %d\n", ret);
+      return -1;
+    } // if
+    first = last;
+  } // while buses
+  return 0;
+} // _PCA9685_showWriteBuses
+
+
+
+/////////////////////////////////////////////////////////////////////
+// write the next frame to every board and advance, wrapping at the end
+int PCA9685_showWriteFrame(PCA9685_show* show) {
+  int ret;
+  uint64_t pos = show->pos;
+
+  if (show->hdr.flags & _PCA9685_SHOWDELTA) {
+    ret = PCA9685_showDecode(show);
+    if (ret != 0) {
+      fprintf(stderr, "PCA9685_showWriteFrame(): PCA9685_showDecode() returned %d\n", ret);
+      return -1;
+    } // if
+    ret = _PCA9685_showWriteBuses(show->spanFds, show->spans, show->spanAddrs,
+                                  show->spanLens, show->spanBufs);
+  } else {
+    const unsigned char* frame = PCA9685_showFrame(show, show->pos);
+    if (frame == NULL) {
+      fprintf(stderr, "PCA9685_showWriteFrame(): PCA9685_showFrame() failed\n");
+      return -1;
+    } // if
+
+    // point the messages straight into the mapped file
+    int n = show->hdr.boards;
+    int i;
+    for (i = 0; i < n; i++) {
+      show->bufs[i] = (unsigned char*) &frame[sizeof(uint64_t) + show->order[i] * _PCA9685_SHOWBOARDLEN];
+    } // for boards
+    ret = _PCA9685_showWriteBuses(show->busFds, n, show->addrs, show->lens, show->bufs);
+    show->pos = (show->pos + 1 < show->hdr.frames ? show->pos + 1 : 0);
+  } // if delta
+
+  if (ret != 0) {
+    fprintf(stderr, "PCA9685_showWriteFrame(): _PCA9685_showWriteBuses() returned ");
+    fprintf(stderr, "%d on frame %llu\n", ret, (unsigned long long) pos);
+    return -1;
+  } // if
+  return 0;
+} // PCA9685_showWriteFrame
+
+
+
+/////////////////////////////////////////////////////////////////////
+// play from the current frame in real time, loops zero to loop forever
+int PCA9685_showPlay(PCA9685_show* show, unsigned int loops) {
+  int ret;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  // the show time of the current frame is "now"
+  uint64_t base = _PCA9685_showPosTime(show);
+  uint64_t loopUs = 0;
+  unsigned int loop = 0;
+
+  show->stop = 0;
+  while (!show->stop) {
+    uint64_t due = loopUs + _PCA9685_showPosTime(show) - base;
+    struct timespec deadline;
+    deadline.tv_sec = start.tv_sec + due / 1000000;
+    deadline.tv_nsec = start.tv_nsec + (due % 1000000) * 1000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    } // if carry
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0) {
+      if (show->stop) return 0;
+    } // while interrupted
+
+    ret = PCA9685_showWriteFrame(show);
+    if (ret != 0) {
+      fprintf(stderr, "PCA9685_showPlay(): PCA9685_showWriteFrame() returned %d\n", ret);
+      return -1;
+    } // if
+
+    // wrapped past the last frame
+    if (show->pos == 0) {
+      loop++;
+      if (loops && loop >= loops) break;
+      loopUs += show->hdr.durationUs;
+    } // if wrapped
+  } // while playing
+
+  return 0;
+} // PCA9685_showPlay
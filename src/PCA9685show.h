@@ -0,0 +1,176 @@
+#ifndef _PCA9685SHOW_H
+#define _PCA9685SHOW_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include "PCA9685.h"
+
+// show file identification
+#define _PCA9685_SHOWMAGIC	"PCA9685S"
+#define _PCA9685_SHOWVERSION	1
+
+// bytes per board in a frame: LED0_ON_L reg followed by the LED regs
+#define _PCA9685_SHOWBOARDLEN	(1 + _PCA9685_CHANS*4)
+
+// bytes of the file mapped at once, so shows may exceed the address space
+#define _PCA9685_SHOWWINDOW	(64 << 20)
+
+// header flags
+#define _PCA9685_SHOWDELTA	0x01	// frames are delta encoded
+
+// default frames between keyframes of a delta show
+#define _PCA9685_SHOWKEYINT	200
+
+// unchanged bytes merged into a span rather than starting a new one,
+// a new I2C message costs a START, the address and the register
+#define _PCA9685_SHOWGAP	3
+
+// show file header, all fields little-endian (host order on the Pi)
+typedef struct PCA9685_showHeader {
+  char magic[8];                // _PCA9685_SHOWMAGIC
+  uint16_t version;             // _PCA9685_SHOWVERSION
+  uint16_t boards;              // boards in the channel map
+  uint32_t flags;               // _PCA9685_SHOWDELTA or zero
+  uint64_t frames;              // frames in the file
+  uint64_t stride;              // bytes per frame, zero for delta shows
+  uint64_t durationUs;          // loop length in microseconds
+  uint64_t mapOffset;           // file offset of the channel map
+  uint64_t frameOffset;         // file offset of frame 0
+  uint64_t indexOffset;         // file offset of the keyframe index
+  uint32_t keyInterval;         // frames between keyframes
+  uint32_t keyframes;           // entries in the keyframe index
+} PCA9685_showHeader;
+
+// one board in the channel map
+typedef struct PCA9685_showBoard {
+  uint8_t adpt;                 // adapter number
+  uint8_t addr;                 // I2C address
+  uint16_t reserved;            // zero
+} PCA9685_showBoard;
+
+// one keyframe in the index of a delta show
+typedef struct PCA9685_showIndex {
+  uint64_t timestampUs;         // timestamp of the keyframe
+  uint64_t offset;              // file offset of the keyframe
+} PCA9685_showIndex;
+
+// a raw frame is a uint64_t timestamp in microseconds followed by
+// _PCA9685_SHOWBOARDLEN bytes per board, padded to a multiple of 8
+//
+// a delta frame is a uint64_t timestamp and a uint32_t length of the
+// board data that follows.  Each board has a uint8_t span count and
+// then its spans, each a uint8_t data length followed by an I2C
+// message: the register address and the changed register bytes.
+// Keyframes have one 64-byte span per board.
+
+// show file being written
+typedef struct PCA9685_showWriter {
+  FILE* fp;                     // output file
+  PCA9685_showHeader hdr;       // header, rewritten on finish
+  unsigned char* frame;         // one frame being encoded
+  uint64_t lastUs;              // timestamp of the last frame
+  unsigned char* regs;          // LED regs per board being appended
+  unsigned char* prev;          // LED regs per board of the last frame
+  PCA9685_showIndex* index;     // keyframes written so far
+  uint64_t offset;              // file offset of the next frame
+  uint64_t rawBytes;            // bytes a raw show would have used
+} PCA9685_showWriter;
+
+// show file being played from a mapped window
+typedef struct PCA9685_show {
+  int file;                     // show file descriptor
+  uint64_t size;                // file size
+  PCA9685_showHeader hdr;       // copy of the header
+  PCA9685_showBoard* map;       // copy of the channel map
+  unsigned char* win;           // mapped window of the file
+  uint64_t winOff;              // file offset of the window
+  size_t winLen;                // length of the window
+  uint64_t pos;                 // next frame to write
+  int* fds;                     // I2C bus fd per board
+  int* order;                   // boards sorted by fd
+  int* busFds;                  // I2C bus fd per sorted board
+  unsigned char* addrs;         // I2C address per sorted board
+  int* lens;                    // message length per sorted board
+  unsigned char** bufs;         // message buffer per sorted board
+  volatile sig_atomic_t stop;   // set non-zero to end PCA9685_showPlay()
+  PCA9685_showIndex* index;     // keyframe index of a delta show
+  uint64_t posOff;              // file offset of frame pos of a delta show
+  uint64_t posUs;               // timestamp of frame pos of a delta show
+  unsigned char* shadow;        // reg and LED regs per board, delta shows
+  int full;                     // write whole boards from the shadow next
+  int spans;                    // dirty spans from the last decode
+  int maxSpans;                 // capacity of the span arrays
+  int* spanFds;                 // I2C bus fd per span
+  unsigned char* spanAddrs;     // I2C address per span
+  int* spanLens;                // message length per span
+  unsigned char** spanBufs;     // message (reg then data) per span
+} PCA9685_show;
+
+
+// create a show file for boards at adpts/addrs
+PCA9685_showWriter* PCA9685_showCreate(const char* path, int boards,
+                                       const unsigned char* adpts,
+                                       const unsigned char* addrs);
+
+// create a delta encoded show file with a keyframe every keyInterval
+PCA9685_showWriter* PCA9685_showCreateDelta(const char* path, int boards,
+                                            const unsigned char* adpts,
+                                            const unsigned char* addrs,
+                                            unsigned int keyInterval);
+
+// append a frame of 16 OFF vals per board with ON at zero
+int PCA9685_showAppend(PCA9685_showWriter* writer, uint64_t timestampUs,
+                       const unsigned int* offVals);
+
+// append a frame of 64 LED register bytes per board
+int PCA9685_showAppendRegs(PCA9685_showWriter* writer, uint64_t timestampUs,
+                           const unsigned char* regs);
+
+// write the final header and close the file, zero durationUs for auto
+int PCA9685_showFinish(PCA9685_showWriter* writer, uint64_t durationUs);
+
+// open and validate a show file for playing
+PCA9685_show* PCA9685_showOpen(const char* path);
+
+// unmap and close a show file
+void PCA9685_showClose(PCA9685_show* show);
+
+// open the adapters of the channel map and initialize every board
+int PCA9685_showOpenI2C(PCA9685_show* show, unsigned int freq);
+
+// set the I2C bus fd of one board
+int PCA9685_showSetFd(PCA9685_show* show, int board, int fd);
+
+// get a pointer to a raw frame (timestamp followed by board records)
+const unsigned char* PCA9685_showFrame(PCA9685_show* show, uint64_t frame);
+
+// decode the delta frame at pos into the dirty spans and advance
+int PCA9685_showDecode(PCA9685_show* show);
+
+// timestamp of a raw frame in microseconds
+uint64_t PCA9685_showTime(PCA9685_show* show, uint64_t frame);
+
+// seek to a frame
+int PCA9685_showSeek(PCA9685_show* show, uint64_t frame);
+
+// seek to the last frame at or before a time in microseconds
+int PCA9685_showSeekTime(PCA9685_show* show, uint64_t timeUs);
+
+// write the next frame to every board and advance, wrapping at the end
+int PCA9685_showWriteFrame(PCA9685_show* show);
+
+// play from the current frame in real time, loops zero to loop forever
+int PCA9685_showPlay(PCA9685_show* show, unsigned int loops);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+
+#include "PCA9685sim.h"
+
+// simulator that _PCA9685_ioctl() and _PCA9685_open() use
+PCA9685_sim* _PCA9685_SIM = NULL;
+
+
+/////////////////////////////////////////////////////////////////////
+// set a device's registers to their power-on values
+static void _PCA9685_simReset(PCA9685_simDevice* dev) {
+  memset(dev->regs, 0, sizeof(dev->regs));
+  dev->regs[_PCA9685_MODE1REG] = _PCA9685_ALLCALLBIT | _PCA9685_SLEEPBIT;
+  dev->regs[_PCA9685_MODE2REG] = _PCA9685_OUTDRVBIT;
+  dev->regs[0x02] = 0xE2;       // SUBADR1
+  dev->regs[0x03] = 0xE4;       // SUBADR2
+  dev->regs[0x04] = 0xE8;       // SUBADR3
+  dev->regs[0x05] = 0xE0;       // ALLCALLADR
+  int i;
+  // every LED starts full off
+  for (i = 0; i < _PCA9685_CHANS; i++) {
+    dev->regs[_PCA9685_BASEPWMREG + i*4 + 3] = 0x10;
+  } // for LEDs
+  dev->regs[_PCA9685_ALLLEDREG + 3] = 0x10;
+  dev->regs[_PCA9685_PRESCALEREG] = 0x1E;
+  dev->ptr = 0;
+} // _PCA9685_simReset
+
+
+
+/////////////////////////////////////////////////////////////////////
+// create a simulator with no devices
+PCA9685_sim* PCA9685_simCreate(void) {
+  PCA9685_sim* sim = calloc(1, sizeof(PCA9685_sim));
+  if (sim == NULL) {
+    fprintf(stderr, "PCA9685_simCreate(): calloc() failed\n");
+    return NULL;
+  } // if
+  sim->funcs = I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL;
+  return sim;
+} // PCA9685_simCreate
+
+
+
+/////////////////////////////////////////////////////////////////////
+// free a simulator, stopping it if it is in use
+void PCA9685_simDestroy(PCA9685_sim* sim) {
+  if (sim == NULL) return;
+  PCA9685_sim* expected = sim;
+  __atomic_compare_exchange_n(&_PCA9685_SIM, &expected, NULL, 0,
+                              __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+  free(sim);
+} // PCA9685_simDestroy
+
+
+
+/////////////////////////////////////////////////////////////////////
+// route every transaction to sim
+void PCA9685_simStart(PCA9685_sim* sim) {
+  __atomic_store_n(&_PCA9685_SIM, sim, __ATOMIC_RELEASE);
+} // PCA9685_simStart
+
+
+
+/////////////////////////////////////////////////////////////////////
+// route transactions to the kernel again
+void PCA9685_simStop(void) {
+  __atomic_store_n(&_PCA9685_SIM, NULL, __ATOMIC_RELEASE);
+} // PCA9685_simStop
+
+
+
+/////////////////////////////////////////////////////////////////////
+// find the device at fd/addr, adding it with power-on registers if new
+PCA9685_simDevice* PCA9685_simFind(PCA9685_sim* sim, int fd, unsigned char addr) {
+  int d;
+  for (d = 0; d < sim->devices; d++) {
+    if (sim->dev[d].fd == fd && sim->dev[d].addr == addr) return &sim->dev[d];
+  } // for devices
+  if (sim->devices == _PCA9685_SIMDEVS) {
+    fprintf(stderr, "PCA9685_simFind(): more than %d devices\n", _PCA9685_SIMDEVS);
+    return NULL;
+  } // if full
+  PCA9685_simDevice* dev = &sim->dev[sim->devices++];
+  memset(dev, 0, sizeof(PCA9685_simDevice));
+  dev->fd = fd;
+  dev->addr = addr;
+  _PCA9685_simReset(dev);
+  return dev;
+} // PCA9685_simFind
+
+
+
+/////////////////////////////////////////////////////////////////////
+// unplug a device so it NACKs, or plug it back in with power-on registers
+void PCA9685_simSetAbsent(PCA9685_simDevice* dev, int absent) {
+  if (dev->absent && !absent) _PCA9685_simReset(dev);
+  dev->absent = absent;
+} // PCA9685_simSetAbsent
+
+
+
+/////////////////////////////////////////////////////////////////////
+// hang a device so every transfer to it times out, or release it
+void PCA9685_simSetHung(PCA9685_simDevice* dev, int hung) {
+  dev->hung = hung;
+} // PCA9685_simSetHung
+
+
+
+/////////////////////////////////////////////////////////////////////
+// get the 16 ON and OFF vals of a simulated device
+void PCA9685_simGetPWMVals(const PCA9685_simDevice* dev,
+                           unsigned int* onVals, unsigned int* offVals) {
+  int i;
+  for (i = 0; i < _PCA9685_CHANS; i++) {
+    const unsigned char* led = &dev->regs[_PCA9685_BASEPWMREG + i*4];
+    onVals[i] = led[0] | led[1] << 8;
+    offVals[i] = led[2] | led[3] << 8;
+  } // for LEDs
+} // PCA9685_simGetPWMVals
+
+
+
+/////////////////////////////////////////////////////////////////////
+// step the register pointer, only when MODE1 has AI set
+static void _PCA9685_simStep(PCA9685_simDevice* dev) {
+  if (dev->regs[_PCA9685_MODE1REG] & _PCA9685_AUTOINCBIT) dev->ptr++;
+} // _PCA9685_simStep
+
+
+
+/////////////////////////////////////////////////////////////////////
+// write one byte at the pointer the way the chip does
+static void _PCA9685_simWrite(PCA9685_simDevice* dev, unsigned char val) {
+  unsigned char reg = dev->ptr;
+  dev->regs[reg] = val;
+  // the ALL_LED registers write every LED register
+  if (reg >= _PCA9685_ALLLEDREG && reg < _PCA9685_ALLLEDREG + 4) {
+    int i;
+    for (i = 0; i < _PCA9685_CHANS; i++) {
+      dev->regs[_PCA9685_BASEPWMREG + i*4 + reg - _PCA9685_ALLLEDREG] = val;
+    } // for LEDs
+  } // if ALL_LED
+  _PCA9685_simStep(dev);
+} // _PCA9685_simWrite
+
+
+
+/////////////////////////////////////////////////////////////////////
+// hold the caller for a transaction's time on the bus at busHz, 9 clocks
+// per byte with the address bytes
+static void _PCA9685_simBusTime(PCA9685_sim* sim, const struct i2c_rdwr_ioctl_data* data) {
+  unsigned int bytes = 0;
+  unsigned int m;
+  for (m = 0; m < data->nmsgs; m++) bytes += 1 + data->msgs[m].len;
+  double ns = bytes * 9e9 / sim->busHz;
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  do {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+  } while ((now.tv_sec - start.tv_sec) * 1e9 + (now.tv_nsec - start.tv_nsec) < ns);
+} // _PCA9685_simBusTime
+
+
+
+/////////////////////////////////////////////////////////////////////
+// carry out one I2C_RDWR transaction on the simulated devices
+static int _PCA9685_simCarry(PCA9685_sim* sim, int fd, char* argp) {
+  struct i2c_rdwr_ioctl_data* data = (struct i2c_rdwr_ioctl_data*) argp;
+  sim->transfers++;
+  if (sim->busHz) _PCA9685_simBusTime(sim, data);
+  unsigned int m;
+  for (m = 0; m < data->nmsgs; m++) {
+    struct i2c_msg* msg = &data->msgs[m];
+    sim->bytes += msg->len;
+
+    // general call SWRST resets every device on the bus
+    if (msg->addr == _PCA9685_GENCALLADDR) {
+      if (!(msg->flags & I2C_M_RD) && msg->len == 1 && msg->buf[0] == _PCA9685_RESETVAL) {
+        int d;
+        for (d = 0; d < sim->devices; d++) {
+          if (sim->dev[d].fd == fd) _PCA9685_simReset(&sim->dev[d]);
+        } // for devices
+      } // if SWRST
+      continue;
+    } // if general call
+
+    PCA9685_simDevice* dev = PCA9685_simFind(sim, fd, msg->addr);
+    if (dev == NULL) return -1;
+    // the adapter aborts at a NACK, the earlier messages have landed
+    if (dev->absent) {
+      errno = ENXIO;
+      return -1;
+    } // if absent
+    // the adapter gives up on the whole transfer after its I2C_TIMEOUT
+    if (dev->hung) {
+      sim->timeouts++;
+      errno = ETIMEDOUT;
+      return -1;
+    } // if hung
+    int i;
+    if (msg->flags & I2C_M_RD) {
+      dev->reads++;
+      for (i = 0; i < msg->len; i++) {
+        msg->buf[i] = dev->regs[dev->ptr];
+        _PCA9685_simStep(dev);
+      } // for data
+    } else if (msg->len > 0) {
+      // the first byte sets the pointer, the rest are written from it
+      dev->writes++;
+      dev->ptr = msg->buf[0];
+      for (i = 1; i < msg->len; i++) {
+        _PCA9685_simWrite(dev, msg->buf[i]);
+      } // for data
+    } // if read
+  } // for msgs
+  return data->nmsgs;
+} // _PCA9685_simCarry
+
+
+
+/////////////////////////////////////////////////////////////////////
+// carry out one I2C_RDWR transaction, called by _PCA9685_ioctl()
+int _PCA9685_simTransfer(PCA9685_sim* sim, int fd, char* argp) {
+  if (!sim->serialize) return _PCA9685_simCarry(sim, fd, argp);
+  while (__atomic_exchange_n(&sim->busy, 1, __ATOMIC_ACQUIRE));
+  int ret = _PCA9685_simCarry(sim, fd, argp);
+  __atomic_store_n(&sim->busy, 0, __ATOMIC_RELEASE);
+  return ret;
+} // _PCA9685_simTransfer
+
+
+
+/////////////////////////////////////////////////////////////////////
+// carry out one SMBus transfer as the I2C messages it puts on the bus
+static int _PCA9685_simSmbus(PCA9685_sim* sim, int fd, char* argp) {
+  struct i2c_smbus_ioctl_data* args = (struct i2c_smbus_ioctl_data*) argp;
+  unsigned char addr = (fd >= 0 && fd < _PCA9685_SIMFDS ? sim->slave[fd] : 0);
+  unsigned char command = args->command;
+  unsigned char buf[1 + I2C_SMBUS_BLOCK_MAX];
+  struct i2c_msg msgs[2] = {
+    { addr, 0, 1, &command },
+    { addr, I2C_M_RD, 0, NULL } };
+  struct i2c_rdwr_ioctl_data data = { msgs, 1 };
+  sim->smbus++;
+
+  if (args->size == I2C_SMBUS_QUICK) {
+    msgs[0].len = 0;
+  } else if (args->size == I2C_SMBUS_BYTE && args->read_write == I2C_SMBUS_READ) {
+    msgs[0] = msgs[1];
+    msgs[0].len = 1;
+    msgs[0].buf = &args->data->byte;
+  } else if (args->size == I2C_SMBUS_BYTE) {
+    // the command byte alone
+  } else if (args->size == I2C_SMBUS_I2C_BLOCK_DATA) {
+    int len = args->data->block[0];
+    if (len < 1 || len > I2C_SMBUS_BLOCK_MAX) {
+      errno = EINVAL;
+      return -1;
+    } // if
+    if (args->read_write == I2C_SMBUS_READ) {
+      msgs[1].len = len;
+      msgs[1].buf = &args->data->block[1];
+      data.nmsgs = 2;
+    } else {
+      buf[0] = command;
+      memcpy(&buf[1], &args->data->block[1], len);
+      msgs[0].len = 1 + len;
+      msgs[0].buf = buf;
+    } // if read
+  } else {
+    errno = EOPNOTSUPP;
+    return -1;
+  } // if size
+  return _PCA9685_simTransfer(sim, fd, (char*) &data);
+} // _PCA9685_simSmbus
+
+
+
+/////////////////////////////////////////////////////////////////////
+// answer an ioctl as an adapter with sim's funcs would
+int _PCA9685_simIoctl(PCA9685_sim* sim, int fd, unsigned long int request, char* argp) {
+  if (request == I2C_FUNCS) {
+    *(unsigned long*) argp = sim->funcs;
+    return 0;
+  } // if FUNCS
+  if (request == I2C_SLAVE) {
+    if (fd >= 0 && fd < _PCA9685_SIMFDS) sim->slave[fd] = (unsigned char) (uintptr_t) argp;
+    return 0;
+  } // if SLAVE
+  if (request == I2C_SMBUS) return _PCA9685_simSmbus(sim, fd, argp);
+  if (request != I2C_RDWR) return 0;
+
+  // the i2c core refuses what the adapter cannot do before any byte moves
+  struct i2c_rdwr_ioctl_data* data = (struct i2c_rdwr_ioctl_data*) argp;
+  if (!(sim->funcs & I2C_FUNC_I2C) || (sim->maxMsgs && data->nmsgs > sim->maxMsgs)) {
+    errno = EOPNOTSUPP;
+    return -1;
+  } // if
+  return _PCA9685_simTransfer(sim, fd, argp);
+} // _PCA9685_simIoctl
@@ -0,0 +1,91 @@
+#ifndef _PCA9685SIM_H
+#define _PCA9685SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "PCA9685.h"
+
+// max simulated devices
+#define _PCA9685_SIMDEVS	128
+
+// fds whose I2C_SLAVE address is kept for SMBus transfers
+#define _PCA9685_SIMFDS		256
+
+// one simulated pca, a register file with an auto-incrementing pointer
+typedef struct PCA9685_simDevice {
+  int fd;                       // I2C bus fd the device is on
+  unsigned char addr;           // I2C address
+  unsigned char ptr;            // register pointer
+  unsigned char regs[256];      // register file
+  int absent;                   // NACKs every message, as if unplugged
+  int hung;                     // times out every transfer, as if holding SCL low
+  uint64_t writes;              // write messages received
+  uint64_t reads;               // read messages answered
+} PCA9685_simDevice;
+
+// simulated I2C buses
+typedef struct PCA9685_sim {
+  int devices;                  // devices seen so far
+  PCA9685_simDevice dev[_PCA9685_SIMDEVS];
+  uint64_t transfers;           // I2C_RDWR transactions
+  uint64_t bytes;               // message bytes, without addresses
+  uint64_t timeouts;            // transfers a hung device timed out
+  unsigned long funcs;          // I2C_FUNCS reported, plain I2C and SMBus by default
+  unsigned int maxMsgs;         // messages one I2C_RDWR takes, 0 for any
+  uint64_t smbus;               // SMBus transfers
+  unsigned long busHz;          // SCL rate transfers take the time of, 0 for instant
+  int serialize;                // transfers from several threads wait for each
+                                // other, as on a kernel adapter; never set it
+                                // where a signal handler transfers
+  int busy;                     // 1 while a serialized transfer is on the bus
+  unsigned char slave[_PCA9685_SIMFDS]; // I2C_SLAVE address per fd
+} PCA9685_sim;
+
+// simulator that _PCA9685_ioctl() and _PCA9685_open() use instead of
+// the kernel, NULL when not simulating
+extern PCA9685_sim* _PCA9685_SIM;
+
+
+// create a simulator with no devices
+PCA9685_sim* PCA9685_simCreate(void);
+
+// free a simulator, stopping it if it is in use
+void PCA9685_simDestroy(PCA9685_sim* sim);
+
+// route every transaction to sim
+void PCA9685_simStart(PCA9685_sim* sim);
+
+// route transactions to the kernel again
+void PCA9685_simStop(void);
+
+// find the device at fd/addr, adding it with power-on registers if new
+PCA9685_simDevice* PCA9685_simFind(PCA9685_sim* sim, int fd, unsigned char addr);
+
+// unplug a device so it NACKs, or plug it back in with power-on registers
+void PCA9685_simSetAbsent(PCA9685_simDevice* dev, int absent);
+
+// hang a device so every transfer to it times out, or release it
+void PCA9685_simSetHung(PCA9685_simDevice* dev, int hung);
+
+// get the 16 ON and OFF vals of a simulated device
+void PCA9685_simGetPWMVals(const PCA9685_simDevice* dev,
+                           unsigned int* onVals, unsigned int* offVals);
+
+
+
+// carry out one I2C_RDWR transaction, called by _PCA9685_ioctl()
+int _PCA9685_simTransfer(PCA9685_sim* sim, int fd, char* argp);
+
+// answer an ioctl as an adapter with sim's funcs would, called by
+// _PCA9685_ioctl()
+int _PCA9685_simIoctl(PCA9685_sim* sim, int fd, unsigned long int request, char* argp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,603 @@
+// benchmark suite for libPCA9685
+// copyright 2018 Scott Edlin
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include <PCA9685.h>
+#include <PCA9685show.h>
+#include <PCA9685rec.h>
+#include <PCA9685sim.h>
+#include <PCA9685engine.h>
+#include <PCA9685shm.h>
+#include <PCA9685client.h>
+#include "config.h"
+
+// bus and rig parameters, set from the command line
+int boards = 60;
+int frames = 2000;
+int fps = 200;
+long busHz = 1000000;
+double speed = 10.0;
+int load = 1;
+
+
+// microseconds between two timespecs
+double elapsedUs(struct timespec* start, struct timespec* end) {
+  return (end->tv_sec - start->tv_sec) * 1000000.0 +
+         (end->tv_nsec - start->tv_nsec) / 1000.0;
+}
+
+
+// microseconds of bus time for one write message of len bytes after
+// the address: START, address, data bytes, each 9 bits, and a STOP
+double busUs(int len) {
+  return (1 + (1 + len) * 9 + 1) * 1000000.0 / busHz;
+}
+
+
+// fill offVals with a slowly fading scene, a tenth of the channels move
+void fadeFrame(unsigned int* offVals, int f) {
+  int i;
+  for (i = 0; i < boards * _PCA9685_CHANS; i++) {
+    if ((i + f) % 10 == 0) {
+      offVals[i] = (offVals[i] + 7 + i) & _PCA9685_MAXVAL;
+    } // if moving
+  } // for channels
+}
+
+
+int benchShowDecode() {
+  printf("benchShowDecode: %d boards, %d frames at %d fps, %ld Hz bus\n",
+         boards, frames, fps, busHz);
+  const char* rawPath = "PCA9685bench_raw.show";
+  const char* deltaPath = "PCA9685bench_delta.show";
+  unsigned char* adpts = calloc(boards, 1);
+  unsigned char* addrs = calloc(boards, 1);
+  unsigned int* offVals = calloc(boards * _PCA9685_CHANS, sizeof(unsigned int));
+  int b, f;
+  for (b = 0; b < boards; b++) {
+    adpts[b] = 1 + b / 62;
+    addrs[b] = 0x40 + b % 62;
+  } // for boards
+
+  PCA9685_showWriter* raw = PCA9685_showCreate(rawPath, boards, adpts, addrs);
+  PCA9685_showWriter* delta = PCA9685_showCreateDelta(deltaPath, boards, adpts, addrs,
+                                                      _PCA9685_SHOWKEYINT);
+  if (raw == NULL || delta == NULL) {
+    fprintf(stderr, "ERROR: benchShowDecode: failed to create the shows\n");
+    return -1;
+  } // if
+  for (f = 0; f < frames; f++) {
+    fadeFrame(offVals, f);
+    uint64_t ts = (uint64_t) f * 1000000 / fps;
+    if (PCA9685_showAppend(raw, ts, offVals) != 0 ||
+        PCA9685_showAppend(delta, ts, offVals) != 0) {
+      fprintf(stderr, "ERROR: benchShowDecode: append failed on frame %d\n", f);
+      return -1;
+    } // if
+  } // for frames
+  PCA9685_showFinish(raw, 0);
+  PCA9685_showFinish(delta, 0);
+
+  PCA9685_show* rawShow = PCA9685_showOpen(rawPath);
+  PCA9685_show* show = PCA9685_showOpen(deltaPath);
+  if (rawShow == NULL || show == NULL) {
+    fprintf(stderr, "ERROR: benchShowDecode: failed to open the shows\n");
+    return -1;
+  } // if
+  printf("file bytes:          raw %llu, delta %llu (%.1f%%)\n",
+         (unsigned long long) rawShow->size, (unsigned long long) show->size,
+         100.0 * show->size / rawShow->size);
+
+  // decode every frame once, timing only the decoder
+  double busRawUs = 0;
+  double busDeltaUs = 0;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (f = 0; f < frames; f++) {
+    if (PCA9685_showDecode(show) != 0) {
+      fprintf(stderr, "ERROR: benchShowDecode: PCA9685_showDecode() failed on frame %d\n", f);
+      return -1;
+    } // if
+    int s;
+    for (s = 0; s < show->spans; s++) {
+      busDeltaUs += busUs(show->spanLens[s]);
+    } // for spans
+  } // for frames
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  busRawUs = (double) frames * boards * busUs(_PCA9685_SHOWBOARDLEN);
+
+  double decodeUs = elapsedUs(&start, &end) / frames;
+  double savedUs = (busRawUs - busDeltaUs) / frames;
+  printf("decode per frame:    %.2f us\n", decodeUs);
+  printf("bus per frame:       raw %.1f us, delta %.1f us\n",
+         busRawUs / frames, busDeltaUs / frames);
+  printf("bus saved per frame: %.1f us\n", savedUs);
+
+  PCA9685_showClose(rawShow);
+  PCA9685_showClose(show);
+  unlink(rawPath);
+  unlink(deltaPath);
+  free(adpts);
+  free(addrs);
+  free(offVals);
+
+  if (decodeUs >= savedUs) {
+    fprintf(stderr, "ERROR: benchShowDecode: decoding costs more than the bus time it saves\n");
+    return -1;
+  } // if
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int benchReplay() {
+  // recording happens in real time, so keep it to two seconds
+  int recFrames = (frames < 2 * fps ? frames : 2 * fps);
+  printf("benchReplay: %d boards, %d frames at %d fps, replayed at %gx\n",
+         boards, recFrames, fps, speed);
+  const char* path = "PCA9685bench.rec";
+  PCA9685_recorder* rec = PCA9685_recCreate(path, _PCA9685_RECSEGS, _PCA9685_RECSEGSIZE);
+  unsigned int* offVals = calloc(boards * _PCA9685_CHANS, sizeof(unsigned int));
+  unsigned int onVals[_PCA9685_CHANS] = { 0 };
+  if (rec == NULL || offVals == NULL) {
+    fprintf(stderr, "ERROR: benchReplay: failed to create %s\n", path);
+    return -1;
+  } // if
+
+  PCA9685_recStart(rec);
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  int b, f;
+  for (f = 0; f < recFrames; f++) {
+    fadeFrame(offVals, f);
+    for (b = 0; b < boards; b++) {
+      PCA9685_setPWMVals(b / 62, 0x40 + b % 62, onVals, &offVals[b * _PCA9685_CHANS]);
+    } // for boards
+    deadline.tv_nsec += 1000000000 / fps;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_nsec -= 1000000000;
+      deadline.tv_sec++;
+    } // if
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+  } // for frames
+  PCA9685_recClose(rec);
+
+  PCA9685_recReader* reader = PCA9685_recOpen(path);
+  if (reader == NULL) {
+    fprintf(stderr, "ERROR: benchReplay: failed to open %s\n", path);
+    return -1;
+  } // if
+  PCA9685_recStats stats;
+  int rc = PCA9685_recReplay(reader, NULL, speed, &stats);
+  PCA9685_recCloseReader(reader);
+  unlink(path);
+  free(offVals);
+
+  // a replay that cannot keep pace falls further behind with every frame
+  double frameUs = 1000000.0 / fps;
+  printf("transactions:        %llu, %llu failed\n",
+         (unsigned long long) stats.records, (unsigned long long) stats.failed);
+  printf("late:                %.1f us mean, %.1f us max\n",
+         stats.meanLateNs / 1000.0, stats.maxLateNs / 1000.0);
+  printf("drift at the end:    %.1f us, frame %.1f us\n", stats.driftNs / 1000.0, frameUs);
+  if (rc != 0 || stats.driftNs / 1000.0 >= frameUs) {
+    fprintf(stderr, "ERROR: benchReplay: replay fell more than a frame behind\n");
+    return -1;
+  } // if
+  printf("passed\n\n");
+  return 0;
+}
+
+
+// competing normal priority load, spins until told to stop
+int loadRunning;
+void* loadThread(void* arg) {
+  (void) arg;
+  volatile unsigned long spins = 0;
+  while (__atomic_load_n(&loadRunning, __ATOMIC_RELAXED)) spins++;
+  return NULL;
+}
+
+
+// run an engine for two seconds under load, with rt or without
+int jitterRun(PCA9685_engine* engine, const PCA9685_rtConfig* rt, const char* label) {
+  int ticks = 2 * fps;
+  unsigned int* offVals = calloc(boards * _PCA9685_CHANS, sizeof(unsigned int));
+  pthread_t* loads = calloc(load > 0 ? load : 1, sizeof(pthread_t));
+  if (offVals == NULL || loads == NULL) return -1;
+  PCA9685_engineResetStats(engine);
+  if (PCA9685_engineStart(engine, rt) != 0) {
+    printf("%-20s skipped, PCA9685_engineStart() failed\n", label);
+    free(offVals);
+    free(loads);
+    return 0;
+  } // if
+  __atomic_store_n(&loadRunning, 1, __ATOMIC_RELAXED);
+  int l;
+  for (l = 0; l < load; l++) {
+    pthread_create(&loads[l], NULL, loadThread, NULL);
+  } // for loads
+
+  // submit at the frame rate from this thread, as an app would
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  int b, f;
+  for (f = 0; f < ticks; f++) {
+    fadeFrame(offVals, f);
+    for (b = 0; b < boards; b++) {
+      PCA9685_engineSubmit(engine, b, NULL, &offVals[b * _PCA9685_CHANS]);
+    } // for boards
+    deadline.tv_nsec += 1000000000 / fps;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_nsec -= 1000000000;
+      deadline.tv_sec++;
+    } // if
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+  } // for frames
+
+  __atomic_store_n(&loadRunning, 0, __ATOMIC_RELAXED);
+  for (l = 0; l < load; l++) {
+    pthread_join(loads[l], NULL);
+  } // for loads
+  PCA9685_engineStop(engine);
+  free(offVals);
+  free(loads);
+
+  printf("%-20s %6llu ticks %5llu missed, late %8.1f us mean %8.1f us p99 %8.1f us max\n",
+         label, (unsigned long long) engine->ticks, (unsigned long long) engine->missed,
+         engine->ticks ? engine->sumLateNs / 1000.0 / engine->ticks : 0.0,
+         PCA9685_engineLatePercentile(engine, 0.99) / 1000.0, engine->maxLateNs / 1000.0);
+  return 0;
+}
+
+
+int benchJitter() {
+  printf("benchJitter: %d boards at %d fps, %d load threads\n", boards, fps, load);
+  PCA9685_engine* engine = PCA9685_engineCreate(fps);
+  if (engine == NULL) {
+    fprintf(stderr, "ERROR: benchJitter: PCA9685_engineCreate() failed\n");
+    return -1;
+  } // if
+  // initialized first, or the probes find power-on boards and restore them
+  int b;
+  for (b = 0; b < boards; b++) {
+    if (PCA9685_initPWM(b / 62, 0x40 + b % 62, 200) != 0 ||
+        PCA9685_engineAdd(engine, b / 62, 0x40 + b % 62) < 0) {
+      fprintf(stderr, "ERROR: benchJitter: failed to initialize or add a board\n");
+      return -1;
+    } // if
+  } // for boards
+
+  // the report is informational, tick lateness depends on the machine
+  PCA9685_rtConfig rt;
+  PCA9685_rtDefaults(&rt);
+  int rc = jitterRun(engine, NULL, "normal:");
+  if (rc == 0) rc = jitterRun(engine, &rt, "SCHED_FIFO, locked:");
+  PCA9685_engineDestroy(engine);
+  if (rc != 0) {
+    fprintf(stderr, "ERROR: benchJitter: failed to run the engine\n");
+    return -1;
+  } // if
+  printf("passed\n\n");
+  return 0;
+}
+
+
+// sort doubles ascending
+int compareDoubles(const void* a, const void* b) {
+  double x = *(const double*) a;
+  double y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+
+// publish every board of every frame through the client, timing each call
+int clientRun(int mode, PCA9685_shm* daemon, const char* label, double busPerCall) {
+  int calls = frames * boards;
+  double* us = calloc(calls, sizeof(double));
+  unsigned int* offVals = calloc(boards * _PCA9685_CHANS, sizeof(unsigned int));
+  unsigned int onVals[_PCA9685_CHANS] = { 0 };
+  int adpts = (boards + 61) / 62;
+  int* handles = calloc(adpts, sizeof(int));
+  if (us == NULL || offVals == NULL || handles == NULL) return -1;
+  PCA9685_clientSetup("/PCA9685bench", mode);
+  int a;
+  for (a = 0; a < adpts; a++) {
+    handles[a] = PCA9685_clientOpenI2C(a, 0x40);
+    if (handles[a] < 0) return -1;
+  } // for adapters
+
+  static PCA9685_shmFrame merged;
+  int merges = 0;
+  int b, f, c = 0;
+  for (f = 0; f < frames; f++) {
+    fadeFrame(offVals, f);
+    for (b = 0; b < boards; b++) {
+      struct timespec start, end;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      PCA9685_clientSetPWMVals(handles[b / 62], 0x40 + b % 62, onVals, &offVals[b * _PCA9685_CHANS]);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      us[c++] = elapsedUs(&start, &end);
+    } // for boards
+    if (daemon) merges += PCA9685_shmMerge(daemon, &merged);
+  } // for frames
+  for (a = 0; a < adpts; a++) {
+    PCA9685_clientClose(handles[a]);
+  } // for adapters
+  PCA9685_clientSetup(NULL, PCA9685_CLIENTAUTO);
+
+  double sum = 0.0;
+  for (c = 0; c < calls; c++) sum += us[c];
+  qsort(us, calls, sizeof(double), compareDoubles);
+  printf("%-20s %8.2f us mean %8.2f us p99 %8.2f us max per call",
+         label, sum / calls, us[(int) (calls * 0.99)], us[calls - 1]);
+  if (busPerCall > 0) {
+    printf(", plus %.1f us on the bus", busPerCall);
+  } else {
+    printf(", %d frames merged", merges);
+  } // if direct
+  printf("\n");
+  free(us);
+  free(offVals);
+  free(handles);
+  return 0;
+}
+
+
+int benchClient() {
+  printf("benchClient: %d boards, %d frames\n", boards, frames);
+  PCA9685_shm* daemon = PCA9685_shmCreate("/PCA9685bench", -1);
+  if (daemon == NULL) {
+    fprintf(stderr, "ERROR: benchClient: failed to create the segment\n");
+    return -1;
+  } // if
+
+  // through the daemon a call returns once the frame is in shared memory,
+  // directly once the simulated bus took it, the real bus time is added
+  int rc = clientRun(PCA9685_CLIENTDAEMON, daemon, "through pca9685d:", 0.0);
+  PCA9685_shmClose(daemon);
+  if (rc == 0) rc = clientRun(PCA9685_CLIENTDIRECT, NULL, "direct:", busUs(1 + _PCA9685_CHANS*4));
+  if (rc != 0) {
+    fprintf(stderr, "ERROR: benchClient: failed to open the boards\n");
+    return -1;
+  } // if
+  printf("passed\n\n");
+  return 0;
+}
+
+
+// 1 if every channel of every board is fully off
+int allOff(PCA9685_sim* sim) {
+  int b, c;
+  for (b = 0; b < boards; b++) {
+    PCA9685_simDevice* dev = PCA9685_simFind(sim, b / 62, 0x40 + b % 62);
+    for (c = 0; c < _PCA9685_CHANS; c++) {
+      if (!(dev->regs[_PCA9685_BASEPWMREG + c*4 + 3] & _PCA9685_FULLBIT)) return 0;
+    } // for chans
+  } // for boards
+  return 1;
+}
+
+
+// fire emergencyOff() while the engine's writer has a frame on the bus,
+// timing until every LED is off for good; the simulated bus serializes
+// transfers like the kernel's adapter lock, so the call waits its turn
+int emergencyRun(PCA9685_sim* sim, int trials, double* meanUs, double* maxUs, int* leaks) {
+  PCA9685_engine* engine = PCA9685_engineCreate(fps);
+  unsigned int* offVals = calloc(boards * _PCA9685_CHANS, sizeof(unsigned int));
+  if (engine == NULL || offVals == NULL) return -1;
+  int b;
+  for (b = 0; b < boards; b++) {
+    if (PCA9685_engineAdd(engine, b / 62, 0x40 + b % 62) < 0) return -1;
+  } // for boards
+  sim->busHz = busHz;
+  __atomic_store_n(&sim->serialize, 1, __ATOMIC_RELEASE);
+  if (PCA9685_engineStart(engine, NULL) != 0) return -1;
+
+  // a late frame lands within a tick and a frame transaction
+  double windowUs = 2 * (1e6 / fps + boards * busUs(1 + _PCA9685_CHANS*4));
+  double sumUs = 0.0;
+  *maxUs = 0.0;
+  *leaks = 0;
+  int t, i;
+  for (t = 0; t < trials; t++) {
+    // every channel changes, so the writer has a full frame to send
+    for (i = 0; i < boards * _PCA9685_CHANS; i++) {
+      offVals[i] = 1 + (t * 37 + i) % _PCA9685_MAXVAL;
+    } // for channels
+    for (b = 0; b < boards; b++) {
+      PCA9685_engineSubmit(engine, b, NULL, &offVals[b * _PCA9685_CHANS]);
+    } // for boards
+    struct timespec start, now, lastOn;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (!__atomic_load_n(&sim->busy, __ATOMIC_ACQUIRE) && elapsedUs(&start, &now) < windowUs);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    PCA9685_emergencyOff();
+    clock_gettime(CLOCK_MONOTONIC, &lastOn);
+    do {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      if (!allOff(sim)) lastOn = now;
+    } while (elapsedUs(&start, &now) < windowUs);
+    if (!allOff(sim)) (*leaks)++;
+    double us = elapsedUs(&start, &lastOn);
+    sumUs += us;
+    if (us > *maxUs) *maxUs = us;
+    PCA9685_emergencyClear();
+  } // for trials
+
+  PCA9685_engineStop(engine);
+  __atomic_store_n(&sim->serialize, 0, __ATOMIC_RELEASE);
+  sim->busHz = 0;
+  PCA9685_engineDestroy(engine);
+  free(offVals);
+  *meanUs = sumUs / trials;
+  return 0;
+}
+
+
+int benchEmergency() {
+  printf("benchEmergency: %d boards, %ld Hz bus\n", boards, busHz);
+  int b;
+  for (b = 0; b < boards; b++) {
+    if (PCA9685_initPWM(b / 62, 0x40 + b % 62, 200) != 0) {
+      fprintf(stderr, "ERROR: benchEmergency: PCA9685_initPWM() failed\n");
+      return -1;
+    } // if
+  } // for boards
+  PCA9685_sim* sim = __atomic_load_n(&_PCA9685_SIM, __ATOMIC_ACQUIRE);
+
+  // the signal handler path
+  int runs = 1000;
+  double sumUs = 0.0, maxUs = 0.0;
+  uint64_t transfers = sim->transfers;
+  int r, rc = 0;
+  for (r = 0; r < runs; r++) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rc |= PCA9685_emergencyOff();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    PCA9685_emergencyClear();
+    double us = elapsedUs(&start, &end);
+    sumUs += us;
+    if (us > maxUs) maxUs = us;
+  } // for runs
+  double ioctls = (double) (sim->transfers - transfers) / runs;
+  int off = 0;
+  for (b = 0; b < boards; b++) {
+    PCA9685_simDevice* dev = PCA9685_simFind(sim, b / 62, 0x40 + b % 62);
+    if (dev->regs[_PCA9685_BASEPWMREG + _PCA9685_CHANS*4 - 1] & _PCA9685_FULLBIT) off++;
+  } // for boards
+
+  // the handlers it replaces, PCA9685_setAllPWM() one register at a time
+  double allUs = 0.0;
+  transfers = sim->transfers;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (b = 0; b < boards; b++) {
+    PCA9685_setAllPWM(b / 62, 0x40 + b % 62, _PCA9685_MINVAL, _PCA9685_MINVAL);
+  } // for boards
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  allUs = elapsedUs(&start, &end);
+  uint64_t allIoctls = sim->transfers - transfers;
+
+  // on the bus each device costs one 5 byte message, and the worst case
+  // waits for a whole batched frame transaction already on the bus
+  int perBus = (boards < _PCA9685_BATCHMSGS ? boards : _PCA9685_BATCHMSGS);
+  double busTime = boards * busUs(5);
+  printf("emergencyOff:        %8.2f us mean %8.2f us max per call, %.0f ioctls, %.1f us on the bus\n",
+         sumUs / runs, maxUs, ioctls, busTime);
+  printf("setAllPWM each board:%8.2f us in all, %llu ioctls, %.1f us on the bus\n",
+         allUs, (unsigned long long) allIoctls, boards * 4 * busUs(2));
+  printf("bound:               %8.1f us, behind a %d device frame transaction\n",
+         busTime + perBus * busUs(1 + _PCA9685_CHANS*4), perBus);
+  if (rc != 0 || off != boards) {
+    fprintf(stderr, "ERROR: benchEmergency: %d of %d boards fully off\n", off, boards);
+    return -1;
+  } // if
+
+  // and measured against an engine flushing on another thread
+  int trials = 20, leaks = 0;
+  double flightUs = 0.0, flightMaxUs = 0.0;
+  if (emergencyRun(sim, trials, &flightUs, &flightMaxUs, &leaks) != 0) {
+    fprintf(stderr, "ERROR: benchEmergency: failed to run the engine\n");
+    return -1;
+  } // if
+  printf("during a flush:      %8.1f us mean %8.1f us max until every LED stayed off, %d of %d left on\n",
+         flightUs, flightMaxUs, leaks, trials);
+  if (leaks) {
+    fprintf(stderr, "ERROR: benchEmergency: a frame landed after the emergency stop\n");
+    return -1;
+  } // if
+  printf("passed\n\n");
+  return 0;
+}
+
+
+// benchmarks by name
+struct bench {
+  const char* name;
+  int (*run)();
+} benches[] = {
+  { "showdecode", benchShowDecode },
+  { "replay", benchReplay },
+  { "jitter", benchJitter },
+  { "client", benchClient },
+  { "emergency", benchEmergency },
+};
+#define BENCHES (int)(sizeof(benches) / sizeof(benches[0]))
+
+
+int main(int argc, char **argv) {
+  int c;
+  while ((c = getopt(argc, argv, "b:f:l:r:s:x:v")) != -1) {
+    switch(c) {
+    case 'b': // boards
+      boards = atoi(optarg);
+      break;
+    case 'f': // frames
+      frames = atoi(optarg);
+      break;
+    case 'l': // load threads
+      load = atoi(optarg);
+      break;
+    case 'r': // bus rate
+      busHz = atol(optarg);
+      break;
+    case 's': // frames per second
+      fps = atoi(optarg);
+      break;
+    case 'x': // replay speed
+      speed = atof(optarg);
+      break;
+    case 'v': // version
+      fprintf(stdout, "PCA9685bench %d.%d\n", libPCA9685_VERSION_MAJOR, libPCA9685_VERSION_MINOR);
+      exit(0);
+      break;
+    }
+  }
+
+  if (boards < 1 || frames < 1 || fps < 1 || busHz < 1 || load < 0 || !(speed > 0)) {
+    fprintf(stderr, "Usage: %s [-b boards] [-f frames] [-l load threads] [-s fps] [-r bus Hz] [-x speed] [-v] [bench ...]\n", argv[0]);
+    fprintf(stderr, "Benchmarks:");
+    int i;
+    for (i = 0; i < BENCHES; i++) {
+      fprintf(stderr, " %s", benches[i].name);
+    } // for benches
+    fprintf(stderr, "\n");
+    exit(-1);
+  } // if args
+
+  // never touch real hardware
+  PCA9685_sim* sim = PCA9685_simCreate();
+  if (sim == NULL) exit(-1);
+  PCA9685_simStart(sim);
+
+  int i, rc;
+  for (i = 0; i < BENCHES; i++) {
+    int run = (optind == argc);
+    int a;
+    for (a = optind; a < argc; a++) {
+      if (strcmp(argv[a], benches[i].name) == 0) run = 1;
+    } // for args
+    if (!run) continue;
+    rc = benches[i].run();
+    if (rc) {
+      fprintf(stderr, "ERROR: %s returned %d\n", benches[i].name, rc);
+      exit(-1);
+    } // if rc
+  } // for benches
+
+  PCA9685_simDestroy(sim);
+  printf("All benchmarks passed.\n");
+  return 0;
+}
@@ -5,8 +5,25 @@
 #include <stdio.h>
 #include <limits.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <math.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <linux/i2c.h>
 
 #include <PCA9685.h>
+#include <PCA9685servo.h>
+#include <PCA9685map.h>
+#include <PCA9685show.h>
+#include <PCA9685rec.h>
+#include <PCA9685sim.h>
+#include <PCA9685engine.h>
+#include <PCA9685metrics.h>
+#include <PCA9685shm.h>
+#include <PCA9685client.h>
 #include "config.h"
 
 int adpt;
@@ -133,6 +150,1252 @@ int testTurnOffAllChannels() {
 }
 
 
+int testServo() {
+  printf("testServo\n");
+  int freq = 50;
+  unsigned char addrs[1] = { addr };
+  PCA9685_servoRig* rig = PCA9685_servoCreate(1, &fd, addrs, freq);
+  if (rig == NULL) {
+    fprintf(stderr, "ERROR: testServo: PCA9685_servoCreate(1, %d, 0x%02x, %d) returned NULL\n", fd, addr, freq);
+    return -1;
+  } // if rig
+  // 50 Hz with prescale 0x79 gives a 19988.48us period
+  unsigned int count = PCA9685_servoUsToCount(rig, 1500.0f);
+  if (count != 307) {
+    fprintf(stderr, "ERROR: testServo: PCA9685_servoUsToCount(1500) returned %d\n", count);
+    PCA9685_servoDestroy(rig);
+    return -1;
+  } // if count
+  // pulses must be positive, rising and inside the period
+  PCA9685_servoCal cals[4] = {
+    { 1000.0f, 1500.0f, 2000.0f, 0.0f, 180.0f },
+    { 0.0f, 1500.0f, 2500.0f, 0.0f, 180.0f },
+    { 1000.0f, 2500.0f, 2000.0f, 0.0f, 180.0f },
+    { 1000.0f, 1500.0f, 20000.0f, 0.0f, 180.0f } };
+  int c;
+  for (c = 0; c < 4; c++) {
+    if (PCA9685_servoSetCal(rig, 0, &cals[c]) != (c == 0 ? 0 : -1)) {
+      fprintf(stderr, "ERROR: testServo: PCA9685_servoSetCal() misjudged calibration %d\n", c);
+      PCA9685_servoDestroy(rig);
+      return -1;
+    } // if
+  } // for cals
+  float angles[_PCA9685_CHANS] =
+    { 0, 45, 90, 135, 180, -10, 190, 90, 90, 90, 90, 90, 90, 90, 90, NAN };
+  int rc = PCA9685_servoSetAngles(rig, angles);
+  if (rc != 0 && !_PCA9685_TEST) {
+    fprintf(stderr, "ERROR: testServo: PCA9685_servoSetAngles() returned %d\n", rc);
+    PCA9685_servoDestroy(rig);
+    return -1;
+  } // if rc
+  float pulses[_PCA9685_CHANS] =
+    { 1000, 1100, 1200, 1300, 1400, 1500, 1600, 1700,
+      1800, 1900, 2000, 2100, 2200, 2300, 2400, 2500 };
+  rc = PCA9685_servoSetPulses(rig, pulses);
+  if (rc != 0 && !_PCA9685_TEST) {
+    fprintf(stderr, "ERROR: testServo: PCA9685_servoSetPulses() returned %d\n", rc);
+    PCA9685_servoDestroy(rig);
+    return -1;
+  } // if rc
+  PCA9685_servoDestroy(rig);
+
+  // a board that fails a frequency change leaves every board at the old one
+  PCA9685_sim* sim = PCA9685_simCreate();
+  if (sim == NULL) {
+    fprintf(stderr, "ERROR: testServo: PCA9685_simCreate() returned NULL\n");
+    return -1;
+  } // if sim
+  PCA9685_simStart(sim);
+  int fds[2] = { fd, fd };
+  unsigned char rigAddrs[2] = { addr, addr + 1 };
+  unsigned char mode1val = _PCA9685_AUTOINCBIT;
+  int i;
+  for (i = 0; i < 2; i++) {
+    _PCA9685_writeI2CReg(fds[i], rigAddrs[i], _PCA9685_MODE1REG, 1, &mode1val);
+  } // for boards
+  PCA9685_simSetAbsent(PCA9685_simFind(sim, fd, addr + 1), 1);
+  rig = PCA9685_servoCreate(2, fds, rigAddrs, freq);
+  rc = PCA9685_servoSetFreq(rig, 60);
+  PCA9685_simStop();
+  unsigned char prescale = PCA9685_simFind(sim, fd, addr)->regs[_PCA9685_PRESCALEREG];
+  if (rc != -1 || rig->freq != (unsigned int) freq ||
+      prescale != _PCA9685_calcPrescale(freq)) {
+    fprintf(stderr, "ERROR: testServo: a failed PCA9685_servoSetFreq() left prescale 0x%02x\n",
+            prescale);
+    PCA9685_servoDestroy(rig);
+    return -1;
+  } // if rc
+  PCA9685_servoDestroy(rig);
+  PCA9685_simDestroy(sim);
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testMap() {
+  printf("testMap\n");
+  const char* config =
+    "# logical adpt addr led count\n"
+    "0  1 0x41 12 4   # spot 1\n"
+    "4  1 0x40 0 16   # wash\n";
+  PCA9685_map* map = PCA9685_mapParse(config);
+  if (map == NULL) {
+    fprintf(stderr, "ERROR: testMap: PCA9685_mapParse() returned NULL\n");
+    return -1;
+  } // if map
+  if (map->chans != 20 || map->boards != 2 || map->board[0].addr != 0x40) {
+    fprintf(stderr, "ERROR: testMap: compiled %d channels on %d boards\n", map->chans, map->boards);
+    PCA9685_mapDestroy(map);
+    return -1;
+  } // if compiled
+  // skip PCA9685_mapOpen() since every board shares the test fd
+  int b;
+  for (b = 0; b < map->boards; b++) {
+    map->board[b].fd = fd;
+  } // for boards
+  unsigned short frame[20];
+  int i;
+  for (i = 0; i < 20; i++) {
+    frame[i] = 0x100 * (i % 16) + i;
+  } // for frame
+  int rc = PCA9685_mapSetFrame(map, frame);
+  if (rc != 0 && !_PCA9685_TEST) {
+    fprintf(stderr, "ERROR: testMap: PCA9685_mapSetFrame() returned %d\n", rc);
+    PCA9685_mapDestroy(map);
+    return -1;
+  } // if rc
+  PCA9685_mapDestroy(map);
+
+  // values that would wrap to a valid board or LED are refused
+  const char* wrapped[3] = { "0 1 0x140 0\n", "0 257 0x40 0\n", "0 1 0x40 256\n" };
+  for (i = 0; i < 3; i++) {
+    map = PCA9685_mapParse(wrapped[i]);
+    if (map != NULL) {
+      fprintf(stderr, "ERROR: testMap: PCA9685_mapParse() accepted %s", wrapped[i]);
+      PCA9685_mapDestroy(map);
+      return -1;
+    } // if map
+  } // for wrapped
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testSnapshot() {
+  printf("testSnapshot\n");
+  unsigned char addrs[2] = { addr, addr + 1 };
+  PCA9685_snapshot snaps[2];
+  int rc = PCA9685_getSnapshots(fd, 2, addrs, snaps);
+  if (rc != 0 && !_PCA9685_TEST) {
+    fprintf(stderr, "ERROR: testSnapshot: PCA9685_getSnapshots(%d, 2, 0x%02x) returned %d\n", fd, addr, rc);
+    return -1;
+  } // if rc
+  if (snaps[1].addr != addr + 1) {
+    fprintf(stderr, "ERROR: testSnapshot: snapshot 1 has addr 0x%02x\n", snaps[1].addr);
+    return -1;
+  } // if addr
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testShow() {
+  printf("testShow\n");
+  const char* path = "PCA9685test.show";
+  unsigned char adpts[2] = { adpt, adpt };
+  unsigned char addrs[2] = { addr, addr + 1 };
+  PCA9685_showWriter* writer = PCA9685_showCreate(path, 2, adpts, addrs);
+  if (writer == NULL) {
+    fprintf(stderr, "ERROR: testShow: PCA9685_showCreate(%s) returned NULL\n", path);
+    return -1;
+  } // if writer
+  unsigned int offVals[2 * _PCA9685_CHANS];
+  int f, i;
+  for (f = 0; f < 3; f++) {
+    for (i = 0; i < 2 * _PCA9685_CHANS; i++) {
+      offVals[i] = f * 0x100 + i;
+    } // for channels
+    if (PCA9685_showAppend(writer, f * 10000, offVals) != 0) {
+      fprintf(stderr, "ERROR: testShow: PCA9685_showAppend() failed on frame %d\n", f);
+      return -1;
+    } // if append
+  } // for frames
+  if (PCA9685_showFinish(writer, 0) != 0) {
+    fprintf(stderr, "ERROR: testShow: PCA9685_showFinish() failed\n");
+    return -1;
+  } // if finish
+
+  PCA9685_show* show = PCA9685_showOpen(path);
+  if (show == NULL) {
+    fprintf(stderr, "ERROR: testShow: PCA9685_showOpen(%s) returned NULL\n", path);
+    return -1;
+  } // if show
+  PCA9685_showSetFd(show, 0, fd);
+  PCA9685_showSetFd(show, 1, fd);
+  if (show->hdr.frames != 3 || show->hdr.durationUs != 30000 ||
+      PCA9685_showSeekTime(show, 15000) != 0 || show->pos != 1) {
+    fprintf(stderr, "ERROR: testShow: %llu frames, %lluus, seek to frame %llu\n",
+            (unsigned long long) show->hdr.frames, (unsigned long long) show->hdr.durationUs,
+            (unsigned long long) show->pos);
+    PCA9685_showClose(show);
+    return -1;
+  } // if header
+  int rc = PCA9685_showWriteFrame(show);
+  if (rc != 0 && !_PCA9685_TEST) {
+    fprintf(stderr, "ERROR: testShow: PCA9685_showWriteFrame() returned %d\n", rc);
+    PCA9685_showClose(show);
+    return -1;
+  } // if rc
+  PCA9685_showClose(show);
+  unlink(path);
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testShowDelta() {
+  printf("testShowDelta\n");
+  const char* path = "PCA9685test.show";
+  unsigned char adpts[2] = { adpt, adpt };
+  unsigned char addrs[2] = { addr, addr + 1 };
+  PCA9685_showWriter* writer = PCA9685_showCreateDelta(path, 2, adpts, addrs, 4);
+  if (writer == NULL) {
+    fprintf(stderr, "ERROR: testShowDelta: PCA9685_showCreateDelta(%s) returned NULL\n", path);
+    return -1;
+  } // if writer
+  // frame 1 changes one channel on each board, frame 2 changes nothing
+  unsigned int offVals[2 * _PCA9685_CHANS] = { 0 };
+  int f;
+  for (f = 0; f < 4; f++) {
+    if (f == 1) {
+      offVals[3] = 0x123;
+      offVals[_PCA9685_CHANS + 10] = 0xfff;
+    } else if (f == 3) {
+      offVals[0] = 0x001;
+    } // if f
+    if (PCA9685_showAppend(writer, f * 10000, offVals) != 0) {
+      fprintf(stderr, "ERROR: testShowDelta: PCA9685_showAppend() failed on frame %d\n", f);
+      return -1;
+    } // if append
+  } // for frames
+  if (PCA9685_showFinish(writer, 0) != 0) {
+    fprintf(stderr, "ERROR: testShowDelta: PCA9685_showFinish() failed\n");
+    return -1;
+  } // if finish
+
+  PCA9685_show* show = PCA9685_showOpen(path);
+  if (show == NULL) {
+    fprintf(stderr, "ERROR: testShowDelta: PCA9685_showOpen(%s) returned NULL\n", path);
+    return -1;
+  } // if show
+  PCA9685_showSetFd(show, 0, fd);
+  PCA9685_showSetFd(show, 1, fd);
+  // full frame, two single-channel spans, then no transaction at all
+  int spans[3] = { 2, 2, 0 };
+  for (f = 0; f < 3; f++) {
+    int rc = PCA9685_showWriteFrame(show);
+    if ((rc != 0 && !_PCA9685_TEST) || show->spans != spans[f]) {
+      fprintf(stderr, "ERROR: testShowDelta: frame %d returned %d with %d spans\n", f, rc, show->spans);
+      PCA9685_showClose(show);
+      return -1;
+    } // if rc
+  } // for frames
+  // seeking rebuilds the shadow from the keyframe and writes whole boards
+  if (PCA9685_showSeekTime(show, 25000) != 0 || show->pos != 2 ||
+      PCA9685_showWriteFrame(show) != 0 || show->spanLens[0] != 65 ||
+      show->spanBufs[1][1 + 10*4 + 3] != 0x0f) {
+    fprintf(stderr, "ERROR: testShowDelta: seek to 25000us gave frame %llu\n",
+            (unsigned long long) show->pos);
+    PCA9685_showClose(show);
+    return -1;
+  } // if seek
+  // a frame cut short after the second board's span count, board 0 has
+  // the count and one 2 byte span of LED3's OFF, is refused, not read past
+  uint32_t cutLen = 1 + 2 + 2 + 1;
+  FILE* file = fopen(path, "r+b");
+  int cut = (PCA9685_showSeekTime(show, 10000) == 0 && file != NULL &&
+             fseek(file, show->posOff + sizeof(uint64_t), SEEK_SET) == 0 &&
+             fwrite(&cutLen, sizeof(cutLen), 1, file) == 1);
+  if (file) fclose(file);
+  if (!cut || PCA9685_showDecode(show) != -1) {
+    fprintf(stderr, "ERROR: testShowDelta: a frame cut short was decoded\n");
+    PCA9685_showClose(show);
+    return -1;
+  } // if cut
+  PCA9685_showClose(show);
+  unlink(path);
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testRecorder() {
+  printf("testRecorder\n");
+  const char* path = "PCA9685test.rec";
+  // each segment holds two transactions of one 65 byte message
+  PCA9685_recorder* rec = PCA9685_recCreate(path, 2, 256);
+  if (rec == NULL) {
+    fprintf(stderr, "ERROR: testRecorder: PCA9685_recCreate(%s) returned NULL\n", path);
+    return -1;
+  } // if rec
+  PCA9685_recStart(rec);
+  unsigned int onVals[_PCA9685_CHANS] = { 0 };
+  unsigned int offVals[_PCA9685_CHANS] = { 0 };
+  int i;
+  for (i = 0; i < 5; i++) {
+    offVals[0] = i;
+    PCA9685_setPWMVals(fd, addr, onVals, offVals);
+  } // for transactions
+  PCA9685_recClose(rec);
+
+  // the ring wrapped into the first segment, so only the last 3 remain
+  PCA9685_recReader* reader = PCA9685_recOpen(path);
+  if (reader == NULL) {
+    fprintf(stderr, "ERROR: testRecorder: PCA9685_recOpen(%s) returned NULL\n", path);
+    return -1;
+  } // if reader
+  const PCA9685_recRecord* record;
+  uint64_t lastNs = 0;
+  int count = 0;
+  while ((record = PCA9685_recNext(reader)) != NULL) {
+    const PCA9685_recMsg* msg = PCA9685_recFirstMsg(record);
+    const unsigned char* data = PCA9685_recMsgData(msg);
+    if (record->nmsgs != 1 || record->fd != fd || msg->addr != addr ||
+        msg->len != 65 || data[0] != _PCA9685_BASEPWMREG || data[3] != 2 + count ||
+        record->timestampNs < lastNs) {
+      fprintf(stderr, "ERROR: testRecorder: record %d does not match\n", count);
+      PCA9685_recCloseReader(reader);
+      return -1;
+    } // if record
+    lastNs = record->timestampNs;
+    count++;
+  } // while records
+  if (count != 3 || reader->hdr->dropped != 0 ||
+      PCA9685_recAdapter(reader->hdr, fd) != adpt) {
+    fprintf(stderr, "ERROR: testRecorder: read %d records, %llu dropped\n",
+            count, (unsigned long long) reader->hdr->dropped);
+    PCA9685_recCloseReader(reader);
+    return -1;
+  } // if count
+  PCA9685_recCloseReader(reader);
+  unlink(path);
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testReplay() {
+  printf("testReplay\n");
+  const char* path = "PCA9685test.rec";
+  PCA9685_sim* sim = PCA9685_simCreate();
+  PCA9685_recorder* rec = PCA9685_recCreate(path, 2, 1024);
+  if (sim == NULL || rec == NULL) {
+    fprintf(stderr, "ERROR: testReplay: failed to create the simulator or %s\n", path);
+    return -1;
+  } // if
+  // record auto increment and three frames on one simulated device
+  PCA9685_simStart(sim);
+  PCA9685_recStart(rec);
+  unsigned char mode1val = _PCA9685_AUTOINCBIT;
+  _PCA9685_writeI2CReg(fd, addr, _PCA9685_MODE1REG, 1, &mode1val);
+  unsigned int onVals[_PCA9685_CHANS] = { 0 };
+  unsigned int offVals[_PCA9685_CHANS] = { 0 };
+  int i;
+  for (i = 0; i < 3; i++) {
+    offVals[1] = 0x100 * (i + 1);
+    PCA9685_setPWMVals(fd, addr, onVals, offVals);
+  } // for frames
+  PCA9685_recClose(rec);
+  PCA9685_simDestroy(sim);
+
+  // replay at 10x onto a fresh simulator
+  sim = PCA9685_simCreate();
+  PCA9685_recReader* reader = PCA9685_recOpen(path);
+  if (sim == NULL || reader == NULL) {
+    fprintf(stderr, "ERROR: testReplay: failed to create the simulator or open %s\n", path);
+    return -1;
+  } // if
+  PCA9685_simStart(sim);
+  PCA9685_recStats stats;
+  int rc = PCA9685_recReplay(reader, NULL, 10.0, &stats);
+  PCA9685_simStop();
+  PCA9685_recCloseReader(reader);
+  unlink(path);
+
+  PCA9685_simDevice* dev = PCA9685_simFind(sim, fd, addr);
+  PCA9685_simGetPWMVals(dev, onVals, offVals);
+  if (rc != 0 || stats.records != 4 || stats.failed != 0 || sim->transfers != 4 ||
+      dev->regs[_PCA9685_MODE1REG] != _PCA9685_AUTOINCBIT ||
+      offVals[0] != 0 || offVals[1] != 0x300 || offVals[2] != 0) {
+    fprintf(stderr, "ERROR: testReplay: replayed %llu records, LED1 OFF 0x%03x\n",
+            (unsigned long long) stats.records, offVals[1]);
+    PCA9685_simDestroy(sim);
+    return -1;
+  } // if
+  PCA9685_simDestroy(sim);
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testEngine() {
+  printf("testEngine\n");
+  PCA9685_sim* sim = PCA9685_simCreate();
+  PCA9685_engine* engine = PCA9685_engineCreate(50);
+  if (sim == NULL || engine == NULL) {
+    fprintf(stderr, "ERROR: testEngine: failed to create the simulator or engine\n");
+    return -1;
+  } // if
+  PCA9685_simStart(sim);
+  unsigned char mode1val = _PCA9685_AUTOINCBIT;
+  _PCA9685_writeI2CReg(fd, addr, _PCA9685_MODE1REG, 1, &mode1val);
+  _PCA9685_writeI2CReg(fd, addr + 1, _PCA9685_MODE1REG, 1, &mode1val);
+  int dev0 = PCA9685_engineAdd(engine, fd, addr);
+  int dev1 = PCA9685_engineAdd(engine, fd, addr + 1);
+
+  // nothing is due right after create
+  int rc = PCA9685_engineService(engine);
+  if (rc != 0) {
+    fprintf(stderr, "ERROR: testEngine: PCA9685_engineService() returned %d before a tick\n", rc);
+    return -1;
+  } // if
+
+  // the first frame writes every LED reg of both devices in one batch
+  unsigned int offVals[_PCA9685_CHANS] = { 0 };
+  PCA9685_engineSubmit(engine, dev0, NULL, offVals);
+  PCA9685_engineSubmit(engine, dev1, NULL, offVals);
+  uint64_t transfers = sim->transfers;
+  rc = PCA9685_engineFlush(engine);
+  if (rc != 0 || sim->transfers != transfers + 1 || engine->msgsSent != 2 ||
+      engine->bytesSent != 2 * (1 + _PCA9685_ENGINEREGS)) {
+    fprintf(stderr, "ERROR: testEngine: first frame sent %llu msgs, %llu bytes\n",
+            (unsigned long long) engine->msgsSent, (unsigned long long) engine->bytesSent);
+    return -1;
+  } // if
+
+  // two submits before a tick, only the newest is written as one span
+  offVals[3] = 0x123;
+  PCA9685_engineSubmit(engine, dev1, NULL, offVals);
+  offVals[3] = 0x1ff;
+  PCA9685_engineSubmit(engine, dev1, NULL, offVals);
+  struct pollfd pfd = { PCA9685_engineTickFd(engine), POLLIN, 0 };
+  if (poll(&pfd, 1, 1000) != 1) {
+    fprintf(stderr, "ERROR: testEngine: no tick within 1000ms\n");
+    return -1;
+  } // if
+  rc = PCA9685_engineService(engine);
+  uint64_t events = 0;
+  if (read(PCA9685_engineEventFd(engine), &events, sizeof(events)) != sizeof(events)) events = 0;
+  unsigned int onVals[_PCA9685_CHANS];
+  PCA9685_simGetPWMVals(PCA9685_simFind(sim, fd, addr + 1), onVals, offVals);
+  if (rc != 1 || events < 1 || engine->coalesced != 1 || engine->msgsSent != 3 ||
+      engine->bytesSent != 2 * (1 + _PCA9685_ENGINEREGS) + 3 || offVals[3] != 0x1ff) {
+    fprintf(stderr, "ERROR: testEngine: tick returned %d, %llu coalesced, LED3 OFF 0x%03x\n",
+            rc, (unsigned long long) engine->coalesced, offVals[3]);
+    return -1;
+  } // if
+
+  // a refresh rewrites every LED reg of a device with an unchanged frame
+  uint64_t bytesSent = engine->bytesSent;
+  rc = PCA9685_engineRefresh(engine, dev0);
+  PCA9685_engineFlush(engine);
+  PCA9685_engineFlush(engine);
+  PCA9685_simStop();
+  if (rc != 0 || PCA9685_engineRefresh(engine, 2) != -1 ||
+      engine->bytesSent != bytesSent + 1 + _PCA9685_ENGINEREGS) {
+    fprintf(stderr, "ERROR: testEngine: refresh sent %llu bytes\n",
+            (unsigned long long) (engine->bytesSent - bytesSent));
+    return -1;
+  } // if
+  PCA9685_engineDestroy(engine);
+  PCA9685_simDestroy(sim);
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testEngineThread() {
+  printf("testEngineThread\n");
+  PCA9685_sim* sim = PCA9685_simCreate();
+  PCA9685_engine* engine = PCA9685_engineCreate(100);
+  if (sim == NULL || engine == NULL) {
+    fprintf(stderr, "ERROR: testEngineThread: failed to create the simulator or engine\n");
+    return -1;
+  } // if
+  PCA9685_simStart(sim);
+  unsigned char mode1val = _PCA9685_AUTOINCBIT;
+  _PCA9685_writeI2CReg(fd, addr, _PCA9685_MODE1REG, 1, &mode1val);
+  int dev = PCA9685_engineAdd(engine, fd, addr);
+  unsigned int offVals[_PCA9685_CHANS] = { 0 };
+  offVals[0] = 0x456;
+  PCA9685_engineSubmit(engine, dev, NULL, offVals);
+
+  // the writer thread services ticks until stopped, no rt settings
+  int rc = PCA9685_engineStart(engine, NULL);
+  struct pollfd pfd = { PCA9685_engineEventFd(engine), POLLIN, 0 };
+  if (rc != 0 || poll(&pfd, 1, 1000) != 1 || PCA9685_engineAdd(engine, fd, addr + 1) != -1 ||
+      PCA9685_engineSetFps(engine, 50) != -1 || PCA9685_engineResetStats(engine) != -1) {
+    fprintf(stderr, "ERROR: testEngineThread: no tick serviced by the writer thread\n");
+    PCA9685_engineStop(engine);
+    return -1;
+  } // if
+  rc = PCA9685_engineStop(engine);
+  unsigned int onVals[_PCA9685_CHANS];
+  PCA9685_simGetPWMVals(PCA9685_simFind(sim, fd, addr), onVals, offVals);
+  PCA9685_simStop();
+  if (rc != 0 || engine->ticks < 1 || engine->lateHist[_PCA9685_ENGINEHIST - 1] != 0 ||
+      offVals[0] != 0x456) {
+    fprintf(stderr, "ERROR: testEngineThread: %llu ticks, LED0 OFF 0x%03x\n",
+            (unsigned long long) engine->ticks, offVals[0]);
+    return -1;
+  } // if
+  PCA9685_engineDestroy(engine);
+  PCA9685_simDestroy(sim);
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testEngineFaults() {
+  printf("testEngineFaults\n");
+  PCA9685_sim* sim = PCA9685_simCreate();
+  PCA9685_engine* engine = PCA9685_engineCreate(50);
+  if (sim == NULL || engine == NULL) {
+    fprintf(stderr, "ERROR: testEngineFaults: failed to create the simulator or engine\n");
+    return -1;
+  } // if
+  PCA9685_simStart(sim);
+  unsigned char mode1val = _PCA9685_AUTOINCBIT;
+  int dev[3];
+  int i;
+  for (i = 0; i < 3; i++) {
+    _PCA9685_writeI2CReg(fd, addr + i, _PCA9685_MODE1REG, 1, &mode1val);
+    dev[i] = PCA9685_engineAdd(engine, fd, addr + i);
+  } // for devices
+  unsigned int offVals[_PCA9685_CHANS] = { 0 };
+  for (i = 0; i < 3; i++) {
+    PCA9685_engineSubmit(engine, dev[i], NULL, offVals);
+  } // for devices
+  int rc = PCA9685_engineFlush(engine);
+
+  // unplug the middle device, the others are still written
+  PCA9685_simDevice* flaky = PCA9685_simFind(sim, fd, addr + 1);
+  PCA9685_simSetAbsent(flaky, 1);
+  offVals[5] = 0x555;
+  for (i = 0; i < 3; i++) {
+    PCA9685_engineSubmit(engine, dev[i], NULL, offVals);
+  } // for devices
+  int rcFail = PCA9685_engineFlush(engine);
+  PCA9685_devHealth health;
+  PCA9685_engineGetHealth(engine, dev[1], &health);
+  if (rc != 0 || rcFail != -1 || health.state != PCA9685_DEVFAILING || health.fails != 1 ||
+      health.backoffNs != _PCA9685_ENGINEBACKOFFMIN) {
+    fprintf(stderr, "ERROR: testEngineFaults: unplugged device state %d after %u fails\n",
+            health.state, health.fails);
+    return -1;
+  } // if
+
+  // while backing off the failing device is left out of the batch
+  offVals[6] = 0x666;
+  for (i = 0; i < 3; i++) {
+    PCA9685_engineSubmit(engine, dev[i], NULL, offVals);
+  } // for devices
+  rc = PCA9685_engineFlush(engine);
+  unsigned int onVals[_PCA9685_CHANS];
+  unsigned int devOffVals[_PCA9685_CHANS];
+  PCA9685_simGetPWMVals(PCA9685_simFind(sim, fd, addr + 2), onVals, devOffVals);
+  if (rc != 0 || devOffVals[5] != 0x555 || devOffVals[6] != 0x666) {
+    fprintf(stderr, "ERROR: testEngineFaults: healthy device LED6 OFF 0x%03x\n", devOffVals[6]);
+    return -1;
+  } // if
+
+  // plugged back in after a power cycle, it is re-initialized in full
+  PCA9685_simSetAbsent(flaky, 0);
+  usleep(2 * _PCA9685_ENGINEBACKOFFMIN / 1000);
+  rc = PCA9685_engineFlush(engine);
+  PCA9685_engineGetHealth(engine, dev[1], &health);
+  PCA9685_simGetPWMVals(flaky, onVals, devOffVals);
+  PCA9685_simStop();
+  if (rc != 0 || health.state != PCA9685_DEVOK || health.recoveries != 1 ||
+      health.errors != 1 || flaky->regs[_PCA9685_MODE1REG] != _PCA9685_AUTOINCBIT ||
+      devOffVals[5] != 0x555 || devOffVals[6] != 0x666) {
+    fprintf(stderr, "ERROR: testEngineFaults: replugged device state %d, LED6 OFF 0x%03x\n",
+            health.state, devOffVals[6]);
+    return -1;
+  } // if
+  PCA9685_engineDestroy(engine);
+  PCA9685_simDestroy(sim);
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testEngineBrownout() {
+  printf("testEngineBrownout\n");
+  PCA9685_sim* sim = PCA9685_simCreate();
+  PCA9685_engine* engine = PCA9685_engineCreate(50);
+  if (sim == NULL || engine == NULL) {
+    fprintf(stderr, "ERROR: testEngineBrownout: failed to create the simulator or engine\n");
+    return -1;
+  } // if
+  PCA9685_simStart(sim);
+  unsigned char mode1val = _PCA9685_AUTOINCBIT;
+  _PCA9685_writeI2CReg(fd, addr, _PCA9685_MODE1REG, 1, &mode1val);
+  int dev = PCA9685_engineAdd(engine, fd, addr);
+  PCA9685_engineSetProbe(engine, 1);
+  unsigned int offVals[_PCA9685_CHANS] = { 0 };
+  offVals[2] = 0x222;
+  PCA9685_engineSubmit(engine, dev, NULL, offVals);
+  int rc = PCA9685_engineFlush(engine);
+
+  // a brownout leaves power-on registers, the next probe notices
+  PCA9685_simDevice* simDev = PCA9685_simFind(sim, fd, addr);
+  PCA9685_simSetAbsent(simDev, 1);
+  PCA9685_simSetAbsent(simDev, 0);
+  offVals[9] = 0x999;
+  PCA9685_engineSubmit(engine, dev, NULL, offVals);
+  int rcReset = PCA9685_engineFlush(engine);
+  PCA9685_devHealth health;
+  PCA9685_engineGetHealth(engine, dev, &health);
+  unsigned int onVals[_PCA9685_CHANS];
+  PCA9685_simGetPWMVals(simDev, onVals, offVals);
+  PCA9685_simStop();
+  if (rc != 0 || rcReset != 0 || engine->probes != 2 || health.resets != 1 ||
+      health.state != PCA9685_DEVOK || simDev->regs[_PCA9685_MODE1REG] != _PCA9685_AUTOINCBIT ||
+      offVals[2] != 0x222 || offVals[9] != 0x999) {
+    fprintf(stderr, "ERROR: testEngineBrownout: %llu resets, MODE1 %02x, LED2 OFF 0x%03x\n",
+            (unsigned long long) health.resets, simDev->regs[_PCA9685_MODE1REG], offVals[2]);
+    return -1;
+  } // if
+  PCA9685_engineDestroy(engine);
+  PCA9685_simDestroy(sim);
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testEngineTimeout() {
+  printf("testEngineTimeout\n");
+  PCA9685_sim* sim = PCA9685_simCreate();
+  PCA9685_engine* engine = PCA9685_engineCreate(50);
+  if (sim == NULL || engine == NULL) {
+    fprintf(stderr, "ERROR: testEngineTimeout: failed to create the simulator or engine\n");
+    return -1;
+  } // if
+  PCA9685_simStart(sim);
+  if (PCA9685_setI2CPolicy(2, 0, 0) != -1 || PCA9685_setI2CPolicy(2, 25, 0) != 0) {
+    fprintf(stderr, "ERROR: testEngineTimeout: PCA9685_setI2CPolicy() took a zero timeout\n");
+    return -1;
+  } // if
+  int policyFd = PCA9685_openI2C(2, addr);
+  if (!_PCA9685_TEST) close(policyFd);
+  unsigned char mode1val = _PCA9685_AUTOINCBIT;
+  int dev[3];
+  int i;
+  for (i = 0; i < 3; i++) {
+    _PCA9685_writeI2CReg(fd, addr + i, _PCA9685_MODE1REG, 1, &mode1val);
+    dev[i] = PCA9685_engineAdd(engine, fd, addr + i);
+  } // for devices
+
+  // a board holding the bus times out the batch and then its own retry
+  PCA9685_simDevice* hung = PCA9685_simFind(sim, fd, addr + 1);
+  PCA9685_simSetHung(hung, 1);
+  unsigned int offVals[_PCA9685_CHANS] = { 0 };
+  offVals[3] = 0x333;
+  for (i = 0; i < 3; i++) {
+    PCA9685_engineSubmit(engine, dev[i], NULL, offVals);
+  } // for devices
+  int rcFail = PCA9685_engineFlush(engine);
+  PCA9685_devHealth health;
+  PCA9685_engineGetHealth(engine, dev[1], &health);
+  if (rcFail != -1 || sim->timeouts != 2 || engine->txTimeouts != 2 || health.timeouts != 1 ||
+      health.backoffNs != _PCA9685_ENGINEBACKOFFHUNG || health.maxTxNs <= 0) {
+    fprintf(stderr, "ERROR: testEngineTimeout: %llu timeouts, backoff %lld ns\n",
+            (unsigned long long) health.timeouts, (long long) health.backoffNs);
+    return -1;
+  } // if
+
+  // it sits out a second, so the next frames see no stall
+  for (i = 0; i < 10; i++) {
+    offVals[4] = i;
+    int d;
+    for (d = 0; d < 3; d++) {
+      PCA9685_engineSubmit(engine, dev[d], NULL, offVals);
+    } // for devices
+    if (PCA9685_engineFlush(engine) != 0) {
+      fprintf(stderr, "ERROR: testEngineTimeout: flush %d failed\n", i);
+      return -1;
+    } // if
+  } // for frames
+  unsigned int onVals[_PCA9685_CHANS];
+  unsigned int devOffVals[_PCA9685_CHANS];
+  PCA9685_simGetPWMVals(PCA9685_simFind(sim, fd, addr + 2), onVals, devOffVals);
+  PCA9685_simStop();
+  if (sim->timeouts != 2 || devOffVals[3] != 0x333 || devOffVals[4] != 9) {
+    fprintf(stderr, "ERROR: testEngineTimeout: %llu stalls, LED4 OFF 0x%03x\n",
+            (unsigned long long) sim->timeouts, devOffVals[4]);
+    return -1;
+  } // if
+  PCA9685_engineDestroy(engine);
+  PCA9685_simDestroy(sim);
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testEngineDeadband() {
+  printf("testEngineDeadband\n");
+  PCA9685_sim* sim = PCA9685_simCreate();
+  PCA9685_engine* engine = PCA9685_engineCreate(50);
+  if (sim == NULL || engine == NULL) {
+    fprintf(stderr, "ERROR: testEngineDeadband: failed to create the simulator or engine\n");
+    return -1;
+  } // if
+  PCA9685_simStart(sim);
+  if (PCA9685_engineSetDeadband(engine, 5000, 0) != -1 ||
+      PCA9685_engineSetDeadband(engine, 8, 0.01) != 0) {
+    fprintf(stderr, "ERROR: testEngineDeadband: PCA9685_engineSetDeadband() took 5000 counts\n");
+    return -1;
+  } // if
+  unsigned char mode1val = _PCA9685_AUTOINCBIT;
+  _PCA9685_writeI2CReg(fd, addr, _PCA9685_MODE1REG, 1, &mode1val);
+  int dev = PCA9685_engineAdd(engine, fd, addr);
+  unsigned int offVals[_PCA9685_CHANS];
+  int i;
+  for (i = 0; i < _PCA9685_CHANS; i++) offVals[i] = 0x800;
+  PCA9685_engineSubmit(engine, dev, NULL, offVals);
+  PCA9685_engineFlush(engine);
+
+  // at half brightness a 1% perceptual step is about 60 counts
+  offVals[0] = 0x820;
+  offVals[1] = 0x900;
+  PCA9685_engineSubmit(engine, dev, NULL, offVals);
+  PCA9685_engineFlush(engine);
+  PCA9685_simDevice* simDev = PCA9685_simFind(sim, fd, addr);
+  unsigned int onVals[_PCA9685_CHANS];
+  unsigned int devOffVals[_PCA9685_CHANS];
+  PCA9685_simGetPWMVals(simDev, onVals, devOffVals);
+  if (devOffVals[0] != 0x800 || devOffVals[1] != 0x900 ||
+      engine->deadbanded != 1 || engine->deadbandFrames != 0) {
+    fprintf(stderr, "ERROR: testEngineDeadband: LED0 OFF 0x%03x, LED1 OFF 0x%03x\n",
+            devOffVals[0], devOffVals[1]);
+    return -1;
+  } // if
+
+  // a frame of small changes only is held back whole
+  uint64_t transfers = sim->transfers;
+  offVals[0] = 0x830;
+  PCA9685_engineSubmit(engine, dev, NULL, offVals);
+  PCA9685_engineFlush(engine);
+  if (sim->transfers != transfers) {
+    fprintf(stderr, "ERROR: testEngineDeadband: a held back frame was written\n");
+    return -1;
+  } // if
+
+  // small steps add up until they pass, and off always goes out
+  offVals[0] = 0x850;
+  offVals[1] = 0;
+  PCA9685_engineSubmit(engine, dev, NULL, offVals);
+  PCA9685_engineFlush(engine);
+  PCA9685_simGetPWMVals(simDev, onVals, devOffVals);
+  PCA9685_simStop();
+  // and the traffic saved is counted, LED0's OFF_L alone each time
+  printf("%llu bytes in %llu messages held back\n", (unsigned long long) engine->deadbandBytes,
+         (unsigned long long) engine->deadbandMsgs);
+  if (devOffVals[0] != 0x850 || devOffVals[1] != 0 || sim->transfers == transfers ||
+      engine->deadbanded != 2 || engine->deadbandFrames != 1 ||
+      engine->deadbandBytes != 4 || engine->deadbandMsgs != 2) {
+    fprintf(stderr, "ERROR: testEngineDeadband: LED0 OFF 0x%03x, %llu held, %llu frames\n",
+            devOffVals[0], (unsigned long long) engine->deadbanded,
+            (unsigned long long) engine->deadbandFrames);
+    return -1;
+  } // if
+  PCA9685_engineDestroy(engine);
+  PCA9685_simDestroy(sim);
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testEngineBudget() {
+  printf("testEngineBudget\n");
+  PCA9685_sim* sim = PCA9685_simCreate();
+  PCA9685_engine* engine = PCA9685_engineCreate(50);
+  if (sim == NULL || engine == NULL) {
+    fprintf(stderr, "ERROR: testEngineBudget: failed to create the simulator or engine\n");
+    return -1;
+  } // if
+  PCA9685_simStart(sim);
+  PCA9685_engineSetProbe(engine, 0);
+  unsigned char mode1val = _PCA9685_AUTOINCBIT;
+  unsigned int offVals[4][_PCA9685_CHANS];
+  int dev[4];
+  int i;
+  for (i = 0; i < 4; i++) {
+    _PCA9685_writeI2CReg(fd, addr + i, _PCA9685_MODE1REG, 1, &mode1val);
+    dev[i] = PCA9685_engineAdd(engine, fd, addr + i);
+    int c;
+    for (c = 0; c < _PCA9685_CHANS; c++) offVals[i][c] = 0x800;
+    PCA9685_engineSubmit(engine, dev[i], NULL, offVals[i]);
+  } // for devices
+  PCA9685_engineFlush(engine);
+
+  // room for two 2-byte spans, the largest errors go first
+  if (PCA9685_engineSetBudget(engine, -1) != -1 ||
+      PCA9685_engineSetBudget(engine, 2 * PCA9685_busCostNs(fd, 1, 4)) != 0) {
+    fprintf(stderr, "ERROR: testEngineBudget: PCA9685_engineSetBudget() took -1\n");
+    return -1;
+  } // if
+  unsigned int errors[4] = { 1000, 10, 2000, 5 };
+  for (i = 0; i < 4; i++) {
+    offVals[i][0] += errors[i];
+    PCA9685_engineSubmit(engine, dev[i], NULL, offVals[i]);
+  } // for devices
+  PCA9685_engineFlush(engine);
+  unsigned int onVals[_PCA9685_CHANS];
+  unsigned int devOffVals[4];
+  for (i = 0; i < 4; i++) {
+    unsigned int vals[_PCA9685_CHANS];
+    PCA9685_simGetPWMVals(PCA9685_simFind(sim, fd, addr + i), onVals, vals);
+    devOffVals[i] = vals[0];
+  } // for devices
+  int64_t staleNs[_PCA9685_CHANS];
+  PCA9685_engineGetStaleness(engine, dev[1], staleNs);
+  if (devOffVals[0] != 0x800 + 1000 || devOffVals[1] != 0x800 || devOffVals[2] != 0x800 + 2000 ||
+      devOffVals[3] != 0x800 || engine->deferred != 2 || staleNs[0] <= 0 || staleNs[1] != 0) {
+    fprintf(stderr, "ERROR: testEngineBudget: LED0 OFF 0x%03x 0x%03x 0x%03x 0x%03x, %llu deferred\n",
+            devOffVals[0], devOffVals[1], devOffVals[2], devOffVals[3],
+            (unsigned long long) engine->deferred);
+    return -1;
+  } // if
+
+  // the held over spans go in the next flush without a new frame
+  PCA9685_engineFlush(engine);
+  for (i = 0; i < 4; i++) {
+    unsigned int vals[_PCA9685_CHANS];
+    PCA9685_simGetPWMVals(PCA9685_simFind(sim, fd, addr + i), onVals, vals);
+    devOffVals[i] = vals[0];
+  } // for devices
+  PCA9685_simStop();
+  PCA9685_engineGetStaleness(engine, dev[1], staleNs);
+  PCA9685_devHealth health;
+  PCA9685_engineGetHealth(engine, dev[1], &health);
+  if (devOffVals[1] != 0x800 + 10 || devOffVals[3] != 0x800 + 5 || engine->deferred != 2 ||
+      staleNs[0] != 0 || health.maxStaleNs <= 0 || engine->maxStaleNs < health.maxStaleNs) {
+    fprintf(stderr, "ERROR: testEngineBudget: LED0 OFF 0x%03x 0x%03x, %llu deferred\n",
+            devOffVals[1], devOffVals[3], (unsigned long long) engine->deferred);
+    return -1;
+  } // if
+  PCA9685_engineDestroy(engine);
+  PCA9685_simDestroy(sim);
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testMetrics() {
+  printf("testMetrics\n");
+  const char* sockPath = "PCA9685test.sock";
+  const char* dumpPath = "PCA9685test.prom";
+  PCA9685_sim* sim = PCA9685_simCreate();
+  PCA9685_engine* engine = PCA9685_engineCreate(50);
+  if (sim == NULL || engine == NULL) {
+    fprintf(stderr, "ERROR: testMetrics: failed to create the simulator or engine\n");
+    return -1;
+  } // if
+  PCA9685_simStart(sim);
+  unsigned char mode1val = _PCA9685_AUTOINCBIT;
+  _PCA9685_writeI2CReg(fd, addr, _PCA9685_MODE1REG, 1, &mode1val);
+  int dev = PCA9685_engineAdd(engine, fd, addr);
+  unsigned int offVals[_PCA9685_CHANS] = { 0 };
+  PCA9685_engineSubmit(engine, dev, NULL, offVals);
+  PCA9685_engineFlush(engine);
+  PCA9685_simStop();
+
+  PCA9685_metrics* metrics = PCA9685_metricsCreate(engine);
+  if (metrics == NULL || PCA9685_metricsListenUnix(metrics, sockPath) != 0) {
+    fprintf(stderr, "ERROR: testMetrics: failed to listen on %s\n", sockPath);
+    return -1;
+  } // if
+
+  // scrape over the unix socket
+  struct sockaddr_un sun;
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  strcpy(sun.sun_path, sockPath);
+  // a scraper that never sends its request holds nothing up
+  int idle = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (idle < 0 || connect(idle, (struct sockaddr*) &sun, sizeof(sun)) != 0) {
+    fprintf(stderr, "ERROR: testMetrics: failed to connect to %s\n", sockPath);
+    return -1;
+  } // if
+  int idleScrapes = PCA9685_metricsService(metrics);
+  struct pollfd pfds[_PCA9685_METRICSFDS];
+  int npfds = PCA9685_metricsPollFds(metrics, pfds);
+
+  int client = socket(AF_UNIX, SOCK_STREAM, 0);
+  const char* request = "GET /metrics HTTP/1.0\r\n\r\n";
+  if (client < 0 || connect(client, (struct sockaddr*) &sun, sizeof(sun)) != 0 ||
+      write(client, request, strlen(request)) != (ssize_t) strlen(request)) {
+    fprintf(stderr, "ERROR: testMetrics: failed to connect to %s\n", sockPath);
+    return -1;
+  } // if
+  int scrapes = PCA9685_metricsService(metrics);
+  static char response[16384];
+  int len = 0;
+  ssize_t n;
+  while ((n = read(client, response + len, sizeof(response) - 1 - len)) > 0) len += n;
+  response[len] = 0;
+  close(client);
+  close(idle);
+
+  // and to a file
+  int rc = PCA9685_metricsDump(metrics, dumpPath);
+  FILE* file = fopen(dumpPath, "r");
+  static char dump[16384];
+  int dumpLen = (file ? fread(dump, 1, sizeof(dump) - 1, file) : 0);
+  dump[dumpLen] = 0;
+  if (file) fclose(file);
+  unlink(dumpPath);
+  PCA9685_metricsDestroy(metrics);
+  PCA9685_engineDestroy(engine);
+  PCA9685_simDestroy(sim);
+
+  char* body = strstr(response, "\r\n\r\n");
+  if (idleScrapes != 0 || npfds != 2 || pfds[1].events != POLLIN ||
+      scrapes < 1 || strncmp(response, "HTTP/1.0 200 OK", 15) != 0 || body == NULL ||
+      strstr(body, "\npca9685_frames_total 1\n") == NULL ||
+      strstr(body, "pca9685_transaction_seconds_count 1\n") == NULL ||
+      strstr(body, "pca9685_device_up{dev=\"0\",fd=\"0\",addr=\"0x40\"} 1\n") == NULL ||
+      rc != 0 || strcmp(dump, body + 4) != 0) {
+    fprintf(stderr, "ERROR: testMetrics: %d scrapes, response:\n%s\n", scrapes, response);
+    return -1;
+  } // if
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testShm() {
+  printf("testShm\n");
+  const char* name = "/PCA9685test";
+  PCA9685_shm* daemon = PCA9685_shmCreate(name, -1);
+  PCA9685_shm* client = PCA9685_shmAttach(name);
+  if (daemon == NULL || client == NULL || !PCA9685_shmDaemonAlive(client)) {
+    fprintf(stderr, "ERROR: testShm: failed to create or attach %s\n", name);
+    return -1;
+  } // if
+  // only the daemon's group may publish
+  struct stat st;
+  if (stat("/dev/shm/PCA9685test", &st) != 0 || (st.st_mode & 0777) != 0660) {
+    fprintf(stderr, "ERROR: testShm: %s is mode %03o\n", name, (unsigned int) st.st_mode & 0777);
+    return -1;
+  } // if
+  // a second daemon leaves the live one's segment alone
+  if (PCA9685_shmCreate(name, -1) != NULL || !PCA9685_shmDaemonAlive(client)) {
+    fprintf(stderr, "ERROR: testShm: %s was replaced under a live daemon\n", name);
+    return -1;
+  } // if
+  int slotA = PCA9685_shmClaim(client);
+  int slotB = PCA9685_shmClaim(client);
+
+  // A drives LED0 of 1/0x40, B drives LED1 of it and LED15 of 1/0x41
+  static PCA9685_shmFrame frameA, frameB, merged;
+  PCA9685_shmBoard* board = PCA9685_shmBoardFind(&frameA, 1, 0x40);
+  board->mask = 0x0001;
+  board->regs[2] = 0x34;
+  board->regs[3] = 0x02;
+  board->regs[6] = 0xff;        // not driven, ignored
+  board = PCA9685_shmBoardFind(&frameB, 1, 0x41);
+  board->mask = 0x8000;
+  board->regs[15*4 + 3] = 0x10;
+  board = PCA9685_shmBoardFind(&frameB, 1, 0x40);
+  board->mask = 0x0002;
+  board->regs[6] = 0x78;
+  board->regs[7] = 0x05;
+  PCA9685_shmPublish(client, slotA, &frameA);
+  PCA9685_shmPublish(client, slotB, &frameB);
+
+  int frames = PCA9685_shmMerge(daemon, &merged);
+  int again = PCA9685_shmMerge(daemon, &merged);
+  printf("slots %d %d, merged %d then %d frames, %u boards\n", slotA, slotB, frames, again, merged.boards);
+  unsigned int b;
+  for (b = 0; b < merged.boards; b++) {
+    board = &merged.board[b];
+    printf("board %d/0x%02x mask %04x LED0 off %d LED1 off %d LED15 off %d\n",
+           board->adpt, board->addr, board->mask,
+           board->regs[2] | (board->regs[3] << 8), board->regs[6] | (board->regs[7] << 8),
+           board->regs[15*4 + 2] | (board->regs[15*4 + 3] << 8));
+  } // for boards
+
+  // a released slot keeps its boards, the daemon gone is noticed
+  PCA9685_shmRelease(client, slotA);
+  int slotC = PCA9685_shmClaim(client);
+  PCA9685_shmRelease(client, slotB);
+  PCA9685_shmRelease(client, slotC);
+  PCA9685_shmClose(daemon);
+  int alive = PCA9685_shmDaemonAlive(client);
+  PCA9685_shmClose(client);
+  PCA9685_shm* gone = PCA9685_shmAttach(name);
+  printf("reclaimed slot %d, daemon alive %d, attach after close %s\n",
+         slotC, alive, (gone ? "succeeded" : "failed"));
+  if (frames != 2 || again != 0 || merged.boards != 2 || slotC != slotA || alive || gone) {
+    fprintf(stderr, "ERROR: testShm: unexpected merge or slot state\n");
+    return -1;
+  } // if
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testClient() {
+  printf("testClient\n");
+  const char* name = "/PCA9685test";
+  PCA9685_sim* sim = PCA9685_simCreate();
+  PCA9685_shm* daemon = PCA9685_shmCreate(name, -1);
+  if (sim == NULL || daemon == NULL) {
+    fprintf(stderr, "ERROR: testClient: failed to create the simulator or %s\n", name);
+    return -1;
+  } // if
+  PCA9685_simStart(sim);
+  daemon->hdr->freq = 200;
+
+  // through the daemon, the handle names the adapter and no bus is touched
+  unsigned int onVals[_PCA9685_CHANS] = { 0 };
+  unsigned int offVals[_PCA9685_CHANS];
+  int i;
+  for (i = 0; i < _PCA9685_CHANS; i++) offVals[i] = 100 * i;
+  PCA9685_clientSetup(name, PCA9685_CLIENTAUTO);
+  int handle = PCA9685_clientOpenI2C(1, 0x40);
+  int mode = PCA9685_clientMode();
+  int rc = PCA9685_clientInitPWM(handle, 0x40, 200);
+  rc |= PCA9685_clientSetPWMVals(handle, 0x40, onVals, offVals);
+  rc |= PCA9685_clientSetPWMVal(handle, 0x41, _PCA9685_BASEPWMREG + 4*3, 0, 1234);
+  int bad = PCA9685_clientSetPWMVal(handle, 0x41, _PCA9685_BASEPWMREG + 1, 0, 0);
+  static PCA9685_shmFrame merged;
+  int frames = PCA9685_shmMerge(daemon, &merged);
+  printf("mode %d, handle adapter %d, rc %d, bad reg %d, merged %d frames, %u boards\n",
+         mode, handle - _PCA9685_CLIENTFD, rc, bad, frames, merged.boards);
+  unsigned int b;
+  for (b = 0; b < merged.boards; b++) {
+    PCA9685_shmBoard* board = &merged.board[b];
+    printf("board %d/0x%02x mask %04x LED3 off %d LED15 off %d\n",
+           board->adpt, board->addr, board->mask,
+           board->regs[3*4 + 2] | (board->regs[3*4 + 3] << 8),
+           board->regs[15*4 + 2] | (board->regs[15*4 + 3] << 8));
+  } // for boards
+  // a daemon gone from under the client fails the frames
+  uint32_t daemonPid = daemon->hdr->daemonPid;
+  daemon->hdr->daemonPid = 0;
+  int lost = PCA9685_clientSetPWMVals(handle, 0x40, onVals, offVals);
+  daemon->hdr->daemonPid = daemonPid;
+  PCA9685_clientClose(handle);
+  int released = (daemon->hdr->slot[0].pid == 0);
+  PCA9685_shmClose(daemon);
+
+  // without the daemon the same calls go to the bus
+  unsigned char mode1val = _PCA9685_AUTOINCBIT;
+  _PCA9685_writeI2CReg(fd, addr, _PCA9685_MODE1REG, 1, &mode1val);
+  PCA9685_clientSetup(name, PCA9685_CLIENTAUTO);
+  int direct = PCA9685_clientOpenI2C(adpt, addr);
+  int directMode = PCA9685_clientMode();
+  rc |= PCA9685_clientSetPWMVals(direct, addr, onVals, offVals);
+  unsigned int simOn[_PCA9685_CHANS], simOff[_PCA9685_CHANS];
+  PCA9685_simGetPWMVals(PCA9685_simFind(sim, direct, addr), simOn, simOff);
+  PCA9685_clientClose(direct);
+  PCA9685_simDestroy(sim);
+  PCA9685_clientSetup(NULL, PCA9685_CLIENTAUTO);
+  printf("without a daemon %d, slot released %d, then mode %d, LED3 off %d LED15 off %d\n",
+         lost, released, directMode, simOff[3], simOff[15]);
+  if (mode != PCA9685_CLIENTDAEMON || rc != 0 || bad != -1 || frames != 1 || merged.boards != 2 ||
+      lost != -1 ||
+      !released || directMode != PCA9685_CLIENTDIRECT || simOff[15] != 1500) {
+    fprintf(stderr, "ERROR: testClient: unexpected daemon or direct state\n");
+    return -1;
+  } // if
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testEmergency() {
+  printf("testEmergency\n");
+  PCA9685_sim* sim = PCA9685_simCreate();
+  PCA9685_engine* engine = PCA9685_engineCreate(50);
+  if (sim == NULL || engine == NULL) {
+    fprintf(stderr, "ERROR: testEmergency: failed to create the simulator or engine\n");
+    return -1;
+  } // if
+  PCA9685_simStart(sim);
+  int rc = PCA9685_initPWM(fd, addr, 200);
+  int dev = PCA9685_engineAdd(engine, fd, addr);
+  unsigned int offVals[_PCA9685_CHANS];
+  int i;
+  for (i = 0; i < _PCA9685_CHANS; i++) offVals[i] = 200 * i;
+  PCA9685_engineSubmit(engine, dev, NULL, offVals);
+  rc |= PCA9685_engineFlush(engine);
+
+  // every LED fully off in one transaction, and the engine held, even
+  // on a board whose AUTOINC was cleared behind the library's back
+  PCA9685_simDevice* simDev = PCA9685_simFind(sim, fd, addr);
+  simDev->regs[_PCA9685_MODE1REG] &= ~_PCA9685_AUTOINCBIT;
+  rc |= PCA9685_emergencyOff();
+  simDev->regs[_PCA9685_MODE1REG] |= _PCA9685_AUTOINCBIT;
+  unsigned int simOn[_PCA9685_CHANS], simOff[_PCA9685_CHANS];
+  PCA9685_simGetPWMVals(simDev, simOn, simOff);
+  int off = 0;
+  for (i = 0; i < _PCA9685_CHANS; i++) {
+    if (simOn[i] == 0 && (simOff[i] & (_PCA9685_FULLBIT << 8))) off++;
+  } // for chans
+  uint64_t writes = simDev->writes;
+  offVals[1] = 4000;
+  PCA9685_engineSubmit(engine, dev, NULL, offVals);
+  rc |= PCA9685_engineFlush(engine);
+  uint64_t heldWrites = simDev->writes - writes;
+
+  // cleared, the engine rewrites the whole frame
+  PCA9685_emergencyClear();
+  rc |= PCA9685_engineFlush(engine);
+  PCA9685_simGetPWMVals(simDev, simOn, simOff);
+
+  // a closed fd is left alone, its number may be another file's now
+  PCA9685_closeI2C(fd);
+  writes = simDev->writes;
+  PCA9685_emergencyOff();
+  PCA9685_emergencyClear();
+  uint64_t closedWrites = simDev->writes - writes;
+  _PCA9685_emergencyAdd(fd, addr);
+  PCA9685_engineDestroy(engine);
+  PCA9685_simDestroy(sim);
+  printf("rc %d, %d LEDs fully off, %llu writes while held, then LED1 off %d LED15 off %d, "
+         "%llu writes once closed\n", rc, off, (unsigned long long) heldWrites, simOff[1], simOff[15],
+         (unsigned long long) closedWrites);
+  if (rc != 0 || off != _PCA9685_CHANS || heldWrites != 0 || simOff[1] != 4000 || simOff[15] != 3000 ||
+      closedWrites != 0) {
+    fprintf(stderr, "ERROR: testEmergency: the emergency stop did not hold the LEDs off\n");
+    return -1;
+  } // if
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testI2CPath() {
+  printf("testI2CPath\n");
+  PCA9685_sim* sim = PCA9685_simCreate();
+  if (sim == NULL) {
+    fprintf(stderr, "ERROR: testI2CPath: failed to create the simulator\n");
+    return -1;
+  } // if
+  PCA9685_simStart(sim);
+
+  // an SMBus-only adapter gets the registers in 32-byte blocks
+  sim->funcs = I2C_FUNC_SMBUS_BYTE | I2C_FUNC_SMBUS_I2C_BLOCK;
+  int smbusFd = PCA9685_openI2C(3, addr);
+  unsigned long funcs;
+  int path = PCA9685_getI2CPath(smbusFd, &funcs);
+  unsigned char mode1val = _PCA9685_AUTOINCBIT;
+  int rc = _PCA9685_writeI2CReg(smbusFd, addr, _PCA9685_MODE1REG, 1, &mode1val);
+  unsigned int onVals[_PCA9685_CHANS] = { 0 };
+  unsigned int offVals[_PCA9685_CHANS];
+  unsigned int readOff[_PCA9685_CHANS];
+  int i;
+  for (i = 0; i < _PCA9685_CHANS; i++) offVals[i] = 0x100 + i;
+  rc |= PCA9685_setPWMVals(smbusFd, addr, onVals, offVals);
+  rc |= PCA9685_getPWMVals(smbusFd, addr, onVals, readOff);
+  if (rc != 0 || path != PCA9685_I2CPATHSMBUS || funcs != sim->funcs || sim->smbus == 0 ||
+      memcmp(offVals, readOff, sizeof(offVals)) != 0) {
+    fprintf(stderr, "ERROR: testI2CPath: %s path, LED15 OFF 0x%03x\n",
+            PCA9685_i2cPathName(path), readOff[15]);
+    return -1;
+  } // if
+  if (PCA9685_setI2CPath(3, 3) != -1 || PCA9685_setI2CPath(3, PCA9685_I2CPATHRDWR) != 0 ||
+      PCA9685_getI2CPath(smbusFd, NULL) != PCA9685_I2CPATHRDWR ||
+      PCA9685_setI2CPath(3, PCA9685_I2CPATHAUTO) != 0 ||
+      PCA9685_getI2CPath(smbusFd, NULL) != PCA9685_I2CPATHSMBUS) {
+    fprintf(stderr, "ERROR: testI2CPath: PCA9685_setI2CPath() did not force the path\n");
+    return -1;
+  } // if
+
+  // an adapter whose quirks refuse combined messages falls back to one
+  // message per I2C_RDWR at the first refusal
+  sim->funcs = I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL;
+  sim->maxMsgs = 1;
+  int singleFd = PCA9685_openI2C(4, addr);
+  int before = PCA9685_getI2CPath(singleFd, NULL);
+  unsigned char mode1 = 0;
+  rc = _PCA9685_readI2CReg(singleFd, addr, _PCA9685_MODE1REG, 1, &mode1);
+  int after = PCA9685_getI2CPath(singleFd, NULL);
+  PCA9685_simStop();
+  PCA9685_simDestroy(sim);
+  printf("%s, then %s\n", PCA9685_i2cPathName(before), PCA9685_i2cPathName(after));
+  if (rc != 0 || before != PCA9685_I2CPATHRDWR || after != PCA9685_I2CPATHSINGLE ||
+      mode1 != _PCA9685_AUTOINCBIT) {
+    fprintf(stderr, "ERROR: testI2CPath: MODE1 %02x read one message at a time\n", mode1);
+    return -1;
+  } // if
+  if (!_PCA9685_TEST) {
+    close(smbusFd);
+    close(singleFd);
+  } // if
+
+  // the fd of the other tests is on the adapter they opened
+  fd = PCA9685_openI2C(adpt, addr);
+  printf("passed\n\n");
+  return 0;
+}
+
+
+int testCalibrate() {
+  printf("testCalibrate\n");
+  PCA9685_sim* sim = PCA9685_simCreate();
+  PCA9685_engine* engine = PCA9685_engineCreate(50);
+  if (sim == NULL || engine == NULL) {
+    fprintf(stderr, "ERROR: testCalibrate: failed to create the simulator or engine\n");
+    return -1;
+  } // if
+  PCA9685_simStart(sim);
+  sim->busHz = 400000;
+  int calFd = PCA9685_openI2C(5, addr);
+  unsigned char mode1val = _PCA9685_AUTOINCBIT;
+  int i;
+  for (i = 0; i < 2; i++) {
+    _PCA9685_writeI2CReg(calFd, addr + i, _PCA9685_MODE1REG, 1, &mode1val);
+    PCA9685_engineAdd(engine, calFd, addr + i);
+  } // for devices
+  unsigned int onVals[_PCA9685_CHANS] = { 0 };
+  unsigned int offVals[_PCA9685_CHANS];
+  for (i = 0; i < _PCA9685_CHANS; i++) offVals[i] = 0x200 + i;
+  int rc = PCA9685_setPWMVals(calFd, addr, onVals, offVals);
+
+  // planned at the kernel's default 100 kHz until measured
+  PCA9685_busCal cal;
+  int nominal = PCA9685_getBusCal(calFd, &cal);
+  unsigned int nominalFps = PCA9685_engineMaxFps(engine);
+  printf("nominal %d, %.0f Hz, max %u fps\n", nominal, cal.sclHz, nominalFps);
+  rc |= PCA9685_calibrate(calFd, addr, &cal);
+  int measured = PCA9685_getBusCal(calFd, &cal);
+  unsigned int measuredFps = PCA9685_engineMaxFps(engine);
+  unsigned int readOff[_PCA9685_CHANS];
+  PCA9685_simGetPWMVals(PCA9685_simFind(sim, calFd, addr), onVals, readOff);
+  PCA9685_simStop();
+  PCA9685_engineDestroy(engine);
+  PCA9685_simDestroy(sim);
+  if (rc != 0 || nominal != 1 || measured != 0 || cal.sclHz < 300000 || cal.sclHz > 500000 ||
+      measuredFps <= nominalFps || memcmp(offVals, readOff, sizeof(offVals)) != 0) {
+    fprintf(stderr, "ERROR: testCalibrate: %.0f Hz measured, %.0f ns per transaction, %u fps\n",
+            cal.sclHz, cal.txNs, measuredFps);
+    return -1;
+  } // if
+  if (!_PCA9685_TEST) close(calFd);
+
+  // the fd of the other tests is on the adapter they opened
+  fd = PCA9685_openI2C(adpt, addr);
+  printf("passed\n\n");
+  return 0;
+}
+
+
 int main(int argc, char **argv) {
   int c;
   while ((c = getopt(argc, argv, "tdv")) != -1) {
@@ -216,6 +1479,126 @@ int main(int argc, char **argv) {
     exit(-1);
   } // if rc
 
+  rc = testServo();
+  if (rc) {
+    fprintf(stderr, "ERROR: testServo() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testMap();
+  if (rc) {
+    fprintf(stderr, "ERROR: testMap() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testSnapshot();
+  if (rc) {
+    fprintf(stderr, "ERROR: testSnapshot() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testShow();
+  if (rc) {
+    fprintf(stderr, "ERROR: testShow() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testShowDelta();
+  if (rc) {
+    fprintf(stderr, "ERROR: testShowDelta() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testRecorder();
+  if (rc) {
+    fprintf(stderr, "ERROR: testRecorder() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testReplay();
+  if (rc) {
+    fprintf(stderr, "ERROR: testReplay() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testEngine();
+  if (rc) {
+    fprintf(stderr, "ERROR: testEngine() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testEngineThread();
+  if (rc) {
+    fprintf(stderr, "ERROR: testEngineThread() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testEngineFaults();
+  if (rc) {
+    fprintf(stderr, "ERROR: testEngineFaults() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testEngineBrownout();
+  if (rc) {
+    fprintf(stderr, "ERROR: testEngineBrownout() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testEngineTimeout();
+  if (rc) {
+    fprintf(stderr, "ERROR: testEngineTimeout() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testEngineDeadband();
+  if (rc) {
+    fprintf(stderr, "ERROR: testEngineDeadband() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testEngineBudget();
+  if (rc) {
+    fprintf(stderr, "ERROR: testEngineBudget() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testMetrics();
+  if (rc) {
+    fprintf(stderr, "ERROR: testMetrics() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testShm();
+  if (rc) {
+    fprintf(stderr, "ERROR: testShm() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testClient();
+  if (rc) {
+    fprintf(stderr, "ERROR: testClient() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testEmergency();
+  if (rc) {
+    fprintf(stderr, "ERROR: testEmergency() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testI2CPath();
+  if (rc) {
+    fprintf(stderr, "ERROR: testI2CPath() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
+  rc = testCalibrate();
+  if (rc) {
+    fprintf(stderr, "ERROR: testCalibrate() returned %d\n", rc);
+    exit(-1);
+  } // if rc
+
   printf("All tests passed.\n");
   return 0;
 }